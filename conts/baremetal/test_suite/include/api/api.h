@@ -12,5 +12,7 @@ int test_api_exregs(void);
 int test_api_ipc(void);
 int test_api_irqctrl(void);
 int test_api_map_unmap(void);
+int test_api_time(void);
+int test_api_trace(void);
 
 #endif /* __TEST_SUITE_API_H__ */
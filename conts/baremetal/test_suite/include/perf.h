@@ -66,5 +66,7 @@ void perf_measure_ipc(void);
 void perf_measure_map(void);
 void perf_measure_unmap(void);
 void perf_measure_mutex(void);
+void perf_measure_sched(void);
+void perf_measure_thread_storm(void);
 
 #endif /* __PERF_TESTS_H__ */
@@ -46,6 +46,12 @@ int test_api(void)
 	if ((err = test_api_irqctrl()) < 0)
 		return err;
 
+	if ((err = test_api_time()) < 0)
+		return err;
+
+	if ((err = test_api_trace()) < 0)
+		return err;
+
 	return 0;
 }
 
@@ -10,6 +10,8 @@
 #include L4LIB_INC_ARCH(syscalls.h)
 #include <l4lib/lib/thread.h>
 #include <l4lib/ipcdefs.h>
+#include <l4lib/time.h>
+#include <l4/api/errno.h>
 #include <tests.h>
 #include <macros.h>
 #include <fault.h>
@@ -523,6 +525,144 @@ int test_ipc_short(void)
 	return 0;
 }
 
+#define IPC_DIRECT_TEST_SIZE		(SZ_4K * 2 + SZ_1K)
+
+/* Page-crossing buffers for direct ipc, deliberately unaligned */
+static char ipc_direct_sbuf[SZ_4K * 4];
+static char ipc_direct_rbuf[SZ_4K * 4];
+
+int ipc_direct_sender(void *arg)
+{
+	struct ipc_ext_data *data = arg;
+	int err;
+
+	if ((err = l4_send_direct(data->partner, 0,
+				  IPC_DIRECT_TEST_SIZE,
+				  data->virtual)) < 0)
+		printf("%s: Direct send failed. err=%d\n",
+		       __FUNCTION__, err);
+	return err;
+}
+
+int ipc_direct_receiver(void *arg)
+{
+	struct ipc_ext_data *data = arg;
+	int err;
+
+	if ((err = l4_receive_direct(data->partner, IPC_DIRECT_TEST_SIZE,
+				     data->virtual)) < 0) {
+		printf("%s: Direct receive failed. err=%d\n",
+		       __FUNCTION__, err);
+		return err;
+	}
+
+	if (read_mr(L4SYS_ARG1) != IPC_DIRECT_TEST_SIZE) {
+		printf("%s: Direct receive size unexpected: %d\n",
+		       __FUNCTION__, read_mr(L4SYS_ARG1));
+		return -1;
+	}
+
+	for (int i = 0; i < IPC_DIRECT_TEST_SIZE; i++) {
+		if (((char *)data->virtual)[i] != (char)('A' + i)) {
+			printf("%s: Direct receive buffer has unexpected "
+			       "data: Offset: %d, Data=%d, expected=%d\n",
+			       __FUNCTION__, i, ((char *)data->virtual)[i],
+			       (char)('A' + i));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Two threads do a direct ipc of a payload larger than
+ * extended ipc allows, crossing page boundaries at
+ * different offsets on each side.
+ */
+int test_ipc_direct(void)
+{
+	struct ipc_ext_data ipc_data[2];
+	struct l4_thread *thread[2];
+	int err;
+
+	for (int i = 0; i < IPC_DIRECT_TEST_SIZE; i++)
+		(ipc_direct_sbuf + SZ_1K * 3)[i] = 'A' + i;
+
+	if ((err = thread_create(ipc_direct_sender, &ipc_data[0],
+				 TC_SHARE_SPACE | TC_NOSTART,
+				 &thread[0])) < 0) {
+		dbg_printf("Thread create failed. "
+			   "err=%d\n", err);
+		return err;
+	}
+
+	if ((err = thread_create(ipc_direct_receiver, &ipc_data[1],
+				 TC_SHARE_SPACE | TC_NOSTART,
+				 &thread[1])) < 0) {
+		dbg_printf("Thread create failed. "
+			   "err=%d\n", err);
+		return err;
+	}
+
+	ipc_data[0].virtual = ipc_direct_sbuf + SZ_1K * 3;
+	ipc_data[0].partner = thread[1]->ids.tid;
+	ipc_data[1].virtual = ipc_direct_rbuf + SZ_1K;
+	ipc_data[1].partner = thread[0]->ids.tid;
+
+	l4_thread_control(THREAD_RUN, &thread[0]->ids);
+	l4_thread_control(THREAD_RUN, &thread[1]->ids);
+
+	if ((err = thread_wait(thread[1])) < 0)
+		return err;
+	thread_wait(thread[0]);
+
+	dbg_printf("Direct IPC send/recv successful.\n");
+	return 0;
+}
+
+/* A receive nobody sends to should give up after its timeout */
+#define IPC_TIMEOUT_MSECS		20
+
+struct ipc_timeval {
+	int tv_sec;
+	int tv_usec;
+};
+
+int test_ipc_timeout(void)
+{
+	struct ipc_timeval start, end;
+	long long elapsed;
+	int err;
+
+	if ((err = l4_ipc_control(IPC_CONTROL_RECV_TIMEOUT, L4_NILTHREAD,
+				  IPC_TIMEOUT_MAX_MSECS + 1)) != -EINVAL) {
+		dbg_printf("Too long a receive timeout was accepted. "
+			   "err=%d\n", err);
+		return -1;
+	}
+
+	l4_gettime(&start);
+	if ((err = l4_receive_timeout(L4_ANYTHREAD,
+				      IPC_TIMEOUT_MSECS)) != -ETIMEDOUT) {
+		dbg_printf("Receive did not time out. err=%d\n", err);
+		return -1;
+	}
+	l4_gettime(&end);
+
+	elapsed = (end.tv_sec - start.tv_sec) * 1000000LL +
+		  end.tv_usec - start.tv_usec;
+	if (elapsed < (IPC_TIMEOUT_MSECS - 1) * 1000LL ||
+	    elapsed > 1000000LL) {
+		dbg_printf("Receive timed out after %d usecs\n",
+			   (int)elapsed);
+		return -1;
+	}
+
+	dbg_printf("Receive timeout successful.\n");
+	return 0;
+}
+
 int test_api_ipc(void)
 {
 	int err;
@@ -530,12 +670,18 @@ int test_api_ipc(void)
 	if ((err = test_ipc_extended()) < 0)
 		goto out_err;
 
+	if ((err = test_ipc_direct()) < 0)
+		goto out_err;
+
 	if ((err = test_ipc_short()) < 0)
 		goto out_err;
 
 	if ((err = test_ipc_full()) < 0)
 		goto out_err;
 
+	if ((err = test_ipc_timeout()) < 0)
+		goto out_err;
+
 	printf("IPC:                           -- PASSED --\n");
 	return 0;
 
@@ -344,6 +344,65 @@ int test_api_unmap(void)
 	return 0;
 }
 
+int test_api_map_batch(void)
+{
+	struct map_desc desc[2];
+	int err;
+	l4id_t self = self_tid();
+
+	/* Two valid ranges, a few pages below the end marks */
+	for (int i = 0; i < 2; i++) {
+		desc[i].phys = CONFIG_CONT0_PAGER_PHYS0_END - PAGE_SIZE * (5 - i * 2);
+		desc[i].virt = CONFIG_CONT0_PAGER_VIRT0_END - PAGE_SIZE * (5 - i * 2);
+		desc[i].npages = 2;
+		desc[i].flags = MAP_USR_RW;
+	}
+
+	if ((err = l4_map_batch(desc, 2, MAP_BATCH_MAP, self)) < 0) {
+		dbg_printf("sys_map_batch failed on valid request. err=%d\n",
+			   err);
+		return err;
+	}
+
+	if ((err = l4_map_batch(desc, 2, MAP_BATCH_UNMAP, self)) < 0) {
+		dbg_printf("sys_map_batch failed on valid unmap. err=%d\n",
+			   err);
+		return err;
+	}
+
+	/* Unmapping again should return ENOMAP */
+	if ((err = l4_map_batch(desc, 2, MAP_BATCH_UNMAP, self)) != -ENOMAP) {
+		dbg_printf("sys_map_batch did not return ENOMAP "
+			   "on second unmap of same ranges. err=%d\n", err);
+		return -1;
+	}
+
+	/* One invalid range fails the whole batch, before any mapping */
+	desc[1].virt = KERNEL_PAGE;
+	if ((err = l4_map_batch(desc, 2, MAP_BATCH_MAP, self)) == 0) {
+		dbg_printf("sys_map_batch succeeded with an invalid "
+			   "range. ret=%d\n", err);
+		return -1;
+	}
+	if ((err = l4_unmap((void *)desc[0].virt, 1, self)) != -ENOMAP) {
+		dbg_printf("sys_map_batch mapped ranges of an "
+			   "invalid batch. err=%d\n", err);
+		return -1;
+	}
+
+	/* Invalid descriptor counts and operations */
+	if ((err = l4_map_batch(desc, 0, MAP_BATCH_MAP, self)) == 0 ||
+	    (err = l4_map_batch(desc, MAP_BATCH_MAX + 1,
+				MAP_BATCH_MAP, self)) == 0 ||
+	    (err = l4_map_batch(desc, 1, 0xF0, self)) == 0) {
+		dbg_printf("sys_map_batch succeeded on invalid "
+			   "arguments. ret=%d\n", err);
+		return -1;
+	}
+
+	return 0;
+}
+
 int test_api_map_unmap(void)
 {
 	int err;
@@ -354,6 +413,9 @@ int test_api_map_unmap(void)
 	if ((err = test_api_unmap()) < 0)
 		goto out_err;
 
+	if ((err = test_api_map_batch()) < 0)
+		goto out_err;
+
 
 	printf("MAP/UNMAP:                     -- PASSED --\n");
 	return 0;
@@ -0,0 +1,74 @@
+/*
+ * Test reading the time from the kip clock.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/time.h>
+#include <tests.h>
+
+#define TIME_READS			1000
+
+/* Two clock reads should never be further apart than this */
+#define TIME_MAX_SKEW_USEC		1000000
+
+struct test_timeval {
+	int tv_sec;
+	int tv_usec;
+};
+
+static long long timeval_usec(struct test_timeval *tv)
+{
+	return tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
+int test_api_time(void)
+{
+	struct test_timeval prev, now, sys;
+	int err;
+
+	if ((err = l4_gettime(&prev)) < 0) {
+		dbg_printf("Reading the kip clock failed. err=%d\n", err);
+		goto out_err;
+	}
+
+	/* Time read from the kip never goes back */
+	for (int i = 0; i < TIME_READS; i++) {
+		l4_gettime(&now);
+		if (now.tv_usec < 0 || now.tv_usec >= 1000000 ||
+		    timeval_usec(&now) < timeval_usec(&prev)) {
+			dbg_printf("Kip clock went from %d.%06d to %d.%06d\n",
+				   prev.tv_sec, prev.tv_usec,
+				   now.tv_sec, now.tv_usec);
+			err = -1;
+			goto out_err;
+		}
+		prev = now;
+	}
+
+	/* And agrees with the system call */
+	if ((err = l4_time(&sys, 0)) < 0) {
+		dbg_printf("Time system call failed. err=%d\n", err);
+		goto out_err;
+	}
+	l4_gettime(&now);
+	if (timeval_usec(&sys) < timeval_usec(&prev) ||
+	    timeval_usec(&now) < timeval_usec(&sys) ||
+	    timeval_usec(&now) - timeval_usec(&prev) > TIME_MAX_SKEW_USEC) {
+		dbg_printf("Kip clock and system call disagree: "
+			   "%d.%06d, %d.%06d, %d.%06d\n",
+			   prev.tv_sec, prev.tv_usec, sys.tv_sec,
+			   sys.tv_usec, now.tv_sec, now.tv_usec);
+		err = -1;
+		goto out_err;
+	}
+
+	printf("TIME:                          -- PASSED --\n");
+	return 0;
+
+out_err:
+	printf("TIME:                          -- FAILED --\n");
+	return err;
+}
@@ -0,0 +1,144 @@
+/*
+ * Test mapping and reading the kernel trace buffers.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syscalls.h)
+#include L4LIB_INC_ARCH(syslib.h)
+#include INC_GLUE(memory.h)
+#include <l4/api/trace.h>
+#include <l4/api/errno.h>
+#include <tests.h>
+
+#if defined (CONFIG_TRACE)
+
+/* Up to 16 pages for each of 4 cpus, below those of the map test */
+#define TRACE_TEST_PAGES_MAX		64
+#define TRACE_TEST_VIRT			(CONFIG_CONT0_PAGER_VIRT0_END - \
+					 PAGE_SIZE * (5 + TRACE_TEST_PAGES_MAX))
+
+#define TRACE_TEST_SYSCALLS		16
+
+/*
+ * Counts system call entries and exits of ours, in
+ * the buffers of all cpus, checking each header.
+ */
+static int trace_count_syscalls(unsigned long start, int npages,
+				l4id_t self, int *entries, int *exits)
+{
+	unsigned long buf = start, end = start + npages * PAGE_SIZE;
+	struct trace_header *header;
+	struct trace_event *event;
+	unsigned int n;
+
+	*entries = *exits = 0;
+	while (buf < end) {
+		header = (struct trace_header *)buf;
+		event = (struct trace_event *)(header + 1);
+
+		if (header->magic != TRACE_MAGIC || header->enabled ||
+		    !header->nevents) {
+			dbg_printf("Bad trace header at 0x%lx\n", buf);
+			return -1;
+		}
+
+		n = header->count < header->nevents ?
+		    header->count : header->nevents;
+		for (unsigned int i = 0; i < n; i++) {
+			if (event[i].tid != self)
+				continue;
+			if (event[i].type == TRACE_SYSCALL_ENTRY)
+				(*entries)++;
+			else if (event[i].type == TRACE_SYSCALL_EXIT)
+				(*exits)++;
+		}
+
+		/* Buffer of the next cpu */
+		buf += page_align_up(sizeof(*header) +
+				     header->nevents * sizeof(*event));
+	}
+
+	return 0;
+}
+
+int test_api_trace(void)
+{
+	l4id_t self = self_tid();
+	int npages, entries, exits;
+	struct task_ids ids;
+	int err;
+
+	/* Buffers must be mapped at a page boundary */
+	if ((err = l4_trace_control(TRACE_CONTROL_MAP,
+				    (void *)TRACE_TEST_VIRT + 4)) >= 0) {
+		dbg_printf("Trace buffers mapped at an unaligned address.\n");
+		err = -1;
+		goto out_err;
+	}
+
+	if ((npages = l4_trace_control(TRACE_CONTROL_MAP,
+				       (void *)TRACE_TEST_VIRT)) < 0) {
+		dbg_printf("Mapping trace buffers failed. err=%d\n", npages);
+		err = npages;
+		goto out_err;
+	}
+
+	/* Trace a few system calls from empty buffers */
+	if ((err = l4_trace_control(TRACE_CONTROL_STOP, 0)) < 0 ||
+	    (err = l4_trace_control(TRACE_CONTROL_RESET, 0)) < 0 ||
+	    (err = l4_trace_control(TRACE_CONTROL_START, 0)) < 0) {
+		dbg_printf("Starting trace failed. err=%d\n", err);
+		goto out_err;
+	}
+
+	/* Buffers may not be reset under the writers */
+	if ((err = l4_trace_control(TRACE_CONTROL_RESET, 0)) != -EBUSY) {
+		dbg_printf("Trace reset while tracing. err=%d\n", err);
+		err = -1;
+		goto out_err;
+	}
+
+	for (int i = 0; i < TRACE_TEST_SYSCALLS; i++)
+		l4_getid(&ids);
+
+	if ((err = l4_trace_control(TRACE_CONTROL_STOP, 0)) < 0) {
+		dbg_printf("Stopping trace failed. err=%d\n", err);
+		goto out_err;
+	}
+
+	if ((err = trace_count_syscalls(TRACE_TEST_VIRT, npages, self,
+					&entries, &exits)) < 0)
+		goto out_err;
+
+	/* The refused reset, start's exit and stop's entry count too */
+	if (entries < TRACE_TEST_SYSCALLS + 2 ||
+	    exits < TRACE_TEST_SYSCALLS + 2) {
+		dbg_printf("Traced %d system call entries and %d exits "
+			   "of %d.\n", entries, exits,
+			   TRACE_TEST_SYSCALLS + 2);
+		err = -1;
+		goto out_err;
+	}
+
+	if ((err = l4_unmap((void *)TRACE_TEST_VIRT, npages, self)) < 0) {
+		dbg_printf("Unmapping trace buffers failed. err=%d\n", err);
+		goto out_err;
+	}
+
+	printf("TRACE:                         -- PASSED --\n");
+	return 0;
+
+out_err:
+	printf("TRACE:                         -- FAILED --\n");
+	return err;
+}
+
+#else /* Not CONFIG_TRACE */
+
+int test_api_trace(void)
+{
+	return 0;
+}
+
+#endif /* End of Not CONFIG_TRACE */
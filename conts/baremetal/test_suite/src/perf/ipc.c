@@ -6,7 +6,81 @@
  * Author: Bahadir Balban
  */
 
-void perf_measure_ipc(void)
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/lib/thread.h>
+#include <l4lib/perfmon.h>
+#include <perf.h>
+#include <tests.h>
+#include <string.h>
+
+struct perfmon_cycles ipc_rtt_cycles;
+
+#define PERFTEST_IPC_ROUNDTRIPS			100
+
+/*
+ * Echo server. Replies to each request and waits
+ * for the next one in a single call, as servers do.
+ */
+int ipc_echo_server(void *arg)
+{
+	l4id_t client = *(l4id_t *)arg;
+
+	l4_receive(client);
+	for (int i = 0; i < PERFTEST_IPC_ROUNDTRIPS - 1; i++)
+		l4_sendrecv(client, client, 0);
+	l4_send(client, 0);
+
+	return 0;
+}
+
+void perf_measure_ipc_roundtrip(void)
 {
+	struct l4_thread *server;
+	l4id_t selftid = self_tid();
+	int err;
+
+	/*
+	 * Initialize structures
+	 */
+	memset(&ipc_rtt_cycles, 0, sizeof (struct perfmon_cycles));
+	ipc_rtt_cycles.min = ~0; /* Init as maximum possible */
+
+	if ((err = thread_create(ipc_echo_server, &selftid,
+				 TC_SHARE_SPACE, &server)) < 0) {
+		printf("%s: Thread create failed. err=%d\n",
+		       __FUNCTION__, err);
+		return;
+	}
+
+	/* Time each client request and server reply pair */
+	for (int i = 0; i < PERFTEST_IPC_ROUNDTRIPS; i++) {
+		perfmon_reset_start_cyccnt();
+		l4_sendrecv(server->ids.tid, server->ids.tid, 0);
+		perfmon_record_cycles(&ipc_rtt_cycles, "IPC_ROUNDTRIP");
+	}
+
+	/*
+	 * Calculate average
+	 */
+	ipc_rtt_cycles.avg = ipc_rtt_cycles.total / ipc_rtt_cycles.ops;
 
+	/*
+	 * Print results
+	 */
+	printf("%s took %llu cycles, %llu min, %llu max, %llu avg, in %llu ops.\n",
+	       "IPC_ROUNDTRIP",
+	       ipc_rtt_cycles.min,
+	       ipc_rtt_cycles.min * USEC_MULTIPLIER,
+	       ipc_rtt_cycles.max * USEC_MULTIPLIER,
+	       ipc_rtt_cycles.avg * USEC_MULTIPLIER,
+	       ipc_rtt_cycles.ops);
+
+	thread_wait(server);
+}
+
+void perf_measure_ipc(void)
+{
+	perf_measure_ipc_roundtrip();
 }
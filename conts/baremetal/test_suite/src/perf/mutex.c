@@ -6,7 +6,114 @@
  * Author: Bahadir Balban
  */
 
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/lib/thread.h>
+#include <l4lib/mutex.h>
+#include <l4lib/perfmon.h>
+#include <perf.h>
+#include <tests.h>
+#include <string.h>
+
+struct perfmon_cycles mutex_cycles;
+
+#define PERFTEST_MUTEX_WORKERS			4
+#define PERFTEST_MUTEX_ROUNDS			500
+
+/* Workers share out these locks, the rest are unused */
+struct mutex_perf_lock {
+	struct l4_mutex lock;
+	int count;
+} mutex_perf_lock[PERFTEST_MUTEX_WORKERS];
+
+/*
+ * Locks and unlocks back to back, with a short critical
+ * section, so that workers on the same lock contend.
+ */
+int mutex_worker(void *arg)
+{
+	struct mutex_perf_lock *l = arg;
+	int err;
+
+	for (int i = 0; i < PERFTEST_MUTEX_ROUNDS; i++) {
+		if ((err = l4_mutex_lock(&l->lock)) < 0)
+			return err;
+		l->count++;
+		if ((err = l4_mutex_unlock(&l->lock)) < 0)
+			return err;
+	}
+	return 0;
+}
+
+/* Runs all workers spread over nlocks locks */
+void perf_measure_mutex_contention(int nlocks, char *name)
+{
+	struct l4_thread *worker[PERFTEST_MUTEX_WORKERS];
+	int err, total = 0;
+
+	/*
+	 * Initialize structures
+	 */
+	memset(&mutex_cycles, 0, sizeof (struct perfmon_cycles));
+	mutex_cycles.min = ~0; /* Init as maximum possible */
+	for (int i = 0; i < nlocks; i++) {
+		l4_mutex_init(&mutex_perf_lock[i].lock);
+		mutex_perf_lock[i].count = 0;
+	}
+
+	/*
+	 * The whole run is timed, from starting the
+	 * first worker until the last one is reaped.
+	 */
+	perfmon_reset_start_cyccnt();
+	for (int i = 0; i < PERFTEST_MUTEX_WORKERS; i++) {
+		if ((err = thread_create(mutex_worker,
+					 &mutex_perf_lock[i % nlocks],
+					 TC_SHARE_SPACE,
+					 &worker[i])) < 0) {
+			printf("%s: Thread create failed. err=%d\n",
+			       __FUNCTION__, err);
+			return;
+		}
+	}
+	for (int i = 0; i < PERFTEST_MUTEX_WORKERS; i++)
+		if ((err = thread_wait(worker[i])) < 0)
+			printf("%s: Worker failed. err=%d\n",
+			       __FUNCTION__, err);
+	perfmon_record_cycles(&mutex_cycles, name);
+
+	/* No increment must be lost to a broken lock */
+	for (int i = 0; i < nlocks; i++)
+		total += mutex_perf_lock[i].count;
+	if (total != PERFTEST_MUTEX_WORKERS * PERFTEST_MUTEX_ROUNDS)
+		printf("%s: %s counted %d of %d rounds.\n", __FUNCTION__,
+		       name, total,
+		       PERFTEST_MUTEX_WORKERS * PERFTEST_MUTEX_ROUNDS);
+
+	/*
+	 * Calculate average per lock/unlock pair
+	 */
+	mutex_cycles.ops = PERFTEST_MUTEX_WORKERS * PERFTEST_MUTEX_ROUNDS;
+	mutex_cycles.avg = mutex_cycles.total / mutex_cycles.ops;
+
+	/*
+	 * Print results
+	 */
+	printf("%s took %llu cycles, %llu usec, %llu avg, in %llu ops.\n",
+	       name,
+	       mutex_cycles.total,
+	       mutex_cycles.total * USEC_MULTIPLIER,
+	       mutex_cycles.avg * USEC_MULTIPLIER,
+	       mutex_cycles.ops);
+}
+
 void perf_measure_mutex(void)
 {
+	/* All workers on one lock */
+	perf_measure_mutex_contention(1, "MUTEX_CONTENDED");
 
+	/* Worker pairs on different locks, which queue apart in the kernel */
+	perf_measure_mutex_contention(PERFTEST_MUTEX_WORKERS / 2,
+				      "MUTEX_PAIRS");
 }
@@ -27,6 +27,8 @@ int test_performance(void)
 	perf_measure_map();
 	perf_measure_unmap();
 	perf_measure_mutex();
+	perf_measure_sched();
+	perf_measure_thread_storm();
 
 	return 0;
 }
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2010 B Labs Ltd.
+ *
+ * Scheduler wakeup latency performance tests
+ *
+ * Author: Bahadir Balban
+ */
+
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/lib/thread.h>
+#include <l4lib/perfmon.h>
+#include <perf.h>
+#include <tests.h>
+#include <string.h>
+
+struct perfmon_cycles sched_wakeup_cycles;
+
+#define PERFTEST_SCHED_LOAD_THREADS		4
+#define PERFTEST_SCHED_WAKEUPS			50
+
+static volatile int sched_load_stop;
+
+/* Keeps the runqueues busy until told to stop */
+int sched_load_thread(void *arg)
+{
+	while (!sched_load_stop)
+		;
+	return 0;
+}
+
+/*
+ * Sleeps on a receive, and records the cycles passed
+ * since the parent started waking it up.
+ */
+int sched_wakeup_thread(void *arg)
+{
+	l4id_t parent = *(l4id_t *)arg;
+
+	for (int i = 0; i < PERFTEST_SCHED_WAKEUPS; i++) {
+		l4_receive(parent);
+		perfmon_record_cycles(&sched_wakeup_cycles, "SCHED_WAKEUP");
+
+		/* Tell parent we ran */
+		l4_send(parent, 0);
+	}
+	return 0;
+}
+
+void perf_measure_sched_wakeup(void)
+{
+	struct l4_thread *load[PERFTEST_SCHED_LOAD_THREADS];
+	struct l4_thread *sleeper;
+	l4id_t selftid = self_tid();
+	int err;
+
+	/*
+	 * Initialize structures
+	 */
+	memset(&sched_wakeup_cycles, 0, sizeof (struct perfmon_cycles));
+	sched_wakeup_cycles.min = ~0; /* Init as maximum possible */
+	sched_load_stop = 0;
+
+	/* Create the load */
+	for (int i = 0; i < PERFTEST_SCHED_LOAD_THREADS; i++) {
+		if ((err = thread_create(sched_load_thread, 0,
+					 TC_SHARE_SPACE,
+					 &load[i])) < 0) {
+			printf("%s: Thread create failed. err=%d\n",
+			       __FUNCTION__, err);
+			return;
+		}
+	}
+
+	if ((err = thread_create(sched_wakeup_thread, &selftid,
+				 TC_SHARE_SPACE, &sleeper)) < 0) {
+		printf("%s: Thread create failed. err=%d\n",
+		       __FUNCTION__, err);
+		return;
+	}
+
+	/*
+	 * Wake up the sleeper and wait for it to
+	 * acknowledge. Only the wakeup is timed.
+	 */
+	for (int i = 0; i < PERFTEST_SCHED_WAKEUPS; i++) {
+		perfmon_reset_start_cyccnt();
+		l4_send(sleeper->ids.tid, 0);
+		l4_receive(sleeper->ids.tid);
+	}
+
+	/*
+	 * Calculate average
+	 */
+	sched_wakeup_cycles.avg =
+		sched_wakeup_cycles.total / sched_wakeup_cycles.ops;
+
+	/*
+	 * Print results
+	 */
+	printf("%s took %llu cycles, %llu min, %llu max, %llu avg, in %llu ops.\n",
+	       "SCHED_WAKEUP",
+	       sched_wakeup_cycles.min,
+	       sched_wakeup_cycles.min * USEC_MULTIPLIER,
+	       sched_wakeup_cycles.max * USEC_MULTIPLIER,
+	       sched_wakeup_cycles.avg * USEC_MULTIPLIER,
+	       sched_wakeup_cycles.ops);
+
+	/* Stop the load and reap all threads */
+	sched_load_stop = 1;
+	thread_wait(sleeper);
+	for (int i = 0; i < PERFTEST_SCHED_LOAD_THREADS; i++)
+		thread_wait(load[i]);
+}
+
+void perf_measure_sched(void)
+{
+	perf_measure_sched_wakeup();
+}
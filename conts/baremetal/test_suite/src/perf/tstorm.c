@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2010 B Labs Ltd.
+ *
+ * Thread create/destroy storm performance tests
+ *
+ * Author: Bahadir Balban
+ */
+
+#include <l4lib/macros.h>
+#include L4LIB_INC_ARCH(syslib.h)
+#include L4LIB_INC_ARCH(syscalls.h)
+#include <l4lib/lib/thread.h>
+#include <l4lib/perfmon.h>
+#include <perf.h>
+#include <tests.h>
+#include <string.h>
+
+struct perfmon_cycles tstorm_cycles;
+
+#define PERFTEST_TSTORM_WORKERS			4
+#define PERFTEST_TSTORM_ROUNDS			50
+
+/*
+ * Creates and destroys threads back to back, so that
+ * all workers hammer the kernel ktcb and space caches
+ * at the same time.
+ */
+int tstorm_worker(void *arg)
+{
+	struct task_ids ids;
+	int err;
+
+	for (int i = 0; i < PERFTEST_TSTORM_ROUNDS; i++) {
+		l4_getid(&ids);
+		if ((err = l4_thread_control(THREAD_CREATE |
+					     TC_SHARE_SPACE, &ids)) < 0)
+			return err;
+		if ((err = l4_thread_control(THREAD_DESTROY, &ids)) < 0)
+			return err;
+	}
+	return 0;
+}
+
+void perf_measure_thread_storm(void)
+{
+	struct l4_thread *worker[PERFTEST_TSTORM_WORKERS];
+	int err;
+
+	/*
+	 * Initialize structures
+	 */
+	memset(&tstorm_cycles, 0, sizeof (struct perfmon_cycles));
+	tstorm_cycles.min = ~0; /* Init as maximum possible */
+
+	/*
+	 * The whole storm is timed, from starting the
+	 * first worker until the last one is reaped.
+	 */
+	perfmon_reset_start_cyccnt();
+	for (int i = 0; i < PERFTEST_TSTORM_WORKERS; i++) {
+		if ((err = thread_create(tstorm_worker, 0,
+					 TC_SHARE_SPACE,
+					 &worker[i])) < 0) {
+			printf("%s: Thread create failed. err=%d\n",
+			       __FUNCTION__, err);
+			return;
+		}
+	}
+	for (int i = 0; i < PERFTEST_TSTORM_WORKERS; i++)
+		if ((err = thread_wait(worker[i])) < 0)
+			printf("%s: Worker failed. err=%d\n",
+			       __FUNCTION__, err);
+	perfmon_record_cycles(&tstorm_cycles, "THREAD_STORM");
+
+	/*
+	 * Calculate average per create/destroy pair
+	 */
+	tstorm_cycles.ops = PERFTEST_TSTORM_WORKERS * PERFTEST_TSTORM_ROUNDS;
+	tstorm_cycles.avg = tstorm_cycles.total / tstorm_cycles.ops;
+
+	/*
+	 * Print results
+	 */
+	printf("%s took %llu cycles, %llu usec, %llu avg, in %llu ops.\n",
+	       "THREAD_STORM",
+	       tstorm_cycles.total,
+	       tstorm_cycles.total * USEC_MULTIPLIER,
+	       tstorm_cycles.avg * USEC_MULTIPLIER,
+	       tstorm_cycles.ops);
+}
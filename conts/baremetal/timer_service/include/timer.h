@@ -13,17 +13,37 @@ struct sleeper_task {
 	struct link list;
 	l4id_t tid;	/* tid of sleeping task */
 	int retval;	/* return value on wakeup */
+	u32 expires;	/* Wheel tick to wake up at */
 };
 
 /* list of tasks to be woken up */
 struct wake_task_list {
 	struct link head;
-	struct link *end; /* optimization */
 	struct l4_mutex wake_list_lock; /* lock for sanity of head */
 };
 
+/*
+ * The wheel turns once every 2^TIMER_TICK_SHIFT usecs, so that
+ * sleeps are good to about half a millisecond.
+ */
+#define TIMER_TICK_SHIFT		9
+#define TIMER_TICK_USEC			(1 << TIMER_TICK_SHIFT)
+
+/* usecs to wheel ticks, rounding up so no one wakes up early */
+#define USEC_TO_TICKS(usec)		\
+	(((usec) + TIMER_TICK_USEC - 1) >> TIMER_TICK_SHIFT)
+
+/*
+ * Longest the timer is programmed for, so that the 32 bit
+ * clock is read before it wraps. Sooner than the shortest
+ * the event would be over before it is set.
+ */
+#define TIMER_MAX_USEC			(1 << 30)
+#define TIMER_MIN_USEC			20
+
 #define BUCKET_BASE_LEVEL_BITS		8
 #define BUCKET_HIGHER_LEVEL_BITS	6
+#define BUCKET_HIGHER_LEVELS		4
 
 #define BUCKET_BASE_LEVEL_SIZE		(1 << BUCKET_BASE_LEVEL_BITS)
 #define BUCKET_HIGHER_LEVEL_SIZE	(1 << BUCKET_HIGHER_LEVEL_BITS)
@@ -32,52 +52,46 @@ struct wake_task_list {
 #define BUCKET_HIGHER_LEVEL_MASK	0x3F
 
 /*
- * Web of sleeping tasks
- * based on timer wheel base algorithm
+ * Web of sleeping tasks based on the timer wheel algorithm.
+ *
+ * Level 0 has a bucket for each of the next 256 ticks. Each
+ * higher level bucket spans a whole turn of the level below,
+ * and is cascaded into it as that level comes round to it.
  */
 struct sleeper_task_bucket {
 	struct link bucket_level0[BUCKET_BASE_LEVEL_SIZE];
-	struct link bucket_level1[BUCKET_HIGHER_LEVEL_SIZE];
-	struct link bucket_level2[BUCKET_HIGHER_LEVEL_SIZE];
-	struct link bucket_level3[BUCKET_HIGHER_LEVEL_SIZE];
-	struct link bucket_level4[BUCKET_HIGHER_LEVEL_SIZE];
+	struct link bucket_higher[BUCKET_HIGHER_LEVELS]
+				 [BUCKET_HIGHER_LEVEL_SIZE];
 };
 
-/* Macros to extract bucket levels */
-#define GET_BUCKET_LEVEL4(x)	\
-	((x >> (BUCKET_BASE_LEVEL_BITS + (3 * BUCKET_HIGHER_LEVEL_BITS))) & \
-	  BUCKET_HIGHER_LEVEL_MASK)
-#define GET_BUCKET_LEVEL3(x)	\
-	((x >> (BUCKET_BASE_LEVEL_BITS + (2 * BUCKET_HIGHER_LEVEL_BITS))) & \
-	  BUCKET_HIGHER_LEVEL_MASK)
-#define GET_BUCKET_LEVEL2(x)	\
-	((x >> (BUCKET_BASE_LEVEL_BITS + (1 * BUCKET_HIGHER_LEVEL_BITS))) & \
-	 BUCKET_HIGHER_LEVEL_MASK)
-#define GET_BUCKET_LEVEL1(x)	\
-	((x >> BUCKET_BASE_LEVEL_BITS) &  BUCKET_HIGHER_LEVEL_MASK)
-#define GET_BUCKET_LEVEL0(x)	(x & BUCKET_BASE_LEVEL_MASK)
+/* Tick shift of a higher level, level 1 being the first */
+#define BUCKET_LEVEL_SHIFT(level)	\
+	(BUCKET_BASE_LEVEL_BITS + (((level) - 1) * BUCKET_HIGHER_LEVEL_BITS))
 
-/* Macros to find bucket level */
-#define IS_IN_LEVEL0_BUCKET(x)		\
-	(x < (1 << BUCKET_BASE_LEVEL_BITS))
-#define IS_IN_LEVEL1_BUCKET(x)		\
-	(x < (1 << (BUCKET_BASE_LEVEL_BITS + BUCKET_HIGHER_LEVEL_BITS)))
-#define IS_IN_LEVEL2_BUCKET(x)		\
-	(x < (1 << (BUCKET_BASE_LEVEL_BITS + (2 * BUCKET_HIGHER_LEVEL_BITS))))
-#define IS_IN_LEVEL3_BUCKET(x)		\
-	(x < (1 << (BUCKET_BASE_LEVEL_BITS + (3 * BUCKET_HIGHER_LEVEL_BITS))))
+/* Macros to extract bucket levels */
+#define GET_BUCKET_LEVEL(x, level)	\
+	(((x) >> BUCKET_LEVEL_SHIFT(level)) & BUCKET_HIGHER_LEVEL_MASK)
+#define GET_BUCKET_LEVEL0(x)		((x) & BUCKET_BASE_LEVEL_MASK)
 
 /*
  * Timer structure
- * TODO: Keep timer 32 bit for time being,
- * we will make it 64 in future
+ *
+ * The primary timer of the device is programmed one-shot for
+ * the earliest sleeper, and the secondary one counts usecs.
  */
 struct timer {
 	int slot;		/* Notify slot on utcb */
 	unsigned long base;	/* Virtual base address */
-	unsigned int count;		/* Counter/jiffies */
+	u32 stamp;		/* Clock at the last read */
+	u64 clock;		/* usecs since the timer was started */
+	u32 sec;		/* Same clock as seconds, */
+	u32 usec;		/* and usecs */
+	u32 count;		/* Next wheel tick to run */
+	u32 next;		/* Wheel tick the timer is programmed for */
+	int pending;		/* Sleepers on the wheel, */
+	int pending0;		/* and those of them on level 0 */
 	struct sleeper_task_bucket task_list;	/* List of sleeping tasks */
-	struct l4_mutex task_list_lock;	/* Lock for sleeper_task_bucket */
+	struct l4_mutex lock;	/* Lock for the wheel and clock */
 	unsigned long phys_base;	/* Physical address of Device */
 	int irq_no;	/* IRQ number of device */
 };
@@ -35,26 +35,32 @@ struct wake_task_list wake_tasks;
 /* tid of handle_request thread */
 l4id_t tid_ipc_handler;
 
+/* Longest sleep, about six days, so that ticks on the wheel compare */
+#define TIMER_SLEEP_MAX_USEC	((u64)1 << (30 + TIMER_TICK_SHIFT))
+
 /*
  * Initialize timer devices
  */
 void timer_struct_init(struct timer* timer, unsigned long base)
 {
 	timer->base = base;
+	timer->stamp = 0;
+	timer->clock = 0;
+	timer->sec = 0;
+	timer->usec = 0;
 	timer->count = 0;
+	timer->next = 0;
+	timer->pending = 0;
+	timer->pending0 = 0;
 	timer->slot = 0;
-	l4_mutex_init(&timer->task_list_lock);
+	l4_mutex_init(&timer->lock);
 
-	for (int i = 0; i < BUCKET_BASE_LEVEL_SIZE ; ++i) {
+	for (int i = 0; i < BUCKET_BASE_LEVEL_SIZE ; ++i)
 		link_init(&timer->task_list.bucket_level0[i]);
-	}
 
-	for (int i = 0; i < BUCKET_HIGHER_LEVEL_SIZE ; ++i) {
-		link_init(&timer->task_list.bucket_level1[i]);
-		link_init(&timer->task_list.bucket_level2[i]);
-		link_init(&timer->task_list.bucket_level3[i]);
-		link_init(&timer->task_list.bucket_level4[i]);
-	}
+	for (int level = 0; level < BUCKET_HIGHER_LEVELS; level++)
+		for (int i = 0; i < BUCKET_HIGHER_LEVEL_SIZE ; ++i)
+			link_init(&timer->task_list.bucket_higher[level][i]);
 }
 
 /*
@@ -63,7 +69,6 @@ void timer_struct_init(struct timer* timer, unsigned long base)
 void wake_task_list_init(void)
 {
 	link_init(&wake_tasks.head);
-	wake_tasks.end = &wake_tasks.head;
 	l4_mutex_init(&wake_tasks.wake_list_lock);
 }
 
@@ -91,31 +96,208 @@ void free_sleeper_task(struct sleeper_task *task)
 }
 
 /*
- * Find the bucket list correspongding to seconds value
+ * Reads the clock, which counts down from the secondary timer,
+ * into the timer's usecs. Called with the timer locked.
  */
-struct link* find_bucket_list(unsigned long seconds)
+void timer_clock_update(struct timer *timer)
 {
-	struct link *vector;
-	struct sleeper_task_bucket *bucket;
+	u32 now = ~timer_read(timer_secondary_base(timer->base));
+	u32 delta = now - timer->stamp;
 
-	bucket = &global_timer[SLEEP_WAKE_TIMER].task_list;
+	timer->stamp = now;
+	timer->clock += delta;
 
-	/*
-	 * TODO: Check if we have already surpassed seconds
-	 */
-	if (IS_IN_LEVEL0_BUCKET(seconds)) {
-		vector = &bucket->bucket_level0[GET_BUCKET_LEVEL0(seconds)];
-	} else if (IS_IN_LEVEL1_BUCKET(seconds)) {
-		vector = &bucket->bucket_level1[GET_BUCKET_LEVEL1(seconds)];
-	} else if (IS_IN_LEVEL2_BUCKET(seconds)) {
-		vector = &bucket->bucket_level2[GET_BUCKET_LEVEL2(seconds)];
-	} else if (IS_IN_LEVEL3_BUCKET(seconds)) {
-		vector = &bucket->bucket_level3[GET_BUCKET_LEVEL3(seconds)];
-	} else {
-		vector = &bucket->bucket_level4[GET_BUCKET_LEVEL4(seconds)];
+	timer->usec += delta;
+	if (timer->usec >= 1000000) {
+		timer->sec += timer->usec / 1000000;
+		timer->usec %= 1000000;
+	}
+}
+
+static inline u32 timer_tick(struct timer *timer)
+{
+	return (u32)(timer->clock >> TIMER_TICK_SHIFT);
+}
+
+/*
+ * Find the bucket list for a wheel tick, by how far it is from
+ * the next tick to run.
+ */
+struct link *find_bucket_list(struct timer *timer, u32 expires)
+{
+	struct sleeper_task_bucket *bucket = &timer->task_list;
+	u32 idx = expires - timer->count;
+	int level;
+
+	/* Already due, runs on the next tick */
+	if ((int)idx < 0)
+		return &bucket->bucket_level0[GET_BUCKET_LEVEL0(timer->count)];
+
+	if (idx < BUCKET_BASE_LEVEL_SIZE)
+		return &bucket->bucket_level0[GET_BUCKET_LEVEL0(expires)];
+
+	for (level = 1; level < BUCKET_HIGHER_LEVELS; level++)
+		if (idx < (1 << BUCKET_LEVEL_SHIFT(level + 1)))
+			break;
+
+	return &bucket->bucket_higher[level - 1]
+				     [GET_BUCKET_LEVEL(expires, level)];
+}
+
+static inline int bucket_is_level0(struct timer *timer, struct link *vector)
+{
+	return vector >= timer->task_list.bucket_level0 &&
+	       vector < timer->task_list.bucket_level0 +
+			BUCKET_BASE_LEVEL_SIZE;
+}
+
+/* Puts a sleeper on the wheel, or moves it to where it now belongs */
+void wheel_add(struct timer *timer, struct sleeper_task *task)
+{
+	struct link *vector = find_bucket_list(timer, task->expires);
+
+	list_insert_tail(&task->list, vector);
+	if (bucket_is_level0(timer, vector))
+		timer->pending0++;
+}
+
+/*
+ * Moves sleepers of the higher level bucket that the wheel has
+ * come round to down the levels. Returns the bucket index, the
+ * next level is cascaded too when it wraps to 0.
+ */
+int wheel_cascade(struct timer *timer, int level)
+{
+	int index = GET_BUCKET_LEVEL(timer->count, level);
+	struct link *vector = &timer->task_list.bucket_higher[level - 1][index];
+	struct sleeper_task *task, *n;
+
+	list_foreach_removable_struct(task, n, vector, list) {
+		list_remove(&task->list);
+		wheel_add(timer, task);
+	}
+
+	return index;
+}
+
+/*
+ * Runs the wheel up to the current tick, moving all sleepers
+ * that are due onto the expired list. Returns how many.
+ */
+int wheel_run(struct timer *timer, struct link *expired)
+{
+	struct sleeper_task *task, *n;
+	u32 now = timer_tick(timer);
+	u32 next;
+	int index, woken = 0;
+
+	/* An empty wheel catches up at once */
+	if (!timer->pending) {
+		timer->count = now + 1;
+		return 0;
+	}
+
+	while ((int)(now - timer->count) >= 0) {
+		index = GET_BUCKET_LEVEL0(timer->count);
+
+		/* Nothing on level 0, skip to the next cascade */
+		if (index && !timer->pending0) {
+			next = (timer->count | BUCKET_BASE_LEVEL_MASK) + 1;
+			timer->count = (int)(next - now) > 0 ? now + 1 : next;
+			continue;
+		}
+
+		if (!index)
+			for (int level = 1; level <= BUCKET_HIGHER_LEVELS &&
+			     !wheel_cascade(timer, level); level++)
+				;
+
+		timer->count++;
+
+		list_foreach_removable_struct(task, n,
+					      &timer->task_list.bucket_level0[index],
+					      list) {
+			list_remove(&task->list);
+			list_insert_tail(&task->list, expired);
+			timer->pending0--;
+			timer->pending--;
+			woken++;
+		}
+	}
+
+	return woken;
+}
+
+/*
+ * Finds the first tick the wheel has work on, that is a sleeper
+ * to wake or a bucket to cascade, which may be before any of
+ * its sleepers expire. Returns 0 if the wheel is empty.
+ */
+int wheel_next(struct timer *timer, u32 *next)
+{
+	struct sleeper_task_bucket *bucket = &timer->task_list;
+	u32 tick, period;
+	int found = 0;
+
+	if (!timer->pending)
+		return 0;
+
+	for (int i = 0; timer->pending0 && i < BUCKET_BASE_LEVEL_SIZE; i++) {
+		tick = timer->count + i;
+		if (!list_empty(&bucket->bucket_level0[GET_BUCKET_LEVEL0(tick)])) {
+			*next = tick;
+			found = 1;
+			break;
+		}
+	}
+
+	for (int level = 1; level <= BUCKET_HIGHER_LEVELS; level++) {
+		period = timer->count >> BUCKET_LEVEL_SHIFT(level);
+
+		/* Unless the wheel is about to cascade the current bucket */
+		for (int i = !!(timer->count &
+				((1 << BUCKET_LEVEL_SHIFT(level)) - 1));
+		     i <= BUCKET_HIGHER_LEVEL_SIZE; i++) {
+			if (list_empty(&bucket->bucket_higher[level - 1]
+					[(period + i) & BUCKET_HIGHER_LEVEL_MASK]))
+				continue;
+
+			tick = (period + i) << BUCKET_LEVEL_SHIFT(level);
+			if (!found || (int)(tick - *next) < 0) {
+				*next = tick;
+				found = 1;
+			}
+			break;
+		}
+	}
+
+	return found;
+}
+
+/*
+ * Programs the timer one-shot for the next tick the wheel has
+ * work on, or for as long as it goes if there is none, so that
+ * the clock is read before it wraps. Called with the timer locked.
+ */
+void timer_program(struct timer *timer)
+{
+	u32 usecs = TIMER_MAX_USEC;
+	u32 next;
+	int ticks;
+
+	if (wheel_next(timer, &next)) {
+		ticks = next - timer_tick(timer);
+		if (ticks <= 0)
+			usecs = TIMER_MIN_USEC;
+		else if (ticks < (TIMER_MAX_USEC >> TIMER_TICK_SHIFT))
+			usecs = (ticks << TIMER_TICK_SHIFT) -
+				(u32)(timer->clock & (TIMER_TICK_USEC - 1));
+		if (usecs < TIMER_MIN_USEC)
+			usecs = TIMER_MIN_USEC;
 	}
 
-	return vector;
+	timer->next = timer_tick(timer) + USEC_TO_TICKS(usecs);
+	timer_oneshot(timer->base, usecs);
 }
 
 /*
@@ -125,15 +307,8 @@ int timer_irq_handler(void *arg)
 {
 	int err;
 	struct timer *timer = (struct timer *)arg;
-	struct link *vector;
 	const int slot = 0;
 
-	/*
-	  * Initialise timer
-	  * 1 interrupt per second
-	  */
-	timer_init(timer->base, 1000000);
-
 	/* Register self for timer irq, using notify slot 0 */
 	if ((err = l4_irq_control(IRQ_CONTROL_REGISTER, slot,
 				  timer->irq_no)) < 0) {
@@ -142,49 +317,36 @@ int timer_irq_handler(void *arg)
 		BUG();
 	}
 
-	/* Enable Timer */
-	timer_start(timer->base);
+	l4_mutex_lock(&timer->lock);
+	timer_clock_update(timer);
+	timer_program(timer);
+	l4_mutex_unlock(&timer->lock);
+
+	/* Requests may now set the timer, we won't miss its irq */
+	l4_send(tid_ipc_handler, L4_IPC_TAG_TIMER_WAKE_THREADS);
 
 	/* Handle irqs forever */
 	while (1) {
-		int count;
-		struct link *task_list;
+		int woken;
 
 		/* Block on irq */
-		if((count = l4_irq_wait(slot, timer->irq_no)) < 0) {
+		if ((err = l4_irq_wait(slot, timer->irq_no)) < 0) {
 			printf("l4_irq_wait() returned with negative value\n");
 			BUG();
 		}
 
-		/*
-		  * Update timer count
-		  * TODO: Overflow check, we have 1 interrupt/sec from timer
-		  * with 32bit count it will take 9years to overflow
-		  */
-		timer->count += count;
-		printf("Got timer irq, current count = 0x%x\n", timer->count);
-
-		/* find bucket list of taks to be woken for current count */
-		vector = find_bucket_list(timer->count);
-		l4_send(tid_ipc_handler,L4_IPC_TAG_TIMER_WAKE_THREADS);
-
-		if (!list_empty(vector)) {
-			/* Removing tasks from sleeper list */
-			l4_mutex_lock(&global_timer[SLEEP_WAKE_TIMER].task_list_lock);
-			task_list = list_detach(vector);
-			l4_mutex_unlock(&global_timer[SLEEP_WAKE_TIMER].task_list_lock);
-
-			/* Add tasks to wake_task_list */
-			l4_mutex_lock(&wake_tasks.wake_list_lock);
-			list_attach(task_list, &wake_tasks.head, wake_tasks.end);
-			l4_mutex_unlock(&wake_tasks.wake_list_lock);
-
-			/*
-			 * Send ipc to handle_request
-			 * thread to send wake signals
-			 */
-			l4_send(tid_ipc_handler,L4_IPC_TAG_TIMER_WAKE_THREADS);
-		}
+		/* Move all that are due to the wake list at once */
+		l4_mutex_lock(&timer->lock);
+		l4_mutex_lock(&wake_tasks.wake_list_lock);
+		timer_clock_update(timer);
+		woken = wheel_run(timer, &wake_tasks.head);
+		l4_mutex_unlock(&wake_tasks.wake_list_lock);
+		timer_program(timer);
+		l4_mutex_unlock(&timer->lock);
+
+		/* Send ipc to handle_request thread to wake them */
+		if (woken)
+			l4_send(tid_ipc_handler, L4_IPC_TAG_TIMER_WAKE_THREADS);
 	}
 }
 
@@ -194,37 +356,35 @@ int timer_irq_handler(void *arg)
 void task_wake(void)
 {
 	struct sleeper_task *struct_ptr, *temp_ptr;
+	struct link woken;
 	int ret;
 
-	if (!list_empty(&wake_tasks.head)) {
-		list_foreach_removable_struct(struct_ptr, temp_ptr,
-					      &wake_tasks.head, list) {
-			/* Remove task from wake list */
-			l4_mutex_lock(&wake_tasks.wake_list_lock);
-			list_remove(&struct_ptr->list);
-			l4_mutex_unlock(&wake_tasks.wake_list_lock);
-
-			/* Set sender correctly */
-			l4_set_sender(struct_ptr->tid);
+	/* Take them all off the wake list */
+	link_init(&woken);
+	l4_mutex_lock(&wake_tasks.wake_list_lock);
+	list_foreach_removable_struct(struct_ptr, temp_ptr,
+				      &wake_tasks.head, list) {
+		list_remove(&struct_ptr->list);
+		list_insert_tail(&struct_ptr->list, &woken);
+	}
+	l4_mutex_unlock(&wake_tasks.wake_list_lock);
 
-			printf("%s : Waking thread 0x%x at time 0x%x\n", __CONTAINER_NAME__,
-				    struct_ptr->tid, global_timer[SLEEP_WAKE_TIMER].count);
+	list_foreach_removable_struct(struct_ptr, temp_ptr, &woken, list) {
+		list_remove(&struct_ptr->list);
 
-			/* send wake ipc */
-			if ((ret = l4_ipc_return(struct_ptr->retval)) < 0) {
-				printf("%s: IPC return error: %d.\n",
-				       __FUNCTION__, ret);
-				BUG();
-			}
+		/* Set sender correctly */
+		l4_set_sender(struct_ptr->tid);
 
-			/* free allocated sleeper task struct */
-			free_sleeper_task(struct_ptr);
+		/* send wake ipc */
+		if ((ret = l4_ipc_return(struct_ptr->retval)) < 0) {
+			printf("%s: IPC return error: %d.\n",
+			       __FUNCTION__, ret);
+			BUG();
 		}
-	}
-	/* If wake list is empty set end = start */
-	if (list_empty(&wake_tasks.head))
-		wake_tasks.end = &wake_tasks.head;
 
+		/* free allocated sleeper task struct */
+		free_sleeper_task(struct_ptr);
+	}
 }
 
 int timer_setup_devices(void)
@@ -251,12 +411,18 @@ int timer_setup_devices(void)
 			BUG();
 		}
 
+		/* Start the clock, the timer is set by its irq handler */
+		timer_stop(global_timer[i].base);
+		timer_init_freerun(timer_secondary_base(global_timer[i].base));
+		timer_start(timer_secondary_base(global_timer[i].base));
+		global_timer[i].stamp =
+			~timer_read(timer_secondary_base(global_timer[i].base));
+
 		/*
 		 * Create new timer irq handler thread.
 		 *
-		 * This will initialize its timer argument, register
-		 * itself as its irq handler, initiate the timer and
-		 * wait on irqs.
+		 * This will register itself as its irq handler,
+		 * set the timer and wait on irqs.
 		 */
 		if ((err = thread_create(timer_irq_handler, &global_timer[i],
 					 TC_SHARE_SPACE,
@@ -265,6 +431,13 @@ int timer_setup_devices(void)
 			       "thread failed.\n");
 			BUG();
 		}
+
+		/* Wait until it handles irqs before taking requests */
+		if ((err = l4_receive(tptr->ids.tid)) < 0) {
+			printf("FATAL: Timer irq handler did not start. "
+			       "err=%d\n", err);
+			BUG();
+		}
 	}
 
 	return 0;
@@ -330,32 +503,29 @@ void *l4_new_virtual(int npages)
 }
 
 /*
- * Got request for sleep for seconds,
- * right now max sleep allowed is 2^32 sec
+ * Got request for sleep for usecs. Sleepers wake up on the
+ * first wheel tick after their time is up.
  */
-void task_sleep(l4id_t tid, unsigned long seconds, int ret)
+void task_sleep(l4id_t tid, u64 usecs, int ret)
 {
+	struct timer *timer = &global_timer[SLEEP_WAKE_TIMER];
 	struct sleeper_task *task = new_sleeper_task(tid, ret);
-	struct link *vector;
-
-	/* can overflow happen here?, timer is in 32bit mode */
-	seconds += global_timer[SLEEP_WAKE_TIMER].count;
-
-	printf("sleep wake timer lock is present at address %lx\n",
-		    ( (unsigned long)&global_timer[SLEEP_WAKE_TIMER].task_list_lock.lock));
 
-	vector = find_bucket_list(seconds);
+	if (usecs > TIMER_SLEEP_MAX_USEC)
+		usecs = TIMER_SLEEP_MAX_USEC;
 
-	printf("Acquiring lock for sleep wake timer\n");
-	l4_mutex_lock(&global_timer[SLEEP_WAKE_TIMER].task_list_lock);
-	printf("got lock for sleep wake timer\n");
+	l4_mutex_lock(&timer->lock);
 
-	list_insert(&task->list, vector);
+	timer_clock_update(timer);
+	task->expires = (u32)USEC_TO_TICKS(timer->clock + usecs);
+	wheel_add(timer, task);
+	timer->pending++;
 
-	printf("Releasing lock for sleep wake timer\n");
-	l4_mutex_unlock(&global_timer[SLEEP_WAKE_TIMER].task_list_lock);
-	printf("released lock for sleep wake timer\n");
+	/* The timer is set for later, bring it forward */
+	if ((int)(task->expires - timer->next) < 0)
+		timer_program(timer);
 
+	l4_mutex_unlock(&timer->lock);
 }
 
 void handle_requests(void)
@@ -391,13 +561,13 @@ void handle_requests(void)
 	 * inside the current container
 	 */
 	switch (tag) {
-	/* Return time in seconds, since the timer was started */
+	/* Return time in seconds and usecs, since the timer was started */
 	case L4_IPC_TAG_TIMER_GETTIME:
-		printf("%s: Got get time request from thread 0x%x "
-			    " at time = 0x%x\n", __CONTAINER_NAME__,
-			    senderid, global_timer[SLEEP_WAKE_TIMER].count);
-
-		write_mr(2, global_timer[SLEEP_WAKE_TIMER].count);
+		l4_mutex_lock(&global_timer[SLEEP_WAKE_TIMER].lock);
+		timer_clock_update(&global_timer[SLEEP_WAKE_TIMER]);
+		write_mr(2, global_timer[SLEEP_WAKE_TIMER].sec);
+		write_mr(3, global_timer[SLEEP_WAKE_TIMER].usec);
+		l4_mutex_unlock(&global_timer[SLEEP_WAKE_TIMER].lock);
 
 		/* Reply */
 		if ((ret = l4_ipc_return(ret)) < 0) {
@@ -406,14 +576,12 @@ void handle_requests(void)
 		}
 		break;
 
+	/* Sleep for seconds, or usecs */
 	case L4_IPC_TAG_TIMER_SLEEP:
-		printf("%s: Got sleep request from thread 0x%x "
-			    "for 0x%x seconds at 0x%x seconds\n",
-			    __CONTAINER_NAME__, senderid, mr[0],
-			    global_timer[SLEEP_WAKE_TIMER].count);
-
+	case L4_IPC_TAG_TIMER_SLEEP_USEC:
 		if (mr[0] > 0) {
-			task_sleep(senderid, mr[0], ret);
+			task_sleep(senderid, tag == L4_IPC_TAG_TIMER_SLEEP ?
+				   (u64)mr[0] * 1000000 : mr[0], ret);
 		}
 		else {
 			if ((ret = l4_ipc_return(ret)) < 0) {
@@ -451,12 +619,12 @@ void main(void)
 	/* initialise timed_out_task list */
 	wake_task_list_init();
 
-	/* Map and initialize timer devices */
-	timer_setup_devices();
-
 	/* Set the tid of ipc handler */
 	tid_ipc_handler = self_tid();
 
+	/* Map and initialize timer devices */
+	timer_setup_devices();
+
 	/* Listen for timer requests */
 	while (1)
 		handle_requests();
@@ -2,10 +2,11 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <libposix.h>
+#include <l4lib/time.h>
 
 int gettimeofday(struct timeval *tv, struct timezone *tz)
 {
-	int ret = l4_time(tv, 0);
+	int ret = l4_gettime(tv);
 
 	/* If error, return positive error code */
 	if (ret < 0) {
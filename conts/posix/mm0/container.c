@@ -7,6 +7,7 @@
 #include <posix/posix_init.h>
 #include <l4lib/init.h>
 #include <l4lib/utcb.h>
+#include <l4lib/lib/thread.h>
 
 /*
  * Application specific utcb allocation
@@ -22,6 +23,9 @@ void __container_init(void)
 	/* Generic L4 initialisation */
 	__l4_init();
 
+	/* Thread library initialisation, for worker threads */
+	__l4_threadlib_init();
+
 	/* Entry to main */
 	main();
 }
@@ -56,6 +56,9 @@ int vfs_init(void)
 	void *rootdev_blocks;
 	struct superblock *root_sb;
 
+	/* Initialise vnode and dentry hashes */
+	vfs_cache_init();
+
 	/* Initialize superblock ids */
 	vfs_fsidx_pool = id_pool_new_init(VFS_FSIDX_SIZE);
 
@@ -12,29 +12,26 @@
 
 /*
  * Given a dentry that has been populated by readdir with children dentries
- * and their vnodes, this itself checks all those children on that level for
- * a match, but it also calls lookup, which recursively checks lower levels.
+ * and their vnodes, this finds the child for the next component in the
+ * dentry hash, and calls its lookup, which recursively checks lower levels.
  */
 struct vnode *lookup_dentry_children(struct dentry *parentdir,
 				     struct pathdata *pdata)
 {
 	struct dentry *childdir;
-	struct vnode *v;
 	const char *component = pathdata_next_component(pdata);
 
-	list_foreach_struct(childdir, &parentdir->children, child)
-		if (IS_ERR(v = childdir->vnode->ops.lookup(childdir->vnode,
-							   pdata, component)))
-			/* Means not found, continue search */
-			if ((int)v == -ENOENT)
-				continue;
-			else	/* A real error */
-				return v;
-		else	/* No error, so found it */
-			return v;
+	/* All children of a read directory are hashed, so a miss is final */
+	if (!(childdir = vfs_dentry_lookup(parentdir, component))) {
+		vfs_dentry_add_negative(parentdir, component);
+		return PTR_ERR(-ENOENT);
+	}
 
-	/* Out of all children dentries, neither was a match */
-	return PTR_ERR(-ENOENT);
+	/* Known not to exist */
+	if (!childdir->vnode)
+		return PTR_ERR(-ENOENT);
+
+	return childdir->vnode->ops.lookup(childdir->vnode, pdata, component);
 }
 
 /* Lookup, recursive, assuming single-mountpoint */
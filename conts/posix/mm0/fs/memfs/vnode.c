@@ -234,11 +234,8 @@ struct vnode *memfs_vnode_mknod(struct vnode *v, const char *dirname,
 		return PTR_ERR(err);
 
 	/* Check there's no existing child with same name */
-	list_foreach_struct(d, &parent->children, child) {
-		/* Does the name exist as a child? */
-		if(d->ops.compare(d, dirname))
-			return PTR_ERR(-EEXIST);
-	}
+	if ((d = vfs_dentry_lookup(parent, dirname)) && d->vnode)
+		return PTR_ERR(-EEXIST);
 
 	/* Allocate a new vnode for the new directory */
 	if (IS_ERR(newv = v->sb->ops->alloc_vnode(v->sb)))
@@ -283,9 +280,9 @@ struct vnode *memfs_vnode_mknod(struct vnode *v, const char *dirname,
 	/* Associate dentry with its parent */
 	list_insert(&newd->child, &parent->children);
 
-	/* Add both vnode and dentry to their flat caches */
-	list_insert(&newd->cache_list, &dentry_cache);
-	list_insert(&newv->cache_list, &vnode_cache);
+	/* Add both vnode and dentry to their caches */
+	vfs_dentry_cache_add(newd);
+	vfs_vnode_cache_add(newv);
 
 	return newv;
 }
@@ -376,8 +373,8 @@ int memfs_vnode_readdir(struct vnode *v)
 		memcpy(newd->name, memfsd[i].name, MEMFS_DNAME_MAX);
 
 		/* Add both vnode and dentry to their caches */
-		list_insert(&newd->cache_list, &dentry_cache);
-		list_insert(&newv->cache_list, &vnode_cache);
+		vfs_dentry_cache_add(newd);
+		vfs_vnode_cache_add(newv);
 	}
 
 	return 0;
@@ -7,6 +7,8 @@
 #include <vfs.h>
 #include <task.h>
 #include <path.h>
+#include <string.h>
+#include <l4/api/errno.h>
 
 LINK_DECLARE(vnode_cache);
 LINK_DECLARE(dentry_cache);
@@ -14,6 +16,190 @@ LINK_DECLARE(dentry_cache);
 struct vfs_mountpoint vfs_root;
 struct id_pool *vfs_fsidx_pool;
 
+/*
+ * Vnode and dentry hashes. The vnode cache list is kept in least
+ * recently used order, most recent first, and so is the list of
+ * negative dentries. Negative dentries are only in the hash and
+ * that list, they are never children of their parent.
+ */
+static struct link vnode_hash[VNODE_HASH_BUCKETS];
+static struct link dentry_hash[DENTRY_HASH_BUCKETS];
+static LINK_DECLARE(dentry_negative);
+static int vfs_nvnodes;
+static int vfs_nnegative;
+
+void vfs_cache_init(void)
+{
+	for (int i = 0; i < VNODE_HASH_BUCKETS; i++)
+		link_init(&vnode_hash[i]);
+	for (int i = 0; i < DENTRY_HASH_BUCKETS; i++)
+		link_init(&dentry_hash[i]);
+}
+
+static inline struct link *vnode_hash_bucket(unsigned long vnum)
+{
+	return &vnode_hash[vnum & (VNODE_HASH_BUCKETS - 1)];
+}
+
+/* FNV-1a hash of the name, mixed with the parent */
+static struct link *dentry_hash_bucket(struct dentry *parent,
+				       const char *name)
+{
+	u32 key = 2166136261U;
+
+	for (; *name; name++) {
+		key ^= (u8)*name;
+		key *= 16777619;
+	}
+	key ^= (unsigned long)parent / sizeof(*parent);
+
+	return &dentry_hash[key & (DENTRY_HASH_BUCKETS - 1)];
+}
+
+void vfs_vnode_get(struct vnode *v)
+{
+	v->refcnt++;
+}
+
+void vfs_vnode_put(struct vnode *v)
+{
+	BUG_ON(--v->refcnt < 0);
+}
+
+/*
+ * Vnodes that no dentry names and no file holds can be read back
+ * from the filesystem at any time. Vnodes are written back as soon
+ * as they change, so these are simply freed.
+ */
+static int vnode_unused(struct vnode *v)
+{
+	return !v->refcnt && list_empty(&v->dentries) &&
+	       !v->dirbuf.buffer && v != vfs_root.pivot;
+}
+
+/* Frees least recently used vnodes until the cache is within limits */
+static void vnode_cache_shrink(void)
+{
+	struct link *l = vnode_cache.prev;
+	struct vnode *v;
+
+	while (vfs_nvnodes >= VNODE_CACHE_MAX && l != &vnode_cache) {
+		v = link_to_struct(l, struct vnode, cache_list);
+		l = l->prev;
+		if (vnode_unused(v))
+			vfs_free_vnode(v);
+	}
+}
+
+/* Adds a vnode to the cache, unless it is there already */
+void vfs_vnode_cache_add(struct vnode *v)
+{
+	if (!list_empty(&v->hash))
+		return;
+
+	/* Done first, so the new vnode is never the one freed */
+	vnode_cache_shrink();
+
+	list_insert(&v->hash, vnode_hash_bucket(v->vnum));
+	list_insert(&v->cache_list, &vnode_cache);
+	vfs_nvnodes++;
+}
+
+void vfs_vnode_cache_remove(struct vnode *v)
+{
+	if (list_empty(&v->hash))
+		return;
+
+	list_remove_init(&v->hash);
+	list_remove_init(&v->cache_list);
+	BUG_ON(--vfs_nvnodes < 0);
+}
+
+static void dentry_negative_free(struct dentry *d)
+{
+	BUG_ON(d->vnode);
+	list_remove(&d->hash);
+	list_remove(&d->cache_list);
+	vfs_free_dentry(d);
+	vfs_nnegative--;
+}
+
+/*
+ * Finds the child of parent with the given name, positive or
+ * negative. Only directories that are read have their children
+ * in the hash, so a miss on those means there is no such name.
+ */
+struct dentry *vfs_dentry_lookup(struct dentry *parent, const char *name)
+{
+	struct dentry *d;
+
+	list_foreach_struct(d, dentry_hash_bucket(parent, name), hash) {
+		if (d->parent != parent || strcmp(d->name, name))
+			continue;
+
+		/* Keep recently missed names longer */
+		if (!d->vnode) {
+			list_remove(&d->cache_list);
+			list_insert(&d->cache_list, &dentry_negative);
+		}
+		return d;
+	}
+
+	return 0;
+}
+
+/*
+ * Records that parent has no child with this name. Failing to do
+ * so only costs a lookup next time, so errors are not returned.
+ */
+struct dentry *vfs_dentry_add_negative(struct dentry *parent,
+				       const char *name)
+{
+	struct dentry *d;
+
+	/* Names that are cut short could match the wrong lookups */
+	if (strlen(name) >= VFS_DNAME_MAX)
+		return 0;
+
+	if (vfs_nnegative >= DENTRY_NEGATIVE_MAX)
+		dentry_negative_free(link_to_struct(dentry_negative.prev,
+						    struct dentry,
+						    cache_list));
+
+	if (!(d = vfs_alloc_dentry()))
+		return 0;
+
+	strcpy(d->name, name);
+	d->ops = generic_dentry_operations;
+	d->parent = parent;
+
+	list_insert(&d->hash, dentry_hash_bucket(parent, name));
+	list_insert(&d->cache_list, &dentry_negative);
+	vfs_nnegative++;
+
+	return d;
+}
+
+/*
+ * Adds a named dentry to the caches, replacing any negative one
+ * for the same name. The root is its own parent, and is not hashed.
+ */
+void vfs_dentry_cache_add(struct dentry *d)
+{
+	struct dentry *neg;
+
+	BUG_ON(!d->vnode);
+	list_insert(&d->cache_list, &dentry_cache);
+
+	if (d->parent == d)
+		return;
+
+	if ((neg = vfs_dentry_lookup(d->parent, d->name)) && !neg->vnode)
+		dentry_negative_free(neg);
+
+	list_insert(&d->hash, dentry_hash_bucket(d->parent, d->name));
+}
+
 /*
  * Vnodes in the vnode cache have 2 keys. One is their dentry names, the other
  * is their vnum. This one checks the vnode cache by the given vnum first.
@@ -25,13 +211,19 @@ struct vnode *vfs_vnode_lookup_byvnum(struct superblock *sb, unsigned long vnum)
 	struct vnode *v;
 	int err;
 
-	/* Check the vnode flat list by vnum */
-	list_foreach_struct(v, &vnode_cache, cache_list)
-		if (v->vnum == vnum)
+	/* Check the vnode hash by vnum */
+	list_foreach_struct(v, vnode_hash_bucket(vnum), hash) {
+		if (v->vnum == vnum) {
+			/* Now the most recently used */
+			list_remove(&v->cache_list);
+			list_insert(&v->cache_list, &vnode_cache);
 			return v;
+		}
+	}
 
 	/* Check the actual filesystem for the vnode */
-	v = vfs_alloc_vnode();
+	if (!(v = vfs_alloc_vnode()))
+		return PTR_ERR(-ENOMEM);
 	v->vnum = vnum;
 
 	/* Note this only checks given superblock */
@@ -40,8 +232,8 @@ struct vnode *vfs_vnode_lookup_byvnum(struct superblock *sb, unsigned long vnum)
 		return PTR_ERR(err);
 	}
 
-	/* Add the vnode back to vnode flat list */
-	list_insert(&v->cache_list, &vnode_cache);
+	/* Add the vnode back to vnode cache */
+	vfs_vnode_cache_add(v);
 
 	return v;
 }
@@ -23,6 +23,8 @@ struct vm_file *do_open2(struct tcb *task, int fd, unsigned long vnum, unsigned
 int flush_file_pages(struct vm_file *f);
 int read_file_pages(struct vm_file *vmfile, unsigned long pfn_start,
 		    unsigned long pfn_end);
+int file_readahead(struct vm_file *vmfile, struct file_readahead *ra,
+		   unsigned long pfn_start, unsigned long pfn_end);
 
 struct vm_file *vfs_file_create(void);
 
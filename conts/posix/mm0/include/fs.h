@@ -89,7 +89,8 @@ struct dentry {
 	struct link children;	/* List of children dentries */
 	struct link vref;		/* For vnode's dirent reference list */
 	struct link cache_list;	/* Dentry cache reference */
-	struct vnode *vnode;		/* The vnode associated with dentry */
+	struct link hash;		/* Dentry hash, by parent and name */
+	struct vnode *vnode;		/* The vnode, 0 if negative dentry */
 	struct dentry_ops ops;
 };
 
@@ -123,6 +124,7 @@ struct vnode {
 	struct file_ops fops;		/* File-related operations on this vnode */
 	struct link dentries;	/* Dirents that refer to this vnode */
 	struct link cache_list;	/* For adding the vnode to vnode cache */
+	struct link hash;		/* Vnode hash, by vnum */
 	struct dirbuf dirbuf;		/* Only directory buffers are kept */
 	u32 mode;			/* Permissions and vnode type */
 	u32 owner;			/* Owner */
@@ -0,0 +1,25 @@
+/*
+ * Page reclaim.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __MM0_RECLAIM_H__
+#define __MM0_RECLAIM_H__
+
+#include <vm_area.h>
+
+/*
+ * Free page watermarks. Reclaim starts when free pages fall
+ * below the low mark, and goes on until the high mark.
+ */
+#define RECLAIM_FREE_LOW		32
+#define RECLAIM_FREE_HIGH		64
+
+void lru_add(struct page *page);
+void lru_del(struct page *page);
+void page_referenced(struct page *page);
+void page_unmap_tasks(struct page *page);
+int reclaim_needed(void);
+int reclaim_pages(void);
+
+#endif /* __MM0_RECLAIM_H__ */
@@ -0,0 +1,54 @@
+/*
+ * In-memory compressed swap store for anonymous pages.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __MM0_SWAP_H__
+#define __MM0_SWAP_H__
+
+#include <l4/lib/list.h>
+#include <vm_area.h>
+
+/* Swap entry buckets, a power of two */
+#define SWAP_HASH_BUCKETS		256
+
+/*
+ * Pages that don't compress to this size or less are kept
+ * whole, taking a page of the store each.
+ */
+#define SWAP_COMPRESS_MAX		(PAGE_SIZE - PAGE_SIZE / 4)
+
+/* A page of compressed data, filled from start to end */
+struct swap_slab {
+	void *paddr;			/* The page holding the data */
+	unsigned int used;		/* Bytes allocated so far */
+	int nentries;			/* Entries with data here */
+};
+
+/* A page of a vm_object that is in the swap store */
+struct swap_entry {
+	struct link hash;		/* Swap hash bucket */
+	struct link list;		/* Owner's list of swapped pages */
+	struct vm_object *owner;	/* The object the page belongs to */
+	unsigned long offset;		/* The page offset in its owner */
+	struct swap_slab *slab;		/* Holds the data, 0 if all zeroes */
+	unsigned int start;		/* Offset of data in slab */
+	unsigned int len;		/* Compressed length, or PAGE_SIZE */
+};
+
+void swap_init(void);
+struct swap_entry *swap_find(struct vm_object *obj, unsigned long offset);
+int swap_out_page(struct page *page);
+int swap_in_page(struct swap_entry *entry, struct page *page);
+void swap_free_entry(struct swap_entry *entry);
+void swap_move_entry(struct swap_entry *entry, struct vm_object *to);
+void swap_release(struct vm_object *obj);
+
+/* Whether an object has the page at offset, in memory or swapped */
+static inline int vm_object_has_page(struct vm_object *obj,
+				     unsigned long offset)
+{
+	return find_page(obj, offset) || swap_find(obj, offset);
+}
+
+#endif /* __MM0_SWAP_H__ */
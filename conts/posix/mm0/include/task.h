@@ -13,6 +13,7 @@
 #include L4LIB_INC_ARCH(types.h)
 #include L4LIB_INC_ARCH(syscalls.h)
 #include <l4lib/utcb.h>
+#include <l4lib/mutex.h>
 #include <lib/addr.h>
 #include <l4/api/kip.h>
 #include <exec.h>
@@ -39,20 +40,37 @@
 
 struct vm_file;
 
+/* Readahead window limits, in pages */
+#define FILE_RA_MIN				4
+#define FILE_RA_MAX				32
+
+/*
+ * Sequential access state of a file reader, either an open
+ * file descriptor or a file-backed vma. All in page offsets.
+ */
+struct file_readahead {
+	unsigned long next;	/* Where a sequential access would start */
+	unsigned long ahead;	/* End of pages already read ahead */
+	unsigned long window;	/* Current readahead window */
+};
+
 struct file_descriptor {
 	unsigned long cursor;
 	struct vm_file *vmfile;
+	struct file_readahead ra;
 };
 
 struct task_fd_head {
 	struct file_descriptor fd[TASK_FILES_MAX];
 	struct id_pool *fdpool;
 	int tcb_refs;
+	struct l4_mutex lock;	/* Held by workers, see mm/worker.c */
 };
 
 struct task_vma_head {
 	struct link list;
 	int tcb_refs;
+	struct l4_mutex lock;	/* Held by workers, see mm/worker.c */
 };
 
 #define TCB_NO_SHARING				0
@@ -84,6 +102,9 @@ struct tcb {
 	/* Task list */
 	struct link list;
 
+	/* Task table hash by tid */
+	struct link tid_hash;
+
 	/* Fields for parent-child relations */
 	struct link child_ref;	/* Child ref in parent's list */
 	struct link children;	/* List of children */
@@ -146,6 +167,10 @@ struct tcb_head {
 	int total;			/* Total threads */
 };
 
+/* Task table buckets, a power of two */
+#define TASK_HASH_BUCKETS		256
+
+void task_hash_init(void);
 struct tcb *find_task(int tid);
 void global_add_task(struct tcb *task);
 void global_remove_task(struct tcb *task);
@@ -15,10 +15,32 @@
 #define VFS_FSIDX_SHIFT		28
 #define VFS_FSIDX_SIZE		16
 
+/*
+ * Vnodes are hashed by vnum, and dentries by their parent and
+ * name. Both are powers of two.
+ */
+#define VNODE_HASH_BUCKETS	256
+#define DENTRY_HASH_BUCKETS	1024
+
+/*
+ * Unused vnodes beyond this many are freed, least recently
+ * used first. Names that are looked up and not found are kept
+ * as negative dentries, up to a number of them.
+ */
+#define VNODE_CACHE_MAX		512
+#define DENTRY_NEGATIVE_MAX	64
+
 extern struct link vnode_cache;
 extern struct link dentry_cache;
 extern struct id_pool *vfs_fsidx_pool;
 
+void vfs_cache_init(void);
+void vfs_vnode_cache_add(struct vnode *v);
+void vfs_vnode_cache_remove(struct vnode *v);
+void vfs_dentry_cache_add(struct dentry *d);
+void vfs_vnode_get(struct vnode *v);
+void vfs_vnode_put(struct vnode *v);
+
 /*
  * This is a temporary origacement for page cache support provided by mm0.
  * Normally mm0 tracks all vnode pages, but this is used to track pages in
@@ -42,10 +64,14 @@ static inline struct dentry *vfs_alloc_dentry(void)
 {
 	struct dentry *d = kzalloc(sizeof(struct dentry));
 
+	if (!d)
+		return 0;
+
 	link_init(&d->child);
 	link_init(&d->children);
 	link_init(&d->vref);
 	link_init(&d->cache_list);
+	link_init(&d->hash);
 
 	return d;
 }
@@ -59,16 +85,21 @@ static inline struct vnode *vfs_alloc_vnode(void)
 {
 	struct vnode *v = kzalloc(sizeof(struct vnode));
 
+	if (!v)
+		return 0;
+
 	link_init(&v->dentries);
 	link_init(&v->cache_list);
+	link_init(&v->hash);
 
 	return v;
 }
 
+/* Only vnodes that no dentry refers to may be freed */
 static inline void vfs_free_vnode(struct vnode *v)
 {
-	BUG(); /* Are the dentries freed ??? */
-	list_remove(&v->cache_list);
+	BUG_ON(!list_empty(&v->dentries));
+	vfs_vnode_cache_remove(v);
 	kfree(v);
 }
 
@@ -95,6 +126,9 @@ struct vnode *generic_vnode_lookup(struct vnode *thisnode, struct pathdata *p,
 				   const char *component);
 struct vnode *vfs_vnode_lookup_bypath(struct pathdata *p);
 struct vnode *vfs_vnode_lookup_byvnum(struct superblock *sb, unsigned long vnum);
+struct dentry *vfs_dentry_lookup(struct dentry *parent, const char *name);
+struct dentry *vfs_dentry_add_negative(struct dentry *parent,
+				       const char *name);
 
 int vfs_init(void);
 
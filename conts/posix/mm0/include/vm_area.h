@@ -52,6 +52,13 @@
 /* Set when the page is dirty in cache but not written to disk */
 #define VM_DIRTY			(1 << 9)
 
+/* Page reclaim state, see mm/reclaim.c */
+#define VM_ACTIVE			(1 << 12) /* On the active list */
+#define VM_REFERENCED			(1 << 13) /* Used since last scan */
+
+/* Mapped writeable since last written back, see mm/writeback.c */
+#define VM_WRITEMAPPED			(1 << 14)
+
 /* Defines the type of file. A device file? Regular file? One used at boot? */
 enum VM_FILE_TYPE {
 	VM_FILE_DEVZERO = 1,
@@ -67,10 +74,14 @@ struct page {
 	int refcnt;		/* Refcount */
 	struct spinlock lock;	/* Page lock. */
 	struct link list;  /* For list of a vm_object's in-memory pages */
+	struct link hash;	/* For page cache hash bucket */
+	struct link lru;	/* For active or inactive list */
+	struct link dirty;	/* For its file's list of dirty pages */
 	struct vm_object *owner;/* The vm_object the page belongs to */
 	unsigned long virtual;	/* If refs >1, first mapper's virtual address */
 	unsigned int flags;	/* Flags associated with the page. */
 	unsigned long offset;	/* The offset page resides in its owner */
+	unsigned long dirtied;	/* Writeback clock when it became dirty */
 };
 extern struct page *page_array;
 
@@ -130,6 +141,8 @@ struct vm_object {
 	struct link list;	    /* List of all vm objects in memory */
 	struct vm_pager *pager;	    /* The pager for this object */
 	struct link page_cache;/* List of in-memory pages */
+	int nswapped;		    /* Number of pages in swap */
+	struct link swap_list;	    /* List of swapped pages */
 };
 
 /* In memory representation of either a vfs file, a device. */
@@ -139,6 +152,8 @@ struct vm_file {
 	unsigned int type;
 	unsigned long length;
 	struct vm_object vm_obj;
+	struct link dirty_pages;	/* Dirty pages, oldest first */
+	struct link dirty_list;		/* For list of files to write back */
 	void (*destroy_priv_data)(struct vm_file *f);
 	struct vnode *vnode;
 	void *private_file_data;	/* FIXME: To be removed and placed into vnode!!! */
@@ -171,6 +186,20 @@ static inline struct vm_object *vm_unlink_object(struct vm_obj_link *link)
 
 #define vm_object_to_file(obj) container_of(obj, struct vm_file, vm_obj)
 
+/* Offsets of a vma resolved to pages of its object chain, a power of two */
+#define VMA_PCACHE_SIZE				16
+
+struct vma_pcache_entry {
+	unsigned long offset;		/* File offset in pfns */
+	struct page *page;		/* First page in chain, 0 if none */
+};
+
+/* Entries are valid while their generation matches, see mm/fault.c */
+struct vma_page_cache {
+	unsigned long gen;
+	struct vma_pcache_entry entry[VMA_PCACHE_SIZE];
+};
+
 /*
  * Describes a virtually contiguous chunk of memory region in a task. It covers
  * a unique virtual address area within its task, meaning that it does not
@@ -189,6 +218,8 @@ struct vm_area {
 	unsigned long pfn_end;		/* Region end virtual pfn, exclusive */
 	unsigned long flags;		/* Protection flags. */
 	unsigned long file_offset;	/* File offset in pfns */
+	struct file_readahead ra;	/* Fault readahead state */
+	struct vma_page_cache pcache;	/* Recently resolved pages */
 };
 
 /*
@@ -208,9 +239,22 @@ static inline struct vm_area *find_vma(unsigned long addr,
 	return 0;
 }
 
+/*
+ * Page cache pages are hashed by their owner object and offset
+ * for lookup, in addition to being kept in offset order on their
+ * owner's list for in-order traversal.
+ */
+#define PAGE_CACHE_HASH_BUCKETS		1024
+
+void page_cache_hash_init(void);
+struct link *page_cache_bucket(struct vm_object *vmo, unsigned long offset);
+
 /* Adds a page to its vm_objects's page cache in order of offset. */
 int insert_page_olist(struct page *this, struct vm_object *vm_obj);
 
+/* Removes a page from its vm_object's page cache */
+void remove_page_olist(struct page *this);
+
 /* Find a page in page cache via page offset */
 struct page *find_page(struct vm_object *obj, unsigned long pfn);
 
@@ -250,9 +294,20 @@ struct page *find_page(struct vm_object *vmo, unsigned long page_offset);
 void *pager_map_page(struct vm_file *f, unsigned long page_offset);
 void pager_unmap_page(void *vaddr);
 
-/* Changes all shadows and their ptes to read-only */
+unsigned long vma_page_to_virtual(struct vm_area *vma, struct page *page);
+
+/* Forgets pages resolved by vmas, as they went out of memory */
+void vma_pcache_invalidate(void);
+
+/* Changes all shadows to read-only */
 int vm_freeze_shadows(struct tcb *task);
 
+/* Gives write access back to forked pages that are not copied on write */
+int vm_remap_shared(struct tcb *parent, struct tcb *child);
+
+/* Shortens the shadow chains of a task's vmas */
+int task_compact_shadows(struct tcb *task);
+
 int vm_compare_prot_flags(unsigned int current, unsigned int needed);
 int task_insert_vma(struct vm_area *vma, struct link *vma_list);
 
@@ -0,0 +1,57 @@
+/*
+ * Worker threads that serve requests in parallel
+ * with the main thread.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __MM0_WORKER_H__
+#define __MM0_WORKER_H__
+
+#include <l4/lib/list.h>
+#include <l4lib/types.h>
+#include <l4lib/mutex.h>
+#include <l4lib/lib/thread.h>
+#include INC_GLUE(message.h)
+
+/*
+ * Number of worker threads. The thread library has
+ * room for THREADS_TOTAL, the main thread included.
+ */
+#define MM0_WORKERS			4
+
+/* Requests that may be outstanding on workers at once */
+#define MM0_JOBS_MAX			32
+
+/* A request handed to a worker */
+struct mm0_job {
+	struct link list;		/* Free or pending list */
+	l4id_t sender;			/* Thread to reply to */
+	u32 tag;			/* Ipc tag of request */
+	u32 mr[MR_UNUSED_TOTAL];	/* Request arguments */
+	int ret;			/* Reply to sender */
+	int retried;			/* Ran out of memory once */
+};
+
+struct mm0_worker {
+	struct l4_thread *thread;
+	struct mm0_job *job;		/* Request in progress, 0 if idle */
+};
+
+/* Serialises workers on all vm objects, files and the page cache */
+extern struct l4_mutex vm_lock;
+
+/* The main thread, whose tid is the pager's */
+extern l4id_t mm0_main_tid;
+
+void mm0_workers_init(void);
+int mm0_worker_request(u32 tag);
+void mm0_dispatch(l4id_t sender, u32 tag, u32 *mr);
+int mm0_worker_done(l4id_t sender);
+void mm0_workers_drain(void);
+void mm0_workers_resume(void);
+void mm0_workers_reclaim(void);
+
+/* Serves a request on a worker, defined by the request loop */
+int handle_worker_request(l4id_t senderid, u32 tag, u32 *mr);
+
+#endif /* __MM0_WORKER_H__ */
@@ -0,0 +1,37 @@
+/*
+ * Background writeback of dirty file pages.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __MM0_WRITEBACK_H__
+#define __MM0_WRITEBACK_H__
+
+#include <l4lib/types.h>
+#include <vm_area.h>
+
+/*
+ * Default thresholds. Pages dirty for longer than the age are
+ * written back, checking every interval. If more than ratio
+ * percent of memory is dirty, pages are written back regardless
+ * of their age.
+ */
+#define WRITEBACK_AGE_MS		3000
+#define WRITEBACK_INTERVAL_MS		500
+#define WRITEBACK_RATIO			10
+
+struct writeback_tunables {
+	unsigned long age_ms;
+	unsigned long interval_ms;
+	unsigned int ratio;
+};
+
+/* May be changed at any time, they take effect on the next pass */
+extern struct writeback_tunables writeback_tunables;
+
+void page_set_dirty(struct page *page);
+void page_clear_dirty(struct page *page);
+void writeback_init(void);
+void writeback_poll(void);
+int writeback_done(l4id_t sender);
+
+#endif /* __MM0_WRITEBACK_H__ */
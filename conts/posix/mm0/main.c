@@ -24,6 +24,9 @@
 #include <test.h>
 #include <capability.h>
 #include <globals.h>
+#include <worker.h>
+#include <reclaim.h>
+#include <writeback.h>
 
 /* Receives all registers and origies back */
 int ipc_test_full_sync(l4id_t senderid)
@@ -40,34 +43,67 @@ int ipc_test_full_sync(l4id_t senderid)
 	return 0;
 }
 
-void handle_requests(void)
+/*
+ * Serves a request handed to a worker. These run in parallel
+ * with requests of other tasks, so they take the locks of what
+ * they use, in the order given in mm/worker.c.
+ */
+int handle_worker_request(l4id_t senderid, u32 tag, u32 *mr)
 {
-	/* Generic ipc data */
-	u32 mr[MR_UNUSED_TOTAL];
-	l4id_t senderid;
 	struct tcb *sender;
-	u32 tag;
 	int ret;
 
-	// printf("%s: Initiating ipc.\n", __TASKNAME__);
-	if ((ret = l4_receive(L4_ANYTHREAD)) < 0) {
-		printf("%s: %s: IPC Error: %d. Quitting...\n", __TASKNAME__,
-		       __FUNCTION__, ret);
-		BUG();
+	/*
+	 * Tasks only come and go by requests of the
+	 * main thread, which run while workers are idle.
+	 */
+	if (!(sender = find_task(senderid)))
+		return -ESRCH;
+
+	l4_mutex_lock(&sender->vm_area_head->lock);
+	if (tag != L4_IPC_TAG_PFAULT)
+		l4_mutex_lock(&sender->files->lock);
+	l4_mutex_lock(&vm_lock);
+
+	switch (tag) {
+	case L4_IPC_TAG_PFAULT: {
+		struct page *p;
+
+		/* Handle page fault. */
+		if (IS_ERR(p = page_fault_handler(sender, (fault_kdata_t *)&mr[0])))
+			ret = (int)p;
+		else
+			ret = 0;
+		break;
 	}
+	case L4_IPC_TAG_READ:
+		ret = sys_read(sender, (int)mr[0], (void *)mr[1], (int)mr[2]);
+		break;
 
-	/* Syslib conventional ipc data which uses first few mrs. */
-	tag = l4_get_tag();
-	senderid = l4_get_sender();
+	case L4_IPC_TAG_WRITE:
+		ret = sys_write(sender, (int)mr[0], (void *)mr[1], (int)mr[2]);
+		break;
 
-	if (!(sender = find_task(senderid))) {
-		l4_ipc_return(-ESRCH);
-		return;
+	case L4_IPC_TAG_LSEEK:
+		ret = sys_lseek(sender, (int)mr[0], (off_t)mr[1], (int)mr[2]);
+		break;
+
+	default:
+		BUG();
 	}
 
-	/* Read mrs not used by syslib */
-	for (int i = 0; i < MR_UNUSED_TOTAL; i++)
-		mr[i] = read_mr(MR_UNUSED_START + i);
+	l4_mutex_unlock(&vm_lock);
+	if (tag != L4_IPC_TAG_PFAULT)
+		l4_mutex_unlock(&sender->files->lock);
+	l4_mutex_unlock(&sender->vm_area_head->lock);
+
+	return ret;
+}
+
+/* Serves a request on the main thread, with workers idle */
+static void handle_request(struct tcb *sender, l4id_t senderid, u32 tag, u32 *mr)
+{
+	int ret;
 
 	switch(tag) {
 	case L4_IPC_TAG_SYNC_FULL:
@@ -84,16 +120,6 @@ void handle_requests(void)
 		// printf("Undefined instruction fault caught.\n");
 		ret = 0;
 		break;
-	case L4_IPC_TAG_PFAULT: {
-		struct page *p;
-
-		/* Handle page fault. */
-		if (IS_ERR(p = page_fault_handler(sender, (fault_kdata_t *)&mr[0])))
-			ret = (int)p;
-		else
-			ret = 0;
-		break;
-	}
 /*
 	case L4_REQUEST_CAPABILITY: {
 		ret = sys_request_cap(sender, (struct capability *)mr[0]);
@@ -114,14 +140,6 @@ void handle_requests(void)
 		ret = sys_shmdt(sender, (void *)mr[0]);
 		break;
 
-	case L4_IPC_TAG_READ:
-		ret = sys_read(sender, (int)mr[0], (void *)mr[1], (int)mr[2]);
-		break;
-
-	case L4_IPC_TAG_WRITE:
-		ret = sys_write(sender, (int)mr[0], (void *)mr[1], (int)mr[2]);
-		break;
-
 	case L4_IPC_TAG_CLOSE:
 		ret = sys_close(sender, (int)mr[0]);
 		break;
@@ -130,10 +148,6 @@ void handle_requests(void)
 		ret = sys_fsync(sender, (int)mr[0]);
 		break;
 
-	case L4_IPC_TAG_LSEEK:
-		ret = sys_lseek(sender, (int)mr[0], (off_t)mr[1], (int)mr[2]);
-		break;
-
 	case L4_IPC_TAG_MMAP: {
 		struct sys_mmap_args *args = (struct sys_mmap_args *)mr[0];
 		ret = (int)sys_mmap(sender, args);
@@ -209,16 +223,85 @@ void handle_requests(void)
 	}
 }
 
+void handle_requests(void)
+{
+	/* Generic ipc data */
+	u32 mr[MR_UNUSED_TOTAL];
+	l4id_t senderid;
+	struct tcb *sender;
+	u32 tag;
+	int ret;
+
+	// printf("%s: Initiating ipc.\n", __TASKNAME__);
+	if ((ret = l4_receive(L4_ANYTHREAD)) < 0) {
+		printf("%s: %s: IPC Error: %d. Quitting...\n", __TASKNAME__,
+		       __FUNCTION__, ret);
+		BUG();
+	}
+
+	/* Syslib conventional ipc data which uses first few mrs. */
+	tag = l4_get_tag();
+	senderid = l4_get_sender();
+
+	/* A worker is done, its sender is replied */
+	if (mm0_worker_done(senderid))
+		return;
+
+	/* The writeback thread is done with a pass */
+	if (writeback_done(senderid))
+		return;
+
+	if (!(sender = find_task(senderid))) {
+		l4_ipc_return(-ESRCH);
+		return;
+	}
+
+	/* Read mrs not used by syslib */
+	for (int i = 0; i < MR_UNUSED_TOTAL; i++)
+		mr[i] = read_mr(MR_UNUSED_START + i);
+
+	if (mm0_worker_request(tag)) {
+		mm0_dispatch(senderid, tag, mr);
+		return;
+	}
+
+	/*
+	 * Wait for workers to go idle, reclaiming pages meanwhile
+	 * if short of them. Replying for workers overwrites our ipc
+	 * registers, so keep them.
+	 */
+	l4_save_ipcregs();
+	if (reclaim_needed())
+		mm0_workers_reclaim();
+	else
+		mm0_workers_drain();
+	l4_restore_ipcregs();
+
+	l4_mutex_lock(&vm_lock);
+	handle_request(sender, senderid, tag, mr);
+	l4_mutex_unlock(&vm_lock);
+
+	/* Start requests that have arrived for workers meanwhile */
+	mm0_workers_resume();
+}
+
 void main(void)
 {
 
 	printf("\n%s: Started with thread id %x\n", __TASKNAME__, __raw_self_tid());
 
+	/* Initialization runs the code that workers drop vm_lock in */
+	l4_mutex_lock(&vm_lock);
 	init();
+	l4_mutex_unlock(&vm_lock);
+
+	mm0_workers_init();
+	writeback_init();
 
 	printf("%s: Memory/Process manager initialized. Listening requests.\n", __TASKNAME__);
 	while (1) {
 		handle_requests();
+		writeback_poll();
 	}
 }
 
@@ -23,18 +23,29 @@ int sys_fork(struct tcb *parent)
 	struct exregs_data exregs;
 	struct task_ids ids;
 
+	/*
+	 * Collapse what we can of the shadow chains first,
+	 * as the child starts with the same chains
+	 */
+	task_compact_shadows(parent);
+
 	/* Make all shadows in this task read-only */
 	vm_freeze_shadows(parent);
 
 	/*
 	 * Create a new L4 thread with parent's page tables
-	 * kernel stack and kernel-side tcb copied
+	 * kernel stack and kernel-side tcb copied. Writable
+	 * pages are write-protected in both as they're copied.
 	 */
 	if (IS_ERR(child = task_create(parent, &ids,
 			    	       TCB_NO_SHARING,
-				       TC_COPY_SPACE)))
+				       TC_COPY_SPACE | TC_COPY_COW)))
 		return (int)child;
 
+	/* Shared pages and the parent's utcbs stay writable */
+	if ((err = vm_remap_shared(parent, child)) < 0)
+		BUG();
+
 	/* Set child's fork return value to 0 */
 	memset(&exregs, 0, sizeof(exregs));
 	exregs_set_mr(&exregs, MR_RETURN, 0);
@@ -35,6 +35,7 @@ struct page *memdev_page_in(struct vm_object *vm_obj,
 	/* Otherwise allocate one of our own for that offset and return it */
 	page = kzalloc(sizeof(struct page));
 	link_init(&page->list);
+	link_init(&page->hash);
 	spin_lock_init(&page->lock);
 	page->offset = pfn_offset;
 	page->owner = vm_obj;
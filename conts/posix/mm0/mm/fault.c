@@ -14,6 +14,10 @@
 #include <shm.h>
 #include <file.h>
 #include <test.h>
+#include <worker.h>
+#include <swap.h>
+#include <reclaim.h>
+#include <writeback.h>
 
 #include L4LIB_INC_ARCH(syscalls.h)
 #include L4LIB_INC_ARCH(syslib.h)
@@ -67,11 +71,107 @@ struct vm_obj_link *vma_next_link(struct link *link,
 		return link_to_struct(link->next, struct vm_obj_link, list);
 }
 
+/*
+ * Per-vma cache of pages resolved through the object chain, so that
+ * repeated faults on an offset skip the walk down a chain that grows
+ * with every fork generation.
+ *
+ * Only private vmas use it. Their writable shadow is not shared with
+ * other vmas, so a page comes in front of a cached one only by a
+ * copy-on-write of this vma, which updates the entry. Otherwise pages
+ * of a chain are only moved or freed after a link is dropped from an
+ * object, which starts a new generation and so empties all caches.
+ */
+static unsigned long vm_chain_gen = 1;
+
+static struct vma_pcache_entry *vma_pcache_slot(struct vm_area *vma,
+						unsigned long offset)
+{
+	struct vma_page_cache *pcache = &vma->pcache;
+
+	/* Forget pages resolved in an older generation */
+	if (pcache->gen != vm_chain_gen) {
+		memset(pcache->entry, 0, sizeof(pcache->entry));
+		pcache->gen = vm_chain_gen;
+	}
+
+	return &pcache->entry[offset & (VMA_PCACHE_SIZE - 1)];
+}
+
+static struct page *vma_pcache_find(struct vm_area *vma,
+				    unsigned long offset)
+{
+	struct vma_pcache_entry *entry;
+
+	if (vma->flags & VMA_SHARED)
+		return 0;
+
+	entry = vma_pcache_slot(vma, offset);
+	if (entry->page && entry->offset == offset)
+		return entry->page;
+
+	return 0;
+}
+
+void vma_pcache_invalidate(void)
+{
+	vm_chain_gen++;
+}
+
+/*
+ * Caches a resolved page. Gen is the generation when the walk
+ * that found it started, as the pager may have let other workers
+ * run meanwhile.
+ */
+static void vma_pcache_add(struct vm_area *vma, unsigned long offset,
+			   struct page *page, unsigned long gen)
+{
+	struct vma_pcache_entry *entry;
+
+	if ((vma->flags & VMA_SHARED) || gen != vm_chain_gen)
+		return;
+
+	entry = vma_pcache_slot(vma, offset);
+	entry->offset = offset;
+	entry->page = page;
+}
+
+/*
+ * Searches the objects of a vma for a page, starting from the given
+ * link. The first object that has it supersedes the ones below. Fails
+ * only if there is no memory to bring the page back in.
+ */
+static struct page *vma_chain_page_in(struct vm_area *vma,
+				      struct vm_obj_link *vmo_link,
+				      unsigned long file_offset)
+{
+	struct page *page;
+
+	while (IS_ERR(page = vmo_link->obj->pager->ops.page_in(vmo_link->obj,
+							       file_offset))) {
+		if ((int)page == -ENOMEM)
+			return page;
+		if (!(vmo_link = vma_next_link(&vmo_link->list,
+					       &vma->vm_obj_list))) {
+			printf("%s:%s: Traversed all shadows and the original "
+			       "file's vm_object, but could not find the "
+			       "faulty page in this vma.\n",__TASKNAME__,
+			       __FUNCTION__);
+			BUG();
+		}
+	}
+
+	return page;
+}
+
 /* Unlinks orig_link from its vma and deletes it but keeps the object. */
 struct vm_object *vma_drop_link(struct vm_obj_link *link)
 {
 	struct vm_object *dropped;
 
+	/* Pages of the chain may move or go away from here on */
+	vm_chain_gen++;
+
 	/* Remove object link from vma's list */
 	list_remove(&link->list);
 
@@ -85,20 +185,18 @@ struct vm_object *vma_drop_link(struct vm_obj_link *link)
 }
 
 /*
- * Checks if page cache pages of lesser is a subset of those of copier.
- *
- * FIXME:
- * Note this just checks the page cache, so if any objects have pages
- * swapped to disk, this function won't work, which is a logic error.
- * This should really count the swapped ones as well.
+ * Checks if pages of lesser is a subset of those of copier. Pages
+ * in swap count as well as those in the page cache.
  */
 int vm_object_is_subset(struct vm_object *shadow,
 			struct vm_object *original)
 {
-	struct page *pc, *pl;
+	struct swap_entry *sl;
+	struct page *pl;
 
 	/* Copier must have equal or more pages to overlap lesser */
-	if (shadow->npages < original->npages)
+	if (shadow->npages + shadow->nswapped <
+	    original->npages + original->nswapped)
 		return 0;
 
 	/*
@@ -106,7 +204,10 @@ int vm_object_is_subset(struct vm_object *shadow,
 	 * must be in copier for overlap.
 	 */
 	list_foreach_struct(pl, &original->page_cache, list)
-		if (!(pc = find_page(shadow, pl->offset)))
+		if (!vm_object_has_page(shadow, pl->offset))
+			return 0;
+	list_foreach_struct(sl, &original->swap_list, list)
+		if (!vm_object_has_page(shadow, sl->offset))
 			return 0;
 	/*
 	 * For all pages of lesser vmo, there seems to be a page
@@ -118,7 +219,8 @@ int vm_object_is_subset(struct vm_object *shadow,
 static inline int vm_object_is_droppable(struct vm_object *shadow,
 					 struct vm_object *original)
 {
-	if (shadow->npages == original->npages &&
+	if (shadow->npages + shadow->nswapped ==
+	    original->npages + original->nswapped &&
 	    (original->flags & VM_OBJ_SHADOW))
 		return 1;
 	else
@@ -154,7 +256,8 @@ int vma_merge_object(struct vm_object *redundant)
 	/* The redundant shadow object */
 	struct vm_object *front; /* Shadow in front of redundant */
 	struct vm_obj_link *last_link;
-	struct page *p1, *p2, *n;
+	struct swap_entry *s1, *sn;
+	struct page *p1, *n;
 
 	/* Check link and shadow count is really 1 */
 	BUG_ON(redundant->nlinks != 1);
@@ -167,8 +270,8 @@ int vma_merge_object(struct vm_object *redundant)
 	/* Move all non-intersecting pages to front shadow. */
 	list_foreach_removable_struct(p1, n, &redundant->page_cache, list) {
 		/* Page doesn't exist in front, move it there */
-		if (!(p2 = find_page(front, p1->offset))) {
-			list_remove_init(&p1->list);
+		if (!vm_object_has_page(front, p1->offset)) {
+			remove_page_olist(p1);
 			spin_lock(&p1->lock);
 			p1->owner = front;
 			spin_unlock(&p1->lock);
@@ -177,6 +280,11 @@ int vma_merge_object(struct vm_object *redundant)
 		}
 	}
 
+	/* Likewise for pages in swap */
+	list_foreach_removable_struct(s1, sn, &redundant->swap_list, list)
+		if (!vm_object_has_page(front, s1->offset))
+			swap_move_entry(s1, front);
+
 	/* Sort out shadow relationships after the merge: */
 
 	/* Front won't be a shadow of the redundant shadow anymore */
@@ -246,12 +354,15 @@ struct vm_obj_link *vma_create_shadow(void)
 /* Allocates a new page, copies the original onto it and returns. */
 struct page *copy_to_new_page(struct page *orig)
 {
-	void *paddr = alloc_page(1);
+	void *paddr;
 
-	BUG_ON(!paddr);
+	if (!(paddr = alloc_page(1)))
+		return PTR_ERR(-ENOMEM);
 
-	/* Copy the page into new page */
+	/* Copy the page into new page, letting other workers run */
+	l4_mutex_unlock(&vm_lock);
 	memcpy(phys_to_virt(paddr), page_to_virt(orig), PAGE_SIZE);
+	l4_mutex_lock(&vm_lock);
 
 	return phys_to_page(paddr);
 }
@@ -469,6 +580,66 @@ int vma_drop_merge_delete_all(struct vm_area *vma)
 	return 0;
 }
 
+/*
+ * Shortens the shadow chain of a vma, so that faults don't walk
+ * through more objects as fork generations go by. Shadows are
+ * otherwise only collapsed as links are dropped, and then only
+ * the one object the drop leaves redundant.
+ *
+ * Shadows that only this vma sees through are merged into the
+ * shadow in front of them, and shadows that the writable shadow
+ * fully covers are dropped.
+ *
+ * This may merge objects of other tasks' chains, so it is only
+ * called while no workers run.
+ */
+static int vma_compact_shadows(struct vm_area *vma)
+{
+	struct vm_obj_link *top, *vmo_link, *next;
+	struct vm_object *obj;
+
+	/* Shared vmas don't have shadows */
+	if (vma->flags & VMA_SHARED)
+		return 0;
+
+	BUG_ON(list_empty(&vma->vm_obj_list));
+	top = link_to_struct(vma->vm_obj_list.next,
+			     struct vm_obj_link, list);
+
+	/* Merge redundant shadows under the first object */
+	vmo_link = vma_next_link(&top->list, &vma->vm_obj_list);
+	while (vmo_link) {
+		next = vma_next_link(&vmo_link->list, &vma->vm_obj_list);
+		obj = vmo_link->obj;
+		if ((obj->flags & VM_OBJ_SHADOW) &&
+		    obj->nlinks == 1 && obj->shadows == 1)
+			vma_merge_object(obj);
+		vmo_link = next;
+	}
+
+	/* Drop the shadows that the writable shadow hides */
+	if (!((top->obj->flags & VM_OBJ_SHADOW) &&
+	      (top->obj->flags & VM_WRITE)))
+		return 0;
+
+	while ((vmo_link = vma_next_link(&top->list, &vma->vm_obj_list)) &&
+	       (vmo_link->obj->flags & VM_OBJ_SHADOW) &&
+	       vm_object_is_subset(top->obj, vmo_link->obj))
+		vma_drop_merge_delete(vma, vmo_link);
+
+	return 0;
+}
+
+int task_compact_shadows(struct tcb *task)
+{
+	struct vm_area *vma;
+
+	list_foreach_struct(vma, &task->vm_area_head->list, list)
+		vma_compact_shadows(vma);
+
+	return 0;
+}
+
 /* TODO:
  * - Why not allocate a swap descriptor in vma_create_shadow() rather than
  *   a bare vm_object? It will be needed.
@@ -552,7 +723,7 @@ struct page *copy_on_write(struct fault_data *fault)
 		 */
 		page = shadow_link->obj->pager->ops.page_in(shadow_link->obj,
 							    file_offset);
-		if (!IS_ERR(page))
+		if (!IS_ERR(page) || (int)page == -ENOMEM)
 			return page;
 
 		/*
@@ -564,24 +735,33 @@ struct page *copy_on_write(struct fault_data *fault)
 		BUG_ON(vmo_link->obj->flags & VM_WRITE);
 	}
 
-	/* Traverse the list of read-only vm objects and search for the page */
-	while (IS_ERR(page = vmo_link->obj->pager->ops.page_in(vmo_link->obj,
-							       file_offset))) {
-		if (!(vmo_link = vma_next_link(&vmo_link->list,
-					       &vma->vm_obj_list))) {
-			printf("%s:%s: Traversed all shadows and the original "
-			       "file's vm_object, but could not find the "
-			       "faulty page in this vma.\n",__TASKNAME__,
-			       __FUNCTION__);
-			BUG();
-		}
-	}
+	/*
+	 * Traverse the list of read-only vm objects and search for the
+	 * page, unless it's been resolved before. The writable shadow
+	 * doesn't have it, so a cached page is on a read-only object.
+	 */
+	if (!(page = vma_pcache_find(vma, file_offset)))
+		if (IS_ERR(page = vma_chain_page_in(vma, vmo_link,
+						    file_offset)))
+			return page;
 
 	/*
 	 * Copy the page. This traverse and copy is like a page-in operation
 	 * of a pager, except that the page is moving along vm_objects.
 	 */
-	new_page = copy_to_new_page(page);
+	if (IS_ERR(new_page = copy_to_new_page(page)))
+		return new_page;
+
+	/*
+	 * The walk and the copy let other workers run. If one of them
+	 * dropped a link meanwhile, its collapse may have merged the page
+	 * of an object below into the shadow, which then supersedes ours.
+	 */
+	if (vm_object_has_page(shadow_link->obj, file_offset)) {
+		free_page((void *)page_to_phys(new_page));
+		return shadow_link->obj->pager->ops.page_in(shadow_link->obj,
+							    file_offset);
+	}
 
 	/* Update page details */
 	spin_lock(&new_page->lock);
@@ -596,6 +776,10 @@ struct page *copy_on_write(struct fault_data *fault)
 	insert_page_olist(new_page, new_page->owner);
 	new_page->owner->npages++;
 
+	/* Anonymous pages may be swapped, those of shm files may not */
+	if (new_page->owner->flags & VM_OBJ_SHADOW)
+		lru_add(new_page);
+
 	mm0_test_global_vm_integrity();
 
 	/* Shared faults don't have shadows so we don't look for collapses */
@@ -616,6 +800,9 @@ struct page *copy_on_write(struct fault_data *fault)
 			vma_drop_merge_delete(vma, vmo_link);
 	}
 
+	/* The copy now supersedes any page resolved before */
+	vma_pcache_add(vma, file_offset, new_page, vm_chain_gen);
+
 	return new_page;
 }
 
@@ -635,7 +822,8 @@ struct page *copy_on_write(struct fault_data *fault)
  * of that file. All subsequent accesses by other processes
  * do so as well.
  *
- * FIXME: Add VM_DIRTY bit for every page that has write-faulted.
+ * File pages that are write-faulted are marked dirty, and are
+ * written back in the background, see mm/writeback.c.
  */
 
 /* Handle read faults */
@@ -643,11 +831,16 @@ struct page *page_read_fault(struct fault_data *fault)
 {
 	struct vm_area *vma = fault->vma;
 	struct vm_obj_link *vmo_link;
-	unsigned long file_offset;
+	unsigned long file_offset, gen;
 	struct page *page = 0;
 
 	file_offset = fault_to_file_offset(fault);
 
+	/* Resolved before? */
+	if ((page = vma_pcache_find(vma, file_offset)))
+		return page;
+	gen = vm_chain_gen;
+
 	/* Get the first object, either original file or a shadow */
 	if (!(vmo_link = vma_next_link(&vma->vm_obj_list, &vma->vm_obj_list))) {
 		printf("%s:%s: No vm object in vma!\n",
@@ -656,19 +849,12 @@ struct page *page_read_fault(struct fault_data *fault)
 	}
 
 	/* Traverse the list of read-only vm objects and search for the page */
-	while (IS_ERR(page = vmo_link->obj->pager->ops.page_in(vmo_link->obj,
-							       file_offset))) {
-		if (!(vmo_link = vma_next_link(&vmo_link->list,
-					       &vma->vm_obj_list))) {
-			printf("%s:%s: Traversed all shadows and the original "
-			       "file's vm_object, but could not find the "
-			       "faulty page in this vma.\n",__TASKNAME__,
-			       __FUNCTION__);
-			BUG();
-		}
-	}
+	if (IS_ERR(page = vma_chain_page_in(vma, vmo_link, file_offset)))
+		return page;
 	BUG_ON(!page);
 
+	vma_pcache_add(vma, file_offset, page, gen);
+
 	return page;
 }
 
@@ -682,7 +868,8 @@ struct page *page_write_fault(struct fault_data *fault)
 
 	/* Copy-on-write. All private vmas are always COW */
 	if (vma_flags & VMA_PRIVATE) {
-		BUG_ON(IS_ERR(page = copy_on_write(fault)));
+		if (IS_ERR(page = copy_on_write(fault)))
+			return page;
 
 	/*
 	 * This handles shared pages that are both anon and non-anon.
@@ -704,7 +891,8 @@ struct page *page_write_fault(struct fault_data *fault)
 			 * page, so its a bug.
 			 */
 			if (vma_flags & VMA_ANONYMOUS) {
-				BUG_ON(IS_ERR(page = copy_on_write(fault)));
+				return copy_on_write(fault);
+			} else if ((int)page == -ENOMEM) {
 				return page;
 			} else {
 				printf("%s: Could not obtain faulty "
@@ -718,33 +906,94 @@ struct page *page_write_fault(struct fault_data *fault)
 		 * Page and object are now dirty. Currently it's
 		 * only relevant for file-backed shared objects.
 		 */
-		page->flags |= VM_DIRTY;
-		page->owner->flags |= VM_DIRTY;
+		page_set_dirty(page);
 	} else
 		BUG();
 
 	return page;
 }
 
+/*
+ * Cluster fault: Reads ahead of a first read or exec fault on a
+ * file mapping, and maps the pages read ahead together with the
+ * faulty one. A task running through a file mapping, e.g. the
+ * text of a newly exec'ed binary, then faults once per window
+ * rather than once per page.
+ *
+ * Pages are only mapped while the file is the first object of a
+ * private vma, where file pages are never mapped writeable. Those
+ * of shared vmas are just read into the cache.
+ */
+static void vma_fault_ahead(struct fault_data *fault, unsigned int map_flags)
+{
+	struct vm_area *vma = fault->vma;
+	unsigned long offset = fault_to_file_offset(fault);
+	unsigned long vma_end = vma->file_offset +
+				vma->pfn_end - vma->pfn_start;
+	unsigned long off, end;
+	struct vm_obj_link *vmo_link;
+	struct l4_map_batch batch;
+	struct vm_file *f;
+	struct page *page;
+
+	BUG_ON(!(vmo_link = vma_next_link(&vma->vm_obj_list,
+					  &vma->vm_obj_list)));
+	if (!(vmo_link->obj->flags & VM_OBJ_FILE))
+		return;
+	f = vm_object_to_file(vmo_link->obj);
+	if (f->type != VM_FILE_VFS)
+		return;
+
+	/* If reading ahead fails, whatever is cached already is mapped */
+	file_readahead(f, &vma->ra, offset, offset + 1);
+
+	if (!(vma->flags & VMA_PRIVATE))
+		return;
+
+	/* Map what is in the cache ahead of the fault, within the vma */
+	end = min(vma->ra.ahead, vma_end);
+	l4_map_batch_init(&batch, fault->task->tid);
+	for (off = offset + 1; off < end; off++) {
+		if (!(page = find_page(&f->vm_obj, off)))
+			break;
+		if (l4_map_batch_add(&batch, (void *)page_to_phys(page),
+				     (void *)vma_page_to_virtual(vma, page),
+				     1, map_flags) < 0)
+			break;
+	}
+	l4_mutex_unlock(&vm_lock);
+	l4_map_batch_flush(&batch);
+	l4_mutex_lock(&vm_lock);
+
+	/* A sequential reader faults next right after the cluster */
+	vma->ra.next = off;
+}
+
 struct page *__do_page_fault(struct fault_data *fault)
 {
 	unsigned int reason = fault->reason;
 	unsigned int pte_flags = fault->pte_flags;
 	unsigned int map_flags = 0;
 	struct page *page = 0;
+	int cluster = 0;
+	int write = 0;
 
 	if ((reason & VM_READ) && (pte_flags & VM_NONE)) {
 		page = page_read_fault(fault);
 		map_flags = MAP_USR_RO;
+		cluster = 1;
 
 	} else if ((reason & VM_WRITE) && (pte_flags & VM_NONE)) {
-		page = page_read_fault(fault);
+		if (IS_ERR(page = page_read_fault(fault)))
+			return page;
 		page = page_write_fault(fault);
 		map_flags = MAP_USR_RW;
+		write = 1;
 
 	} else if ((reason & VM_EXEC) && (pte_flags & VM_NONE)) {
 		page = page_read_fault(fault);
 		map_flags = MAP_USR_RX;
+		cluster = 1;
 
 	} else if ((reason & VM_EXEC) && (pte_flags & VM_READ)) {
 		/* Retrieve already paged in file */
@@ -760,20 +1009,40 @@ struct page *__do_page_fault(struct fault_data *fault)
 			map_flags = MAP_USR_RWX;
 		else
 			map_flags = MAP_USR_RW;
+		write = 1;
 
 	} else {
 		printf("mm0: Unhandled page fault.\n");
 		BUG();
 	}
 
+	/* Out of memory, it is retried after reclaim */
+	if (IS_ERR(page))
+		return page;
 	BUG_ON(!page);
+	page_referenced(page);
 
 	/* Map the new page to faulty task */
+	l4_mutex_unlock(&vm_lock);
 	l4_map((void *)page_to_phys(page),
 	       (void *)page_align(fault->address), 1,
 	       map_flags, fault->task->tid);
+	l4_mutex_lock(&vm_lock);
 	// vm_object_print(page->owner);
 
+	/*
+	 * Writeback may have cleaned a file page before it got mapped,
+	 * so it is dirtied again, now that the task can write it.
+	 */
+	if (write && (page->owner->flags & VM_OBJ_FILE)) {
+		page->flags |= VM_WRITEMAPPED;
+		page_set_dirty(page);
+	}
+
+	/* Bring in and map the pages that are likely to fault next */
+	if (cluster)
+		vma_fault_ahead(fault, map_flags);
+
 	return page;
 }
 
@@ -781,14 +1050,17 @@ struct page *__do_page_fault(struct fault_data *fault)
  * Sets all r/w shadow objects as read-only for the process
  * so that as expected after a fork() operation, writes to those
  * objects cause copy-on-write events.
+ *
+ * The pages of those objects are write-protected in the page
+ * tables by the kernel, as it copies the tables with TC_COPY_COW.
+ * The kernel doesn't know vmas, so the pages that are not to be
+ * copied on write are given back write access by vm_remap_shared().
  */
 int vm_freeze_shadows(struct tcb *task)
 {
-	unsigned long virtual;
 	struct vm_area *vma;
 	struct vm_obj_link *vmo_link;
 	struct vm_object *vmo;
-	struct page *p;
 
 	list_foreach_struct(vma, &task->vm_area_head->list, list) {
 
@@ -816,26 +1088,102 @@ int vm_freeze_shadows(struct tcb *task)
 		/* Make the object read only */
 		vmo->flags &= ~VM_WRITE;
 		vmo->flags |= VM_READ;
+	}
 
-		/*
-		 * Make all pages on it read-only
-		 * in the page tables.
-		 */
-		list_foreach_struct(p, &vmo->page_cache, list) {
+	return 0;
+}
 
-			/* Find virtual address of each page */
-			virtual = vma_page_to_virtual(vma, p);
+/* Adds the pages of a writable shared vma that may be written to a batch */
+static int vma_remap_shared(struct vm_area *vma, struct l4_map_batch *batch)
+{
+	unsigned long end = vma->file_offset + vma->pfn_end - vma->pfn_start;
+	unsigned int map_flags;
+	struct vm_object *vmo;
+	struct page *p;
+	int err;
 
-			/* Map the page as read-only */
-			l4_map((void *)page_to_phys(p),
-			       (void *)virtual, 1,
-			       MAP_USR_RO, task->tid);
-		}
+	if (!((vma->flags & VMA_SHARED) && (vma->flags & VM_WRITE)))
+		return 0;
+	map_flags = (vma->flags & VM_EXEC) ? MAP_USR_RWX : MAP_USR_RW;
+
+	/* Shared vmas only have the one object */
+	BUG_ON(list_empty(&vma->vm_obj_list));
+	vmo = link_to_struct(vma->vm_obj_list.next,
+			     struct vm_obj_link, list)->obj;
+
+	list_foreach_struct(p, &vmo->page_cache, list) {
+		if (p->offset < vma->file_offset || p->offset >= end)
+			continue;
+
+		/* Others of a vfs file must fault, so writeback sees writes */
+		if ((vmo->flags & VM_OBJ_FILE) &&
+		    vm_object_to_file(vmo)->type == VM_FILE_VFS &&
+		    !(p->flags & VM_WRITEMAPPED))
+			continue;
+
+		if ((err = l4_map_batch_add(batch, (void *)page_to_phys(p),
+					    (void *)vma_page_to_virtual(vma, p),
+					    1, map_flags)) < 0)
+			return err;
 	}
 
 	return 0;
 }
 
+/*
+ * The kernel write-protects the writable pages of both tasks when
+ * it copies the page tables for a fork, except for device pages.
+ * This gives write access back to the pages that are not copied on
+ * write:
+ * - Pages of writable shared vmas, e.g. shm, in both tasks.
+ * - The utcb pages of the parent. It writes them at every ipc, and
+ *   the child gets utcbs of its own.
+ */
+int vm_remap_shared(struct tcb *parent, struct tcb *child)
+{
+	struct l4_map_batch batch;
+	struct utcb_desc *udesc;
+	struct vm_area *vma;
+	struct vm_object *vmo;
+	struct page *page;
+	int err;
+
+	/* The child has copies of the parent's vmas */
+	l4_map_batch_init(&batch, child->tid);
+	list_foreach_struct(vma, &parent->vm_area_head->list, list)
+		if ((err = vma_remap_shared(vma, &batch)) < 0)
+			return err;
+	if ((err = l4_map_batch_flush(&batch)) < 0)
+		return err;
+
+	l4_map_batch_init(&batch, parent->tid);
+	list_foreach_struct(vma, &parent->vm_area_head->list, list)
+		if ((err = vma_remap_shared(vma, &batch)) < 0)
+			return err;
+
+	/*
+	 * A utcb page the parent wrote to is on its frozen shadow. If it
+	 * is not, it was already read-only, and is copied on write.
+	 */
+	list_foreach_struct(udesc, &parent->utcb_head->list, list) {
+		if (!(vma = find_vma(udesc->utcb_base,
+				     &parent->vm_area_head->list)))
+			continue;
+		vmo = link_to_struct(vma->vm_obj_list.next,
+				     struct vm_obj_link, list)->obj;
+		if (!(page = find_page(vmo, vma->file_offset +
+				       __pfn(udesc->utcb_base) -
+				       vma->pfn_start)))
+			continue;
+		if ((err = l4_map_batch_add(&batch, (void *)page_to_phys(page),
+					    (void *)udesc->utcb_base, 1,
+					    MAP_USR_RW)) < 0)
+			return err;
+	}
+
+	return l4_map_batch_flush(&batch);
+}
+
 /*
  * Page fault model:
  *
@@ -1023,6 +1371,8 @@ struct page *task_prefault_smart(struct tcb *task, unsigned long address,
 	/* Traverse the list of vm objects and search for the page */
 	while (IS_ERR(page = vmo_link->obj->pager->ops.page_in(vmo_link->obj,
 							       file_offset))) {
+		if ((int)page == -ENOMEM)
+			return page;
 		if (!(vmo_link = vma_next_link(&vmo_link->list,
 					       &vma->vm_obj_list))) {
 			printf("%s:%s: Traversed all shadows and the original "
@@ -1055,6 +1405,7 @@ struct page *task_prefault_smart(struct tcb *task, unsigned long address,
 		printf("l4_map() failed. err=%d\n", err);
 		BUG();
 	}
+	page_referenced(page);
 
 	return page;
 }
@@ -28,7 +28,10 @@
 #include <vfs.h>
 #include <alloca.h>
 #include <path.h>
+#include <reclaim.h>
+#include <writeback.h>
 #include <syscalls.h>
+#include <worker.h>
 
 #include INC_GLUE(message.h)
 
@@ -227,46 +230,50 @@ out:
 
 
 /*
- * Inserts the page to vmfile's list in order of page frame offset.
- * We use an ordered list instead of a better data structure for now.
+ * Inserts the page to vmfile's list in order of page frame offset,
+ * and hashes it for lookup. Pages mostly arrive in ascending order,
+ * or right after a page that is already cached, so the list is only
+ * walked as a last resort.
  */
 int insert_page_olist(struct page *this, struct vm_object *vmo)
 {
-	struct page *before, *after;
+	struct page *before;
+	struct link *pos;
 
-	/* Add if list is empty */
-	if (list_empty(&vmo->page_cache)) {
+	BUG_ON(find_page(vmo, this->offset));
+	list_insert(&this->hash, page_cache_bucket(vmo, this->offset));
+
+	/* Add as last if list is empty or it is past the last page */
+	if (list_empty(&vmo->page_cache) ||
+	    link_to_struct(vmo->page_cache.prev, struct page,
+			   list)->offset < this->offset) {
 		list_insert_tail(&this->list, &vmo->page_cache);
 		return 0;
 	}
 
-	/* Else find the right interval */
-	list_foreach_struct(before, &vmo->page_cache, list) {
-		after = link_to_struct(before->list.next, struct page, list);
-
-		/* If there's only one in list */
-		if (before->list.next == &vmo->page_cache) {
-			/* Add as next if greater */
-			if (this->offset > before->offset)
-				list_insert(&this->list, &before->list);
-			/* Add  as previous if smaller */
-			else if (this->offset < before->offset)
-				list_insert_tail(&this->list, &before->list);
-			else
-				BUG();
-			return 0;
-		}
+	/* Add right after its predecessor if it is cached */
+	if (this->offset > 0 &&
+	    (before = find_page(vmo, this->offset - 1))) {
+		list_insert(&this->list, &before->list);
+		return 0;
+	}
 
-		/* If this page is in-between two other, insert it there */
-		if (before->offset < this->offset &&
-		    after->offset > this->offset) {
-			list_insert(&this->list, &before->list);
-			return 0;
-		}
-		BUG_ON(this->offset == before->offset);
-		BUG_ON(this->offset == after->offset);
+	/* Else walk back from the end to find the right interval */
+	for (pos = vmo->page_cache.prev; pos != &vmo->page_cache;
+	     pos = pos->prev) {
+		before = link_to_struct(pos, struct page, list);
+		if (before->offset < this->offset)
+			break;
 	}
-	BUG();
+	list_insert(&this->list, pos);
+	return 0;
+}
+
+/* Removes the page from its vm_object's list and the page cache hash */
+void remove_page_olist(struct page *this)
+{
+	list_remove_init(&this->list);
+	list_remove_init(&this->hash);
 }
 
 /*
@@ -292,6 +299,48 @@ int read_file_pages(struct vm_file *vmfile, unsigned long pfn_start,
 	return 0;
 }
 
+/*
+ * Updates the readahead state of a reader accessing pages
+ * pfn_start to pfn_end, and reads in the pages ahead of it.
+ *
+ * An access that starts where the last one ended, or on its
+ * last page, is sequential and doubles the window. Anything
+ * else starts over with the minimum window. New pages are only
+ * read once the reader gets within half a window of the end
+ * of the last read ahead.
+ */
+int file_readahead(struct vm_file *vmfile, struct file_readahead *ra,
+		   unsigned long pfn_start, unsigned long pfn_end)
+{
+	unsigned long file_end = __pfn(page_align_up(vmfile->length));
+	unsigned long start, end;
+	int err;
+
+	if (ra->window && (pfn_start == ra->next ||
+			   pfn_start + 1 == ra->next)) {
+		ra->window = min(ra->window * 2, FILE_RA_MAX);
+	} else {
+		ra->window = FILE_RA_MIN;
+		ra->ahead = 0;
+	}
+	ra->next = pfn_end;
+
+	if (pfn_end + ra->window / 2 <= ra->ahead)
+		return 0;
+
+	start = max(pfn_end, ra->ahead);
+	end = min(pfn_end + ra->window, file_end);
+	if (start >= end)
+		return 0;
+
+	/* If reading fails, the next access tries again from start */
+	ra->ahead = end;
+	if ((err = read_file_pages(vmfile, start, end)) < 0)
+		ra->ahead = start;
+
+	return err;
+}
+
 /*
  * The buffer must be contiguous by page, if npages > 1.
  */
@@ -338,26 +387,29 @@ int vfs_update_file_stats(struct vm_file *f)
 	return 0;
 }
 
-/* Writes pages in cache back to their file */
+/*
+ * Writes pages in cache back to their file. Only the pages that
+ * are still dirty are written, the rest have been written back
+ * in the background already.
+ */
 int write_file_pages(struct vm_file *f, unsigned long pfn_start,
 		     unsigned long pfn_end)
 {
+	struct page *page, *n;
 	int err;
 
 	/* We have only thought of vfs files for this */
 	BUG_ON(f->type != VM_FILE_VFS);
 
-	/* Need not flush files that haven't been written */
-	if (!(f->vm_obj.flags & VM_DIRTY))
-		return 0;
-
 	BUG_ON(pfn_end != __pfn(page_align_up(f->length)));
-	for (int f_offset = pfn_start; f_offset < pfn_end; f_offset++) {
-		err = f->vm_obj.pager->ops.page_out(&f->vm_obj, f_offset);
+	list_foreach_removable_struct(page, n, &f->dirty_pages, dirty) {
+		if (page->offset < pfn_start || page->offset >= pfn_end)
+			continue;
+		err = f->vm_obj.pager->ops.page_out(&f->vm_obj, page->offset);
 		if (err < 0) {
-			printf("%s: %s:Could not write page %d "
+			printf("%s: %s:Could not write page %lu "
 			       "to file with vnum: 0x%lu\n", __TASKNAME__,
-			       __FUNCTION__, f_offset, f->vnode->vnum);
+			       __FUNCTION__, page->offset, f->vnode->vnum);
 			return err;
 		}
 	}
@@ -450,6 +502,7 @@ int do_close(struct tcb *task, int fd)
 
 	task->files->fd[fd].cursor = 0;
 	task->files->fd[fd].vmfile = 0;
+	memset(&task->files->fd[fd].ra, 0, sizeof(struct file_readahead));
 
 	return 0;
 }
@@ -472,21 +525,25 @@ int sys_fsync(struct tcb *task, int fd)
 	return fsync_common(task, fd);
 }
 
-/* FIXME: Add error handling to this */
-/* Extends a file's size by adding it new pages */
+/*
+ * Extends a file's size by adding it new pages. Pages are allocated
+ * one by one, as reclaim frees them one by one.
+ */
 int new_file_pages(struct vm_file *f, unsigned long start, unsigned long end)
 {
 	unsigned long npages = end - start;
 	struct page *page;
 	void *paddr;
 
-	/* Allocate the memory for new pages */
-	if (!(paddr = alloc_page(npages)))
-		return -ENOMEM;
-
 	/* Process each page */
 	for (unsigned long i = 0; i < npages; i++) {
-		page = phys_to_page(paddr + PAGE_SIZE * i);
+		/* Added by an earlier try that ran out of memory */
+		if (find_page(&f->vm_obj, start + i))
+			continue;
+
+		if (!(paddr = alloc_page(1)))
+			return -ENOMEM;
+		page = phys_to_page(paddr);
 		page_init(page);
 		page->refcnt++;
 		page->owner = &f->vm_obj;
@@ -496,11 +553,10 @@ int new_file_pages(struct vm_file *f, unsigned long start, unsigned long end)
 		/* Add the page to file's vm object */
 		BUG_ON(!list_empty(&page->list));
 		insert_page_olist(page, &f->vm_obj);
+		f->vm_obj.npages++;
+		lru_add(page);
 	}
 
-	/* Update vm object */
-	f->vm_obj.npages += npages;
-
 	return 0;
 }
 
@@ -523,7 +579,8 @@ int copy_cache_pages(struct vm_file *vmfile, struct tcb *task, void *buf,
 		     unsigned long pfn_start, unsigned long pfn_end,
 		     unsigned long cursor_offset, int count, int read)
 {
-	struct page *file_page;
+	struct page *file_page, *task_page;
+	struct link *pos;
 	unsigned long task_offset; /* Current copy offset on the task buffer */
 	unsigned long file_offset; /* Current copy offset on the file */
 	int copysize, left;
@@ -534,11 +591,15 @@ int copy_cache_pages(struct vm_file *vmfile, struct tcb *task, void *buf,
 	left = count;
 
 	/* Find the head of consecutive pages */
-	list_foreach_struct(file_page, &vmfile->vm_obj.page_cache, list) {
-		if (file_page->offset < pfn_start)
-			continue;
-		else if (file_page->offset == pfn_end || left == 0)
+	BUG_ON(!(file_page = find_page(&vmfile->vm_obj, pfn_start)));
+
+	/* Walk the ordered list from there */
+	for (pos = &file_page->list; pos != &vmfile->vm_obj.page_cache;
+	     pos = pos->next) {
+		file_page = link_to_struct(pos, struct page, list);
+		if (file_page->offset == pfn_end || left == 0)
 			break;
+		page_referenced(file_page);
 
 		empty = PAGE_SIZE - page_offset(file_offset);
 
@@ -547,20 +608,41 @@ int copy_cache_pages(struct vm_file *vmfile, struct tcb *task, void *buf,
 			copysize = min(PAGE_SIZE - page_offset(file_offset), left);
 		     	copysize = min(copysize, PAGE_SIZE - page_offset(task_offset));
 
-			if (read)
-				page_copy(task_prefault_smart(task, task_offset,
-							      VM_READ | VM_WRITE),
-					  file_page,
+			/* Other workers may go on while copying */
+			if (read) {
+				task_page =
+					task_prefault_smart(task, task_offset,
+							    VM_READ | VM_WRITE);
+				if (IS_ERR(task_page))
+					return (int)task_page;
+				l4_mutex_unlock(&vm_lock);
+				page_copy(task_page, file_page,
 					  page_offset(task_offset),
 					  page_offset(file_offset),
 					  copysize);
-			else
-				page_copy(file_page,
-					  task_prefault_smart(task, task_offset,
-							      VM_READ),
+			} else {
+				task_page =
+					task_prefault_smart(task, task_offset,
+							    VM_READ);
+				if (IS_ERR(task_page))
+					return (int)task_page;
+				l4_mutex_unlock(&vm_lock);
+				page_copy(file_page, task_page,
 					  page_offset(file_offset),
 					  page_offset(task_offset),
 					  copysize);
+			}
+			l4_mutex_lock(&vm_lock);
+
+			/*
+			 * Dirtied after the copy, as writeback may have
+			 * cleaned the page meanwhile. The task's page may
+			 * be of a shared file mapping too.
+			 */
+			if (!read)
+				page_set_dirty(file_page);
+			else if (task_page->owner->flags & VM_OBJ_FILE)
+				page_set_dirty(task_page);
 
 			empty -= copysize;
 			left -= copysize;
@@ -621,6 +703,12 @@ int sys_read(struct tcb *task, int fd, void *buf, int count)
 	if ((ret = read_file_pages(vmfile, pfn_start, pfn_end)) < 0)
 		return ret;
 
+	/*
+	 * Read ahead if it looks like a sequential reader. This is only
+	 * a hint, the requested range is in already, so it can't fail.
+	 */
+	file_readahead(vmfile, &task->files->fd[fd].ra, pfn_start, pfn_end);
+
 	/* Read it into the user buffer from the cache */
 	if ((count = copy_cache_pages(vmfile, task, buf, pfn_start, pfn_end,
 				      cursor, count, 1)) < 0)
@@ -940,8 +1028,9 @@ int sys_open(struct tcb *task, const char *pathname,
 		goto out;
 	}
 
-	/* Assign file information */
+	/* Assign file information, the file holds the vnode in cache */
 	vmfile->vnode = v;
+	vfs_vnode_get(v);
 	vmfile->length = vmfile->vnode->size;
 
 	/* Add a reference to it from the task */
@@ -33,6 +33,7 @@
 #include <mmap.h>
 #include <file.h>
 #include <syscalls.h>
+#include <swap.h>
 #include <linker.h>
 
 /* Kernel data acquired during initialisation */
@@ -280,6 +281,8 @@ void init_physmem_secondary(struct membank *membank)
 	/* Initialise the page array */
 	for (int i = 0; i < npages; i++) {
 		link_init(&membank[0].page_array[i].list);
+		link_init(&membank[0].page_array[i].lru);
+		link_init(&membank[0].page_array[i].dirty);
 
 		/*
 		 * Set use counts for pages the
@@ -488,6 +491,12 @@ void init(void)
 
 	init_physmem();
 
+	page_cache_hash_init();
+
+	swap_init();
+
+	task_hash_init();
+
 	init_devzero();
 
 	shm_pool_init();
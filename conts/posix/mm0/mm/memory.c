@@ -115,6 +115,7 @@ void *pager_map_pages(struct vm_file *f, unsigned long page_offset, unsigned lon
 	int err;
 	struct page *p;
 	void *addr_start, *addr;
+	struct l4_map_batch batch;
 
 	/* Get the pages */
 	if ((err = read_file_pages(f, page_offset, page_offset + npages)) < 0)
@@ -125,12 +126,15 @@ void *pager_map_pages(struct vm_file *f, unsigned long page_offset, unsigned lon
 		return PTR_ERR(-ENOMEM);
 	addr = addr_start;
 
-	/* Map pages contiguously one by one */
+	/* Map pages contiguously, in as few calls as possible */
+	l4_map_batch_init(&batch, self_tid());
 	for (unsigned long pfn = page_offset; pfn < page_offset + npages; pfn++) {
 		BUG_ON(!(p = find_page(&f->vm_obj, pfn)))
-			l4_map((void *)page_to_phys(p), addr, 1, MAP_USR_RW, self_tid());
-			addr += PAGE_SIZE;
+		BUG_ON(l4_map_batch_add(&batch, (void *)page_to_phys(p),
+					addr, 1, MAP_USR_RW) < 0);
+		addr += PAGE_SIZE;
 	}
+	BUG_ON(l4_map_batch_flush(&batch) < 0);
 
 	return addr_start;
 }
@@ -169,6 +173,7 @@ void *pager_validate_map_user_range2(struct tcb *user, void *userptr,
 	unsigned long npages = __pfn(end - start);
 	void *virt, *virt_start;
 	void *mapped = 0;
+	struct l4_map_batch batch;
 
 	/* Validate that user task owns this address range */
 	if (pager_validate_user_range(user, userptr, size, vm_flags) < 0)
@@ -180,11 +185,13 @@ void *pager_validate_map_user_range2(struct tcb *user, void *userptr,
 	virt = virt_start;
 
 	/* Map every page contiguously in the allocated virtual address range */
+	l4_map_batch_init(&batch, self_tid());
 	for (unsigned long addr = start; addr < end; addr += PAGE_SIZE) {
 		struct page *p = task_prefault_page(user, addr, vm_flags);
 
 		if (IS_ERR(p)) {
 			/* Unmap pages mapped so far */
+			l4_map_batch_flush(&batch);
 			l4_unmap_helper(virt_start, __pfn(addr - start));
 
 			/* Delete virtual address range */
@@ -193,10 +200,11 @@ void *pager_validate_map_user_range2(struct tcb *user, void *userptr,
 			return p;
 		}
 
-		l4_map((void *)page_to_phys(p),
-		       virt, 1, MAP_USR_RW, self_tid());
+		BUG_ON(l4_map_batch_add(&batch, (void *)page_to_phys(p),
+					virt, 1, MAP_USR_RW) < 0);
 		virt += PAGE_SIZE;
 	}
+	BUG_ON(l4_map_batch_flush(&batch) < 0);
 
 	/* Set the mapped pointer to offset of user pointer given */
 	mapped = virt_start;
@@ -14,6 +14,10 @@
 #include <init.h>
 #include <l4/api/errno.h>
 #include <fs.h>
+#include <worker.h>
+#include <swap.h>
+#include <reclaim.h>
+#include <writeback.h>
 
 struct page *page_init(struct page *page)
 {
@@ -22,16 +26,38 @@ struct page *page_init(struct page *page)
 	page->refcnt = -1;
 	spin_lock_init(&page->lock);
 	link_init(&page->list);
+	link_init(&page->hash);
+	link_init(&page->lru);
+	link_init(&page->dirty);
 
 	return page;
 }
 
+/* Page cache hash, keyed by vm_object and page offset */
+static struct link page_cache_hash[PAGE_CACHE_HASH_BUCKETS];
+
+void page_cache_hash_init(void)
+{
+	for (int i = 0; i < PAGE_CACHE_HASH_BUCKETS; i++)
+		link_init(&page_cache_hash[i]);
+}
+
+struct link *page_cache_bucket(struct vm_object *vmo, unsigned long offset)
+{
+	unsigned long key = ((unsigned long)vmo / sizeof(*vmo)) ^ offset;
+
+	/* Multiplicative hash, consecutive offsets spread across buckets */
+	key *= 0x9E3779B1;
+
+	return &page_cache_hash[(key >> 22) & (PAGE_CACHE_HASH_BUCKETS - 1)];
+}
+
 struct page *find_page(struct vm_object *obj, unsigned long pfn)
 {
 	struct page *p;
 
-	list_foreach_struct(p, &obj->page_cache, list)
-		if (p->offset == pfn)
+	list_foreach_struct(p, page_cache_bucket(obj, pfn), hash)
+		if (p->offset == pfn && p->owner == obj)
 			return p;
 
 	return 0;
@@ -47,7 +73,9 @@ int default_release_pages(struct vm_object *vm_obj)
 	struct page *p, *n;
 
 	list_foreach_removable_struct(p, n, &vm_obj->page_cache, list) {
-		list_remove_init(&p->list);
+		remove_page_olist(p);
+		lru_del(p);
+		page_clear_dirty(p);
 		BUG_ON(p->refcnt);
 
 		/* Reinitialise the page */
@@ -85,6 +113,12 @@ int file_page_out(struct vm_object *vm_obj, unsigned long page_offset)
 	if (!(page->flags & VM_DIRTY))
 		return 0;
 
+	/* Writes after this one must fault, and dirty the page again */
+	if (page->flags & VM_WRITEMAPPED) {
+		page_unmap_tasks(page);
+		page->flags &= ~VM_WRITEMAPPED;
+	}
+
 	paddr = (void *)page_to_phys(page);
 
 	//printf("%s/%s: Writing to vnode %lu, at pgoff 0x%lu, %d pages, buf at %p\n",
@@ -95,8 +129,8 @@ int file_page_out(struct vm_object *vm_obj, unsigned long page_offset)
 			     phys_to_virt(paddr))) < 0)
 		return err;
 
-	/* Clear dirty flag */
-	page->flags &= ~VM_DIRTY;
+	/* Clear dirty flag, and take it off its file's dirty list */
+	page_clear_dirty(page);
 
 	return 0;
 }
@@ -104,7 +138,7 @@ int file_page_out(struct vm_object *vm_obj, unsigned long page_offset)
 struct page *file_page_in(struct vm_object *vm_obj, unsigned long page_offset)
 {
 	struct vm_file *f = vm_object_to_file(vm_obj);
-	struct page *page;
+	struct page *page, *cached;
 	void *paddr;
 	int err;
 
@@ -119,17 +153,30 @@ struct page *file_page_in(struct vm_object *vm_obj, unsigned long page_offset)
 	/* Call vfs only if the page is not resident in page cache. */
 	if (!(page = find_page(vm_obj, page_offset))) {
 		/* Allocate a new page */
-		paddr = alloc_page(1);
+		if (!(paddr = alloc_page(1)))
+			return PTR_ERR(-ENOMEM);
 		page = phys_to_page(paddr);
 
-		/* Call to vfs to read into the page. */
-		if ((err = vfs_read(f->vnode, page_offset,
-				    1, phys_to_virt(paddr))) < 0) {
-
+		/*
+		 * Call to vfs to read into the page. Vfs writes only
+		 * touch blocks of pages in the cache, or beyond the
+		 * end of the vnode, so other workers may go on
+		 * meanwhile.
+		 */
+		l4_mutex_unlock(&vm_lock);
+		err = vfs_read(f->vnode, page_offset, 1, phys_to_virt(paddr));
+		l4_mutex_lock(&vm_lock);
+		if (err < 0) {
 			free_page(paddr);
 			return PTR_ERR(err);
 		}
 
+		/* Another worker may have read it in meanwhile */
+		if ((cached = find_page(vm_obj, page_offset))) {
+			free_page(paddr);
+			return cached;
+		}
+
 	//	printf("%s/%s: Reading into vnode %lu, at pgoff 0x%lu, %d pages, buf at %p\n",
 	//	       __TASKNAME__, __FUNCTION__, f->vnode->vnum, page_offset, 1, vaddr);
 
@@ -146,6 +193,8 @@ struct page *file_page_in(struct vm_object *vm_obj, unsigned long page_offset)
 		/* Add the page to owner's list of in-memory pages */
 		BUG_ON(!list_empty(&page->list));
 		insert_page_olist(page, vm_obj);
+		if (f->type == VM_FILE_VFS)
+			lru_add(page);
 	}
 
 	return page;
@@ -164,33 +213,53 @@ struct vm_pager file_pager = {
 };
 
 
-/* A proposal for shadow vma container, could be part of vm_file->priv_data */
-struct vm_swap_node {
-	struct vm_file *swap_file;
-	struct task_ids task_ids;
-	struct address_pool *pool;
-};
-
 /*
- * This should save swap_node/page information either in the pte or in a global
- * list of swap descriptors, and then write the page into the possibly one and
- * only swap file.
+ * Anonymous pages are either in memory, or compressed in the
+ * swap store since they were reclaimed, see mm/swap.c
  */
 struct page *swap_page_in(struct vm_object *vm_obj, unsigned long file_offset)
 {
-	struct page *p;
+	struct swap_entry *entry;
+	struct page *page;
+	void *paddr;
+
+	if ((page = find_page(vm_obj, file_offset)))
+		return page;
 
-	/* No swapping yet, so the page is either here or not here. */
-	if (!(p = find_page(vm_obj, file_offset)))
+	/* Neither here nor swapped, the object doesn't have it */
+	if (!(entry = swap_find(vm_obj, file_offset)))
 		return PTR_ERR(-EINVAL);
-	else
-		return p;
+
+	if (!(paddr = alloc_page(1)))
+		return PTR_ERR(-ENOMEM);
+	page = phys_to_page(paddr);
+	swap_in_page(entry, page);
+
+	/* Update page details */
+	page_init(page);
+	page->refcnt++;
+	page->owner = vm_obj;
+	page->offset = file_offset;
+
+	/* Back in the owner's list of in-memory pages */
+	insert_page_olist(page, vm_obj);
+	vm_obj->npages++;
+	lru_add(page);
+
+	return page;
+}
+
+int swap_release_pages(struct vm_object *vm_obj)
+{
+	swap_release(vm_obj);
+
+	return default_release_pages(vm_obj);
 }
 
 struct vm_pager swap_pager = {
 	.ops = {
 		.page_in = swap_page_in,
-		.release_pages = default_release_pages,
+		.release_pages = swap_release_pages,
 	},
 };
 
@@ -203,7 +272,7 @@ int bootfile_release_pages(struct vm_object *vm_obj)
 	struct page *p, *n;
 
 	list_foreach_removable_struct(p, n, &vm_obj->page_cache, list) {
-		list_remove(&p->list);
+		remove_page_olist(p);
 		BUG_ON(p->refcnt);
 
 		/* Reinitialise the page */
@@ -0,0 +1,247 @@
+/*
+ * Page reclaim.
+ *
+ * Anonymous pages of shadows and pages of vfs files are kept on
+ * two lists, in the order they were last found to be in use. New
+ * pages start on the inactive list, and go to the active list if
+ * they are referenced again while there. Reclaim takes pages from
+ * the head of the inactive list, giving those referenced since
+ * they got there another round on the active list, and refills
+ * the inactive list from the head of the active one.
+ *
+ * There are no referenced bits in the page tables that we could
+ * read. Instead a page is unmapped from all tasks when it becomes
+ * inactive, so that the next access faults and marks it referenced.
+ *
+ * Clean file pages are simply dropped, dirty ones are written back
+ * first, and anonymous pages go to the compressed swap store.
+ *
+ * Reclaim changes the object chains of all tasks, so it only runs
+ * on the main thread while workers are idle, see mm/worker.c.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4/macros.h>
+#include <l4/lib/list.h>
+#include <l4/api/errno.h>
+#include L4LIB_INC_ARCH(syscalls.h)
+#include L4LIB_INC_ARCH(syslib.h)
+#include <mem/alloc_page.h>
+#include <vm_area.h>
+#include <globals.h>
+#include <task.h>
+#include <swap.h>
+#include <reclaim.h>
+#include <worker.h>
+
+static LINK_DECLARE(lru_active);
+static LINK_DECLARE(lru_inactive);
+static int nr_active;
+static int nr_inactive;
+
+/* Adds a page that has just come into the cache */
+void lru_add(struct page *page)
+{
+	BUG_ON(!list_empty(&page->lru));
+	page->flags &= ~(VM_ACTIVE | VM_REFERENCED);
+	list_insert_tail(&page->lru, &lru_inactive);
+	nr_inactive++;
+}
+
+/* Takes a page off the lists, if it is on them */
+void lru_del(struct page *page)
+{
+	if (list_empty(&page->lru))
+		return;
+
+	list_remove_init(&page->lru);
+	if (page->flags & VM_ACTIVE)
+		nr_active--;
+	else
+		nr_inactive--;
+	page->flags &= ~(VM_ACTIVE | VM_REFERENCED);
+}
+
+static void page_activate(struct page *page)
+{
+	list_remove(&page->lru);
+	list_insert_tail(&page->lru, &lru_active);
+	page->flags &= ~VM_REFERENCED;
+	page->flags |= VM_ACTIVE;
+	nr_inactive--;
+	nr_active++;
+}
+
+/*
+ * Marks a page in use. An inactive page that was already
+ * referenced since it got on the list becomes active.
+ */
+void page_referenced(struct page *page)
+{
+	if (list_empty(&page->lru))
+		return;
+
+	if ((page->flags & (VM_ACTIVE | VM_REFERENCED)) == VM_REFERENCED)
+		page_activate(page);
+	else
+		page->flags |= VM_REFERENCED;
+}
+
+/* Whether the page is the first one a vma finds for its offset */
+static int vma_sees_page(struct vm_area *vma, struct page *page)
+{
+	struct vm_obj_link *vmo_link;
+
+	if (page->offset < vma->file_offset ||
+	    page->offset >= vma->file_offset + vma->pfn_end - vma->pfn_start)
+		return 0;
+
+	list_foreach_struct(vmo_link, &vma->vm_obj_list, list) {
+		if (vmo_link->obj == page->owner)
+			return 1;
+
+		/* Hidden by an object in front */
+		if (vm_object_has_page(vmo_link->obj, page->offset))
+			return 0;
+	}
+
+	return 0;
+}
+
+/* Unmaps a page from all tasks that map it, except the pager */
+void page_unmap_tasks(struct page *page)
+{
+	struct vm_area *vma;
+	struct tcb *task;
+
+	/* Threads of a task each unmap, which is harmless */
+	list_foreach_struct(task, &global_tasks.list, list) {
+		if (task->tid == mm0_main_tid)
+			continue;
+		list_foreach_struct(vma, &task->vm_area_head->list, list)
+			if (vma_sees_page(vma, page))
+				l4_unmap((void *)vma_page_to_virtual(vma, page),
+					 1, task->tid);
+	}
+}
+
+/*
+ * Unmaps a page from all tasks that map it. Pages that the pager
+ * maps for itself are wired, they return -EBUSY.
+ */
+static int page_unmap_all(struct page *page)
+{
+	struct tcb *self = find_task(mm0_main_tid);
+	struct vm_area *vma;
+
+	list_foreach_struct(vma, &self->vm_area_head->list, list)
+		if (vma_sees_page(vma, page))
+			return -EBUSY;
+
+	page_unmap_tasks(page);
+
+	return 0;
+}
+
+static void page_deactivate(struct page *page)
+{
+	list_remove(&page->lru);
+	list_insert_tail(&page->lru, &lru_inactive);
+	page->flags &= ~(VM_ACTIVE | VM_REFERENCED);
+	nr_active--;
+	nr_inactive++;
+
+	/* The next access faults, and tells that it is in use */
+	if (page_unmap_all(page) < 0)
+		lru_del(page);
+}
+
+/* Takes a page out of memory, saving its contents if need be */
+static int page_evict(struct page *page)
+{
+	struct vm_object *obj = page->owner;
+	struct vm_file *f;
+	int taken = 0;
+	int err;
+
+	if (!(obj->flags & VM_OBJ_SHADOW)) {
+		/* Pages beyond the end of file can't be written back */
+		f = vm_object_to_file(obj);
+		BUG_ON(f->type != VM_FILE_VFS);
+		if (page->offset >= __pfn(page_align_up(f->length)))
+			return -EINVAL;
+	}
+
+	/* Tasks must not change the page while it is being saved */
+	if ((err = page_unmap_all(page)) < 0)
+		return err;
+	page->flags &= ~VM_WRITEMAPPED;
+
+	if (obj->flags & VM_OBJ_SHADOW) {
+		if ((taken = swap_out_page(page)) < 0)
+			return taken;
+	} else if ((err = obj->pager->ops.page_out(obj, page->offset)) < 0) {
+		return err;
+	}
+
+	lru_del(page);
+	remove_page_olist(page);
+	BUG_ON(--obj->npages < 0);
+	page_init(page);
+
+	/* Unless the swap store keeps it */
+	if (!taken)
+		free_page((void *)page_to_phys(page));
+
+	return 0;
+}
+
+int reclaim_needed(void)
+{
+	return alloc_page_nfree() < RECLAIM_FREE_LOW;
+}
+
+/*
+ * Reclaims pages until there are enough free ones, or all pages
+ * have been looked at twice. Returns the number of pages evicted.
+ */
+int reclaim_pages(void)
+{
+	int scan = 2 * (nr_active + nr_inactive);
+	struct page *page;
+	int evicted = 0;
+	int err;
+
+	while (alloc_page_nfree() < RECLAIM_FREE_HIGH && scan-- > 0) {
+		/* Keep enough pages inactive to find unused ones */
+		if (nr_inactive < nr_active)
+			page_deactivate(link_to_struct(lru_active.next,
+						       struct page, lru));
+
+		if (list_empty(&lru_inactive))
+			break;
+		page = link_to_struct(lru_inactive.next, struct page, lru);
+
+		/* Used since it became inactive */
+		if (page->flags & VM_REFERENCED) {
+			page_activate(page);
+			continue;
+		}
+
+		if ((err = page_evict(page)) < 0) {
+			/* Wired by the pager, it is never reclaimed */
+			if (err == -EBUSY)
+				lru_del(page);
+			else
+				page_activate(page);
+			continue;
+		}
+		evicted++;
+	}
+
+	/* Pages that vmas have resolved may be gone */
+	if (evicted)
+		vma_pcache_invalidate();
+
+	return evicted;
+}
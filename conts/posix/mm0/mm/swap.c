@@ -0,0 +1,316 @@
+/*
+ * In-memory compressed swap store.
+ *
+ * There is no swap device, so anonymous pages that are reclaimed
+ * are compressed into slabs of memory instead. Compressed pages
+ * are packed one after the other into the current slab page, and
+ * a slab page is freed once all its entries are swapped back in
+ * or released. All-zero pages take no room at all, and pages that
+ * don't compress well are kept whole.
+ *
+ * The store never allocates pages itself, as it runs when there
+ * are none to spare. A page that is swapped out becomes the next
+ * slab whenever the current one is full.
+ *
+ * All of this runs under vm_lock.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4/macros.h>
+#include <l4/lib/list.h>
+#include <l4/api/errno.h>
+#include <mem/malloc.h>
+#include <mem/alloc_page.h>
+#include <vm_area.h>
+#include <string.h>
+#include <swap.h>
+
+/*
+ * The compressor is an LZ77 variant. Output is groups of up to
+ * 16 items, each group led by a 16-bit word whose bits tell which
+ * items are copies. A literal is a byte, and a copy is two bytes
+ * of 12-bit backwards distance and 4-bit length.
+ */
+#define LZ_HASH_BITS			12
+#define LZ_MIN_MATCH			3
+#define LZ_MAX_MATCH			(LZ_MIN_MATCH + 15)
+#define LZ_MAX_DISTANCE			4095
+
+/* Last position of each hashed 3-byte sequence */
+static u16 lz_hash[1 << LZ_HASH_BITS];
+
+/* Compression output, too large for worker stacks */
+static u8 swap_buf[SWAP_COMPRESS_MAX];
+
+static inline unsigned int lz_hashof(const u8 *p)
+{
+	unsigned int key = p[0] | p[1] << 8 | p[2] << 16;
+
+	return (key * 0x9E3779B1) >> (32 - LZ_HASH_BITS);
+}
+
+/* Compresses a page, returns 0 if it doesn't fit in dstmax bytes */
+static int lz_compress(const u8 *src, u8 *dst, int dstmax)
+{
+	const u8 *end = src + PAGE_SIZE, *p = src, *ref;
+	u8 *out = dst, *ctrlp;
+	unsigned int ctrl = 0, bit = 0, dist, len, max, h;
+
+	memset(lz_hash, 0, sizeof(lz_hash));
+
+	ctrlp = out;
+	out += 2;
+	while (p < end) {
+		/* Start a new group */
+		if (bit == 16) {
+			ctrlp[0] = ctrl;
+			ctrlp[1] = ctrl >> 8;
+			if (out + 2 > dst + dstmax)
+				return 0;
+			ctrlp = out;
+			out += 2;
+			ctrl = 0;
+			bit = 0;
+		}
+
+		/* Room for the largest item */
+		if (out + 2 > dst + dstmax)
+			return 0;
+
+		/* Hash entries are only hints, matches are checked */
+		len = 0;
+		dist = 0;
+		if (end - p >= LZ_MIN_MATCH) {
+			h = lz_hashof(p);
+			ref = src + lz_hash[h];
+			lz_hash[h] = p - src;
+			dist = p - ref;
+			if (dist > 0 && dist <= LZ_MAX_DISTANCE) {
+				max = min(end - p, LZ_MAX_MATCH);
+				while (len < max && ref[len] == p[len])
+					len++;
+			}
+		}
+
+		if (len >= LZ_MIN_MATCH) {
+			ctrl |= 1 << bit;
+			*out++ = dist >> 4;
+			*out++ = (dist & 0xF) << 4 | (len - LZ_MIN_MATCH);
+			p += len;
+		} else {
+			*out++ = *p++;
+		}
+		bit++;
+	}
+	ctrlp[0] = ctrl;
+	ctrlp[1] = ctrl >> 8;
+
+	return out - dst;
+}
+
+static void lz_decompress(const u8 *src, int srclen, u8 *dst)
+{
+	const u8 *in = src, *end = src + srclen;
+	u8 *out = dst;
+	unsigned int ctrl, dist, len;
+
+	while (in < end) {
+		ctrl = in[0] | in[1] << 8;
+		in += 2;
+		for (int bit = 0; bit < 16 && in < end; bit++) {
+			if (ctrl & (1 << bit)) {
+				dist = in[0] << 4 | in[1] >> 4;
+				len = (in[1] & 0xF) + LZ_MIN_MATCH;
+				in += 2;
+				BUG_ON(dist > (unsigned int)(out - dst) ||
+				       out + len > dst + PAGE_SIZE);
+				for (; len; len--, out++)
+					*out = *(out - dist);
+			} else {
+				BUG_ON(out >= dst + PAGE_SIZE);
+				*out++ = *in++;
+			}
+		}
+	}
+	BUG_ON(out != dst + PAGE_SIZE);
+}
+
+/* Swap entries are hashed by their owner and offset, like pages */
+static struct link swap_hash[SWAP_HASH_BUCKETS];
+
+/* Slab that compressed pages go into, 0 if none has room */
+static struct swap_slab *swap_slab_current;
+
+static struct link *swap_bucket(struct vm_object *obj, unsigned long offset)
+{
+	unsigned long key = ((unsigned long)obj / sizeof(*obj)) ^ offset;
+
+	key *= 0x9E3779B1;
+
+	return &swap_hash[(key >> 24) & (SWAP_HASH_BUCKETS - 1)];
+}
+
+void swap_init(void)
+{
+	for (int i = 0; i < SWAP_HASH_BUCKETS; i++)
+		link_init(&swap_hash[i]);
+}
+
+struct swap_entry *swap_find(struct vm_object *obj, unsigned long offset)
+{
+	struct swap_entry *entry;
+
+	/* Most objects never had a page swapped */
+	if (!obj->nswapped)
+		return 0;
+
+	list_foreach_struct(entry, swap_bucket(obj, offset), hash)
+		if (entry->offset == offset && entry->owner == obj)
+			return entry;
+
+	return 0;
+}
+
+static void swap_entry_add(struct swap_entry *entry, struct vm_object *obj)
+{
+	entry->owner = obj;
+	list_insert(&entry->hash, swap_bucket(obj, entry->offset));
+	list_insert(&entry->list, &obj->swap_list);
+	obj->nswapped++;
+}
+
+static void swap_entry_remove(struct swap_entry *entry)
+{
+	list_remove_init(&entry->hash);
+	list_remove_init(&entry->list);
+	BUG_ON(--entry->owner->nswapped < 0);
+}
+
+/* Makes the page a slab, it must no longer be in use */
+static struct swap_slab *swap_slab_new(struct page *page)
+{
+	struct swap_slab *slab;
+
+	if (!(slab = kzalloc(sizeof(*slab))))
+		return 0;
+
+	slab->paddr = (void *)page_to_phys(page);
+
+	return slab;
+}
+
+static int page_is_zero(struct page *page)
+{
+	unsigned long *word = page_to_virt(page);
+
+	for (int i = 0; i < PAGE_SIZE / sizeof(*word); i++)
+		if (word[i])
+			return 0;
+	return 1;
+}
+
+/*
+ * Saves the contents of a page in the store. The page must be
+ * unmapped from all tasks. Returns 1 if the page itself is now
+ * used by the store, in which case it must not be freed, and 0
+ * if the page may be freed.
+ */
+int swap_out_page(struct page *page)
+{
+	struct swap_slab *slab = swap_slab_current;
+	struct swap_entry *entry;
+	int len, taken = 0;
+
+	if (!(entry = kzalloc(sizeof(*entry))))
+		return -ENOMEM;
+	link_init(&entry->hash);
+	link_init(&entry->list);
+	entry->offset = page->offset;
+
+	if (page_is_zero(page))
+		goto out;
+
+	if (!(len = lz_compress(page_to_virt(page), swap_buf,
+				SWAP_COMPRESS_MAX))) {
+		/* Doesn't compress well, the page is kept as it is */
+		if (!(slab = swap_slab_new(page)))
+			goto out_err;
+		len = PAGE_SIZE;
+		taken = 1;
+	} else if (!slab || PAGE_SIZE - slab->used < len) {
+		/* Current slab is full, the page becomes the next one */
+		if (!(slab = swap_slab_new(page)))
+			goto out_err;
+		swap_slab_current = slab;
+		taken = 1;
+	}
+
+	if (len < PAGE_SIZE)
+		memcpy(phys_to_virt(slab->paddr) + slab->used, swap_buf, len);
+
+	entry->slab = slab;
+	entry->start = slab->used;
+	entry->len = len;
+	slab->used += len;
+	slab->nentries++;
+
+out:
+	swap_entry_add(entry, page->owner);
+	return taken;
+
+out_err:
+	kfree(entry);
+	return -ENOMEM;
+}
+
+/* Frees an entry, along with its slab if it was the last one there */
+void swap_free_entry(struct swap_entry *entry)
+{
+	struct swap_slab *slab = entry->slab;
+
+	swap_entry_remove(entry);
+	kfree(entry);
+
+	if (!slab || --slab->nentries)
+		return;
+
+	if (slab == swap_slab_current)
+		swap_slab_current = 0;
+	free_page(slab->paddr);
+	kfree(slab);
+}
+
+/* Brings the contents of an entry back into a page, and frees it */
+int swap_in_page(struct swap_entry *entry, struct page *page)
+{
+	void *data;
+
+	if (!entry->slab) {
+		memset(page_to_virt(page), 0, PAGE_SIZE);
+	} else {
+		data = phys_to_virt(entry->slab->paddr) + entry->start;
+		if (entry->len == PAGE_SIZE)
+			memcpy(page_to_virt(page), data, PAGE_SIZE);
+		else
+			lz_decompress(data, entry->len, page_to_virt(page));
+	}
+	swap_free_entry(entry);
+
+	return 0;
+}
+
+/* Hands a swapped page over to another object, e.g. on a merge */
+void swap_move_entry(struct swap_entry *entry, struct vm_object *to)
+{
+	swap_entry_remove(entry);
+	swap_entry_add(entry, to);
+}
+
+/* Releases all swapped pages of an object that is going away */
+void swap_release(struct vm_object *obj)
+{
+	struct swap_entry *entry, *n;
+
+	list_foreach_removable_struct(entry, n, &obj->swap_list, list)
+		swap_free_entry(entry);
+}
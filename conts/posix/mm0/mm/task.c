@@ -50,10 +50,28 @@ void print_tasks(void)
 	}
 }
 
+/*
+ * Task table hash, keyed by tid. The kernel hands out
+ * tids sequentially, so the low bits spread them evenly.
+ */
+static struct link task_hash[TASK_HASH_BUCKETS];
+
+void task_hash_init(void)
+{
+	for (int i = 0; i < TASK_HASH_BUCKETS; i++)
+		link_init(&task_hash[i]);
+}
+
+static inline struct link *task_hash_bucket(int tid)
+{
+	return &task_hash[tid & (TASK_HASH_BUCKETS - 1)];
+}
+
 void global_add_task(struct tcb *task)
 {
 	BUG_ON(!list_empty(&task->list));
 	list_insert_tail(&task->list, &global_tasks.list);
+	list_insert_tail(&task->tid_hash, task_hash_bucket(task->tid));
 	global_tasks.total++;
 }
 
@@ -61,6 +79,7 @@ void global_remove_task(struct tcb *task)
 {
 	BUG_ON(list_empty(&task->list));
 	list_remove_init(&task->list);
+	list_remove_init(&task->tid_hash);
 	BUG_ON(--global_tasks.total < 0);
 }
 
@@ -68,7 +87,7 @@ struct tcb *find_task(int tid)
 {
 	struct tcb *t;
 
-	list_foreach_struct(t, &global_tasks.list, list)
+	list_foreach_struct(t, task_hash_bucket(tid), tid_hash)
 		if (t->tid == tid)
 			return t;
 	return 0;
@@ -91,6 +110,7 @@ struct tcb *tcb_alloc_init(unsigned int flags)
 		}
 		task->vm_area_head->tcb_refs = 1;
 		link_init(&task->vm_area_head->list);
+		l4_mutex_init(&task->vm_area_head->lock);
 
 		/* Also allocate a utcb head for new address space */
 		if (!(task->utcb_head =
@@ -138,6 +158,7 @@ struct tcb *tcb_alloc_init(unsigned int flags)
 			return err;
 		}
 		task->files->tcb_refs = 1;
+		l4_mutex_init(&task->files->lock);
 	}
 
 	/* Ids will be acquired from the kernel */
@@ -147,6 +168,7 @@ struct tcb *tcb_alloc_init(unsigned int flags)
 
 	/* Initialise list structure */
 	link_init(&task->list);
+	link_init(&task->tid_hash);
 	link_init(&task->child_ref);
 	link_init(&task->children);
 
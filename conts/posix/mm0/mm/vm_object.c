@@ -9,6 +9,7 @@
 #include <l4/api/errno.h>
 #include <mem/malloc.h>
 #include <globals.h>
+#include <vfs.h>
 
 /* Global list of all in-memory files on the system */
 struct global_list global_vm_files = {
@@ -72,10 +73,11 @@ void vm_object_print(struct vm_object *vmo)
 {
 	struct vm_file *f;
 
-	printf("Object type: %s %s. links: %d, shadows: %d, Pages in cache: %d.\n",
+	printf("Object type: %s %s. links: %d, shadows: %d, Pages in cache: %d, "
+	       "in swap: %d.\n",
 	       vmo->flags & VM_WRITE ? "writeable" : "read-only",
 	       vmo->flags & VM_OBJ_FILE ? "file" : "shadow", vmo->nlinks, vmo->shadows,
-	       vmo->npages);
+	       vmo->npages, vmo->nswapped);
 	if (vmo->flags & VM_OBJ_FILE) {
 		f = vm_object_to_file(vmo);
 		char *ftype;
@@ -118,6 +120,7 @@ struct vm_object *vm_object_init(struct vm_object *obj)
 	link_init(&obj->shdw_list);
 	link_init(&obj->page_cache);
 	link_init(&obj->link_list);
+	link_init(&obj->swap_list);
 
 	return obj;
 }
@@ -141,6 +144,8 @@ struct vm_file *vm_file_create(void)
 		return PTR_ERR(-ENOMEM);
 
 	link_init(&f->list);
+	link_init(&f->dirty_pages);
+	link_init(&f->dirty_list);
 	vm_object_init(&f->vm_obj);
 	f->vm_obj.flags = VM_OBJ_FILE;
 
@@ -186,12 +191,16 @@ int vm_object_delete(struct vm_object *vmo)
 	BUG_ON(!list_empty(&vmo->shdw_list));
 	BUG_ON(!list_empty(&vmo->link_list));
 	BUG_ON(!list_empty(&vmo->page_cache));
+	BUG_ON(!list_empty(&vmo->swap_list));
 	BUG_ON(!list_empty(&vmo->shref));
 
 	/* Obtain and free via the base object */
 	if (vmo->flags & VM_OBJ_FILE) {
 		f = vm_object_to_file(vmo);
 		BUG_ON(!list_empty(&f->list));
+		BUG_ON(!list_empty(&f->dirty_pages));
+		if (f->type == VM_FILE_VFS && f->vnode)
+			vfs_vnode_put(f->vnode);
 		if (f->private_file_data) {
 			if (f->destroy_priv_data)
 				f->destroy_priv_data(f);
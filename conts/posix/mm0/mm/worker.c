@@ -0,0 +1,296 @@
+/*
+ * Worker threads of the pager.
+ *
+ * The main thread receives all requests. Page faults and file reads,
+ * writes and seeks are handed to a pool of workers, so that a request
+ * that takes long, e.g. a large read, does not hold up the faults of
+ * other tasks, and faults on separate cpus are served in parallel.
+ * Everything else is served by the main thread itself while workers
+ * are idle, as those requests restructure tasks and address spaces,
+ * or create and destroy threads, which only the pager thread may do.
+ *
+ * Tasks only accept replies from their pager, i.e. the main thread.
+ * A worker tells the main thread when it is done with a request, and
+ * the main thread replies to the task on its behalf.
+ *
+ * Locking, in the order taken:
+ *
+ * task->vm_area_head->lock: The vmas of an address space and their
+ * object chains. Held by a worker throughout a request, so threads
+ * sharing an address space take turns.
+ *
+ * task->files->lock: The open files of a task, held throughout a
+ * file request.
+ *
+ * vm_lock: All vm objects, their pages, the page cache, and the page
+ * and memory allocators. Held by a worker except while it copies page
+ * contents, reads pages from the vfs or maps pages, which is where
+ * requests spend most of their time. The main thread also holds
+ * vm_lock for requests it serves, as it runs the same code.
+ *
+ * Meanwhile, a copy-on-write on another worker may drop a link to a
+ * shadow that is also in this task's chain, and merge the object it
+ * leaves redundant into the shadow in front of it. A merge only moves
+ * the pages that the front shadow lacks, and frees the others. So the
+ * page a walk found first for an offset stays allocated, and file pages
+ * are not touched, but a page may show up in a shadow after the walk
+ * found none there. copy_on_write() checks for that before adding its
+ * copy, as file_page_in() does for pages read in by another worker.
+ *
+ * Page reclaim also runs on the main thread while workers are idle.
+ * A job that runs out of memory is not replied, but tried once more
+ * after reclaim, ahead of the jobs that arrived after it.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4/macros.h>
+#include <l4/lib/list.h>
+#include <l4/api/errno.h>
+#include L4LIB_INC_ARCH(syscalls.h)
+#include L4LIB_INC_ARCH(syslib.h)
+#include <l4lib/ipcdefs.h>
+#include <stdio.h>
+#include <string.h>
+#include <task.h>
+#include <worker.h>
+#include <reclaim.h>
+
+L4_MUTEX(vm_lock);
+
+static struct mm0_worker mm0_workers[MM0_WORKERS];
+static struct mm0_job mm0_jobs[MM0_JOBS_MAX];
+
+/* Unused jobs, jobs waiting for a worker, and those waiting for memory */
+static struct link job_free;
+static struct link job_pending;
+static struct link job_retry;
+
+/* The main thread, which is the pager */
+l4id_t mm0_main_tid;
+
+static int mm0_worker_thread(void *arg)
+{
+	struct mm0_worker *w = arg;
+	struct mm0_job *job;
+	int err;
+
+	/* Wait for the first job */
+	if ((err = l4_receive(mm0_main_tid)) < 0)
+		goto out_err;
+
+	for (;;) {
+		job = w->job;
+		job->ret = handle_worker_request(job->sender, job->tag,
+						 job->mr);
+
+		/* Report back, and wait for the next job */
+		if ((err = l4_sendrecv_short(mm0_main_tid, mm0_main_tid,
+					     0, 1)) < 0)
+			goto out_err;
+	}
+
+out_err:
+	printf("%s: Worker ipc error: %d. Quitting...\n",
+	       __TASKNAME__, err);
+	BUG();
+	return err;
+}
+
+/* Page faults and file transfers are served by workers */
+int mm0_worker_request(u32 tag)
+{
+	switch (tag) {
+	case L4_IPC_TAG_PFAULT:
+	case L4_IPC_TAG_READ:
+	case L4_IPC_TAG_WRITE:
+	case L4_IPC_TAG_LSEEK:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void mm0_worker_start(struct mm0_worker *w, struct mm0_job *job)
+{
+	int err;
+
+	w->job = job;
+	if ((err = l4_send_short(w->thread->ids.tid, 0, 1)) < 0) {
+		printf("%s: Worker ipc error: %d.\n", __TASKNAME__, err);
+		BUG();
+	}
+}
+
+/* Replies to the sender of the worker's job, leaving the worker idle */
+static void mm0_worker_finish(struct mm0_worker *w)
+{
+	struct mm0_job *job = w->job;
+	int err;
+
+	w->job = 0;
+
+	/* Out of memory, it goes again after reclaim */
+	if (job->ret == -ENOMEM && !job->retried) {
+		job->retried = 1;
+		list_insert_tail(&job->list, &job_retry);
+		return;
+	}
+
+	/*
+	 * The sender may have been destroyed meanwhile
+	 * with the rest of its thread group.
+	 */
+	l4_set_sender(job->sender);
+	if ((err = l4_ipc_return(job->ret)) < 0)
+		printf("%s: Could not reply to (%d). err=%d\n",
+		       __TASKNAME__, job->sender, err);
+
+	list_insert(&job->list, &job_free);
+}
+
+/* Waits for a busy worker to finish its job */
+static void mm0_worker_wait(struct mm0_worker *w)
+{
+	int err;
+
+	if ((err = l4_receive(w->thread->ids.tid)) < 0) {
+		printf("%s: Worker ipc error: %d.\n", __TASKNAME__, err);
+		BUG();
+	}
+	mm0_worker_finish(w);
+}
+
+static struct mm0_worker *mm0_worker_idle(void)
+{
+	for (int i = 0; i < MM0_WORKERS; i++)
+		if (!mm0_workers[i].job)
+			return &mm0_workers[i];
+	return 0;
+}
+
+static struct mm0_worker *mm0_worker_find(l4id_t tid)
+{
+	for (int i = 0; i < MM0_WORKERS; i++)
+		if (mm0_workers[i].thread->ids.tid == tid)
+			return &mm0_workers[i];
+	return 0;
+}
+
+/* Hands a request to an idle worker, or queues it until one is idle */
+void mm0_dispatch(l4id_t sender, u32 tag, u32 *mr)
+{
+	struct mm0_job *job;
+
+	/*
+	 * Out of jobs, so all workers are busy. Wait for one, unless
+	 * the job it finishes waits for memory rather than going free.
+	 */
+	while (list_empty(&job_free)) {
+		mm0_worker_wait(&mm0_workers[0]);
+		mm0_workers_resume();
+	}
+
+	job = link_to_struct(job_free.next, struct mm0_job, list);
+	list_remove_init(&job->list);
+
+	job->sender = sender;
+	job->tag = tag;
+	job->retried = 0;
+	memcpy(job->mr, mr, sizeof(job->mr));
+
+	/* Jobs start in the order they arrive */
+	list_insert_tail(&job->list, &job_pending);
+	mm0_workers_resume();
+}
+
+/*
+ * Completes the job of a worker that has reported back, and
+ * gives it the next pending job. Returns 0 if sender is not a
+ * worker.
+ */
+int mm0_worker_done(l4id_t sender)
+{
+	struct mm0_worker *w;
+
+	if (!(w = mm0_worker_find(sender)))
+		return 0;
+
+	mm0_worker_finish(w);
+	mm0_workers_resume();
+
+	return 1;
+}
+
+/*
+ * Waits until all workers are idle. Jobs that are still
+ * pending stay so until mm0_workers_resume().
+ */
+void mm0_workers_drain(void)
+{
+	for (int i = 0; i < MM0_WORKERS; i++)
+		if (mm0_workers[i].job)
+			mm0_worker_wait(&mm0_workers[i]);
+}
+
+/*
+ * Reclaims pages with workers idle, and puts the jobs that ran
+ * out of memory in front of the pending ones, in their order.
+ */
+void mm0_workers_reclaim(void)
+{
+	struct mm0_job *job, *n;
+	struct link *first;
+
+	mm0_workers_drain();
+
+	l4_mutex_lock(&vm_lock);
+	reclaim_pages();
+	l4_mutex_unlock(&vm_lock);
+
+	first = job_pending.next;
+	list_foreach_removable_struct(job, n, &job_retry, list) {
+		list_remove(&job->list);
+		list_insert_tail(&job->list, first);
+	}
+}
+
+/* Hands pending jobs to idle workers, reclaiming pages if short */
+void mm0_workers_resume(void)
+{
+	struct mm0_worker *w;
+	struct mm0_job *job;
+
+	if (!list_empty(&job_retry) || reclaim_needed())
+		mm0_workers_reclaim();
+
+	while (!list_empty(&job_pending) && (w = mm0_worker_idle())) {
+		job = link_to_struct(job_pending.next, struct mm0_job, list);
+		list_remove_init(&job->list);
+		mm0_worker_start(w, job);
+	}
+}
+
+void mm0_workers_init(void)
+{
+	int err;
+
+	mm0_main_tid = self_tid();
+
+	link_init(&job_free);
+	link_init(&job_pending);
+	link_init(&job_retry);
+	for (int i = 0; i < MM0_JOBS_MAX; i++) {
+		link_init(&mm0_jobs[i].list);
+		list_insert(&mm0_jobs[i].list, &job_free);
+	}
+
+	for (int i = 0; i < MM0_WORKERS; i++) {
+		if ((err = thread_create(mm0_worker_thread, &mm0_workers[i],
+					 TC_SHARE_SPACE,
+					 &mm0_workers[i].thread)) < 0) {
+			printf("%s: Could not create worker thread. "
+			       "err=%d\n", __TASKNAME__, err);
+			BUG();
+		}
+	}
+}
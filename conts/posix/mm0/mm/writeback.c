@@ -0,0 +1,283 @@
+/*
+ * Background writeback of dirty file pages.
+ *
+ * Pages of vfs files that are written, by write faults or by
+ * sys_write(), go on their file's list of dirty pages in the order
+ * they became dirty, and files with dirty pages go on a list of
+ * their own. A writeback thread writes back pages that have been
+ * dirty for long enough, and any pages while too much of memory
+ * is dirty. Closing or syncing a file then only writes back what
+ * was dirtied since.
+ *
+ * A page that was mapped writeable is unmapped from tasks as it is
+ * written back, so that the next write faults and dirties it again.
+ *
+ * The writeback thread sleeps in a receive with a timeout, and
+ * runs a pass each time the interval runs out, whether requests
+ * come in or not. The main thread reads the clock after each
+ * request, so that pages are stamped as they are dirtied, and
+ * asks for a pass right away if too much memory is dirty. The
+ * writeback thread holds vm_lock for a page at a time, so that
+ * workers and the main thread go on between pages. Writing a page
+ * to the vfs only touches blocks of pages in the cache, which
+ * workers never read from the vfs.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4/macros.h>
+#include <l4/lib/list.h>
+#include <l4/api/errno.h>
+#include <l4/generic/time.h>
+#include L4LIB_INC_ARCH(syscalls.h)
+#include L4LIB_INC_ARCH(syslib.h)
+#include <l4lib/lib/thread.h>
+#include <l4lib/time.h>
+#include <stdio.h>
+#include <fs.h>
+#include <vm_area.h>
+#include <physmem.h>
+#include <worker.h>
+#include <writeback.h>
+
+struct writeback_tunables writeback_tunables = {
+	.age_ms = WRITEBACK_AGE_MS,
+	.interval_ms = WRITEBACK_INTERVAL_MS,
+	.ratio = WRITEBACK_RATIO,
+};
+
+/* Files with dirty pages, in the order they were dirtied */
+static LINK_DECLARE(dirty_files);
+static int nr_dirty;
+
+/* Writeback clock in milliseconds */
+static unsigned long wb_now;
+
+/*
+ * Busy is set by the main thread from asking for a pass until the
+ * pass is reported done. Running is set by the writeback thread
+ * while a pass of its own runs. Both are under wb_lock.
+ */
+static struct l4_thread *wb_thread;
+static L4_MUTEX(wb_lock);
+static int wb_busy;
+static int wb_running;
+
+/*
+ * Marks a page dirty. Pages of vfs files go on their file's
+ * list of dirty pages, unless they are there already.
+ */
+void page_set_dirty(struct page *page)
+{
+	struct vm_object *obj = page->owner;
+	struct vm_file *f;
+
+	page->flags |= VM_DIRTY;
+	obj->flags |= VM_DIRTY;
+
+	if (!(obj->flags & VM_OBJ_FILE))
+		return;
+	f = vm_object_to_file(obj);
+	if (f->type != VM_FILE_VFS || !list_empty(&page->dirty))
+		return;
+
+	page->dirtied = wb_now;
+	if (list_empty(&f->dirty_pages))
+		list_insert_tail(&f->dirty_list, &dirty_files);
+	list_insert_tail(&page->dirty, &f->dirty_pages);
+	nr_dirty++;
+}
+
+/* Marks a page clean, as it is written back or dropped */
+void page_clear_dirty(struct page *page)
+{
+	struct vm_object *obj = page->owner;
+	struct vm_file *f;
+
+	page->flags &= ~VM_DIRTY;
+	if (list_empty(&page->dirty))
+		return;
+
+	f = vm_object_to_file(obj);
+	list_remove_init(&page->dirty);
+	BUG_ON(--nr_dirty < 0);
+
+	/* The file has nothing left to flush */
+	if (list_empty(&f->dirty_pages)) {
+		list_remove_init(&f->dirty_list);
+		obj->flags &= ~VM_DIRTY;
+	}
+}
+
+static int writeback_over_ratio(void)
+{
+	unsigned long total = __pfn(membank[0].end - membank[0].start);
+
+	return nr_dirty * 100UL > total * writeback_tunables.ratio;
+}
+
+/* Puts a file behind the others, the rest of its pages are younger */
+static void writeback_skip_file(struct vm_file *f)
+{
+	list_remove(&f->dirty_list);
+	list_insert_tail(&f->dirty_list, &dirty_files);
+}
+
+/*
+ * Writes back the oldest page of the file at the head of the list
+ * while it is old enough, or while too much memory is dirty. Each
+ * dirty page at the start is looked at once at most.
+ */
+static void writeback_pages(unsigned long now)
+{
+	struct vm_file *f;
+	struct page *page;
+	int err;
+
+	l4_mutex_lock(&vm_lock);
+
+	for (int scan = nr_dirty; scan > 0 && !list_empty(&dirty_files);
+	     scan--) {
+		f = link_to_struct(dirty_files.next, struct vm_file,
+				   dirty_list);
+		page = link_to_struct(f->dirty_pages.next, struct page, dirty);
+
+		if (!writeback_over_ratio() &&
+		    (long)(now - page->dirtied) <
+		    (long)writeback_tunables.age_ms) {
+			writeback_skip_file(f);
+			continue;
+		}
+
+		/* A write is extending the file, which has no length yet */
+		if (page->offset >= __pfn(page_align_up(f->length))) {
+			writeback_skip_file(f);
+			continue;
+		}
+
+		if ((err = f->vm_obj.pager->ops.page_out(&f->vm_obj,
+							 page->offset)) < 0) {
+			printf("%s: Could not write back page %lu of file "
+			       "with vnum: 0x%lx. err=%d\n", __TASKNAME__,
+			       page->offset, f->vnode->vnum, err);
+			writeback_skip_file(f);
+			continue;
+		}
+
+		/* Let others in between pages */
+		l4_mutex_unlock(&vm_lock);
+		l4_mutex_lock(&vm_lock);
+	}
+
+	l4_mutex_unlock(&vm_lock);
+}
+
+static void writeback_clock_update(void)
+{
+	struct timeval tv;
+
+	l4_gettime(&tv);
+	wb_now = tv.tv_sec * 1000UL + tv.tv_usec / 1000;
+}
+
+/*
+ * Passes of its own are not reported, so that the main thread,
+ * which may have asked for a pass in the meantime, is never
+ * sending to us while we send to it.
+ */
+static int writeback_thread(void *arg)
+{
+	int err;
+
+	for (;;) {
+		/* Wait to be asked for a pass, or until one is due */
+		err = l4_receive_timeout(mm0_main_tid,
+					 writeback_tunables.interval_ms);
+		if (err == -ETIMEDOUT) {
+			/* A pass the main thread asked for is next, skip ours */
+			l4_mutex_lock(&wb_lock);
+			if (wb_busy) {
+				l4_mutex_unlock(&wb_lock);
+				continue;
+			}
+			wb_running = 1;
+			l4_mutex_unlock(&wb_lock);
+
+			writeback_clock_update();
+			writeback_pages(wb_now);
+
+			l4_mutex_lock(&wb_lock);
+			wb_running = 0;
+			l4_mutex_unlock(&wb_lock);
+			continue;
+		}
+		if (err < 0)
+			goto out_err;
+
+		writeback_pages(wb_now);
+
+		/* Report back to the main thread */
+		if ((err = l4_send_short(mm0_main_tid, 0, 1)) < 0)
+			goto out_err;
+	}
+
+out_err:
+	printf("%s: Writeback ipc error: %d. Quitting...\n",
+	       __TASKNAME__, err);
+	BUG();
+	return err;
+}
+
+/*
+ * Called by the main thread after each request. Starts a pass
+ * right away if too much memory is dirty, others are started by
+ * the writeback thread as its interval runs out.
+ */
+void writeback_poll(void)
+{
+	int err;
+
+	/* The clock is in the kip, reading it is cheap */
+	writeback_clock_update();
+
+	if (!writeback_over_ratio())
+		return;
+
+	l4_mutex_lock(&wb_lock);
+	if (wb_busy || wb_running) {
+		l4_mutex_unlock(&wb_lock);
+		return;
+	}
+	wb_busy = 1;
+	l4_mutex_unlock(&wb_lock);
+
+	if ((err = l4_send_short(wb_thread->ids.tid, 0, 1)) < 0) {
+		printf("%s: Writeback ipc error: %d.\n", __TASKNAME__, err);
+		BUG();
+	}
+}
+
+/* Returns 1 if sender is the writeback thread reporting a pass done */
+int writeback_done(l4id_t sender)
+{
+	if (!wb_thread || sender != wb_thread->ids.tid)
+		return 0;
+
+	l4_mutex_lock(&wb_lock);
+	wb_busy = 0;
+	l4_mutex_unlock(&wb_lock);
+	return 1;
+}
+
+void writeback_init(void)
+{
+	int err;
+
+	writeback_clock_update();
+
+	if ((err = thread_create(writeback_thread, 0, TC_SHARE_SPACE,
+				 &wb_thread)) < 0) {
+		printf("%s: Could not create writeback thread. "
+		       "err=%d\n", __TASKNAME__, err);
+		BUG();
+	}
+}
@@ -20,6 +20,8 @@ void ipc_extended_test(void);
 
 int shmtest(void);
 int forktest(void);
+int forkperf(void);
+int cowtest(void);
 int mmaptest(void);
 int dirtest(void);
 int fileio(void);
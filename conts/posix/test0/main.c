@@ -65,6 +65,12 @@ int main(int argc, char *argv[])
 	if (parent_of_all == getpid()) {
 		user_mutex_test();
 	}
+	if (parent_of_all == getpid()) {
+		forkperf();
+	}
+	if (parent_of_all == getpid()) {
+		cowtest();
+	}
 
 	exectest(parent_of_all);
 
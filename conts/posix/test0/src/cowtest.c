@@ -0,0 +1,81 @@
+/*
+ * Concurrent copy-on-write test.
+ *
+ * A parent and its child write every page of a private mapping they
+ * share after a fork, so that their faults are served at the same
+ * time. Whichever finishes first has a shadow that covers the one they
+ * share, and drops it, which merges its pages into the shadow of the
+ * other while that one still copies pages. Each then checks that it
+ * reads back what it wrote.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <tests.h>
+#include INC_GLUE(memory.h)
+
+#define COWTEST_PAGES			64
+#define COWTEST_ROUNDS			8
+
+static void cowtest_fill(char *area, char val)
+{
+	for (int i = 0; i < COWTEST_PAGES; i++) {
+		area[i * PAGE_SIZE] = val + i;
+		area[i * PAGE_SIZE + PAGE_SIZE - 1] = val + i;
+	}
+}
+
+static int cowtest_check(char *area, char val)
+{
+	for (int i = 0; i < COWTEST_PAGES; i++)
+		if (area[i * PAGE_SIZE] != (char)(val + i) ||
+		    area[i * PAGE_SIZE + PAGE_SIZE - 1] != (char)(val + i))
+			return -1;
+	return 0;
+}
+
+int cowtest(void)
+{
+	char *area;
+	pid_t pid;
+
+	if ((area = mmap(0, COWTEST_PAGES * PAGE_SIZE,
+			 PROT_READ | PROT_WRITE,
+			 MAP_ANONYMOUS | MAP_PRIVATE, 0, 0)) == MAP_FAILED) {
+		test_printf("MMAP failed.\n");
+		goto out_err;
+	}
+
+	for (int i = 0; i < COWTEST_ROUNDS; i++) {
+		/* Give the shadow the child will share all of the pages */
+		cowtest_fill(area, 'a');
+
+		if ((pid = fork()) < 0)
+			goto out_err;
+
+		/* Parent and child now fault on the same shadow chain */
+		cowtest_fill(area, pid ? 'p' : 'c');
+
+		if (cowtest_check(area, pid ? 'p' : 'c') < 0) {
+			test_printf("%d: Read back other task's pages.\n",
+				    getpid());
+			goto out_err;
+		}
+
+		/* Child leaves once its pages are checked */
+		if (pid == 0)
+			_exit(0);
+	}
+
+	printf("COW TEST            -- PASSED --\n");
+	return 0;
+
+out_err:
+	printf("COW TEST            -- FAILED --\n");
+	if (getpid() != parent_of_all)
+		_exit(1);
+	return 0;
+}
@@ -200,6 +200,23 @@ int dirtest(void)
 	if (lsdir("/usr/./././bin//") < 0)
 		goto out_err;
 
+	/* A name that was not found must be found once it is created */
+	test_printf("\nLooking up missing /usr/lib twice, then creating it\n");
+	if (open("/usr/lib", O_RDONLY) >= 0 || open("/usr/lib", O_RDONLY) >= 0) {
+		test_printf("OPEN of missing directory succeeded.\n");
+		goto out_err;
+	}
+	if (mkdir("/usr/lib", 0) < 0) {
+		test_printf("MKDIR: %d\n", errno);
+		goto out_err;
+	}
+	if (mkdir("/usr/lib", 0) >= 0) {
+		test_printf("MKDIR of existing directory succeeded.\n");
+		goto out_err;
+	}
+	if (lsdir("/usr/lib") < 0)
+		goto out_err;
+
 	printf("DIR TEST            -- PASSED --\n");
 	return 0;
 
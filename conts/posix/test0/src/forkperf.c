@@ -0,0 +1,72 @@
+/*
+ * Fork latency test.
+ *
+ * Measures fork() with a number of dirty private pages in the
+ * parent. Forked children exit right away, so the time is that
+ * of creating the child and write-protecting the parent.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <tests.h>
+#include INC_GLUE(memory.h)
+
+#define FORKPERF_PAGES			64
+#define FORKPERF_FORKS			16
+
+static unsigned long tv_to_usec(struct timeval *tv)
+{
+	return tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+int forkperf(void)
+{
+	unsigned long usec, min = ~0UL, max = 0, total = 0;
+	struct timeval start, end;
+	char *area;
+	pid_t pid;
+
+	if ((area = mmap(0, FORKPERF_PAGES * PAGE_SIZE,
+			 PROT_READ | PROT_WRITE,
+			 MAP_ANONYMOUS | MAP_PRIVATE, 0, 0)) == MAP_FAILED) {
+		test_printf("MMAP failed.\n");
+		goto out_err;
+	}
+
+	for (int i = 0; i < FORKPERF_FORKS; i++) {
+		/* Dirty all pages, so that they are writable again */
+		for (int j = 0; j < FORKPERF_PAGES; j++)
+			area[j * PAGE_SIZE] = i;
+
+		gettimeofday(&start, 0);
+		if ((pid = fork()) < 0)
+			goto out_err;
+
+		/* Child leaves right away */
+		if (pid == 0)
+			_exit(0);
+		gettimeofday(&end, 0);
+
+		usec = tv_to_usec(&end) - tv_to_usec(&start);
+		total += usec;
+		if (usec < min)
+			min = usec;
+		if (usec > max)
+			max = usec;
+	}
+
+	printf("PERFMON: %s with %d dirty pages took %lu min, %lu max, "
+	       "%lu avg, %lu total microseconds in %d ops.\n",
+	       "fork()", FORKPERF_PAGES, min, max,
+	       total / FORKPERF_FORKS, total, FORKPERF_FORKS);
+	printf("FORK PERF TEST      -- PASSED --\n");
+	return 0;
+
+out_err:
+	printf("FORK PERF TEST      -- FAILED --\n");
+	return 0;
+}
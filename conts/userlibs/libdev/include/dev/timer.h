@@ -20,4 +20,12 @@ void timer_init_oneshot(unsigned long timer_base);
 void timer_init_periodic(unsigned long timer_base, u32 load_value);
 void timer_init(unsigned long timer_base, u32 load_value);
 
+/*
+ * A device with two timers may have one count time while
+ * the other gives one-shot events.
+ */
+unsigned long timer_secondary_base(unsigned long timer_base);
+void timer_init_freerun(unsigned long timer_base);
+void timer_oneshot(unsigned long timer_base, u32 load_value);
+
 #endif /* __LIBDEV_TIMER_H__ */
@@ -9,6 +9,11 @@
 #include <l4lib/types.h>
 #include "timer.h"
 
+unsigned long timer_secondary_base(unsigned long timer_base)
+{
+	return timer_base + SP804_SECONDARY_OFFSET;
+}
+
 /* Enable timer with its current configuration */
 void timer_start(unsigned long timer_base)
 {
@@ -61,6 +66,24 @@ void timer_init_oneshot(unsigned long timer_base)
 	write(reg, timer_base + SP804_CTRL);
 }
 
+/* Free running, 32 bit, no irqs, wraps from 0 back to 0xFFFFFFFF */
+void timer_init_freerun(unsigned long timer_base)
+{
+	write(SP804_32BIT, timer_base + SP804_CTRL);
+	timer_load(0xFFFFFFFF, timer_base);
+}
+
+/* One shot, 32 bit, irq once after load_value ticks */
+void timer_oneshot(unsigned long timer_base, u32 load_value)
+{
+	u32 reg = SP804_ONESHOT | SP804_32BIT | SP804_IRQEN;
+
+	/* Stop the timer before reloading it */
+	write(reg, timer_base + SP804_CTRL);
+	timer_load(load_value, timer_base);
+	write(reg | SP804_ENABLE, timer_base + SP804_CTRL);
+}
+
 void timer_init(unsigned long timer_base, u32 load_value)
 {
 	timer_stop(timer_base);
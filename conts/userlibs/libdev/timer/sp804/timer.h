@@ -24,6 +24,8 @@
 #define SP804_32BIT			(1 << 1)
 #define SP804_ONESHOT			(1 << 0)
 
+#define SP804_SECONDARY_OFFSET		0x20
+
 /* Timer prescaling */
 #define SP804_SCALE_SHIFT		2
 #define SP804_SCALE_DIV16		1
@@ -52,12 +54,15 @@ void sp804_enable(unsigned long timer_base)
 	write(reg | SP804_ENABLE, timer_base + SP804_CTRL);
 }
 
+unsigned long timer_secondary_base(unsigned long timer_base);
 void timer_start(unsigned long timer_base);
 void timer_load(u32 loadval, unsigned long timer_base);
 u32 timer_read(unsigned long timer_base);
 void timer_stop(unsigned long timer_base);
 void timer_init_periodic(unsigned long timer_base, u32 load_value);
 void timer_init_oneshot(unsigned long timer_base);
+void timer_init_freerun(unsigned long timer_base);
+void timer_oneshot(unsigned long timer_base, u32 load_value);
 void timer_init(unsigned long timer_base, u32 load_value);
 
 #endif /* __SP804_TIMER_H__ */
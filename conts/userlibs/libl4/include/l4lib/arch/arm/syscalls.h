@@ -61,10 +61,9 @@ typedef int (*__l4_irq_control_t)(unsigned int req, unsigned int flags, l4id_t i
 extern __l4_irq_control_t __l4_irq_control;
 int l4_irq_control(unsigned int req, unsigned int flags, l4id_t id);
 
-typedef int (*__l4_ipc_control_t)(unsigned int action, l4id_t blocked_sender,
-				  u32 blocked_tag);
+typedef int (*__l4_ipc_control_t)(unsigned int req, l4id_t tid, u32 arg);
 extern __l4_ipc_control_t __l4_ipc_control;
-int l4_ipc_control(unsigned int, l4id_t blocked_sender, u32 blocked_tag);
+int l4_ipc_control(unsigned int req, l4id_t tid, u32 arg);
 
 typedef int (*__l4_exchange_registers_t)(void *exregs_struct, l4id_t tid);
 extern __l4_exchange_registers_t __l4_exchange_registers;
@@ -86,6 +85,15 @@ typedef int (*__l4_cache_control_t)(void *start, void *end, unsigned int flags);
 extern __l4_cache_control_t __l4_cache_control;
 int l4_cache_control(void *start, void *end, unsigned int flags);
 
+typedef int (*__l4_map_batch_t)(struct map_desc *desc, int ndesc,
+				unsigned int op, l4id_t tid);
+extern __l4_map_batch_t __l4_map_batch;
+int l4_map_batch(struct map_desc *desc, int ndesc, unsigned int op, l4id_t tid);
+
+typedef int (*__l4_trace_control_t)(unsigned int req, void *virt);
+extern __l4_trace_control_t __l4_trace_control;
+int l4_trace_control(unsigned int req, void *virt);
+
 /* To be supplied by server tasks. */
 void *virt_to_phys(void *);
 void *phys_to_virt(void *);
@@ -83,6 +83,15 @@ static inline unsigned int l4_get_ipc_msg_index(unsigned int word)
 	       >> L4_IPC_FLAGS_MSG_INDEX_SHIFT;
 }
 
+/* Marks only the first nmrs primary message registers for transfer */
+static inline unsigned int l4_set_ipc_nmrs(unsigned int word, unsigned int nmrs)
+{
+	word &= ~L4_IPC_FLAGS_NMRS_MASK;
+	word |= L4_IPC_FLAGS_NMRS_VALID |
+		((nmrs << L4_IPC_FLAGS_NMRS_SHIFT) & L4_IPC_FLAGS_NMRS_MASK);
+	return word;
+}
+
 static inline unsigned int l4_set_ipc_flags(unsigned int word, unsigned int flags)
 {
 	word &= ~L4_IPC_FLAGS_TYPE_MASK;
@@ -236,6 +245,50 @@ static inline int l4_receive_extended(l4id_t from, unsigned int size, void *buf)
 	return l4_ipc(L4_NILTHREAD, from, flags);
 }
 
+/*
+ * Direct extended IPC copies once between the user buffers of
+ * both parties, and may be up to L4_IPC_DIRECT_MAX_SIZE bytes.
+ * The buffer pointer and size are passed in two consecutive MRs.
+ */
+static inline int l4_send_direct(l4id_t to, unsigned int tag,
+				 unsigned int size, void *buf)
+{
+	unsigned int flags = 0;
+
+	l4_set_tag(tag);
+
+	/* Set up flags word for direct ipc */
+	flags = l4_set_ipc_flags(flags, L4_IPC_FLAGS_DIRECT);
+	flags = l4_set_ipc_msg_index(flags, L4SYS_ARG0);
+
+	/* Write buffer pointer and size to MR index that we specified */
+	write_mr(L4SYS_ARG0, (unsigned long)buf);
+	write_mr(L4SYS_ARG1, size);
+
+	return l4_ipc(to, L4_NILTHREAD, flags);
+}
+
+/*
+ * Receives into buf up to size bytes. On return the
+ * number of bytes received is in MR L4SYS_ARG1.
+ */
+static inline int l4_receive_direct(l4id_t from, unsigned int size, void *buf)
+{
+	unsigned int flags = 0;
+
+	/* Indicate direct receive */
+	flags = l4_set_ipc_flags(flags, L4_IPC_FLAGS_DIRECT);
+
+	/* Indicate which MR index buffer pointer is stored */
+	flags = l4_set_ipc_msg_index(flags, L4SYS_ARG0);
+
+	/* Set MRs with buffer and size to receive data */
+	write_mr(L4SYS_ARG0, (unsigned long)buf);
+	write_mr(L4SYS_ARG1, size);
+
+	return l4_ipc(L4_NILTHREAD, from, flags);
+}
+
 /*
  * Return result value as extended IPC.
  *
@@ -300,6 +353,38 @@ static inline int l4_receive(l4id_t from)
 	return l4_ipc(L4_NILTHREAD, from, 0);
 }
 
+/* Receives as above, giving up with -ETIMEDOUT after msecs */
+static inline int l4_receive_timeout(l4id_t from, unsigned int msecs)
+{
+	int err;
+
+	if ((err = l4_ipc_control(IPC_CONTROL_RECV_TIMEOUT,
+				  L4_NILTHREAD, msecs)) < 0)
+		return err;
+
+	return l4_receive(from);
+}
+
+/*
+ * Short sends that only transfer the first nmrs message
+ * registers, MR_TAG included, e.g. for notifications and acks.
+ */
+static inline int l4_send_short(l4id_t to, unsigned int tag, int nmrs)
+{
+	l4_set_tag(tag);
+
+	return l4_ipc(to, L4_NILTHREAD, l4_set_ipc_nmrs(0, nmrs));
+}
+
+static inline int l4_sendrecv_short(l4id_t to, l4id_t from,
+				    unsigned int tag, int nmrs)
+{
+	BUG_ON(to == L4_NILTHREAD || from == L4_NILTHREAD);
+	l4_set_tag(tag);
+
+	return l4_ipc(to, from, l4_set_ipc_nmrs(0, nmrs));
+}
+
 static inline void l4_print_mrs()
 {
 	printf("Message registers: 0x%x, 0x%x, 0x%x, 0x%x, 0x%x, 0x%x\n",
@@ -352,6 +437,67 @@ static inline void *l4_unmap_helper(void *virt, int npages)
 	return 0;
 }
 
+/*
+ * Collects mappings for a single address space, and issues them
+ * with as few batched map calls as possible. Pages that continue
+ * the previous range both physically and virtually are merged.
+ */
+struct l4_map_batch {
+	struct map_desc desc[MAP_BATCH_MAX];
+	int ndesc;
+	l4id_t tid;
+};
+
+static inline void l4_map_batch_init(struct l4_map_batch *batch, l4id_t tid)
+{
+	batch->ndesc = 0;
+	batch->tid = tid;
+}
+
+static inline int l4_map_batch_flush(struct l4_map_batch *batch)
+{
+	int err = 0;
+
+	if (batch->ndesc)
+		err = l4_map_batch(batch->desc, batch->ndesc,
+				   MAP_BATCH_MAP, batch->tid);
+	batch->ndesc = 0;
+	return err;
+}
+
+static inline int l4_map_batch_add(struct l4_map_batch *batch, void *phys,
+				   void *virt, unsigned long npages,
+				   unsigned int flags)
+{
+	struct map_desc *last;
+	int err;
+
+	/* Extend the last range if this one carries on from it */
+	if (batch->ndesc) {
+		last = &batch->desc[batch->ndesc - 1];
+		if (last->flags == flags &&
+		    last->phys + last->npages * PAGE_SIZE ==
+		    (unsigned long)phys &&
+		    last->virt + last->npages * PAGE_SIZE ==
+		    (unsigned long)virt) {
+			last->npages += npages;
+			return 0;
+		}
+	}
+
+	if (batch->ndesc == MAP_BATCH_MAX)
+		if ((err = l4_map_batch_flush(batch)) < 0)
+			return err;
+
+	batch->desc[batch->ndesc].phys = (unsigned long)phys;
+	batch->desc[batch->ndesc].virt = (unsigned long)virt;
+	batch->desc[batch->ndesc].npages = npages;
+	batch->desc[batch->ndesc].flags = flags;
+	batch->ndesc++;
+
+	return 0;
+}
+
 #define L4_EXIT_MASK		0xFFFF
 
 static inline void l4_exit(unsigned int exit_code)
@@ -73,5 +73,6 @@ extern l4id_t pagerid;
 #define L4_IPC_TAG_TIMER_GETTIME				55
 #define L4_IPC_TAG_TIMER_SLEEP				56
 #define L4_IPC_TAG_TIMER_WAKE_THREADS		57
+#define L4_IPC_TAG_TIMER_SLEEP_USEC			58
 
 #endif /* __IPCDEFS_H__ */
@@ -19,6 +19,7 @@
 #define CAP_TYPE_UMUTEX		(1 << 6)
 #define CAP_TYPE_QUANTITY	(1 << 7)
 #define CAP_TYPE_CAP		(1 << 8)
+#define CAP_TYPE_TRACE		(1 << 9)
 #define cap_type(c)	((c)->type & CAP_TYPE_MASK)
 
 /*
@@ -144,5 +145,9 @@
 #define CAP_CAP_MODIFY		(CAP_CAP_DEDUCE | CAP_CAP_SPLIT \
 				 | CAP_CAP_DESTROY)
 
+/* Kernel event trace capability */
+#define CAP_TRACE_MAP		(1 << 0)
+#define CAP_TRACE_CONTROL	(1 << 1)
+
 
 #endif /* __CAP_TYPES_H__ */
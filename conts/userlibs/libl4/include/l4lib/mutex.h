@@ -35,6 +35,10 @@ int l4_mutex_unlock(struct l4_mutex *m);
  */
 #define L4_MUTEX_LOCKED			0
 #define L4_MUTEX_UNLOCKED		-1
+
+/* Rounds a locker watches a held mutex before sleeping in the kernel */
+#define L4_MUTEX_SPIN			1000
+
 #define L4_MUTEX(m)	\
 	struct l4_mutex m = { L4_MUTEX_UNLOCKED }
 
@@ -0,0 +1,15 @@
+/*
+ * Reading the time without entering the kernel.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __L4LIB_TIME_H__
+#define __L4LIB_TIME_H__
+
+#include <l4lib/kip.h>
+
+extern struct kip_clock *kip_clock_ref;
+
+int l4_gettime(void *timeval);
+
+#endif /* __L4LIB_TIME_H__ */
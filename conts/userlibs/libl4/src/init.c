@@ -25,6 +25,8 @@ __l4_capability_control_t __l4_capability_control = 0;
 __l4_time_t __l4_time = 0;
 __l4_mutex_control_t __l4_mutex_control = 0;
 __l4_cache_control_t __l4_cache_control = 0;
+__l4_map_batch_t __l4_map_batch = 0;
+__l4_trace_control_t __l4_trace_control = 0;
 
 struct kip *kip;
 
@@ -36,6 +38,9 @@ l4id_t pagerid;
  */
 struct utcb **kip_utcb_ref;
 
+/* Time of day kept by the kernel, see l4_gettime() */
+struct kip_clock *kip_clock_ref;
+
 
 void __l4_init(void)
 {
@@ -65,5 +70,9 @@ void __l4_init(void)
 	__l4_time =		(__l4_time_t)kip->time;
 	__l4_mutex_control =	(__l4_mutex_control_t)kip->mutex_control;
 	__l4_cache_control =	(__l4_cache_control_t)kip->cache_control;
+	__l4_map_batch =	(__l4_map_batch_t)kip->map_batch;
+	__l4_trace_control =	(__l4_trace_control_t)kip->trace_control;
+
+	kip_clock_ref =		(struct kip_clock *)kip->clock;
 }
 
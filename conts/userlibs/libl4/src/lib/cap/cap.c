@@ -111,6 +111,9 @@ void cap_print(struct capability *cap)
 	case CAP_TYPE_IRQCTRL:
 		printf("Capability type:\t\t%s\n", "IRQ Control");
 		break;
+	case CAP_TYPE_TRACE:
+		printf("Capability type:\t\t%s\n", "Trace");
+		break;
 	case CAP_TYPE_QUANTITY:
 		printf("Capability type:\t\t%s\n", "Quantitative");
 		break;
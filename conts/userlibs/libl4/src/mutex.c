@@ -49,6 +49,17 @@
  *   is no guarantee that that would in turn wake up others.
  *   It might even quit attempting to take the lock.
  * - Whether this is the best design - time will tell.
+ *
+ * Spinning:
+ *
+ * On SMP the holder may be running on another cpu, and about to
+ * release the lock. A contended locker then first watches the lock
+ * word for a bounded number of rounds before entering the kernel.
+ * The word is only read while spinning, as every failed lock
+ * attempt counts as a contention that must rendezvous in the kernel.
+ * The lock word doesn't tell who holds it, so once others are found
+ * sleeping on the lock, the holder is assumed to be slow and there
+ * is no spinning.
  */
 
 extern int __l4_mutex_lock(void *word);
@@ -59,10 +70,35 @@ void l4_mutex_init(struct l4_mutex *m)
 	m->lock = L4_MUTEX_UNLOCKED;
 }
 
+#if defined(CONFIG_SMP)
+/* Waits a while for a held lock to look free */
+static void l4_mutex_spin(struct l4_mutex *m)
+{
+	volatile int *word = &m->lock;
+	int val;
+
+	for (int i = 0; i < L4_MUTEX_SPIN; i++) {
+		if ((val = *word) == L4_MUTEX_UNLOCKED)
+			return;
+
+		/* Others are asleep, the holder is slow to release */
+		if (val != L4_MUTEX_LOCKED)
+			return;
+	}
+}
+#else
+/* The holder can't run while we spin */
+static inline void l4_mutex_spin(struct l4_mutex *m) { }
+#endif
+
 int l4_mutex_lock(struct l4_mutex *m)
 {
 	int err;
 
+	/* Give a running holder the chance to release it first */
+	if (m->lock != L4_MUTEX_UNLOCKED)
+		l4_mutex_spin(m);
+
 	while(__l4_mutex_lock(&m->lock) != L4_MUTEX_SUCCESS) {
 		if ((err = l4_mutex_control(&m->lock, L4_MUTEX_LOCK)) < 0) {
 			printf("%s: Error: %d\n", __FUNCTION__, err);
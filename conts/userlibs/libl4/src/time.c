@@ -0,0 +1,66 @@
+/*
+ * Time of day from the kip clock
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4lib/time.h>
+#include <l4lib/types.h>
+#include L4LIB_INC_ARCH(syscalls.h)
+
+/* Same layout as the kernel's */
+struct l4_timeval {
+	int tv_sec;
+	int tv_usec;
+};
+
+/*
+ * Orders reads of the clock against the kernel's updates. On a
+ * single cpu the kernel only writes it on irqs, which are ordered
+ * with this cpu's reads already.
+ */
+static inline void clock_read_barrier(void)
+{
+#if defined (CONFIG_SMP)
+	__asm__ __volatile__ (
+		"mcr	p15, 0, %0, c7, c10, 5\n"
+		:: "r" (0) : "memory"
+	);
+#else
+	__asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+/*
+ * Gets the time of day as l4_time() does, but by reading the
+ * clock that the kernel keeps in the kip.
+ */
+int l4_gettime(void *timeval)
+{
+	volatile struct kip_clock *clock = kip_clock_ref;
+	struct l4_timeval *tv = timeval;
+	u32 seq, sec, usec;
+
+	/* No clock in the kip, ask the kernel */
+	if (!clock)
+		return l4_time(timeval, 0);
+
+	do {
+		seq = clock->seq;
+		clock_read_barrier();
+
+		sec = clock->sec;
+		usec = clock->usec;
+
+		/* Time since the kernel last updated it */
+		if (clock->counter)
+			usec += ~*(volatile u32 *)clock->counter -
+				clock->stamp;
+
+		clock_read_barrier();
+	} while ((seq & 1) || seq != clock->seq);
+
+	tv->tv_sec = sec + usec / 1000000;
+	tv->tv_usec = usec % 1000000;
+
+	return 0;
+}
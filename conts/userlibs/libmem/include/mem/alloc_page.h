@@ -3,21 +3,33 @@
 
 #include <mem/memcache.h>
 
-/* List member to keep track of free and unused physical pages.
- * Has PAGE_SIZE granularity */
-struct page_area {
-	struct link list;
-	unsigned int used;	/* Used or free */
-	unsigned int pfn;	/* Base pfn */
-	unsigned int numpages;	/* Number of pages this region covers */
-	struct mem_cache *cache;/* The cache used when freeing the page area for
-				 * quickly finding where the area is stored. */
+/* Largest block is 2^(PAGE_ALLOC_ORDERS - 1) pages */
+#define PAGE_ALLOC_ORDERS	20
+
+/* Set in the state of a page that heads a free block */
+#define PAGE_BLOCK_FREE		(1U << 31)
+
+/*
+ * One per allocatable page. The state of a page heading a free
+ * block is PAGE_BLOCK_FREE | order, and that of a page heading
+ * an allocation is its number of pages. All others are zero.
+ */
+struct page_block {
+	struct link list;	/* Free list of its order, if a free head */
+	unsigned int state;
 };
 
+/*
+ * Binary buddy allocator. Free blocks of each power-of-two
+ * size are kept on their order's list, and a block's buddy is
+ * found by flipping the bit of its order in its page index.
+ */
 struct page_allocator {
-	struct link page_area_list;
-	struct link pga_cache_list;
-	int pga_free;
+	unsigned long start_pfn;	/* First pfn allocated from */
+	unsigned long npages;		/* Number of pages from start_pfn */
+	unsigned long free_pages;	/* Number of pages free */
+	struct page_block *blocks;	/* Per-page state, npages long */
+	struct link free_list[PAGE_ALLOC_ORDERS];
 };
 
 /* Initialises the page allocator */
@@ -26,5 +38,6 @@ void init_page_allocator(unsigned long start, unsigned long end);
 /* Page allocation functions */
 void *alloc_page(int quantity);
 int free_page(void *paddr);
+unsigned long alloc_page_nfree(void);
 
 #endif /* __ALLOC_PAGE_H__ */
@@ -6,6 +6,7 @@
 
 void *kmalloc(size_t size);
 void kfree(void *blk);
+void *krealloc(void *blk, size_t size);
 
 static inline void *kzalloc(size_t size)
 {
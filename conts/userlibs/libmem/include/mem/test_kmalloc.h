@@ -1,8 +1,10 @@
 #ifndef __TEST_KMALLOC_H__
 #define __TEST_KMALLOC_H__
 
-#include <kmem/kmalloc.h>
+#include <mem/malloc.h>
 
 void test_kmalloc(int num_allocs, int allocs_max, FILE *initstate, FILE *exitstate);
+void test_kmalloc_perf(int num_allocs, int allocs_max, int ops);
+int test_kmalloc_small_then_large(void);
 
 #endif
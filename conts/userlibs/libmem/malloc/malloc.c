@@ -19,14 +19,24 @@ Messages that indicate a software error will contain three asterisks (***).
 #include <string.h> /* memcpy(), memset() */
 #include <stdio.h> /* printf() */
 #include <l4/macros.h>
+#include <mem/malloc.h>
+#include <mem/memcache.h>
 #define	_32BIT	1
 
+/* Size of a slab, and alignment of slabs within the heap */
+#define KMALLOC_SLAB_SIZE	4096
+
+/* Size classes are 16, 32, ..., 512 bytes, bigger ones use the heap list */
+#define KMALLOC_MIN_SHIFT	4
+#define KMALLOC_CLASSES		6
+#define KMALLOC_SLAB_MAX	(1 << (KMALLOC_MIN_SHIFT + KMALLOC_CLASSES - 1))
+
 /* use small (32K) heap for 16-bit compilers,
-large (500K) heap for 32-bit compilers */
+large (512K) heap for 32-bit compilers */
 #if defined(_32BIT)
-#define	HEAP_SIZE	500000uL
+#define	HEAP_SIZE	(128 * KMALLOC_SLAB_SIZE)
 #else
-#define	HEAP_SIZE	32768u
+#define	HEAP_SIZE	(8 * KMALLOC_SLAB_SIZE)
 #endif
 
 #define	MALLOC_MAGIC	0x6D92	/* must be < 0x8000 */
@@ -40,6 +50,31 @@ typedef struct _malloc		/* Turbo C	DJGPP */
 } malloc_t;		/* total   6 bytes	12 bytes */
 
 static char *g_heap_bot, *g_kbrk, *g_heap_top;
+
+/* Slabs are taken from the heap top downwards, g_slab_bot is the last */
+static char *g_slab_bot;
+
+static char heap[HEAP_SIZE] __attribute__((aligned(KMALLOC_SLAB_SIZE)));
+
+static void heap_init(void)
+{
+	if (g_heap_bot != NULL)
+		return;
+	g_heap_bot = g_kbrk = heap;
+	g_heap_top = g_slab_bot = g_heap_bot + HEAP_SIZE;
+}
+
+/*
+ * First block of the heap list, or NULL if there is none yet. The heap is
+ * set up by whichever of the slabs or the list comes first, so a non-NULL
+ * g_heap_bot does not mean a block has been written there.
+ */
+static inline malloc_t *heap_first(void)
+{
+	if (g_kbrk == g_heap_bot)
+		return NULL;
+	return (malloc_t *)g_heap_bot;
+}
 /*****************************************************************************
 *****************************************************************************/
 void dump_heap(void)
@@ -50,7 +85,7 @@ void dump_heap(void)
 	int total;
 
 	printf("===============================================\n");
-	for(m = (malloc_t *)g_heap_bot; m != NULL; m = m->next)
+	for(m = heap_first(); m != NULL; m = m->next)
 	{
 		printf("blk %5p: %6u bytes %s\n", m,
 			m->size, m->used ? "used" : "free");
@@ -69,8 +104,9 @@ void dump_heap(void)
 		blks_free, blks_used + blks_free);
 	printf("bytes: %6u used, %6u free, %6u total\n", bytes_used,
 		bytes_free, bytes_used + bytes_free);
-	printf("g_heap_bot=0x%p, g_kbrk=0x%p, g_heap_top=0x%p\n",
-		g_heap_bot, g_kbrk, g_heap_top);
+	printf("g_heap_bot=0x%p, g_kbrk=0x%p, g_slab_bot=0x%p, "
+		"g_heap_top=0x%p\n",
+		g_heap_bot, g_kbrk, g_slab_bot, g_heap_top);
 	total = (bytes_used + bytes_free) +
 			(blks_used + blks_free) * sizeof(malloc_t);
 	if(total != g_kbrk - g_heap_bot)
@@ -100,22 +136,16 @@ can you tell if you're
 *****************************************************************************/
 static void *kbrk(int *delta)
 {
-	static char heap[HEAP_SIZE];
-/**/
 	char *new_brk, *old_brk;
 
 /* heap doesn't exist yet */
-	if(g_heap_bot == NULL)
-	{
-		g_heap_bot = g_kbrk = heap;
-		g_heap_top = g_heap_bot + HEAP_SIZE;
-	}
+	heap_init();
 	new_brk = g_kbrk + (*delta);
 /* too low: return NULL */
 	if(new_brk < g_heap_bot)
 		return NULL;
-/* too high: return NULL */
-	if(new_brk >= g_heap_top)
+/* too high, i.e. into the slabs: return NULL */
+	if(new_brk >= g_slab_bot)
 		return NULL;
 /* success: adjust brk value... */
 	old_brk = g_kbrk;
@@ -126,9 +156,9 @@ static void *kbrk(int *delta)
 	return old_brk;
 }
 /*****************************************************************************
-kmalloc() and kfree() use g_heap_bot, but not g_kbrk nor g_heap_top
+kmalloc_large() and kfree_large() use the heap list, but not g_heap_top
 *****************************************************************************/
-void *kmalloc(size_t size)
+static void *kmalloc_large(size_t size)
 {
 	unsigned total_size;
 	malloc_t *m, *n;
@@ -138,8 +168,8 @@ void *kmalloc(size_t size)
 		return NULL;
 	total_size = size + sizeof(malloc_t);
 /* search heap for free block (FIRST FIT) */
-	m = (malloc_t *)g_heap_bot;
-/* g_heap_bot == 0 == NULL if heap does not yet exist */
+	m = heap_first();
+/* m == NULL if heap list does not yet have any blocks */
 	if(m != NULL)
 	{
 		if(m->magic != MALLOC_MAGIC)
@@ -148,19 +178,19 @@ void *kmalloc(size_t size)
 			printf("*** kernel heap is corrupt in kmalloc()\n");
 			return NULL;
 		}
-		for(; m->next != NULL; m = m->next)
+/* the last block is considered too, and m is left pointing at it */
+		for(;; m = m->next)
 		{
-			if(m->used)
-				continue;
 /* size == m->size is a perfect fit */
-			if(size == m->size)
-				m->used = 1;
-			else
+			if(!m->used && size == m->size)
 			{
+				m->used = 1;
+				return (char *)m + sizeof(malloc_t);
+			}
 /* otherwise, we need an extra sizeof(malloc_t) bytes for the header
 of a second, free block */
-				if(total_size > m->size)
-					continue;
+			if(!m->used && total_size <= m->size)
+			{
 /* create a new, smaller free block after this one */
 				n = (malloc_t *)((char *)m + total_size);
 				n->size = m->size - total_size;
@@ -171,8 +201,10 @@ of a second, free block */
 				m->size = size;
 				m->next = n;
 				m->used = 1;
+				return (char *)m + sizeof(malloc_t);
 			}
-			return (char *)m + sizeof(malloc_t);
+			if(m->next == NULL)
+				break;
 		}
 	}
 /* use kbrk() to enlarge (or create!) heap */
@@ -207,7 +239,7 @@ create a new, free block */
 
 /*****************************************************************************
 *****************************************************************************/
-void kfree(void *blk)
+static void kfree_large(void *blk)
 {
 	malloc_t *m, *n;
 
@@ -223,8 +255,8 @@ void kfree(void *blk)
 		return;
 	}
 /* find this block in the heap */
-	n = (malloc_t *)g_heap_bot;
-	if(n->magic != MALLOC_MAGIC)
+	n = heap_first();
+	if(n != NULL && n->magic != MALLOC_MAGIC)
 //		panic("kernel heap is corrupt in kfree()");
 	{
 		printf("*** kernel heap is corrupt in kfree()\n");
@@ -251,7 +283,7 @@ void kfree(void *blk)
 
 /* coalesce adjacent free blocks
 Hard to spell, hard to do */
-	for(m = (malloc_t *)g_heap_bot; m != NULL; m = m->next)
+	for(m = heap_first(); m != NULL; m = m->next)
 	{
 		while(!m->used && m->next != NULL && !m->next->used)
 		{
@@ -262,12 +294,153 @@ Hard to spell, hard to do */
 		}
 	}
 }
+/*****************************************************************************
+Size-class slabs
+
+Allocations of up to KMALLOC_SLAB_MAX bytes are rounded up to a power of
+two and served from a slab of that size class. A slab is a mem_cache over
+a KMALLOC_SLAB_SIZE aligned chunk, taken from the top of the heap while
+the list of large blocks above grows up from the bottom. kfree() tells
+them apart by address, and finds an object's slab by aligning it down.
+
+Each class keeps its slabs with free objects in front, so allocation only
+looks at the first one. Slabs that become empty are released for use by
+any class, except the last one of a class.
+*****************************************************************************/
+static struct link slab_class[KMALLOC_CLASSES];
+static struct link slab_free;
+static int slabs_initialised;
+
+static void slabs_init(void)
+{
+	heap_init();
+	for (int i = 0; i < KMALLOC_CLASSES; i++)
+		link_init(&slab_class[i]);
+	link_init(&slab_free);
+	slabs_initialised = 1;
+}
+
+static inline int size_to_class(size_t size)
+{
+	int class = 0;
+
+	while ((1 << (KMALLOC_MIN_SHIFT + class)) < size)
+		class++;
+	return class;
+}
+
+static inline int is_slab_object(void *blk)
+{
+	return (char *)blk >= g_slab_bot && (char *)blk < g_heap_top;
+}
+
+static inline struct mem_cache *slab_of(void *blk)
+{
+	return (struct mem_cache *)((unsigned long)blk &
+				    ~(KMALLOC_SLAB_SIZE - 1));
+}
+
+/* Gets an empty slab for @class, either a released one or a new one */
+static struct mem_cache *slab_new(int class)
+{
+	struct mem_cache *slab;
+	void *chunk;
+
+	if (!list_empty(&slab_free)) {
+		slab = link_to_struct(slab_free.next, struct mem_cache, list);
+		list_remove(&slab->list);
+		chunk = slab;
+	} else {
+		/* Carve a new one below the last, if the heap list allows */
+		if (g_slab_bot - KMALLOC_SLAB_SIZE < g_kbrk)
+			return NULL;
+		g_slab_bot -= KMALLOC_SLAB_SIZE;
+		chunk = g_slab_bot;
+	}
+
+	if (!(slab = mem_cache_init(chunk, KMALLOC_SLAB_SIZE,
+				    1 << (KMALLOC_MIN_SHIFT + class), 1)))
+		return NULL;
+	list_insert(&slab->list, &slab_class[class]);
+	return slab;
+}
+
+void *kmalloc(size_t size)
+{
+	struct mem_cache *slab;
+	struct link *head;
+	void *blk;
+
+	if(size == 0)
+		return NULL;
+	if (size > KMALLOC_SLAB_MAX)
+		return kmalloc_large(size);
+	if (!slabs_initialised)
+		slabs_init();
+
+	head = &slab_class[size_to_class(size)];
+	slab = link_to_struct(head->next, struct mem_cache, list);
+
+	/* Slabs with free objects are in front, so if first is full all are */
+	if (list_empty(head) || mem_cache_is_full(slab))
+		if (!(slab = slab_new(size_to_class(size))))
+			return kmalloc_large(size);
+
+	blk = mem_cache_alloc(slab);
+
+	/* Move it out of the way once full */
+	if (mem_cache_is_full(slab)) {
+		list_remove(&slab->list);
+		list_insert_tail(&slab->list, head);
+	}
+	return blk;
+}
+
+void kfree(void *blk)
+{
+	struct mem_cache *slab;
+	struct link *head;
+
+	if (!is_slab_object(blk)) {
+		kfree_large(blk);
+		return;
+	}
+
+	slab = slab_of(blk);
+	head = &slab_class[size_to_class(slab->struct_size)];
+
+/* BB: Addition: put 0xFF to block memory so we know if we use freed memory */
+	memset(blk, 0xFF, slab->struct_size);
+	BUG_ON(mem_cache_free(slab, blk) < 0);
+
+	/* Release it if empty and not the last of its class, else to front */
+	list_remove(&slab->list);
+	if (mem_cache_is_empty(slab) && !list_empty(head))
+		list_insert(&slab->list, &slab_free);
+	else
+		list_insert(&slab->list, head);
+}
+
+/* Usable size of an allocated block */
+static size_t ksize(void *blk)
+{
+	malloc_t *m;
+
+	if (is_slab_object(blk))
+		return slab_of(blk)->struct_size;
+
+	m = (malloc_t *)((char *)blk - sizeof(malloc_t));
+	if(m->magic != MALLOC_MAGIC)
+		return 0;
+	return m->size;
+}
+
 /*****************************************************************************
 *****************************************************************************/
 void *krealloc(void *blk, size_t size)
 {
 	void *new_blk;
-	malloc_t *m;
+	size_t old_size;
 
 /* size == 0: free block */
 	if(size == 0)
@@ -283,18 +456,15 @@ void *krealloc(void *blk, size_t size)
 /* if allocation OK, and if old block exists, copy old block to new */
 		if(new_blk != NULL && blk != NULL)
 		{
-			m = (malloc_t *)((char *)blk - sizeof(malloc_t));
-			if(m->magic != MALLOC_MAGIC)
-//				panic("attempt to krealloc() block at "
-//					"0x%p with bad magic value", blk);
+			if(!(old_size = ksize(blk)))
 			{
 				printf("*** attempt to krealloc() block at "
 					"0x%p with bad magic value\n", blk);
 				return NULL;
 			}
 /* copy minimum of old and new block sizes */
-			if(size > m->size)
-				size = m->size;
+			if(size > old_size)
+				size = old_size;
 			memcpy(new_blk, blk, size);
 /* free the old block */
 			kfree(blk);
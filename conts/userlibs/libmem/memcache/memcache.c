@@ -20,6 +20,12 @@ static int find_and_set_first_free_bit(u32 *word, unsigned int limit)
 	int i;
 
 	for(i = 0; i < limit; i++) {
+		/* Skip full words in one go */
+		if (!(i & (WORD_BITS - 1)) &&
+		    word[BITWISE_GETWORD(i)] == ~0U) {
+			i += WORD_BITS - 1;
+			continue;
+		}
 		/* Find first unset bit */
 		if (!(word[BITWISE_GETWORD(i)] & BITWISE_GETBIT(i))) {
 			/* Set it */
@@ -1,5 +1,5 @@
 /*
- * A proof-of-concept linked-list based page allocator.
+ * A binary buddy page allocator.
  *
  * Copyright (C) 2007 Bahadir Balban
  */
@@ -19,233 +19,165 @@
 
 struct page_allocator allocator;
 
+/* Puts the block at page index @idx on the free list of @order */
+static void free_block_insert(struct page_allocator *p,
+			      unsigned long idx, int order)
+{
+	p->blocks[idx].state = PAGE_BLOCK_FREE | order;
+	list_insert(&p->blocks[idx].list, &p->free_list[order]);
+}
+
+static void free_block_remove(struct page_allocator *p, unsigned long idx)
+{
+	p->blocks[idx].state = 0;
+	list_remove_init(&p->blocks[idx].list);
+}
+
 /*
- * Allocate a new page area from the page area cache
+ * Frees the block at @idx of @order, merging it with its buddy
+ * for as long as the buddy is a whole free block of the same order.
  */
-static struct page_area *new_page_area(struct page_allocator *p)
+static void free_block(struct page_allocator *p, unsigned long idx, int order)
 {
-	struct mem_cache *cache;
-	struct page_area *new_area;
-
-	list_foreach_struct(cache, &p->pga_cache_list, list) {
-		if ((new_area = mem_cache_alloc(cache)) != 0) {
-			new_area->cache = cache;
-			p->pga_free--;
-			return new_area;
-		}
+	unsigned long buddy;
+
+	while (order < PAGE_ALLOC_ORDERS - 1) {
+		buddy = idx ^ (1UL << order);
+		if (buddy + (1UL << order) > p->npages ||
+		    p->blocks[buddy].state != (PAGE_BLOCK_FREE | order))
+			break;
+		free_block_remove(p, buddy);
+		idx &= ~(1UL << order);
+		order++;
 	}
-	return 0;
+	free_block_insert(p, idx, order);
 }
 
-/* Given the page @quantity, finds a free region, divides and returns new area. */
-static struct page_area *
-get_free_page_area(int quantity, struct page_allocator *p)
+/*
+ * Frees @npages pages starting at page index @idx, as the largest
+ * naturally aligned blocks that fit in the range.
+ */
+static void free_range(struct page_allocator *p, unsigned long idx,
+		       unsigned long npages)
 {
-	struct page_area *new, *area;
-
-	if (quantity <= 0)
-		return 0;
-
-	list_foreach_struct(area, &p->page_area_list, list) {
-
-		/* Check for exact size match */
-		if (area->numpages == quantity && !area->used) {
-			area->used = 1;
-			return area;
-		}
-
-		/* Divide a bigger area */
-		if (area->numpages > quantity && !area->used) {
-			new = new_page_area(p);
-			area->numpages -= quantity;
-			new->pfn = area->pfn + area->numpages;
-			new->numpages = quantity;
-			new->used = 1;
-			link_init(&new->list);
-			list_insert(&new->list, &area->list);
-			return new;
-		}
+	int order;
+
+	p->free_pages += npages;
+	while (npages) {
+		for (order = 0; order < PAGE_ALLOC_ORDERS - 1; order++)
+			if ((idx & (1UL << order)) || (2UL << order) > npages)
+				break;
+		free_block(p, idx, order);
+		idx += 1UL << order;
+		npages -= 1UL << order;
 	}
-
-	/* No more pages */
-	return 0;
 }
 
-
 /*
- * All physical memory is tracked by a simple linked list implementation. A
- * single list contains both used and free page_area descriptors. Each page_area
- * describes a continuous region of physical pages, indicating its location by
- * it's pfn.
+ * All physical memory between @start and @end is tracked by the buddy
+ * allocator. Its per-page state array is placed at @start, and pages
+ * after it are free to allocate.
  *
  * alloc_page() keeps track of all page-granuled memory, except the bits that
  * were in use before the allocator initialised. This covers anything that is
- * outside the @start @end range. This includes the page tables, first caches
- * allocated by this function, compile-time allocated kernel data and text.
- * Also other memory regions like IO are not tracked by alloc_page() but by
- * other means.
+ * outside the @start @end range. This includes the page tables, compile-time
+ * allocated kernel data and text. Also other memory regions like IO are not
+ * tracked by alloc_page() but by other means.
  */
-
 void init_page_allocator(unsigned long start, unsigned long end)
 {
-	/* Initialise a page area cache in the first page */
-	struct page_area *freemem, *area;
-	struct mem_cache *cache;
-
-	link_init(&allocator.page_area_list);
-	link_init(&allocator.pga_cache_list);
-
-	/* Initialise the first page area cache */
-	cache = mem_cache_init(phys_to_virt((void *)start), PAGE_SIZE,
-			       sizeof(struct page_area), 0);
-	list_insert(&cache->list, &allocator.pga_cache_list);
-
-	/* Initialise the first area that describes the page just allocated */
-	area = mem_cache_alloc(cache);
-	link_init(&area->list);
-	area->pfn = __pfn(start);
-	area->used = 1;
-	area->numpages = 1;
-	area->cache = cache;
-	list_insert(&area->list, &allocator.page_area_list);
-
-	/* Update freemem start address */
-	start += PAGE_SIZE;
-
-	/* Initialise first area that describes all of free physical memory */
-	freemem = mem_cache_alloc(cache);
-	link_init(&freemem->list);
-	freemem->pfn = __pfn(start);
-	freemem->numpages = __pfn(end) - freemem->pfn;
-	freemem->cache = cache;
-	freemem->used = 0;
-
-	/* Add it as the first unused page area */
-	list_insert(&freemem->list, &allocator.page_area_list);
-
-	/* Initialise free page area counter */
-	allocator.pga_free = mem_cache_total_empty(cache);
+	unsigned long total = __pfn(end) - __pfn(start);
+	unsigned long statesize =
+		page_align_up(total * sizeof(struct page_block));
+
+	for (int i = 0; i < PAGE_ALLOC_ORDERS; i++)
+		link_init(&allocator.free_list[i]);
+
+	allocator.blocks = phys_to_virt((void *)start);
+	allocator.start_pfn = __pfn(start + statesize);
+	allocator.npages = __pfn(end) - allocator.start_pfn;
+	allocator.free_pages = 0;
+	memset(allocator.blocks, 0,
+	       allocator.npages * sizeof(struct page_block));
+
+	free_range(&allocator, 0, allocator.npages);
 }
 
 /*
- * Check if we're about to run out of free page area structures.
- * If so, allocate a new cache of page areas.
+ * Allocates @quantity physically contiguous pages. The smallest
+ * free block that fits is split down, and any pages of it beyond
+ * @quantity are given back. Returns 0 when out of memory.
  */
-int check_page_areas(struct page_allocator *p)
-{
-	struct page_area *new;
-	struct mem_cache *newcache;
-
-	/* If only one free area left */
-	if (p->pga_free == 1) {
-
-		/* Use that area to allocate a new page */
-		if (!(new = get_free_page_area(1, p)))
-			return -1;	/* Out of memory */
-
-		/* Free page areas must now be reduced to 0 */
-		BUG_ON(p->pga_free != 0);
-
-		/* Initialise it as a new source of page area structures */
-		newcache = mem_cache_init(phys_to_virt((void *)__pfn_to_addr(new->pfn)),
-					  PAGE_SIZE, sizeof(struct page_area), 0);
-
-		/*
-		 * Update the free page area counter
-		 * NOTE: need to lock the allocator here
-		 */
-		p->pga_free += mem_cache_total_empty(newcache);
-
-		/*
-		 * Add the new cache to available
-		 * list of free page area caches
-		 */
-		list_insert(&newcache->list, &p->pga_cache_list);
-		/* Unlock here */
-	}
-	return 0;
-}
-
 void *alloc_page(int quantity)
 {
-	struct page_area *new;
+	struct page_allocator *p = &allocator;
+	struct page_block *block;
+	unsigned long idx;
+	int order, want;
 
-	/*
-	 * First make sure we have enough page
-	 * area structures in the cache
-	 */
-	if (check_page_areas(&allocator) < 0)
-		return 0; /* Out of memory */
+	if (quantity <= 0)
+		return 0;
 
-	/*
-	 * Now allocate the actual pages, using the available
-	 * page area structures to describe the allocation
-	 */
-	new = get_free_page_area(quantity, &allocator);
+	/* Smallest order that covers quantity */
+	for (want = 0; want < PAGE_ALLOC_ORDERS; want++)
+		if ((1UL << want) >= quantity)
+			break;
 
-	/* Return physical address */
-	return (void *)__pfn_to_addr(new->pfn);
-}
+	for (order = want; order < PAGE_ALLOC_ORDERS; order++)
+		if (!list_empty(&p->free_list[order]))
+			break;
 
+	/* No more pages */
+	if (order >= PAGE_ALLOC_ORDERS)
+		return 0;
 
-/* Merges two page areas, frees area cache if empty, returns the merged area. */
-struct page_area *merge_free_areas(struct page_area *before,
-				   struct page_area *after)
-{
-	struct mem_cache *c;
-
-	BUG_ON(before->pfn + before->numpages != after->pfn);
-	BUG_ON(before->used || after->used)
-	BUG_ON(before == after);
-
-	before->numpages += after->numpages;
-	list_remove(&after->list);
-	c = after->cache;
-	mem_cache_free(c, after);
-
-	/* Recursively free the cache page */
-	if (mem_cache_is_empty(c)) {
-		list_remove(&c->list);
-		if (free_page(virt_to_phys(c)) < 0) {
-			printf("Page ptr: 0x%lx, virt_to_phys = 0x%lx\n"
-			       "Page not found in cache.\n",
-			       (unsigned long)c, (unsigned long)virt_to_phys(c));
-			BUG();
-		}
+	block = link_to_struct(p->free_list[order].next,
+			       struct page_block, list);
+	idx = block - p->blocks;
+	free_block_remove(p, idx);
+
+	/* Split it, freeing upper halves until it is of wanted order */
+	while (order > want) {
+		order--;
+		free_block_insert(p, idx + (1UL << order), order);
 	}
-	return before;
+	p->free_pages -= 1UL << want;
+
+	/* Give back what is beyond quantity */
+	if ((1UL << want) > quantity)
+		free_range(p, idx + quantity, (1UL << want) - quantity);
+
+	p->blocks[idx].state = quantity;
+
+	/* Return physical address */
+	return (void *)__pfn_to_addr(p->start_pfn + idx);
 }
 
-static int find_and_free_page_area(void *addr, struct page_allocator *p)
+/* Frees all pages of the allocation that starts at @paddr */
+int free_page(void *paddr)
 {
-	struct page_area *area, *prev, *next;
-
-	/* First find the page area to be freed. */
-	list_foreach_struct(area, &p->page_area_list, list)
-		if (__pfn_to_addr(area->pfn) == (unsigned long)addr &&
-		    area->used) {	/* Found it */
-			area->used = 0;
-			goto found;
-		}
-	return -1; /* Finished the loop, but area not found. */
-
-found:
-	/* Now merge with adjacent areas, if possible */
-	if (area->list.prev != &p->page_area_list) {
-		prev = link_to_struct(area->list.prev, struct page_area, list);
-		if (!prev->used)
-			area = merge_free_areas(prev, area);
-	}
-	if (area->list.next != &p->page_area_list) {
-		next = link_to_struct(area->list.next, struct page_area, list);
-		if (!next->used)
-			area = merge_free_areas(area, next);
-	}
+	struct page_allocator *p = &allocator;
+	unsigned long pfn = __pfn((unsigned long)paddr);
+	unsigned long idx, npages;
+
+	if (pfn < p->start_pfn || pfn >= p->start_pfn + p->npages)
+		return -1;
+
+	idx = pfn - p->start_pfn;
+	npages = p->blocks[idx].state;
+
+	/* Not the head of an allocation */
+	if (!npages || (npages & PAGE_BLOCK_FREE))
+		return -1;
+
+	p->blocks[idx].state = 0;
+	free_range(p, idx, npages);
+
 	return 0;
 }
 
-int free_page(void *paddr)
+/* Number of pages that are free, in any block */
+unsigned long alloc_page_nfree(void)
 {
-	return find_and_free_page_area(paddr, &allocator);
+	return allocator.free_pages;
 }
-
@@ -134,6 +134,49 @@ def test_mm_params(num_allocs, max_alloc_size, page_size, numpages, iterations):
             sys.exit(1)
 
 
+def test_mm_perf():
+    """
+    Runs the page allocator benchmark on random workloads of a few
+    different allocation sizes and live allocation counts. Each run
+    reports allocations per second and fragmentation.
+    """
+    numpages = SZ_10MB // 4096
+    for max_alloc_size in [1, 8, 64]:
+        for num_allocs in [100, 1000]:
+            cmd = "./test -a=b -n=%d -s=%d -ps=%d -pn=%d" % (
+                num_allocs,
+                max_alloc_size,
+                4096,
+                numpages,
+            )
+            print(
+                "num_allocs = %d, max_alloc_size = %d, page_size = %d, numpages = %d"
+                % (num_allocs, max_alloc_size, 4096, numpages)
+            )
+            if os.system(cmd) != 0:
+                print("Error: %s has failed.\n" % cmd)
+                sys.exit(1)
+
+
+def test_km_perf():
+    """
+    Runs the kmalloc benchmark on random workloads, from sizes served
+    by the smallest slab classes up to ones served by the heap list.
+    """
+    numpages = 1024
+    for max_alloc_size in [32, 512, 4096]:
+        cmd = "./test -a=K -n=%d -s=%d -ps=%d -pn=%d" % (
+            64,
+            max_alloc_size,
+            4096,
+            numpages,
+        )
+        print("num_allocs = %d, max_alloc_size = %d" % (64, max_alloc_size))
+        if os.system(cmd) != 0:
+            print("Error: %s has failed.\n" % cmd)
+            sys.exit(1)
+
+
 def run_tests():
     if os.path.exists(tests_run_root):
         shutil.rmtree(tests_run_root)
@@ -142,6 +185,8 @@ def run_tests():
     # 	for i in range (100):
     # test_km()
     test_mm()
+    test_mm_perf()
+    test_km_perf()
     # test_mm_params(10922, 10, 128, 81920, 50)
     # test_km()
     # test_mc()
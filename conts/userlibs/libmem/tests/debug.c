@@ -3,13 +3,14 @@
 
 void print_page_area_list(struct page_allocator *p)
 {
-	struct page_area *area;
+	struct page_block *block;
 
-	list_foreach_struct (area, &p->page_area_list, list) {
-		printf("%-20s\n%-20s\n", "Page area:","-------------------------");
-		printf("%-20s %u\n", "Pfn:", area->pfn);
-		printf("%-20s %d\n", "Used:", area->used);
-		printf("%-20s %d\n\n", "Number of pages:", area->numpages);
+	for (int i = 0; i < PAGE_ALLOC_ORDERS; i++) {
+		list_foreach_struct (block, &p->free_list[i], list) {
+			printf("%-20s\n%-20s\n", "Free block:","-------------------------");
+			printf("%-20s %lu\n", "Pfn:", p->start_pfn + (block - p->blocks));
+			printf("%-20s %d\n\n", "Order:", i);
+		}
 	}
 }
 
@@ -5,7 +5,7 @@
 
 #include <l4/macros.h>
 #include <l4/config.h>
-#include <kmem/kmalloc.h>
+#include <mem/malloc.h>
 #include <mem/alloc_page.h>
 
 #include INC_SUBARCH(mm.h)
@@ -100,6 +100,8 @@ void print_options(struct cmdline_opts *opts)
 {
 	dprintf("Running: %s\n",
 	       ((opts->run_allocator == 'p') ? "page allocator" :
+		(opts->run_allocator == 'b') ? "page allocator benchmark" :
+		(opts->run_allocator == 'K') ? "kmalloc benchmark" :
 		((opts->run_allocator == 'k') ? "kmem/kfree" :
 		 "memcache allocator")));
 	dprintf("Total allocations: %d\n", opts->allocations);
@@ -114,7 +116,7 @@ void display_help(void)
 {
 	printf("Main:\n");
 	printf("\tUsage:\n");
-	printf("\tmain\t-a=<p>|<k>|<m> [-n=<number of allocations>] [-s=<maximum size for any allocation>]\n"
+	printf("\tmain\t-a=<p>|<b>|<k>|<K>|<m> [-n=<number of allocations>] [-s=<maximum size for any allocation>]\n"
 	       "\t\t[-fi=<file to dump init state>] [-fx=<file to dump exit state>]\n"
 	       "\t\t[-ps=<page size>] [-pn=<total number of pages>]\n");
 	printf("\n");
@@ -132,7 +134,9 @@ int get_cmdline_opts(int argc, char *argv[], struct cmdline_opts *opts)
 			if (argv[i][1] == 'a') {
 				if (argv[i][3] == 'k' ||
 				    argv[i][3] == 'm' ||
-				    argv[i][3] == 'p') {
+				    argv[i][3] == 'p' ||
+				    argv[i][3] == 'b' ||
+				    argv[i][3] == 'K') {
 					opts->run_allocator = argv[i][3];
 					parsed = 1;
 				}
@@ -196,7 +200,7 @@ void get_output_files(FILE **out1, FILE **out2,
 
 int main(int argc, char *argv[])
 {
-	FILE *finit, *fexit;
+	FILE *finit = 0, *fexit = 0;
 	int output_files = 0;
 	if (get_cmdline_opts(argc, argv, &options) < 0) {
 		display_help();
@@ -224,11 +228,22 @@ int main(int argc, char *argv[])
 		TEST_PHYSMEM_TOTAL_PAGES = options.no_of_pages;
 	}
 	alloc_test_memory();
+	if (options.run_allocator == 'k' || options.run_allocator == 'K')
+		if (test_kmalloc_small_then_large() < 0)
+			exit(1);
 	if (options.run_allocator == 'p') {
 		if (!output_files)
 			get_output_files(&finit, &fexit, "alloc_page", 0);
 		test_allocpage(options.allocations, options.alloc_size_max,
 			       finit, fexit);
+	} else if (options.run_allocator == 'b') {
+		test_allocpage_perf(options.allocations,
+				    options.alloc_size_max,
+				    options.allocations * 100);
+	} else if (options.run_allocator == 'K') {
+		test_kmalloc_perf(options.allocations,
+				  options.alloc_size_max,
+				  options.allocations * 100);
 	} else if (options.run_allocator == 'k') {
 		if (!output_files)
 			get_output_files(&finit, &fexit, "kmalloc", 0);
@@ -243,8 +258,10 @@ int main(int argc, char *argv[])
 		printf("Invalid allocator option.\n");
 	}
 	free((void *)malloced_test_memory);
-	fclose(finit);
-	fclose(fexit);
+	if (finit)
+		fclose(finit);
+	if (fexit)
+		fclose(fexit);
 	return 0;
 }
 
@@ -21,48 +21,103 @@ unsigned int PAGE_ALLOC_SIZE_MAX = 8;
 
 extern struct page_allocator allocator;
 
-void print_page_area(struct page_area *a, int areano)
+/* Number of free blocks of each order, and pages in the largest one */
+static unsigned long free_blocks_by_order(struct page_allocator *p,
+					  int *nblocks)
 {
-	printf("Area starts @: 0x%lu, %s, numpages: %d\n",
-	       __pfn_to_addr(a->pfn),
-	       (a->used) ? "used" : "unused", a->numpages);
-	return;
+	struct page_block *block;
+	unsigned long largest = 0;
+
+	for (int i = 0; i < PAGE_ALLOC_ORDERS; i++) {
+		nblocks[i] = 0;
+		list_foreach_struct(block, &p->free_list[i], list) {
+			nblocks[i]++;
+			largest = 1UL << i;
+		}
+	}
+	return largest;
 }
 
-void print_areas(struct link *area_head)
+void print_free_lists(struct page_allocator *p)
 {
-	struct page_area *cur;
-	int areano = 1;
+	int nblocks[PAGE_ALLOC_ORDERS];
 
-	printf("Page areas:\n-------------\n");
-	list_foreach_struct(cur, area_head, list)
-		print_page_area(cur, areano++);
+	free_blocks_by_order(p, nblocks);
+	printf("Free lists:\n-------------\n");
+	for (int i = 0; i < PAGE_ALLOC_ORDERS; i++)
+		if (nblocks[i])
+			printf("Order %d: %d blocks\n", i, nblocks[i]);
 }
 
-void print_cache(struct mem_cache *c, int cacheno)
+void print_page_allocator_state(void)
 {
-	printf("Cache %d state:\n-------------\n", cacheno);
-	printf("Total: %d\n", c->total);
-	printf("Free: %d\n", c->free);
-	printf("Start: 0x%x\n", c->start);
+	printf("Pages: %lu, free: %lu\n",
+	       allocator.npages, allocator.free_pages);
+	print_free_lists(&allocator);
 }
 
-void print_caches(struct link *cache_head)
+/*
+ * Fragmentation is the part of free memory that is not in the
+ * largest free block, in percent. Zero when all free pages are
+ * in one block.
+ */
+static int page_allocator_fragmentation(struct page_allocator *p)
 {
-	int caches = 1;
-	struct mem_cache *cur;
+	int nblocks[PAGE_ALLOC_ORDERS];
+	unsigned long largest = free_blocks_by_order(p, nblocks);
 
-	list_foreach_struct(cur, cache_head, list)
-		print_cache(cur, caches++);
+	if (!p->free_pages)
+		return 0;
+	return 100 - (largest * 100) / p->free_pages;
 }
 
-void print_page_allocator_state(void)
+/*
+ * Times a random workload of allocations and frees of
+ * 1 to @page_alloc_size_max pages each, with at most
+ * @page_allocations live at a time, and reports the
+ * rate and the fragmentation it leaves behind.
+ */
+void test_allocpage_perf(int page_allocations, int page_alloc_size_max,
+			 int ops)
 {
-	print_areas(&allocator.page_area_list);
-	printf("Data Cache:\n--------\n");
-	print_caches(&allocator.dcache_list);
-	printf("Cache Cache:\n----------\n");
-	print_caches(&allocator.ccache_list);
+	void *mem[page_allocations];
+	int allocs = 0, failed = 0, frag;
+	clock_t start, ticks;
+	int i;
+
+	memset(mem, 0, sizeof(mem));
+	srand(time(0));
+
+	start = clock();
+	for (int op = 0; op < ops; op++) {
+		i = rand() % page_allocations;
+		if (mem[i]) {
+			BUG_ON(free_page(mem[i]) < 0);
+			mem[i] = 0;
+		} else if ((mem[i] =
+			    alloc_page((rand() % page_alloc_size_max) + 1))) {
+			allocs++;
+		} else {
+			failed++;
+		}
+	}
+	ticks = clock() - start;
+
+	/* Fragmentation with the workload's allocations in place */
+	frag = page_allocator_fragmentation(&allocator);
+
+	for (i = 0; i < page_allocations; i++)
+		if (mem[i])
+			BUG_ON(free_page(mem[i]) < 0);
+
+	printf("%-30s%d\n", "Operations:", ops);
+	printf("%-30s%d\n", "Allocations:", allocs);
+	printf("%-30s%d\n", "Failed allocations:", failed);
+	printf("%-30s%lu\n", "Allocations per second:",
+	       ticks ? (unsigned long)allocs * CLOCKS_PER_SEC / ticks : 0);
+	printf("%-30s%d%%\n", "Fragmentation under load:", frag);
+	printf("%-30s%d%%\n", "Fragmentation after free:",
+	       page_allocator_fragmentation(&allocator));
 }
 
 /* FIXME: with current default parameters (allocations = 30, sizemax = 8),
@@ -14,14 +14,94 @@
 #include <time.h>
 #include "test_alloc_generic.h"
 #include "test_allocpage.h"
+#include "test_kmalloc.h"
 #include "debug.h"
 #include "tests.h"
 
-extern struct link km_area_start;
+void dump_heap(void);
 
 void print_kmalloc_state(void)
 {
-	print_km_area_list(&km_area_start);
+	dump_heap();
+}
+
+/*
+ * Allocates from the slabs before the heap list has any blocks, then from
+ * the heap list, which must not mistake the slab-only heap for a corrupt
+ * one. Must run before anything else has been allocated.
+ */
+int test_kmalloc_small_then_large(void)
+{
+	void *small, *large, *grown;
+
+	if (!(small = kmalloc(16))) {
+		printf("kmalloc(16) failed on an empty heap.\n");
+		return -1;
+	}
+	if (!(large = kmalloc(1000))) {
+		printf("kmalloc(1000) failed after kmalloc(16).\n");
+		return -1;
+	}
+	memset(small, 0x5A, 16);
+	memset(large, 0xA5, 1000);
+	if (!(grown = krealloc(small, 2000))) {
+		printf("krealloc() of a slab object to 2000 bytes failed.\n");
+		return -1;
+	}
+	if (((unsigned char *)grown)[15] != 0x5A) {
+		printf("krealloc() did not copy the slab object.\n");
+		return -1;
+	}
+	kfree(large);
+	kfree(grown);
+	if (!(large = kmalloc(1000))) {
+		printf("kmalloc(1000) failed after freeing the heap list.\n");
+		return -1;
+	}
+	kfree(large);
+	return 0;
+}
+
+/*
+ * Times a random workload of kmalloc()/kfree() calls of 1 to
+ * @kmalloc_alloc_size_max bytes each, with at most
+ * @kmalloc_allocations live at a time.
+ */
+void test_kmalloc_perf(int kmalloc_allocations, int kmalloc_alloc_size_max,
+		       int ops)
+{
+	void *mem[kmalloc_allocations];
+	int allocs = 0, failed = 0;
+	clock_t start, ticks;
+	int i;
+
+	memset(mem, 0, sizeof(mem));
+	srand(time(0));
+
+	start = clock();
+	for (int op = 0; op < ops; op++) {
+		i = rand() % kmalloc_allocations;
+		if (mem[i]) {
+			kfree(mem[i]);
+			mem[i] = 0;
+		} else if ((mem[i] =
+			    kmalloc((rand() % kmalloc_alloc_size_max) + 1))) {
+			allocs++;
+		} else {
+			failed++;
+		}
+	}
+	ticks = clock() - start;
+
+	for (i = 0; i < kmalloc_allocations; i++)
+		if (mem[i])
+			kfree(mem[i]);
+
+	printf("%-30s%d\n", "Operations:", ops);
+	printf("%-30s%d\n", "Allocations:", allocs);
+	printf("%-30s%d\n", "Failed allocations:", failed);
+	printf("%-30s%lu\n", "Operations per second:",
+	       ticks ? (unsigned long)ops * CLOCKS_PER_SEC / ticks : 0);
 }
 
 void test_kmalloc(int kmalloc_allocations, int kmalloc_alloc_size_max,
@@ -14,6 +14,7 @@
 #define L4_IPC_FLAGS_SHORT		0x00000000	/* Short IPC involves just primary message registers */
 #define L4_IPC_FLAGS_FULL		0x00000001	/* Full IPC involves full UTCB copy */
 #define L4_IPC_FLAGS_EXTENDED		0x00000002	/* Extended IPC can page-fault and copy up to 2KB */
+#define L4_IPC_FLAGS_DIRECT		0x00000003	/* Direct extended IPC copies once between user buffers */
 
 /* Extended IPC extra fields */
 #define L4_IPC_FLAGS_MSG_INDEX_MASK	0x00000FF0	/* Index of message register with buffer pointer */
@@ -21,26 +22,55 @@
 #define L4_IPC_FLAGS_SIZE_SHIFT		16
 #define L4_IPC_FLAGS_MSG_INDEX_SHIFT	4
 
+/*
+ * Number of valid primary message registers, counting from MR0.
+ * Only registers below the count are transferred, if the valid
+ * bit is set. Otherwise all primary registers are transferred.
+ */
+#define L4_IPC_FLAGS_NMRS_VALID		0x00008000
+#define L4_IPC_FLAGS_NMRS_MASK		0x00007000
+#define L4_IPC_FLAGS_NMRS_SHIFT		12
+
 
 #define L4_IPC_EXTENDED_MAX_SIZE	(SZ_1K*2)
 
+/*
+ * Direct extended IPC takes the buffer address from the message
+ * register at the message index, and the size from the one after.
+ */
+#if !defined (CONFIG_IPC_DIRECT_MAX_SIZE)
+#define CONFIG_IPC_DIRECT_MAX_SIZE	SZ_64K
+#endif
+#define L4_IPC_DIRECT_MAX_SIZE		CONFIG_IPC_DIRECT_MAX_SIZE
+
+/* Ipc control requests */
+#define IPC_CONTROL_RECV_TIMEOUT	0	/* arg: msecs, 0 for none */
+
+/* Longest receive timeout, so that expiry times compare */
+#define IPC_TIMEOUT_MAX_MSECS		(1 << 20)
+
 #if defined (__KERNEL__)
 
 /* Kernel-only flags */
 #define IPC_FLAGS_SHORT			L4_IPC_FLAGS_SHORT
 #define IPC_FLAGS_FULL			L4_IPC_FLAGS_FULL
 #define IPC_FLAGS_EXTENDED		L4_IPC_FLAGS_EXTENDED
+#define IPC_FLAGS_DIRECT		L4_IPC_FLAGS_DIRECT
 #define IPC_FLAGS_MSG_INDEX_MASK	L4_IPC_FLAGS_MSG_INDEX_MASK
 #define IPC_FLAGS_TYPE_MASK		L4_IPC_FLAGS_TYPE_MASK
 #define IPC_FLAGS_SIZE_MASK		L4_IPC_FLAGS_SIZE_MASK
 #define IPC_FLAGS_SIZE_SHIFT		L4_IPC_FLAGS_SIZE_SHIFT
 #define IPC_FLAGS_MSG_INDEX_SHIFT	L4_IPC_FLAGS_MSG_INDEX_SHIFT
+#define IPC_FLAGS_NMRS_VALID		L4_IPC_FLAGS_NMRS_VALID
+#define IPC_FLAGS_NMRS_MASK		L4_IPC_FLAGS_NMRS_MASK
+#define IPC_FLAGS_NMRS_SHIFT		L4_IPC_FLAGS_NMRS_SHIFT
 #define IPC_FLAGS_ERROR_MASK		0xF0000000
 #define IPC_FLAGS_ERROR_SHIFT		28
 #define IPC_EFAULT			(1 << 28)
 #define IPC_ENOIPC			(1 << 29)
 
 #define IPC_EXTENDED_MAX_SIZE		L4_IPC_EXTENDED_MAX_SIZE
+#define IPC_DIRECT_MAX_SIZE		L4_IPC_DIRECT_MAX_SIZE
 
 /*
  * ipc syscall uses an ipc_dir variable and send/recv
@@ -56,6 +86,7 @@ enum IPC_DIR {
 /* These are for internally created ipc paths. */
 int ipc_send(l4id_t to, unsigned int flags);
 int ipc_sendrecv(l4id_t to, l4id_t from, unsigned int flags);
+void ipc_window_init(void);
 
 #endif
 
@@ -70,11 +70,43 @@ struct kip {
 	u32 utcb;
 
 	struct kernel_descriptor kdesc;
+
+	/* Added since, at the end so that earlier offsets stay put */
+	u32 clock;
+	u32 map_batch;
+	u32 trace_control;
 } __attribute__((__packed__));
 
+/*
+ * Time of day, kept by the kernel in the second half of the kip
+ * page, at the user address in kip->clock.
+ *
+ * The time was sec:usec when the clock read stamp. Counter, if not
+ * 0, is the user address of a register that counts down once a
+ * usec, and the clock is its inverse, which gives the time since.
+ * Only tickless pb926 builds have one. Otherwise, on all other
+ * platforms and periodic builds, counter is 0 and time is only as
+ * recent as the last timer tick.
+ *
+ * The kernel makes seq odd while it changes the rest, so a reader
+ * copies the fields and tries again if seq was odd or has changed.
+ */
+struct kip_clock {
+	u32 seq;
+	u32 sec;
+	u32 usec;
+	u32 stamp;
+	u32 counter;
+};
+
+#define KIP_CLOCK_OFFSET		0x800
+
 
 #if defined (__KERNEL__)
 extern struct kip kip;
+
+#define kip_clock	((volatile struct kip_clock *)			\
+			 ((unsigned long)&kip + KIP_CLOCK_OFFSET))
 #endif /* __KERNEL__ */
 
 
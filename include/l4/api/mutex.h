@@ -29,10 +29,12 @@ struct mutex_queue {
 	struct waitqueue_head wqh_holders;
 };
 
+/* Must be a power of two */
+#define MUTEX_QUEUE_BUCKETS		64
+
 /*
- * Mutex queue head keeps the list of all userspace mutexes.
- *
- * Here, mutex_control_mutex is a single lock for:
+ * A hash bucket of mutex queues. Its lock is a single lock for
+ * the mutexes that hash here:
  * (1) Mutex_queue create/deletion
  * (2) List add/removal.
  * (3) Wait synchronization:
@@ -40,10 +42,18 @@ struct mutex_queue {
  *       rendezvous inspection to occur atomically. Currently
  *       it's not done since we rely on this mutex for that.
  */
-struct mutex_queue_head {
+struct mutex_queue_bucket {
 	struct link list;
-	struct mutex mutex_control_mutex;
-	int count;
+	struct mutex lock;
+};
+
+/*
+ * Mutex queue head keeps all userspace mutexes that have
+ * sleepers, hashed by their physical address, so that
+ * unrelated mutexes neither search nor lock the same list.
+ */
+struct mutex_queue_head {
+	struct mutex_queue_bucket bucket[MUTEX_QUEUE_BUCKETS];
 };
 
 void init_mutex_queue_head(struct mutex_queue_head *mqhead);
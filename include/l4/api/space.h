@@ -1,5 +1,19 @@
 #ifndef __API_SPACE_H__
 #define __API_SPACE_H__
 
+/* Operations for the batched map system call */
+#define MAP_BATCH_MAP			0
+#define MAP_BATCH_UNMAP			1
+
+/* Maximum number of ranges in one batched map call */
+#define MAP_BATCH_MAX			16
+
+/* Describes one range of a batched map or unmap */
+struct map_desc {
+	unsigned long phys;	/* Ignored on unmap */
+	unsigned long virt;
+	unsigned long npages;
+	unsigned int flags;	/* Ignored on unmap */
+};
 
 #endif /* __API_SPACE_H__ */
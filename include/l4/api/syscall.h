@@ -27,7 +27,9 @@
 #define sys_time_offset				0x30
 #define sys_mutex_control_offset		0x34
 #define sys_cache_control_offset		0x38
-#define syscalls_end_offset			sys_cache_control_offset
+#define sys_map_batch_offset			0x3C
+#define sys_trace_control_offset		0x40
+#define syscalls_end_offset			sys_trace_control_offset
 #define SYSCALLS_TOTAL				((syscalls_end_offset >> 2) + 1)
 
 void print_syscall_context(struct ktcb *t);
@@ -39,7 +41,7 @@ int sys_exchange_registers(struct exregs_data *exregs, l4id_t tid);
 int sys_schedule(void);
 int sys_unmap(unsigned long virtual, unsigned long npages, unsigned int tid);
 int sys_irq_control(unsigned int req, unsigned int flags, l4id_t id);
-int sys_ipc_control(void);
+int sys_ipc_control(unsigned int req, l4id_t tid, u32 arg);
 int sys_map(unsigned long phys, unsigned long virt, unsigned long npages,
 	    unsigned int flags, l4id_t tid);
 int sys_getid(struct task_ids *ids);
@@ -49,5 +51,9 @@ int sys_time(struct timeval *tv, int set);
 int sys_mutex_control(unsigned long mutex_address, int mutex_op);
 int sys_cache_control(unsigned long start, unsigned long end,
 		      unsigned int flags);
+struct map_desc;
+int sys_map_batch(struct map_desc *desc, int ndesc,
+		  unsigned int op, l4id_t tid);
+int sys_trace_control(unsigned int req, unsigned long virt);
 
 #endif /* __SYSCALL_H__ */
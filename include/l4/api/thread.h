@@ -8,6 +8,7 @@
 #define THREAD_DESTROY		0x30000000
 #define THREAD_RECYCLE		0x40000000
 #define THREAD_WAIT		0x50000000
+#define THREAD_AFFINITY		0x60000000
 
 #define THREAD_SHARE_MASK	0x00F00000
 #define THREAD_SPACE_MASK	0x0F000000
@@ -15,6 +16,7 @@
 #define TC_SHARE_CAPS		0x00100000 /* Share all thread capabilities */
 #define TC_SHARE_UTCB		0x00200000 /* Share utcb location (same space */
 #define TC_SHARE_GROUP		0x00400000 /* Share thread group id */
+#define TC_COPY_COW		0x00800000 /* Copy space copy-on-write */
 
 #define TC_SHARE_SPACE		0x01000000 /* New thread, use given space */
 #define TC_COPY_SPACE		0x02000000 /* New thread, copy given space */
@@ -22,4 +24,5 @@
 
 /* #define THREAD_USER_MASK	0x000F0000 Reserved for userspace */
 #define THREAD_EXIT_MASK	0x0000FFFF /* Thread exit code */
+#define THREAD_CPU_MASK		0x0000FFFF /* Cpus a thread may run on */
 #endif /* __API_THREAD_H__ */
@@ -0,0 +1,64 @@
+/*
+ * Kernel event trace buffers
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __API_TRACE_H__
+#define __API_TRACE_H__
+
+#define TRACE_CONTROL_MAP		0
+#define TRACE_CONTROL_START		1
+#define TRACE_CONTROL_STOP		2
+#define TRACE_CONTROL_RESET		3
+
+/* Event types */
+#define TRACE_SYSCALL_ENTRY		1	/* arg: syscall number */
+#define TRACE_SYSCALL_EXIT		2	/* arg: return value */
+#define TRACE_IPC_SEND			3	/* arg: receiver tid */
+#define TRACE_IPC_RECV			4	/* arg: expected sender tid */
+#define TRACE_IPC_RENDEZVOUS		5	/* arg: peer tid */
+#define TRACE_CONTEXT_SWITCH		6	/* arg: next tid */
+#define TRACE_SPACE_SWITCH		7	/* arg: next space id */
+#define TRACE_IRQ			8	/* arg: irq number */
+#define TRACE_PAGE_FAULT		9	/* arg: fault address */
+#define TRACE_PAGE_FAULT_DONE		10	/* arg: ipc return value */
+#define TRACE_MUTEX_SLEEP		11	/* arg: mutex physical address */
+#define TRACE_MUTEX_WAKE		12	/* arg: mutex physical address */
+
+/* Event data bits */
+#define TRACE_DATA_HANDOFF		(1 << 0) /* Switched straight to peer */
+#define TRACE_DATA_SENDER		(1 << 1) /* Rendezvous by the sender */
+
+#define TRACE_MAGIC			0x45435254	/* "TRCE" */
+#define TRACE_VERSION			1
+
+/*
+ * Each cpu has a ring of events behind this header. The cpu
+ * writes the event at head and then moves head on, with irqs
+ * disabled. Count is the number of events ever written, so the
+ * ring holds the last min(count, nevents) of them, oldest at
+ * head once it has wrapped.
+ *
+ * Stamps are in units of usec_per_stamp, and wrap.
+ */
+struct trace_header {
+	u32 magic;
+	u16 version;
+	u16 cpu;
+	u32 nevents;
+	u32 usec_per_stamp;
+	u32 head;
+	u32 count;
+	u32 enabled;
+	u32 reserved;
+};
+
+struct trace_event {
+	u32 stamp;
+	u16 type;
+	u16 data;
+	u32 tid;	/* Thread that was running */
+	u32 arg;
+};
+
+#endif /* __API_TRACE_H__ */
@@ -21,5 +21,8 @@
  */
 #define	USERSPACE_CONSOLE_VBASE		0xF9800000
 
+/* Read-only timer registers, for reading the clock from the kip */
+#define	USERSPACE_CLOCK_VBASE		0xF9801000
+
 
 #endif /* __ARM_IO_H__ */
@@ -106,6 +106,9 @@ typedef struct pmd_table {
 #define __MAP_USR_IO	(uncacheable | unbufferable | (SVC_RW_USR_RW << PAGE_AP0)	\
 			| (SVC_RW_USR_RW << PAGE_AP1) | (SVC_RW_USR_RW << PAGE_AP2)	\
 			| (SVC_RW_USR_RW << PAGE_AP3))
+#define __MAP_USR_IO_RO	(uncacheable | unbufferable | (SVC_RW_USR_RO << PAGE_AP0)	\
+			| (SVC_RW_USR_RO << PAGE_AP1) | (SVC_RW_USR_RO << PAGE_AP2)	\
+			| (SVC_RW_USR_RO << PAGE_AP3))
 
 /* There is no execute bit in ARMv5, so we ignore it */
 #define __MAP_USR_RWX	__MAP_USR_RW
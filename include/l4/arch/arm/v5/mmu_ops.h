@@ -25,6 +25,7 @@ void arm_drain_writebuffer(void);
 void arm_invalidate_tlb(void);
 void arm_invalidate_itlb(void);
 void arm_invalidate_dtlb(void);
+void arm_wait_for_interrupt(void);
 
 static inline void arm_enable_caches(void)
 {
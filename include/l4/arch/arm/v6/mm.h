@@ -1,10 +1,10 @@
 /*
- * ARM v5-specific virtual memory details
+ * ARM v6-specific virtual memory details
  *
  * Copyright (C) 2007 Bahadir Balban
  */
-#ifndef __V5_MM_H__
-#define __V5_MM_H__
+#ifndef __V6_MM_H__
+#define __V6_MM_H__
 
 /* ARM specific definitions */
 #define VIRT_MEM_START			0
@@ -70,18 +70,23 @@ typedef struct pmd_table {
 	pte_t entry[PMD_ENTRY_TOTAL];
 } pmd_table_t;
 
-/* Applies for both small and large pages */
-#define PAGE_AP0				4
-#define PAGE_AP1				6
-#define	PAGE_AP2				8
-#define PAGE_AP3				10
+/*
+ * We use the v6 extended page table format (XP bit set), which
+ * has a single AP field and the not-global bit. User mappings
+ * are non-global, so their tlb entries are tagged with the asid
+ * of their space and survive space switches.
+ */
+#define PAGE_AP					4
+#define PAGE_APX				(1 << 9)
+#define PAGE_SHARED				(1 << 10)
+#define PAGE_NOT_GLOBAL				(1 << 11)
 
 /* Permission values with rom and sys bits ignored */
 #define SVC_RW_USR_NONE				1
 #define SVC_RW_USR_RO				2
 #define SVC_RW_USR_RW				3
 
-#define PTE_PROT_MASK				(0xFF << 4)
+#define PTE_PROT_MASK				(0x3 << PAGE_AP)
 
 #define CACHEABILITY				3
 #define BUFFERABILITY				2
@@ -91,29 +96,33 @@ typedef struct pmd_table {
 #define unbufferable				0
 
 /* Helper macros for common cases */
-#define __MAP_USR_RW	(cacheable | bufferable | (SVC_RW_USR_RW << PAGE_AP0)		\
-			| (SVC_RW_USR_RW << PAGE_AP1) | (SVC_RW_USR_RW << PAGE_AP2)	\
-			| (SVC_RW_USR_RW << PAGE_AP3))
-#define __MAP_USR_RO	(cacheable | bufferable | (SVC_RW_USR_RO << PAGE_AP0)		\
-			| (SVC_RW_USR_RO << PAGE_AP1) | (SVC_RW_USR_RO << PAGE_AP2)	\
-			| (SVC_RW_USR_RO << PAGE_AP3))
-#define __MAP_KERN_RW	(cacheable | bufferable | (SVC_RW_USR_NONE << PAGE_AP0) 	\
-			| (SVC_RW_USR_NONE << PAGE_AP1) | (SVC_RW_USR_NONE << PAGE_AP2)	\
-			| (SVC_RW_USR_NONE << PAGE_AP3))
-#define __MAP_KERN_IO	(uncacheable | unbufferable | (SVC_RW_USR_NONE << PAGE_AP0)	\
-			| (SVC_RW_USR_NONE << PAGE_AP1) | (SVC_RW_USR_NONE << PAGE_AP2)	\
-			| (SVC_RW_USR_NONE << PAGE_AP3))
-#define __MAP_USR_IO	(uncacheable | unbufferable | (SVC_RW_USR_RW << PAGE_AP0)	\
-			| (SVC_RW_USR_RW << PAGE_AP1) | (SVC_RW_USR_RW << PAGE_AP2)	\
-			| (SVC_RW_USR_RW << PAGE_AP3))
-
-/* There is no execute bit in ARMv5, so we ignore it */
+#define __MAP_USR_RW	(cacheable | bufferable | (SVC_RW_USR_RW << PAGE_AP)	\
+			| PAGE_NOT_GLOBAL)
+#define __MAP_USR_RO	(cacheable | bufferable | (SVC_RW_USR_RO << PAGE_AP)	\
+			| PAGE_NOT_GLOBAL)
+#define __MAP_KERN_RW	(cacheable | bufferable | (SVC_RW_USR_NONE << PAGE_AP))
+#define __MAP_KERN_IO	(uncacheable | unbufferable | (SVC_RW_USR_NONE << PAGE_AP))
+#define __MAP_USR_IO	(uncacheable | unbufferable | (SVC_RW_USR_RW << PAGE_AP)	\
+			| PAGE_NOT_GLOBAL)
+#define __MAP_USR_IO_RO	(uncacheable | unbufferable | (SVC_RW_USR_RO << PAGE_AP)	\
+			| PAGE_NOT_GLOBAL)
+
+/* We don't use the execute-never bit yet, so we ignore it */
 #define __MAP_USR_RWX	__MAP_USR_RW
 #define __MAP_USR_RX	__MAP_USR_RO
 #define __MAP_KERN_RWX	__MAP_KERN_RW
 #define __MAP_KERN_RX	__MAP_KERN_RW	/* We always have kernel RW */
 #define __MAP_FAULT	0
 
+/*
+ * Address space identifiers. Asid 0 is reserved for switching
+ * page tables, the rest are shared among spaces by their spid.
+ */
+#define ASID_TOTAL		256
+#define ASID_MASK		(ASID_TOTAL - 1)
+#define ASID_RESERVED		0
+#define SPACE_ASID(spid)	(((spid) % (ASID_TOTAL - 1)) + 1)
+
 void add_section_mapping_init(unsigned int paddr, unsigned int vaddr,
 			      unsigned int size, unsigned int flags);
 
@@ -122,4 +131,4 @@ void remove_section_mapping(unsigned long vaddr);
 extern pgd_table_t init_pgd;
 
 #endif /* __ASSEMBLY__ */
-#endif /* __V5_MM_H__ */
+#endif /* __V6_MM_H__ */
@@ -24,6 +24,12 @@ void arm_drain_writebuffer(void);
 void arm_invalidate_tlb(void);
 void arm_invalidate_itlb(void);
 void arm_invalidate_dtlb(void);
+void arm_invalidate_tlb_mva(unsigned int mva_asid);
+void arm_invalidate_tlb_asid(unsigned int asid);
+void arm_clean_dcache_mva(unsigned int mva);
+void arm_invalidate_btb(void);
+void arm_set_context_id(unsigned int);
+void arm_enable_extended_pt(void);
 
 static inline void arm_enable_caches(void)
 {
@@ -38,14 +44,22 @@ static inline void dmb(void)
 	arm_drain_writebuffer();
 }
 
+/* Data synchronization barrier, i.e. drain write buffer */
 static inline void dsb(void)
 {
-	/* No op */
+	__asm__ __volatile__ (
+		"mcr	p15, 0, %0, c7, c10, 4\n"
+		:: "r" (0) : "memory"
+	);
 }
 
+/* Instruction synchronization barrier, i.e. prefetch flush */
 static inline void isb(void)
 {
-	/* No op */
+	__asm__ __volatile__ (
+		"mcr	p15, 0, %0, c7, c5, 4\n"
+		:: "r" (0) : "memory"
+	);
 }
 
 
@@ -46,6 +46,8 @@ u32 timer_read(unsigned long timer_base);
 void timer_start(unsigned long timer_base);
 void timer_stop(unsigned long timer_base);
 void timer_init_periodic(unsigned long timer_base);
+void timer_init_freerun(unsigned long timer_base);
+void timer_oneshot(unsigned long timer_base, u32 ticks);
 void timer_irq_clear(unsigned long timer_base);
 void timer_init(unsigned long timer_base);
 
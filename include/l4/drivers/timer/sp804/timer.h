@@ -42,5 +42,7 @@ u32 timer_read(unsigned long timer_base);
 void timer_stop(unsigned long timer_base);
 void timer_init_periodic(unsigned long timer_base, unsigned int load_value);
 void timer_init_oneshot(unsigned long timer_base);
+void timer_init_freerun(unsigned long timer_base);
+void timer_oneshot(unsigned long timer_base, u32 load_value);
 void timer_init(unsigned long timer_base, unsigned int load_value);
 #endif /* __SP804_TIMER_H__ */
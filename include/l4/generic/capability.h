@@ -114,5 +114,7 @@ int cap_irq_check(struct ktcb *registrant, unsigned int req,
 		  unsigned int flags, l4id_t irq);
 int cap_cache_check(unsigned long start, unsigned long end,
 		    unsigned int flags);
+int cap_trace_check(unsigned int req, unsigned long virt,
+		    unsigned long npages);
 
 #endif /* __GENERIC_CAPABILITY_H__ */
@@ -12,6 +12,21 @@
 #include INC_SUBARCH(cache.h)
 #include <l4/lib/printk.h>
 
+/* Indices into the cache_ops counts */
+enum cache_op {
+	CACHE_OP_DCACHE_CLEAN_MVA = 0,
+	CACHE_OP_DCACHE_INVAL_MVA,
+	CACHE_OP_ICACHE_CLEAN_MVA,
+	CACHE_OP_ICACHE_INVAL_MVA,
+	CACHE_OP_DCACHE_CLEAN_SETWAY,
+	CACHE_OP_DCACHE_INVAL_SETWAY,
+	CACHE_OP_TLB_MVA,
+	CACHE_OP_TLB_ASID,
+	CACHE_OP_TLB_ALL,
+	CACHE_OP_CACHE_ALL,
+	CACHE_OP_TOTAL,
+};
+
 #if defined(CONFIG_DEBUG_ACCOUNTING)
 
 struct exception_count {
@@ -42,21 +57,15 @@ struct syscall_count {
 	u64 time;
 	u64 mutexctrl;
 	u64 cachectrl;
+	u64 mapbatch;
+	u64 tracectrl;
 } __attribute__ ((__packed__));
 
 struct task_op_count {
 	u64 context_switch;
 	u64 space_switch;
-};
-
-struct cache_op_count {
-	u64 dcache_clean_mva;
-	u64 dcache_inval_mva;
-	u64 icache_clean_mva;
-	u64 icache_inval_mva;
-	u64 dcache_clean_setway;
-	u64 dcache_inval_setway;
-	u64 tlb_mva;
+	u64 migrate_idle;	/* Taken by an idle cpu */
+	u64 migrate_balance;	/* Moved by periodic balancing or affinity */
 };
 
 #if defined(CONFIG_DEBUG_PERFMON_KERNEL)
@@ -85,6 +94,8 @@ struct syscall_timings {
 	struct syscall_timing time;
 	struct syscall_timing mutexctrl;
 	struct syscall_timing cachectrl;
+	struct syscall_timing mapbatch;
+	struct syscall_timing tracectrl;
 	u64 all_total;
 } __attribute__ ((__packed__));
 
@@ -101,7 +112,7 @@ struct system_accounting {
 #endif
 
 	struct exception_count exceptions;
-	struct cache_op_count cache_ops;
+	u64 cache_ops[CACHE_OP_TOTAL];
 	struct task_op_count task_ops;
 } __attribute__ ((__packed__));
 
@@ -143,11 +154,27 @@ static inline void system_account_space_switch(void)
 	system_accounting.task_ops.space_switch++;
 }
 
+static inline void system_account_migrate_idle(void)
+{
+	system_accounting.task_ops.migrate_idle++;
+}
+
+static inline void system_account_migrate_balance(void)
+{
+	system_accounting.task_ops.migrate_balance++;
+}
+
+static inline void system_account_cache_op(enum cache_op op)
+{
+	BUG_ON((unsigned int)op >= CACHE_OP_TOTAL);
+	system_accounting.cache_ops[op]++;
+}
+
 #include INC_SUBARCH(debug.h)
 
 #else /* End of CONFIG_DEBUG_ACCOUNTING */
 
-static inline void system_account_cache_op(int op) { }
+static inline void system_account_cache_op(enum cache_op op) { }
 static inline void system_account_irq(void) { }
 static inline void system_account_syscall(void) { }
 static inline void system_account_dabort(void) { }
@@ -155,6 +182,8 @@ static inline void system_account_pabort(void) { }
 static inline void system_account_undef_abort(void) { }
 static inline void system_account_space_switch(void) { }
 static inline void system_account_context_switch(void) { }
+static inline void system_account_migrate_idle(void) { }
+static inline void system_account_migrate_balance(void) { }
 
 #endif /* End of !CONFIG_DEBUG_ACCOUNTING */
 
@@ -28,6 +28,15 @@ void printhex8(unsigned int);
 
 void platform_test_cpucycles(void);
 
+#if defined (CONFIG_TICKLESS)
+/* Timer event in usecs from now, and a wrapping usec clock */
+void platform_timer_oneshot(u32 usecs);
+u32 platform_timer_clock(void);
+
+/* User address of the register that the clock is the inverse of */
+unsigned long platform_timer_clock_user(void);
+#endif
+
 enum mem_type {
 	MEM_TYPE_RAM = 0,
 	MEM_TYPE_DEV = 1,
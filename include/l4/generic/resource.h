@@ -39,11 +39,25 @@ container_head_init(struct container_head *chead)
 	spin_lock_init(&chead->lock);
 }
 
-/* Hash table for all existing tasks */
+/* Must be a power of two */
+#define KTCB_HASH_BUCKETS		64
+
+/* A tid hash bucket with its own lock for lookups */
+struct ktcb_hash_bucket {
+	struct link list;
+	struct spinlock lock;
+};
+
+/*
+ * List and tid hash table for all existing tasks. The hash
+ * is only used for container thread lists, so that tid
+ * lookups do not take the list lock and walk every thread.
+ */
 struct ktcb_list {
 	struct link list;
 	struct spinlock list_lock;
 	int count;
+	struct ktcb_hash_bucket hash[KTCB_HASH_BUCKETS];
 };
 
 /*
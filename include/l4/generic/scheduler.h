@@ -22,6 +22,9 @@
 #define TASK_PRIO_LOW		2
 #define TASK_PRIO_TOTAL		30
 
+/* One runqueue list per priority level, 0 to TASK_PRIO_MAX inclusive */
+#define SCHED_PRIO_LEVELS	(TASK_PRIO_MAX + 1)
+
 /*
  * CONFIG_SCHED_TICKS gives ticks per second.
  * try ticks = 1000, and timeslice = 1 for regressed preemption test.
@@ -33,6 +36,9 @@
  */
 #define SCHED_GRANULARITY			CONFIG_SCHED_TICKS/10
 
+/* Idle cpus take tasks at once, others balance at this interval */
+#define SCHED_BALANCE_TICKS			(CONFIG_SCHED_TICKS / 4)
+
 static inline struct ktcb *current_task(void)
 {
 	register u32 stack asm("sp");
@@ -44,11 +50,16 @@ static inline struct ktcb *current_task(void)
 
 #define SCHED_RQ_TOTAL			4
 
-/* A basic runqueue */
+/*
+ * A priority-indexed runqueue. Each priority level has its own
+ * list and a bit in prio_bitmap is set if that list is non-empty,
+ * so that the highest priority runnable task is found with a clz.
+ */
 struct runqueue {
 	struct scheduler *sched;
 	struct spinlock lock;		/* Lock */
-	struct link task_list;		/* List of tasks in rq */
+	u32 prio_bitmap;		/* Non-empty priority levels */
+	struct link task_list[SCHED_PRIO_LEVELS]; /* Tasks by priority */
 	unsigned int total;		/* Total tasks */
 };
 
@@ -72,6 +83,18 @@ struct scheduler {
 
 	struct ktcb *idle_task;
 
+	/*
+	 * Tasks that other cpus must not take away, as they may
+	 * still run here. The previous task could be saving its
+	 * context until this cpu schedules again.
+	 */
+	int cpu;
+	struct ktcb *curr;
+	struct ktcb *prev;
+
+	/* Jiffies at the last periodic balance */
+	u32 balance_stamp;
+
 	/* Total priority of all tasks in container */
 	int prio_total;
 };
@@ -80,11 +103,18 @@ DECLARE_PERCPU(extern struct scheduler, scheduler);
 
 void sched_init_runqueue(struct scheduler *sched, struct runqueue *rq);
 void sched_init_task(struct ktcb *task, int priority);
+void sched_set_priority(struct ktcb *task, int prio);
 void sched_prepare_sleep(void);
 void sched_suspend_sync(void);
 void sched_suspend_async(void);
 void sched_resume_sync(struct ktcb *task);
 void sched_resume_async(struct ktcb *task);
+void sched_handoff_prepare(struct ktcb *next);
+void sched_handoff_switch(struct ktcb *next);
+void sched_tick_program(struct ktcb *task);
+void sched_idle_wait(void);
+void sched_balance_tick(void);
+int sched_set_affinity(struct ktcb *task, u32 mask);
 void sched_enqueue_task(struct ktcb *first_time_runner, int sync);
 void scheduler_start(void);
 void schedule(void);
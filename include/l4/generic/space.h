@@ -20,6 +20,7 @@
 #define MAP_USR_RX			8
 #define MAP_KERN_RX			9
 #define MAP_UNMAP			10	/* For unmap syscall */
+#define MAP_USR_IO_RO			11	/* Kernel-only, for boot mappings */
 #define MAP_INVALID_FLAGS 		(1 << 31)
 
 /* Some default aliases */
@@ -40,6 +41,7 @@
 struct address_space {
 	l4id_t spid;
 	struct link list;
+	struct link hash_list;	/* Spid hash bucket */
 	struct spinlock lock;
 	pgd_table_t *pgd;
 
@@ -48,13 +50,18 @@ struct address_space {
 	int ktcb_refs;
 };
 
+/* Must be a power of two */
+#define SPACE_HASH_BUCKETS		32
+
 struct address_space_list {
 	struct link list;
 	struct spinlock lock;
 	int count;
+	struct link hash[SPACE_HASH_BUCKETS];	/* Spaces by spid */
 };
 
-struct address_space *address_space_create(struct address_space *orig);
+struct address_space *address_space_create(struct address_space *orig,
+					   int cow);
 void address_space_delete(struct address_space *space, struct cap_list *clist);
 void address_space_attach(struct ktcb *tcb, struct address_space *space);
 struct address_space *address_space_find(l4id_t spid);
@@ -28,6 +28,7 @@
 #define TASK_INTERRUPTED		(1 << 0)
 #define TASK_SUSPENDING			(1 << 1)
 #define TASK_RESUMING			(1 << 2)
+#define TASK_TIMEDOUT			(1 << 4)
 #define TASK_PENDING_SIGNAL		(TASK_SUSPENDING)
 #define TASK_REALTIME			(1 << 5)
 
@@ -96,6 +97,7 @@ struct ktcb {
 
 	/* CPU affinity */
 	int affinity;
+	u32 affinity_mask;	/* Cpus the task may be moved to */
 
 	/* Flags to indicate various task status */
 	unsigned int flags;
@@ -113,6 +115,7 @@ struct ktcb {
 	enum task_state state;
 
 	struct link task_list; /* Global task list. */
+	struct link tid_hash_list; /* Container tid hash bucket */
 
 	/* UTCB related, see utcb.txt in docs */
 	unsigned long utcb_address;	/* Virtual ref to task's utcb area */
@@ -146,6 +149,11 @@ struct ktcb {
 	struct waitqueue_head wqh_send;
 	l4id_t expected_sender;
 
+	/* Receive timeout, and the list of running timeouts */
+	u32 ipc_timeout;		/* Ticks, for the next receive */
+	u32 timeout_expires;		/* Jiffies when it runs out */
+	struct link timeout_list;
+
 	/* Waitqueue for notifiactions */
 	struct waitqueue_head wqh_notify;
 
@@ -157,6 +165,9 @@ struct ktcb {
 	struct waitqueue_head *waiting_on;
 	struct waitqueue *wq;
 
+	/* User buffer address for direct extended ipc */
+	unsigned long extended_ipc_uaddr;
+
 	/*
 	 * Extended ipc size and buffer that
 	 * points to the space after ktcb
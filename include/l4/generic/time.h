@@ -15,7 +15,26 @@ struct timeval {
 
 extern volatile u32 jiffies;
 
+#define USEC_PER_TICK		(1000000 / CONFIG_SCHED_TICKS)
+
 int do_timer_irq(void);
 int secondary_timer_irq(void);
+void update_system_time(u32 ticks);
+void update_process_times(u32 ticks);
+
+struct ktcb;
+void timeout_add(struct ktcb *task, u32 ticks);
+void timeout_del(struct ktcb *task);
+int timeout_due(void);
+void timeout_expire(void);
+u32 timeout_next_ticks(void);
+
+#if defined (CONFIG_TICKLESS)
+void tick_account(void);
+void tick_program(u32 ticks);
+#else
+static inline void tick_account(void) { }
+static inline void tick_program(u32 ticks) { }
+#endif
 
 #endif /* __GENERIC_TIME_H__ */
@@ -0,0 +1,40 @@
+/*
+ * Kernel event tracing
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#ifndef __GENERIC_TRACE_H__
+#define __GENERIC_TRACE_H__
+
+#include <l4/api/trace.h>
+
+#if defined (CONFIG_TRACE)
+
+extern volatile int trace_enabled;
+
+void trace_init(void);
+void __trace_event(unsigned int type, unsigned int data, u32 arg);
+
+/* While tracing is off, events cost a load and a branch */
+static inline void trace_event_data(unsigned int type,
+				    unsigned int data, u32 arg)
+{
+	if (trace_enabled)
+		__trace_event(type, data, arg);
+}
+
+#else /* !CONFIG_TRACE */
+
+static inline void trace_init(void) { }
+
+static inline void trace_event_data(unsigned int type,
+				    unsigned int data, u32 arg) { }
+
+#endif /* End of !CONFIG_TRACE */
+
+static inline void trace_event(unsigned int type, u32 arg)
+{
+	trace_event_data(type, 0, arg);
+}
+
+#endif /* __GENERIC_TRACE_H__ */
@@ -16,6 +16,15 @@ static inline int extended_ipc_msg_size(unsigned int flags)
 	       >> IPC_FLAGS_SIZE_SHIFT;
 }
 
+/* Number of primary message registers the sender has filled in */
+static inline int ipc_flags_get_nmrs(unsigned int flags)
+{
+	if (!(flags & IPC_FLAGS_NMRS_VALID))
+		return MR_TOTAL;
+
+	return (flags & IPC_FLAGS_NMRS_MASK) >> IPC_FLAGS_NMRS_SHIFT;
+}
+
 static inline void tcb_set_ipc_flags(struct ktcb *task,
 				     unsigned int flags)
 {
@@ -9,6 +9,7 @@
 #include <l4/generic/irq.h>
 
 int ipi_handler(struct irq_desc *desc);
+void arch_tlb_shootdown_ipi(void);
 
 
 #define IPI_TIMER_EVENT		0
@@ -39,6 +39,14 @@ int remove_mapping_space(struct address_space *space, unsigned long vaddr);
 void remove_mapping_pgd_all_user(struct address_space *space,
 				 struct cap_list *clist);
 
+int attach_range_pmds(unsigned long vaddr, unsigned long npages,
+		      struct address_space *space);
+void detach_range_pmds(unsigned long vaddr, unsigned long npages,
+		       struct address_space *space);
+
+void arch_mapping_batch_begin(void);
+void arch_mapping_batch_end(void);
+
 int check_mapping_pgd(unsigned long vaddr, unsigned long size,
 		      unsigned int flags, pgd_table_t *pgd);
 
@@ -49,7 +57,8 @@ void copy_pgd_kern_all(pgd_table_t *);
 
 struct address_space;
 int delete_page_tables(struct address_space *space, struct cap_list *clist);
-int copy_user_tables(struct address_space *new, struct address_space *orig);
+int copy_user_tables(struct address_space *new, struct address_space *orig,
+		     int cow);
 void remap_as_pages(void *vstart, void *vend);
 
 void copy_pgds_by_vrange(pgd_table_t *to, pgd_table_t *from,
@@ -78,6 +87,7 @@ void arch_prepare_write_pte(struct address_space *space, u32 paddr, u32 vaddr,
 pmd_t *arch_pick_pmd(pgd_table_t *pgd, unsigned long vaddr);
 
 void arch_write_pmd(pmd_t *pmd_entry, u32 pmd_phys, u32 vaddr, u32 asid);
+void arch_clear_pmd(pmd_t *pmd_entry);
 
 int arch_check_pte_access_perms(pte_t pte, unsigned int flags);
 
@@ -36,6 +36,12 @@
 #define IO_AREA6_VADDR		(IO_AREA_START + (SZ_1MB*6))
 #define IO_AREA7_VADDR		(IO_AREA_START + (SZ_1MB*7))
 
+/*
+ * Per-cpu kernel windows for mapping another task's pages
+ * one at a time, e.g. for direct extended ipc copies.
+ */
+#define IPC_WINDOW_VBASE	IO_AREA7_VADDR
+
 /*
  * IO_AREA8_VADDR
  * The beginning page in this slot is used for userspace uart mapping
@@ -12,6 +12,30 @@
 #include <l4/types.h>
 #include <l4/lib/list.h>
 #include <l4/lib/mutex.h>
+#include <l4/generic/smp.h>
+
+/*
+ * Number of free objects each cpu keeps cached in front of the
+ * bitmap. Half of it is moved in one go when it runs empty or full.
+ */
+#define MEM_CACHE_MAGAZINE_SIZE		8
+
+/*
+ * Objects that may sit in other cpus' magazines while this cpu
+ * finds the bitmap full. Caches sized to an exact count add these.
+ */
+#define MEM_CACHE_MAGAZINE_RESERVE	\
+	((CONFIG_NCPU - 1) * MEM_CACHE_MAGAZINE_SIZE)
+
+/*
+ * A per-cpu stack of free objects. Only touched by its own cpu with
+ * preemption disabled, so it needs no lock. Objects in a magazine
+ * are still marked as occupied in the bitmap.
+ */
+struct mem_cache_magazine {
+	int count;
+	unsigned int objs[MEM_CACHE_MAGAZINE_SIZE];
+};
 
 /*
  * Very basic cache structure. All it does is, keep an internal bitmap of
@@ -23,11 +47,14 @@ struct mem_cache {
 	struct link list;
 	struct mutex mutex;
 	int total;
-	int free;
+	int free;		/* Free in bitmap, excludes magazines */
 	unsigned int start;
 	unsigned int end;
 	unsigned int struct_size;
 	unsigned int *bitmap;
+	int bwords;		/* Number of bitmap words */
+	int hint;		/* All bitmap words below this are full */
+	DECLARE_PERCPU(struct mem_cache_magazine, magazine);
 };
 
 int mem_cache_bufsize(void *start, int struct_size, int nstructs, int aligned);
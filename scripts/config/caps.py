@@ -36,6 +36,14 @@ cap_strings = {
 \t\t\t\t          | CAP_TRANSFERABLE,
 \t\t\t\t.start = IRQ_RANGE_START, .end = IRQ_RANGE_END, .size = 0,
 \t\t\t},
+""",
+    "trace": """
+\t\t\t[${idx}] = {
+\t\t\t\t.target = ${cid},
+\t\t\t\t.type = CAP_TYPE_TRACE | CAP_RTYPE_CONTAINER,
+\t\t\t\t.access = CAP_TRACE_MAP | CAP_TRACE_CONTROL,
+\t\t\t\t.start = 0, .end = 0, .size = 0,
+\t\t\t},
 """,
     "exregs": """
 \t\t\t[${idx}] = {
@@ -156,9 +164,10 @@ def prepare_custom_capability(cont, caplist, param, val):
 
 
 def _init_capability(caplist, captype, cont):
-    """Initialize a capability with default container id for pools/irqctrl."""
+    """Initialize a capability with default container id for pools/irqctrl/trace."""
     caplist.caps[captype] = cap_strings[captype]
-    if captype.endswith("pool") or captype.endswith("irqctrl"):
+    if (captype.endswith("pool") or captype.endswith("irqctrl")
+            or captype == "trace"):
         templ = Template(caplist.caps[captype])
         caplist.caps[captype] = templ.safe_substitute(cid=cont.id)
 
@@ -171,6 +180,10 @@ def prepare_typed_capability(cont, caplist, param, val):
     if captype not in cap_strings:
         return
 
+    # A disabled capability must not be created at all
+    if "USE" in params and str(val).strip() in ("0", ""):
+        return
+
     # Auto-initialize capability if not yet seen (handles out-of-order symbols)
     if captype not in caplist.caps:
         _init_capability(caplist, captype, cont)
@@ -6,6 +6,7 @@ from os.path import join
 
 from .projpaths import PROJROOT, CONFIG_H
 from .lib import conv_hex
+from .configuration import configuration_retrieve
 
 
 def get_conts_memory_regions(phys_virt, array_start, array_end):
@@ -105,6 +106,37 @@ def virt_region_sanity_check():
     check_memory_overlap("VIRT", virt_start, virt_end)
 
 
+def trace_capability_sanity_check():
+    """
+    Check that only containers with trace enabled get the trace capability.
+
+    The trace capability maps the kernel trace buffers of all cpus and
+    starts or stops tracing, so it must never reach a container by default.
+    """
+    config = configuration_retrieve()
+    if not config:
+        return
+
+    enabled = set()
+    pattern = r"CONFIG_CONT(\d+)_PAGER_CAP_TRACE_USE\s+1\s*$"
+    with open(join(PROJROOT, CONFIG_H), "r") as file:
+        for line in file:
+            match = re.search(pattern, line)
+            if match:
+                enabled.add(int(match.group(1)))
+
+    for cont in config.containers:
+        for owner, caplist in cont.caplist.items():
+            if "trace" not in caplist.caps:
+                continue
+            if owner != "PAGER" or int(cont.id) not in enabled:
+                print(f"Container {cont.id} has a trace capability "
+                      f"without trace enabled!!!")
+                print()
+                sys.exit(1)
+
+
 def sanity_check_conts():
     phys_region_sanity_check()
     virt_region_sanity_check()
+    trace_capability_sanity_check()
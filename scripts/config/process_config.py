@@ -256,6 +256,12 @@ def generate_container_symbols(manifest: Dict) -> Dict[str, Any]:
             1 if irqctrl.get("enabled", False) else 0
         )
 
+        # Kernel event tracing (pager-level, privileged containers only).
+        # The symbol is only written for containers that enable it.
+        trace = caps.get("trace", {})
+        if trace.get("enabled", False):
+            symbols[f"{prefix}PAGER_CAP_TRACE_USE"] = 1
+
         # Custom capabilities (default to disabled)
         for i in range(4):
             symbols[f"{prefix}PAGER_CAP_CUSTOM{i}_USE"] = 0
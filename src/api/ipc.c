@@ -4,6 +4,8 @@
  * Copyright (C) 2007-2009 Bahadir Bilgehan Balban
  */
 #include <l4/generic/tcb.h>
+#include <l4/generic/trace.h>
+#include <l4/generic/time.h>
 #include <l4/lib/mutex.h>
 #include <l4/api/ipc.h>
 #include <l4/api/thread.h>
@@ -14,7 +16,36 @@
 #include INC_API(syscall.h)
 #include INC_GLUE(message.h)
 #include INC_GLUE(ipc.h)
+#include INC_GLUE(mapping.h)
+#include INC_GLUE(memlayout.h)
+#include INC_GLUE(cache.h)
 
+/*
+ * Copies the first nmrs primary message registers. Notifications
+ * and acks use only a few words, so these are assigned directly.
+ */
+static inline void ipc_copy_mrs(unsigned int *mr0_dst,
+				unsigned int *mr0_src, int nmrs)
+{
+	switch (nmrs) {
+	case 3:
+		mr0_dst[2] = mr0_src[2];
+		/* Fall through */
+	case 2:
+		mr0_dst[1] = mr0_src[1];
+		/* Fall through */
+	case 1:
+		mr0_dst[0] = mr0_src[0];
+		/* Fall through */
+	case 0:
+		break;
+	default:
+		for (int i = 0; i < nmrs; i++)
+			mr0_dst[i] = mr0_src[i];
+	}
+}
+
+/* Copies only the primary message registers the sender has used */
 int ipc_short_copy(struct ktcb *to, struct ktcb *from)
 {
 	unsigned int *mr0_src;
@@ -29,6 +60,24 @@ int ipc_short_copy(struct ktcb *to, struct ktcb *from)
 	/* NOTE:
 	 * Make sure MR_TOTAL matches the number of registers saved on stack.
 	 */
+	ipc_copy_mrs(mr0_dst, mr0_src,
+		     ipc_flags_get_nmrs(tcb_get_ipc_flags(from)));
+
+	return 0;
+}
+
+/* Copies all primary message registers */
+static int ipc_primary_copy(struct ktcb *to, struct ktcb *from)
+{
+	unsigned int *mr0_src;
+	unsigned int *mr0_dst;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Waddress-of-packed-member"
+	mr0_src = KTCB_REF_MR0(from);
+	mr0_dst = KTCB_REF_MR0(to);
+#pragma GCC diagnostic pop
+
 	memcpy(mr0_dst, mr0_src, MR_TOTAL * sizeof(unsigned int));
 
 	return 0;
@@ -42,8 +91,8 @@ int ipc_full_copy(struct ktcb *to, struct ktcb *from)
 	struct utcb *to_utcb = (struct utcb *)to->utcb_address;
 	int ret;
 
-	/* First do the short copy of primary mrs */
-	if ((ret = ipc_short_copy(to, from)) < 0)
+	/* First copy all primary mrs */
+	if ((ret = ipc_primary_copy(to, from)) < 0)
 		return ret;
 
 	/* Check that utcb memory accesses won't fault us */
@@ -78,6 +127,96 @@ int ipc_extended_copy(struct ktcb *to, struct ktcb *from)
 	return 0;
 }
 
+/*
+ * Returns the kernel window this cpu uses to reach a page
+ * of the ipc peer, which is not the current address space.
+ */
+static inline unsigned long ipc_window_vaddr(void)
+{
+	return IPC_WINDOW_VBASE + smp_get_cpuid() * PAGE_SIZE;
+}
+
+/*
+ * The window aliases a page that its owner reaches at another
+ * address. A virtually tagged cache must be written back and
+ * emptied around each use, both of the window's lines and of
+ * the owner's, which may be in the cache if the peer shares
+ * our space.
+ */
+static inline void ipc_window_sync(unsigned long window)
+{
+#if defined (CONFIG_SUBARCH_V5)
+	arch_clean_invalidate_dcache(window, window + PAGE_SIZE);
+#endif
+}
+
+/*
+ * Direct copy moves the message between user buffers in one
+ * pass. Current's buffer is accessed directly, while the peer's
+ * buffer is mapped a page at a time to this cpu's ipc window.
+ * Both parties have paged in their buffers before the rendezvous.
+ *
+ * We may be preempted between pages, so that a large message
+ * does not hold up the cpu. Either buffer may have been unmapped
+ * by another thread of its space meanwhile, so each page is
+ * checked as it is reached.
+ */
+int ipc_direct_copy(struct ktcb *to, struct ktcb *from)
+{
+	struct ktcb *peer = (current == from) ? to : from;
+	unsigned long size = min(from->extended_ipc_size,
+				 to->extended_ipc_size);
+	unsigned long local = current->extended_ipc_uaddr;
+	unsigned long remote = peer->extended_ipc_uaddr;
+	unsigned int local_flags = (peer == to) ? MAP_USR_RO : MAP_USR_RW;
+	unsigned int remote_flags = (peer == to) ? MAP_USR_RW : MAP_USR_RO;
+	unsigned long window, offset, chunk, copied;
+	unsigned int *mr0_dst;
+
+	for (copied = 0; copied < size; copied += chunk) {
+		offset = (remote + copied) & PAGE_MASK;
+		chunk = min(PAGE_SIZE - offset, size - copied);
+
+		/* The window is per-cpu, so we must not be moved */
+		preempt_disable();
+
+		if (!check_mapping_pgd(local + copied, chunk, local_flags,
+				       TASK_PGD(current)) ||
+		    !check_mapping_pgd(remote + copied, chunk, remote_flags,
+				       TASK_PGD(peer))) {
+			preempt_enable();
+			return -EFAULT;
+		}
+
+		window = ipc_window_vaddr();
+		add_mapping_space(virt_to_phys_by_pgd(TASK_PGD(peer),
+						      remote + copied),
+				  window, PAGE_SIZE, MAP_KERN_RW,
+				  current->space);
+		ipc_window_sync(window);
+		if (peer == to)
+			memcpy((void *)(window + offset),
+			       (void *)(local + copied), chunk);
+		else
+			memcpy((void *)(local + copied),
+			       (void *)(window + offset), chunk);
+		ipc_window_sync(window);
+		remove_mapping_space(current->space, window);
+
+		preempt_enable();
+	}
+
+	/* Tell the receiver how much it got */
+	to->extended_ipc_size = size;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Waddress-of-packed-member"
+	mr0_dst = KTCB_REF_MR0(to);
+#pragma GCC diagnostic pop
+	mr0_dst[extended_ipc_msg_index(tcb_get_ipc_flags(to)) + 1] = size;
+
+	return 0;
+}
+
 /*
  * Copies message registers from one ktcb stack to another. During the return
  * from system call, the registers are popped from the stack. In the future
@@ -105,6 +244,8 @@ int ipc_msg_copy(struct ktcb *to, struct ktcb *from)
 	 * FULL		FULL/SHORT	-> FULL IPC
 	 * EXTENDED	EXTENDED	-> EXTENDED IPC
 	 * EXTENDED	NON-EXTENDED	-> ENOIPC
+	 * DIRECT	DIRECT		-> DIRECT IPC
+	 * DIRECT	NON-DIRECT	-> ENOIPC
 	 */
 
 	switch(recv_ipc_type) {
@@ -115,6 +256,8 @@ int ipc_msg_copy(struct ktcb *to, struct ktcb *from)
 			ret = ipc_full_copy(to, from);
 		if (send_ipc_type == IPC_FLAGS_EXTENDED)
 			ret = -ENOIPC;
+		if (send_ipc_type == IPC_FLAGS_DIRECT)
+			ret = -ENOIPC;
 		break;
 	case IPC_FLAGS_FULL:
 		if (send_ipc_type == IPC_FLAGS_SHORT)
@@ -123,6 +266,8 @@ int ipc_msg_copy(struct ktcb *to, struct ktcb *from)
 			ret = ipc_full_copy(to, from);
 		if (send_ipc_type == IPC_FLAGS_EXTENDED)
 			ret = -ENOIPC;
+		if (send_ipc_type == IPC_FLAGS_DIRECT)
+			ret = -ENOIPC;
 		break;
 	case IPC_FLAGS_EXTENDED:
 		if (send_ipc_type == IPC_FLAGS_EXTENDED) {
@@ -135,6 +280,17 @@ int ipc_msg_copy(struct ktcb *to, struct ktcb *from)
 			ret = -ENOIPC;
 		if (send_ipc_type == IPC_FLAGS_FULL)
 			ret = -ENOIPC;
+		if (send_ipc_type == IPC_FLAGS_DIRECT)
+			ret = -ENOIPC;
+		break;
+	case IPC_FLAGS_DIRECT:
+		if (send_ipc_type == IPC_FLAGS_DIRECT) {
+			/* We do a short copy as well. */
+			if ((ret = ipc_short_copy(to, from)) < 0)
+				break;
+			ret = ipc_direct_copy(to, from);
+		} else
+			ret = -ENOIPC;
 		break;
 	}
 
@@ -150,9 +306,24 @@ int ipc_msg_copy(struct ktcb *to, struct ktcb *from)
 	return ret;
 }
 
-int sys_ipc_control(void)
+/*
+ * Sets a timeout in milliseconds for the next receive of the
+ * caller, after which it gives up with -ETIMEDOUT. Zero clears
+ * it. The timeout is rounded up to whole ticks, and one more, so
+ * that it never runs out early.
+ */
+int sys_ipc_control(unsigned int req, l4id_t tid, u32 arg)
 {
-	return -ENOSYS;
+	switch (req) {
+	case IPC_CONTROL_RECV_TIMEOUT:
+		if (arg > IPC_TIMEOUT_MAX_MSECS)
+			return -EINVAL;
+		current->ipc_timeout = arg ? (arg * CONFIG_SCHED_TICKS + 999)
+					     / 1000 + 1 : 0;
+		return 0;
+	default:
+		return -EINVAL;
+	}
 }
 
 /*
@@ -185,6 +356,12 @@ int ipc_handle_errors(void)
 	/* Did we wake up normally or get interrupted */
 	if (current->flags & TASK_INTERRUPTED) {
 		current->flags &= ~TASK_INTERRUPTED;
+
+		/* Interrupted by the receive timeout */
+		if (current->flags & TASK_TIMEDOUT) {
+			current->flags &= ~TASK_TIMEDOUT;
+			return -ETIMEDOUT;
+		}
 		return -EINTR;
 	}
 
@@ -219,6 +396,8 @@ int ipc_send(l4id_t recv_tid, unsigned int flags)
 	struct waitqueue_head *wqhs, *wqhr;
 	int ret = 0;
 
+	trace_event(TRACE_IPC_SEND, recv_tid);
+
 	if (!(receiver = tcb_find_lock(recv_tid)))
 		return -ESRCH;
 
@@ -240,9 +419,18 @@ int ipc_send(l4id_t recv_tid, unsigned int flags)
 		wqhr->sleepers--;
 		task_unset_wqh(receiver);
 
-		/* Release locks */
+		/*
+		 * Release locks. The receiver can't go away while it
+		 * is off its waitqueue and not woken up (see above),
+		 * so its thread lock is not needed for the copy. This
+		 * leaves the copy preemptible, as it is on receive.
+		 */
 		spin_unlock(&wqhr->slock);
 		spin_unlock(&wqhs->slock);
+		spin_unlock(&receiver->thread_lock);
+
+		trace_event_data(TRACE_IPC_RENDEZVOUS, TRACE_DATA_SENDER,
+				 receiver->tid);
 
 		/* Copy message registers */
 		if ((ret = ipc_msg_copy(receiver, current)) < 0)
@@ -253,9 +441,6 @@ int ipc_send(l4id_t recv_tid, unsigned int flags)
 
 		/* Wake it up async */
 		sched_resume_async(receiver);
-
-		/* Release thread lock (protects for delete) */
-		spin_unlock(&receiver->thread_lock);
 		return ret;
 	}
 
@@ -278,11 +463,17 @@ int ipc_send(l4id_t recv_tid, unsigned int flags)
 int ipc_recv(l4id_t senderid, unsigned int flags)
 {
 	struct waitqueue_head *wqhs, *wqhr;
+	u32 timeout = current->ipc_timeout;
 	int ret = 0;
 
 	wqhs = &current->wqh_send;
 	wqhr = &current->wqh_recv;
 
+	/* A timeout only applies to one receive */
+	current->ipc_timeout = 0;
+
+	trace_event(TRACE_IPC_RECV, senderid);
+
 	/*
 	 * Indicate who we expect to receive from,
 	 * so senders know.
@@ -312,6 +503,8 @@ int ipc_recv(l4id_t senderid, unsigned int flags)
 				spin_unlock(&wqhr->slock);
 				spin_unlock(&wqhs->slock);
 
+				trace_event(TRACE_IPC_RENDEZVOUS, sleeper->tid);
+
 				/* Copy message registers */
 				if ((ret = ipc_msg_copy(current, sleeper)) < 0)
 					ipc_signal_error(sleeper, ret);
@@ -333,10 +526,125 @@ int ipc_recv(l4id_t senderid, unsigned int flags)
 	sched_prepare_sleep();
 	// printk("%s: (%d) waiting for (%d)\n", __FUNCTION__,
 	//       current->tid, current->expected_sender);
+
+	/* We must not be preempted asleep before the timeout is set */
+	preempt_disable();
 	spin_unlock(&wqhr->slock);
 	spin_unlock(&wqhs->slock);
+	if (timeout)
+		timeout_add(current, timeout);
+	preempt_enable();
+
 	schedule();
 
+	if (timeout)
+		timeout_del(current);
+
+	return ipc_handle_errors();
+}
+
+/*
+ * Conditions for switching directly to a receiver. It must be on
+ * our cpu, not be outranked by current, and neither party may
+ * have pending events that the scheduler would need to handle.
+ * Current's receive may not have a timeout, which is only set
+ * on the slow path.
+ */
+static inline int ipc_can_handoff(struct ktcb *receiver)
+{
+	return receiver->affinity == current->affinity &&
+	       receiver->priority >= current->priority &&
+	       current->state == TASK_RUNNABLE &&
+	       current->ticks_left > 0 && !need_resched &&
+	       !current->ipc_timeout &&
+	       !(current->flags & TASK_PENDING_SIGNAL) &&
+	       !(receiver->flags & TASK_PENDING_SIGNAL);
+}
+
+/*
+ * Send/receive fast path. If the receiver is already waiting for
+ * us, the message is copied, current goes to sleep waiting for the
+ * reply, and the receiver is switched to directly on current's
+ * timeslice, without a trip through the scheduler.
+ *
+ * Returns -EAGAIN if the fast path does not apply, in which case
+ * nothing has been done and the regular path must be taken.
+ */
+static int ipc_sendrecv_fast(l4id_t to, unsigned int flags)
+{
+	struct ktcb *receiver;
+	struct waitqueue_head *wqhs, *wqhr;
+	struct waitqueue *rwq;
+	int ret;
+
+	if (!(receiver = tcb_find_lock(to)))
+		return -ESRCH;
+
+	wqhs = &receiver->wqh_send;
+	wqhr = &receiver->wqh_recv;
+
+	spin_lock(&wqhs->slock);
+	spin_lock(&wqhr->slock);
+
+	/* Receiver must be ready and expecting us */
+	if (!(receiver->state == TASK_SLEEPING &&
+	      receiver->waiting_on == wqhr &&
+	      (receiver->expected_sender == current->tid ||
+	       receiver->expected_sender == L4_ANYTHREAD)) ||
+	    !ipc_can_handoff(receiver)) {
+		spin_unlock(&wqhr->slock);
+		spin_unlock(&wqhs->slock);
+		spin_unlock(&receiver->thread_lock);
+		return -EAGAIN;
+	}
+
+	/* Remove from waitqueue */
+	rwq = receiver->wq;
+	list_remove_init(&rwq->task_list);
+	wqhr->sleepers--;
+	task_unset_wqh(receiver);
+
+	spin_unlock(&wqhr->slock);
+	spin_unlock(&wqhs->slock);
+
+	trace_event_data(TRACE_IPC_RENDEZVOUS,
+			 TRACE_DATA_SENDER | TRACE_DATA_HANDOFF,
+			 receiver->tid);
+
+	/* Copy message registers */
+	if ((ret = ipc_msg_copy(receiver, current)) < 0) {
+		ipc_signal_error(receiver, ret);
+		sched_resume_async(receiver);
+		spin_unlock(&receiver->thread_lock);
+		return ret;
+	}
+
+	/*
+	 * Nobody can be sending to us from the receiver since it
+	 * was waiting to receive, so go straight to waiting for the
+	 * reply. No scheduling may occur until we switch.
+	 */
+	preempt_disable();
+	current->expected_sender = to;
+
+	wqhs = &current->wqh_send;
+	wqhr = &current->wqh_recv;
+
+	spin_lock(&wqhs->slock);
+	spin_lock(&wqhr->slock);
+
+	CREATE_WAITQUEUE_ON_STACK(wq, current);
+	wqhr->sleepers++;
+	list_insert_tail(&wq.task_list, &wqhr->task_list);
+	task_set_wqh(current, wqhr, &wq);
+	sched_handoff_prepare(receiver);
+
+	spin_unlock(&wqhr->slock);
+	spin_unlock(&wqhs->slock);
+	spin_unlock(&receiver->thread_lock);
+
+	sched_handoff_switch(receiver);
+
 	return ipc_handle_errors();
 }
 
@@ -359,6 +667,10 @@ int ipc_sendrecv(l4id_t to, l4id_t from, unsigned int flags)
 	int ret = 0;
 
 	if (to == from) {
+		/* Try handing over the cpu to a waiting receiver */
+		if ((ret = ipc_sendrecv_fast(to, flags)) != -EAGAIN)
+			return ret;
+
 		/* Send ipc request */
 		if ((ret = ipc_send(to, flags)) < 0)
 			return ret;
@@ -490,13 +802,115 @@ int ipc_send_extended(l4id_t recv_tid, unsigned int flags)
 	return ipc_send(recv_tid, flags);
 }
 
+/*
+ * Reads the user buffer address and size of a direct ipc,
+ * and pages in the buffer with the given access flags.
+ */
+static int ipc_direct_setup(unsigned int flags, unsigned int access)
+{
+	unsigned long msg_index;
+	unsigned long ipc_address;
+	unsigned long size;
+	unsigned int *mr0_current;
+	int err;
+
+	/*
+	 * Obtain primary message register index
+	 * containing direct ipc buffer address.
+	 * Size is in the one following it.
+	 */
+	msg_index = extended_ipc_msg_index(flags);
+	if (msg_index + 1 >= MR_TOTAL)
+		return -EINVAL;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Waddress-of-packed-member"
+	mr0_current = KTCB_REF_MR0(current);
+#pragma GCC diagnostic pop
+
+	ipc_address = (unsigned long)mr0_current[msg_index];
+	size = (unsigned long)mr0_current[msg_index + 1];
+
+	/* Check size is good */
+	if (size > IPC_DIRECT_MAX_SIZE)
+		return -EINVAL;
+
+	/* Page fault those pages on the current task if needed */
+	if (size && (err = check_access(ipc_address, size, access, 1)) < 0)
+		return err;
+
+	current->extended_ipc_uaddr = ipc_address;
+	current->extended_ipc_size = size;
+
+	return 0;
+}
+
+/*
+ * In direct receive, the receive buffer is paged in before
+ * engaging in real ipc. The sender copies straight into it.
+ */
+int ipc_recv_direct(l4id_t sendertid, unsigned int flags)
+{
+	int err;
+
+	if ((err = ipc_direct_setup(flags, MAP_USR_RW)) < 0)
+		return err;
+
+	return ipc_recv(sendertid, flags);
+}
+
+/*
+ * In direct send, the send buffer is paged in and left in place,
+ * rather than being copied to the kernel stack.
+ */
+int ipc_send_direct(l4id_t recv_tid, unsigned int flags)
+{
+	int err;
+
+	if ((err = ipc_direct_setup(flags, MAP_USR_RO)) < 0)
+		return err;
+
+	return ipc_send(recv_tid, flags);
+}
+
+/*
+ * Reserves the page table for the per-cpu ipc windows. This is
+ * in the global io area, so all address spaces share it and
+ * windows can later be mapped without allocating a pmd.
+ */
+void ipc_window_init(void)
+{
+	for (int i = 0; i < CONFIG_NCPU; i++) {
+		add_boot_mapping(virt_to_phys(&kip),
+				 IPC_WINDOW_VBASE + i * PAGE_SIZE,
+				 PAGE_SIZE, MAP_KERN_RW);
+		remove_mapping_space(current->space,
+				     IPC_WINDOW_VBASE + i * PAGE_SIZE);
+	}
+}
 
 static inline int __sys_ipc(l4id_t to, l4id_t from,
 			    unsigned int ipc_dir, unsigned int flags)
 {
 	int ret;
 
-	if (ipc_flags_get_type(flags) == IPC_FLAGS_EXTENDED) {
+	if (ipc_flags_get_type(flags) == IPC_FLAGS_DIRECT) {
+		switch (ipc_dir) {
+		case IPC_SEND:
+			ret = ipc_send_direct(to, flags);
+			break;
+		case IPC_RECV:
+			ret = ipc_recv_direct(from, flags);
+			break;
+		case IPC_SENDRECV:
+			ret = ipc_sendrecv_extended(to, from, flags);
+			break;
+		case IPC_INVALID:
+		default:
+			printk("Unsupported ipc operation.\n");
+			ret = -ENOSYS;
+		}
+	} else if (ipc_flags_get_type(flags) == IPC_FLAGS_EXTENDED) {
 		switch (ipc_dir) {
 		case IPC_SEND:
 			ret = ipc_send_extended(to, flags);
@@ -589,6 +1003,12 @@ int sys_ipc(l4id_t to, l4id_t from, unsigned int flags)
 		goto error;
 	}
 
+	/* Cannot have more valid mrs than there are */
+	if (ipc_flags_get_nmrs(flags) > MR_TOTAL) {
+		ret = -EINVAL;
+		goto error;
+	}
+
 	/* Everything in place, now check capability */
 	if ((ret = cap_ipc_check(to, from, flags, ipc_dir)) < 0)
 		return ret;
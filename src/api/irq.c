@@ -93,6 +93,7 @@ int irq_control_register(struct ktcb *task, int slot, l4id_t irqnum)
 
 	/* Make thread a real-time task */
 	current->flags |= TASK_REALTIME;
+	sched_set_priority(current, TASK_PRIO_REALTIME);
 
 	return 0;
 }
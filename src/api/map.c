@@ -4,6 +4,8 @@
  * Copyright (C) 2007 Bahadir Balban
  */
 #include <l4/generic/tcb.h>
+#include <l4/generic/space.h>
+#include <l4/lib/string.h>
 #include INC_API(syscall.h)
 #include INC_SUBARCH(mm.h)
 #include <l4/api/errno.h>
@@ -29,10 +31,54 @@ int user_map_flags_validate(unsigned int flags)
 	return 0;
 }
 
+/*
+ * Pages changed in one batch before preemption is let in. Batches
+ * run with preemption disabled, so this bounds the latency that a
+ * mapping request of any size adds.
+ */
+#define MAP_BATCH_PAGES		PMD_ENTRY_TOTAL
+
+/* Ends the batch and opens a new one every MAP_BATCH_PAGES pages */
+static void map_batch_progress(int *batched, unsigned long npages)
+{
+	if ((*batched += npages) < MAP_BATCH_PAGES)
+		return;
+
+	arch_mapping_batch_end();
+	arch_mapping_batch_begin();
+	*batched = 0;
+}
+
+/*
+ * Maps a range inside an open batch. The range must have all its
+ * pmds attached, so that only ptes are written here.
+ */
+static int map_batch_range(unsigned long phys, unsigned long virt,
+			   unsigned long npages, unsigned int flags,
+			   struct address_space *space, int *batched)
+{
+	unsigned long n;
+	int err;
+
+	while (npages) {
+		n = npages < MAP_BATCH_PAGES ? npages : MAP_BATCH_PAGES;
+		if ((err = add_mapping_space(phys, virt, n << PAGE_BITS,
+					     flags, space)) < 0)
+			return err;
+		map_batch_progress(batched, n);
+		phys += n << PAGE_BITS;
+		virt += n << PAGE_BITS;
+		npages -= n;
+	}
+
+	return 0;
+}
+
 int sys_map(unsigned long phys, unsigned long virt,
 	    unsigned long npages, unsigned int flags, l4id_t tid)
 {
 	struct ktcb *target;
+	int batched = 0;
 	int err;
 
 	if (!(target = tcb_find(tid)))
@@ -48,8 +94,26 @@ int sys_map(unsigned long phys, unsigned long virt,
 	if ((err = cap_map_check(target, phys, virt, npages, flags)) < 0)
 		return err;
 
-	return add_mapping_space(phys, virt, npages << PAGE_BITS,
-				 flags, target->space);
+	/* Single page mappings are synced as they are written */
+	if (npages == 1)
+		return add_mapping_space(phys, virt, PAGE_SIZE,
+					 flags, target->space);
+
+	if ((err = attach_range_pmds(virt, npages, target->space)) < 0)
+		goto out_err;
+
+	arch_mapping_batch_begin();
+	err = map_batch_range(phys, virt, npages, flags,
+			      target->space, &batched);
+	arch_mapping_batch_end();
+	if (err < 0)
+		goto out_err;
+
+	return 0;
+
+out_err:
+	detach_range_pmds(virt, npages, target->space);
+	return err;
 }
 
 /*
@@ -60,7 +124,7 @@ int sys_map(unsigned long phys, unsigned long virt,
 int sys_unmap(unsigned long virtual, unsigned long npages, unsigned int tid)
 {
 	struct ktcb *target;
-	int ret = 0, retval = 0;
+	int ret = 0, retval = 0, batched = 0;
 
 	if (!(target = tcb_find(tid)))
 		return -ESRCH;
@@ -71,13 +135,109 @@ int sys_unmap(unsigned long virtual, unsigned long npages, unsigned int tid)
 	if ((ret = cap_unmap_check(target, virtual, npages)) < 0)
 		return ret;
 
+	/* Sync caches and tlb once for the whole range */
+	arch_mapping_batch_begin();
 	for (int i = 0; i < npages; i++) {
 		ret = remove_mapping_space(target->space,
 					   virtual + i * PAGE_SIZE);
 		if (ret)
 			retval = ret;
+		map_batch_progress(&batched, 1);
 	}
+	arch_mapping_batch_end();
 
 	return retval;
 }
 
+/*
+ * Maps or unmaps a vector of ranges in a single call. The ranges are
+ * copied in and validated before any of them is changed, with one
+ * capability check per range. Cache and tlb maintenance is done once
+ * for the whole batch. Returns as sys_map()/sys_unmap() would.
+ */
+int sys_map_batch(struct map_desc *udesc, int ndesc,
+		  unsigned int op, l4id_t tid)
+{
+	struct map_desc desc[MAP_BATCH_MAX];
+	struct ktcb *target;
+	int ret = 0, retval = 0, batched = 0;
+	int i;
+
+	if (!(target = tcb_find(tid)))
+		return -ESRCH;
+
+	if (ndesc <= 0 || ndesc > MAP_BATCH_MAX)
+		return -EINVAL;
+
+	if (op != MAP_BATCH_MAP && op != MAP_BATCH_UNMAP)
+		return -EINVAL;
+
+	/* Page-in and copy descriptors so they can't change under us */
+	if ((ret = check_access((unsigned long)udesc,
+				ndesc * sizeof(struct map_desc),
+				MAP_USR_RO, 1)) < 0)
+		return ret;
+	memcpy(desc, udesc, ndesc * sizeof(struct map_desc));
+
+	for (int i = 0; i < ndesc; i++) {
+		if (!desc[i].npages || !desc[i].virt)
+			return -EINVAL;
+
+		if (op == MAP_BATCH_UNMAP) {
+			if ((ret = cap_unmap_check(target, desc[i].virt,
+						   desc[i].npages)) < 0)
+				return ret;
+			continue;
+		}
+
+		if (!user_map_flags_validate(desc[i].flags) || !desc[i].phys)
+			return -EINVAL;
+
+		if ((ret = cap_map_check(target, desc[i].phys, desc[i].virt,
+					 desc[i].npages, desc[i].flags)) < 0)
+			return ret;
+	}
+
+	/* Allocations may sleep, so they are all done before the batch */
+	if (op == MAP_BATCH_MAP)
+		for (i = 0; i < ndesc; i++)
+			if ((ret = attach_range_pmds(desc[i].virt,
+						     desc[i].npages,
+						     target->space)) < 0)
+				goto out_detach;
+
+	arch_mapping_batch_begin();
+	for (i = 0; i < ndesc; i++) {
+		if (op == MAP_BATCH_MAP) {
+			if ((ret = map_batch_range(desc[i].phys, desc[i].virt,
+						   desc[i].npages,
+						   desc[i].flags,
+						   target->space,
+						   &batched)) < 0) {
+				/* All of the ranges have their pmds */
+				arch_mapping_batch_end();
+				i = ndesc - 1;
+				goto out_detach;
+			}
+			continue;
+		}
+		for (int j = 0; j < desc[i].npages; j++) {
+			ret = remove_mapping_space(target->space,
+						   desc[i].virt +
+						   j * PAGE_SIZE);
+			if (ret)
+				retval = ret;
+			map_batch_progress(&batched, 1);
+		}
+	}
+	arch_mapping_batch_end();
+
+	return retval;
+
+out_detach:
+	/* Drop the pmds left empty in the ranges attached so far */
+	for (; i >= 0; i--)
+		detach_range_pmds(desc[i].virt, desc[i].npages,
+				  target->space);
+	return ret;
+}
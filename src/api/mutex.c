@@ -9,6 +9,7 @@
 #include <l4/generic/scheduler.h>
 #include <l4/generic/container.h>
 #include <l4/generic/tcb.h>
+#include <l4/generic/trace.h>
 #include <l4/api/kip.h>
 #include <l4/api/errno.h>
 #include <l4/api/mutex.h>
@@ -20,19 +21,32 @@
 void init_mutex_queue_head(struct mutex_queue_head *mqhead)
 {
 	memset(mqhead, 0, sizeof(*mqhead));
-	link_init(&mqhead->list);
-	mutex_init(&mqhead->mutex_control_mutex);
+
+	for (int i = 0; i < MUTEX_QUEUE_BUCKETS; i++) {
+		link_init(&mqhead->bucket[i].list);
+		mutex_init(&mqhead->bucket[i].lock);
+	}
 }
 
-void mutex_queue_head_lock(struct mutex_queue_head *mqhead)
+/* Mutexes are at least word aligned, so the low bits carry nothing */
+static inline struct mutex_queue_bucket *
+mutex_queue_bucket(struct mutex_queue_head *mqhead, unsigned long physical)
 {
-	mutex_lock(&mqhead->mutex_control_mutex);
+	unsigned long key = physical / sizeof(unsigned long);
+
+	return &mqhead->bucket[(key ^ (key >> 6) ^ (key >> 12)) &
+			       (MUTEX_QUEUE_BUCKETS - 1)];
 }
 
-void mutex_queue_head_unlock(struct mutex_queue_head *mqhead)
+void mutex_queue_bucket_lock(struct mutex_queue_bucket *bucket)
+{
+	mutex_lock(&bucket->lock);
+}
+
+void mutex_queue_bucket_unlock(struct mutex_queue_bucket *bucket)
 {
 	/* Async unlock because in some cases preemption may be disabled here */
-	mutex_unlock_async(&mqhead->mutex_control_mutex);
+	mutex_unlock_async(&bucket->lock);
 }
 
 
@@ -46,28 +60,27 @@ void mutex_queue_init(struct mutex_queue *mq, unsigned long physical)
 	waitqueue_head_init(&mq->wqh_contenders);
 }
 
-void mutex_control_add(struct mutex_queue_head *mqhead, struct mutex_queue *mq)
+void mutex_control_add(struct mutex_queue_bucket *bucket,
+		       struct mutex_queue *mq)
 {
 	BUG_ON(!list_empty(&mq->list));
 
-	list_insert(&mq->list, &mqhead->list);
-	mqhead->count++;
+	list_insert(&mq->list, &bucket->list);
 }
 
-void mutex_control_remove(struct mutex_queue_head *mqhead, struct mutex_queue *mq)
+void mutex_control_remove(struct mutex_queue *mq)
 {
 	list_remove_init(&mq->list);
-	mqhead->count--;
 }
 
 /* Note, this has ptr/negative error returns instead of ptr/zero. */
-struct mutex_queue *mutex_control_find(struct mutex_queue_head *mqhead,
+struct mutex_queue *mutex_control_find(struct mutex_queue_bucket *bucket,
 				       unsigned long mutex_physical)
 {
 	struct mutex_queue *mutex_queue;
 
 	/* Find the mutex queue with this key */
-	list_foreach_struct(mutex_queue, &mqhead->list, list)
+	list_foreach_struct(mutex_queue, &bucket->list, list)
 		if (mutex_queue->physical == mutex_physical)
 			return mutex_queue;
 
@@ -101,6 +114,21 @@ void mutex_control_delete(struct mutex_queue *mq)
 	mutex_cap_free(mq);
 }
 
+/* Wakes up a waiter of the mutex at the physical address */
+static inline void mutex_queue_wake(struct waitqueue_head *wqh,
+				    unsigned long mutex_address)
+{
+	trace_event(TRACE_MUTEX_WAKE, mutex_address);
+	wake_up(wqh, WAKEUP_ASYNC);
+}
+
+/* Sleeps on the mutex after wait_on_prepare() */
+static inline int mutex_queue_wait(unsigned long mutex_address)
+{
+	trace_event(TRACE_MUTEX_SLEEP, mutex_address);
+	return wait_on_prepared_wait();
+}
+
 /*
  * Here's how this whole mutex implementation works:
  *
@@ -155,19 +183,21 @@ void mutex_control_delete(struct mutex_queue *mq)
 int mutex_control_lock(struct mutex_queue_head *mqhead,
 		       unsigned long mutex_address)
 {
+	struct mutex_queue_bucket *bucket =
+		mutex_queue_bucket(mqhead, mutex_address);
 	struct mutex_queue *mutex_queue;
 
-	mutex_queue_head_lock(mqhead);
+	mutex_queue_bucket_lock(bucket);
 
 	/* Search for the mutex queue */
-	if (!(mutex_queue = mutex_control_find(mqhead, mutex_address))) {
+	if (!(mutex_queue = mutex_control_find(bucket, mutex_address))) {
 		/* Create a new one */
 		if (!(mutex_queue = mutex_control_create(mutex_address))) {
-			mutex_queue_head_unlock(mqhead);
+			mutex_queue_bucket_unlock(bucket);
 			return -ENOMEM;
 		}
 		/* Add the queue to mutex queue list */
-		mutex_control_add(mqhead, mutex_queue);
+		mutex_control_add(bucket, mutex_queue);
 
 	} else if (mutex_queue->wqh_holders.sleepers) {
 		/*
@@ -179,15 +209,16 @@ int mutex_control_lock(struct mutex_queue_head *mqhead,
 		/* No contenders left as far as current holder is concerned */
 		if (mutex_queue->contenders == 0) {
 			/* Wake up current holder */
-			wake_up(&mutex_queue->wqh_holders, WAKEUP_ASYNC);
+			mutex_queue_wake(&mutex_queue->wqh_holders,
+					 mutex_address);
 
 			/* There must not be any contenders, delete the mutex */
-			mutex_control_remove(mqhead, mutex_queue);
+			mutex_control_remove(mutex_queue);
 			mutex_control_delete(mutex_queue);
 		}
 
 		/* Release lock and return */
-		mutex_queue_head_unlock(mqhead);
+		mutex_queue_bucket_unlock(bucket);
 		return 0;
 	}
 
@@ -197,25 +228,27 @@ int mutex_control_lock(struct mutex_queue_head *mqhead,
 	wait_on_prepare(&mutex_queue->wqh_contenders, &wq);
 
 	/* Release lock */
-	mutex_queue_head_unlock(mqhead);
+	mutex_queue_bucket_unlock(bucket);
 
 	/* Initiate prepared wait */
-	return wait_on_prepared_wait();
+	return mutex_queue_wait(mutex_address);
 }
 
 int mutex_control_unlock(struct mutex_queue_head *mqhead,
 			 unsigned long mutex_address, int contenders)
 {
+	struct mutex_queue_bucket *bucket =
+		mutex_queue_bucket(mqhead, mutex_address);
 	struct mutex_queue *mutex_queue;
 
-	mutex_queue_head_lock(mqhead);
+	mutex_queue_bucket_lock(bucket);
 
 	/* Search for the mutex queue */
-	if (!(mutex_queue = mutex_control_find(mqhead, mutex_address))) {
+	if (!(mutex_queue = mutex_control_find(bucket, mutex_address))) {
 
 		/* No such mutex, create one and sleep on it */
 		if (!(mutex_queue = mutex_control_create(mutex_address))) {
-			mutex_queue_head_unlock(mqhead);
+			mutex_queue_bucket_unlock(bucket);
 			return -ENOMEM;
 		}
 
@@ -223,7 +256,7 @@ int mutex_control_unlock(struct mutex_queue_head *mqhead,
 		mutex_queue->contenders = contenders;
 
 		/* Add the queue to mutex queue list */
-		mutex_control_add(mqhead, mutex_queue);
+		mutex_control_add(bucket, mutex_queue);
 
 		/* Prepare to wait on the lock holders queue */
 		CREATE_WAITQUEUE_ON_STACK(wq, current);
@@ -232,10 +265,10 @@ int mutex_control_unlock(struct mutex_queue_head *mqhead,
 		wait_on_prepare(&mutex_queue->wqh_holders, &wq);
 
 		/* Release lock first */
-		mutex_queue_head_unlock(mqhead);
+		mutex_queue_bucket_unlock(bucket);
 
 		/* Initiate prepared wait */
-		return wait_on_prepared_wait();
+		return mutex_queue_wait(mutex_address);
 	}
 
 	/* Set new or increment the contenders value */
@@ -243,7 +276,7 @@ int mutex_control_unlock(struct mutex_queue_head *mqhead,
 
 	/* Wake up holders if any, and take wake up responsibility */
 	if (mutex_queue->wqh_holders.sleepers)
-		wake_up(&mutex_queue->wqh_holders, WAKEUP_ASYNC);
+		mutex_queue_wake(&mutex_queue->wqh_holders, mutex_address);
 
 	/*
 	 * Now wake up as many contenders as possible, otherwise
@@ -255,7 +288,8 @@ int mutex_control_unlock(struct mutex_queue_head *mqhead,
 		mutex_queue->contenders--;
 
 		/* Wake up a contender who made it to kernel */
-		wake_up(&mutex_queue->wqh_contenders, WAKEUP_ASYNC);
+		mutex_queue_wake(&mutex_queue->wqh_contenders,
+				 mutex_address);
 	}
 
 	/*
@@ -268,12 +302,12 @@ int mutex_control_unlock(struct mutex_queue_head *mqhead,
 		/* Delete only if no more contenders */
 		if (mutex_queue->wqh_contenders.sleepers == 0) {
 			/* Since noone is left, delete the mutex queue */
-			mutex_control_remove(mqhead, mutex_queue);
+			mutex_control_remove(mutex_queue);
 			mutex_control_delete(mutex_queue);
 		}
 
 		/* Release lock and return */
-		mutex_queue_head_unlock(mqhead);
+		mutex_queue_bucket_unlock(bucket);
 	} else {
 		/* Prepare to wait on the lock holders queue */
 		CREATE_WAITQUEUE_ON_STACK(wq, current);
@@ -282,10 +316,10 @@ int mutex_control_unlock(struct mutex_queue_head *mqhead,
 		wait_on_prepare(&mutex_queue->wqh_holders, &wq);
 
 		/* Release lock first */
-		mutex_queue_head_unlock(mqhead);
+		mutex_queue_bucket_unlock(bucket);
 
 		/* Initiate prepared wait */
-		return wait_on_prepared_wait();
+		return mutex_queue_wait(mutex_address);
 	}
 
 	return 0;
@@ -328,7 +328,10 @@ int arch_setup_new_thread(struct ktcb *new, struct ktcb *orig,
 static DECLARE_SPINLOCK(task_select_affinity_lock);
 static unsigned int cpu_rr_affinity;
 
-/* Select which cpu to place the new task in round-robin fashion */
+/*
+ * Select which cpu to place the new task in round-robin fashion.
+ * The scheduler balances it over to other cpus later as needed.
+ */
 void thread_setup_affinity(struct ktcb *task)
 {
 	spin_lock(&task_select_affinity_lock);
@@ -382,7 +385,8 @@ int thread_setup_space(struct ktcb *tcb, struct task_ids *ids, unsigned int flag
 			goto out;
 		}
 		spin_lock(&space->lock);
-		if (IS_ERR(new = address_space_create(space))) {
+		if (IS_ERR(new = address_space_create(space,
+							  flags & TC_COPY_COW))) {
 			spin_unlock(&curcont->space_list.lock);
 			spin_unlock(&space->lock);
 			ret = (int)new;
@@ -395,7 +399,7 @@ int thread_setup_space(struct ktcb *tcb, struct task_ids *ids, unsigned int flag
 		spin_unlock(&curcont->space_list.lock);
 	}
 	else if (flags & TC_NEW_SPACE) {
-		if (IS_ERR(new = address_space_create(0))) {
+		if (IS_ERR(new = address_space_create(0, 0))) {
 			ret = (int)new;
 			goto out;
 		}
@@ -437,6 +441,10 @@ int thread_create(struct task_ids *ids, unsigned int flags)
 		}
 	}
 
+	/* Copy-on-write only applies to a copied space */
+	if ((flags & TC_COPY_COW) && !(flags & TC_COPY_SPACE))
+		return -EINVAL;
+
 	if (!(new = tcb_alloc_init(curcont->cid)))
 		return -ENOMEM;
 
@@ -538,6 +546,9 @@ int sys_thread_control(unsigned int flags, struct task_ids *ids)
 	case THREAD_WAIT:
 		ret = thread_wait(task);
 		break;
+	case THREAD_AFFINITY:
+		ret = sched_set_affinity(task, flags & THREAD_CPU_MASK);
+		break;
 
 	default:
 		ret = -EINVAL;
@@ -11,6 +11,7 @@
 #include <l4/generic/tcb.h>
 #include <l4/generic/platform.h>
 #include <l4/generic/debug.h>
+#include <l4/generic/trace.h>
 #include <l4/lib/printk.h>
 #include <l4/api/ipc.h>
 #include <l4/api/kip.h>
@@ -81,6 +82,7 @@ void ipc_restore_state(struct ipc_state *state)
 int __attribute__((optimize("O0")))
 fault_ipc_to_pager(u32 faulty_pc, u32 fsr, u32 far, u32 ipc_tag)
 {
+	u32 ipc_timeout;
 	int err;
 
 	/* mr[0] has the fault tag. The rest is the fault structure */
@@ -135,10 +137,21 @@ fault_ipc_to_pager(u32 faulty_pc, u32 fsr, u32 far, u32 ipc_tag)
 		thread_destroy(current);
 	}
 
+	trace_event(TRACE_PAGE_FAULT, is_prefetch_abort(fsr) ?
+		    faulty_pc : far);
+
+	/* A receive timeout is for the task's own ipc, not the fault's */
+	ipc_timeout = current->ipc_timeout;
+	current->ipc_timeout = 0;
+
 	/* Send ipc to the task's pager */
-	if ((err = ipc_sendrecv(tcb_pagerid(current),
-				tcb_pagerid(current), 0)) < 0) {
-			BUG_ON(current->nlocks);
+	err = ipc_sendrecv(tcb_pagerid(current), tcb_pagerid(current), 0);
+	current->ipc_timeout = ipc_timeout;
+
+	trace_event(TRACE_PAGE_FAULT_DONE, err);
+
+	if (err < 0) {
+		BUG_ON(current->nlocks);
 
 		/* Return on interrupt */
 		if (err == -EINTR) {
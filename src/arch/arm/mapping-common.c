@@ -221,6 +221,69 @@ int add_mapping_space(unsigned long physical, unsigned long virtual,
 	return 0;
 }
 
+/*
+ * Attaches an empty pmd to every part of the range that has none.
+ * Pmd allocation may sleep on the pmd cache, so mapping batches,
+ * which run with preemption disabled, get all their pmds from here
+ * first and then only write ptes.
+ */
+int attach_range_pmds(unsigned long virtual, unsigned long npages,
+		      struct address_space *space)
+{
+	unsigned long npmds;
+	pmd_table_t *pmd_table;
+
+	npmds = (((virtual & (PMD_MAP_SIZE - 1)) + (npages << PAGE_BITS)
+		  + PMD_MAP_SIZE - 1) / PMD_MAP_SIZE);
+	virtual &= ~(PMD_MAP_SIZE - 1);
+
+	for (int i = 0; i < npmds; i++, virtual += PMD_MAP_SIZE) {
+		if (pmd_exists(space->pgd, virtual))
+			continue;
+
+		if (!(pmd_table = pmd_cap_alloc(&current->space->cap_list)))
+			return -ENOMEM;
+
+		attach_pmd(space, pmd_table, virtual);
+	}
+
+	return 0;
+}
+
+/*
+ * Undoes attach_range_pmds() for a request that failed, detaching
+ * and freeing the pmds of the range that have nothing mapped. An
+ * empty pmd that was there before goes too, the next mapping in
+ * its part of the range only allocates it again.
+ */
+void detach_range_pmds(unsigned long virtual, unsigned long npages,
+		       struct address_space *space)
+{
+	unsigned long npmds;
+	pmd_table_t *pmd_table;
+	int used;
+
+	npmds = (((virtual & (PMD_MAP_SIZE - 1)) + (npages << PAGE_BITS)
+		  + PMD_MAP_SIZE - 1) / PMD_MAP_SIZE);
+	virtual &= ~(PMD_MAP_SIZE - 1);
+
+	for (int i = 0; i < npmds; i++, virtual += PMD_MAP_SIZE) {
+		if (!(pmd_table = pmd_exists(space->pgd, virtual)))
+			continue;
+
+		used = 0;
+		for (int j = 0; j < PMD_ENTRY_TOTAL; j++)
+			if ((pmd_table->entry[j] & PTE_TYPE_MASK) !=
+			    PTE_TYPE_FAULT)
+				used = 1;
+		if (used)
+			continue;
+
+		arch_clear_pmd(arch_pick_pmd(space->pgd, virtual));
+		pmd_cap_free(pmd_table, &current->space->cap_list);
+	}
+}
+
 void add_boot_mapping(unsigned long physical, unsigned long virtual,
 		     unsigned int sz_bytes, unsigned int flags)
 {
@@ -369,18 +432,52 @@ int delete_page_tables(struct address_space *space, struct cap_list *clist)
 	return 0;
 }
 
+/*
+ * Drops user write access from all user-writable memory pages of
+ * a pmd, so that the pages may be shared copy-on-write.
+ *
+ * Device pages are left alone, they are told apart by being
+ * uncached. The pager knows which of the memory pages are shared
+ * rather than copied, e.g. shm and utcbs, and maps them writable
+ * again after the copy.
+ */
+static void pmd_wrprotect_user(pmd_table_t *pmd, unsigned long vbase,
+			       struct address_space *space)
+{
+	pte_t pte;
+
+	for (int j = 0; j < PMD_ENTRY_TOTAL; j++) {
+		pte = pmd->entry[j];
+		if ((pte & PTE_TYPE_MASK) != PTE_TYPE_SMALL ||
+		    (pte & PTE_PROT_MASK) != (__MAP_USR_RW & PTE_PROT_MASK) ||
+		    (pte & (cacheable | bufferable)) !=
+		    (cacheable | bufferable))
+			continue;
+
+		pte = (pte & ~PTE_PROT_MASK) | (__MAP_USR_RO & PTE_PROT_MASK);
+		arch_write_pte(&pmd->entry[j], pte,
+			       vbase + j * PAGE_SIZE, space->spid);
+	}
+}
+
 /*
  * Copies userspace entries of one task to another.
  * In order to do that, it allocates new pmds and
  * copies the original values into new ones.
+ *
+ * With cow, user-writable pages are made read-only
+ * in the original before they are copied, so that
+ * they become copy-on-write in both spaces. That is
+ * done in a mapping batch, which may not sleep, so
+ * all new pmds are allocated in a first pass.
  */
 int copy_user_tables(struct address_space *new,
-		     struct address_space *orig_space)
+		     struct address_space *orig_space, int cow)
 {
 	pgd_table_t *to = new->pgd, *from = orig_space->pgd;
 	pmd_table_t *pmd, *orig;
 
-	/* Allocate and copy all pmds that will be exclusive to new task. */
+	/* Allocate all pmds that will be exclusive to new task. */
 	for (int i = 0; i < PGD_ENTRY_TOTAL; i++) {
 		/* Detect a pmd entry that is not a global pmd? */
 		if (!is_global_pgdi(i) &&
@@ -390,20 +487,42 @@ int copy_user_tables(struct address_space *new,
 			if (!(pmd = pmd_cap_alloc(&current->space->cap_list)))
 				goto out_error;
 
-			/* Find original pmd */
+			/* Replace original pmd entry in pgd with new */
+			to->entry[i] = (pmd_t)(virt_to_phys(pmd)
+					       | PMD_TYPE_PMD);
+		}
+	}
+
+	if (cow)
+		arch_mapping_batch_begin();
+
+	/* Copy the original pmds into new ones */
+	for (int i = 0; i < PGD_ENTRY_TOTAL; i++) {
+		if (!is_global_pgdi(i) &&
+		    ((from->entry[i] & PMD_TYPE_MASK)
+		     == PMD_TYPE_PMD)) {
+			/* Find original and new pmds */
 			orig = (pmd_table_t *)
 				phys_to_virt((from->entry[i] &
 				PMD_ALIGN_MASK));
+			pmd = (pmd_table_t *)
+			      phys_to_virt((to->entry[i] &
+					    PMD_ALIGN_MASK));
+
+			/* Write-protect the original for sharing */
+			if (cow)
+				pmd_wrprotect_user(orig, i * PMD_MAP_SIZE,
+						   orig_space);
 
 			/* Copy original to new */
 			memcpy(pmd, orig, sizeof(pmd_table_t));
-
-			/* Replace original pmd entry in pgd with new */
-			to->entry[i] = (pmd_t)(virt_to_phys(pmd)
-					       | PMD_TYPE_PMD);
 		}
 	}
 
+	/* Drop the writable translations of the original */
+	if (cow)
+		arch_mapping_batch_end();
+
 	/* Just in case the new table is written to any ttbr
 	 * after here, make sure all writes on it are complete. */
 	dmb();
@@ -10,6 +10,8 @@
 #include <l4/generic/resource.h>
 #include <l4/generic/platform.h>
 #include <l4/generic/debug.h>
+#include <l4/generic/trace.h>
+#include <l4/generic/preempt.h>
 #include <l4/api/errno.h>
 #include INC_SUBARCH(mm.h)
 #include INC_SUBARCH(mmu_ops.h)
@@ -20,6 +22,16 @@
 #include INC_ARCH(asm.h)
 #include INC_API(kip.h)
 #include INC_ARCH(io.h)
+#include INC_SUBARCH(cpu.h)
+
+/*
+ * Set while a batch of mapping changes is in progress. Pte and
+ * pmd writes then leave cache and tlb maintenance to the end of
+ * the batch, which does it once for all of them. The cache is
+ * cleaned once, before the first valid translation is replaced.
+ */
+DECLARE_PERCPU(static int, mapping_batch);
+DECLARE_PERCPU(static int, mapping_batch_cleaned);
 
 /*
  * Removes initial mappings needed for transition to virtual memory.
@@ -118,6 +130,18 @@ void arch_prepare_pte(u32 paddr, u32 vaddr, unsigned int flags,
 
 void arch_write_pte(pte_t *ptep, pte_t pte, u32 vaddr, u32 asid)
 {
+	if (per_cpu(mapping_batch)) {
+		/* Data of the old translation must reach memory first */
+		if ((*ptep & PTE_TYPE_MASK) != PTE_TYPE_FAULT &&
+		    !per_cpu(mapping_batch_cleaned)) {
+			arm_clean_invalidate_cache();
+			system_account_cache_op(CACHE_OP_CACHE_ALL);
+			per_cpu(mapping_batch_cleaned) = 1;
+		}
+		*ptep = pte;
+		return;
+	}
+
 	/* FIXME:
 	 * Clean the dcache and invalidate the icache
 	 * for the old translation first?
@@ -140,6 +164,10 @@ void arch_write_pte(pte_t *ptep, pte_t pte, u32 vaddr, u32 asid)
 	 */
 	arm_clean_invalidate_cache();
 	arm_invalidate_tlb();
+
+	system_account_cache_op(CACHE_OP_CACHE_ALL);
+	system_account_cache_op(CACHE_OP_CACHE_ALL);
+	system_account_cache_op(CACHE_OP_TLB_ALL);
 }
 
 
@@ -171,10 +199,43 @@ void arch_write_pmd(pmd_t *pmd_entry, u32 pmd_phys, u32 vaddr, u32 asid)
 {
 	/* FIXME: Clean the dcache if there was a valid entry */
 	*pmd_entry = (pmd_t)(pmd_phys | PMD_TYPE_PMD);
+	if (per_cpu(mapping_batch))
+		return;
 	arm_clean_invalidate_cache(); /*FIXME: Write these properly! */
 	arm_invalidate_tlb();
 }
 
+/* Detaches an empty pmd, so nothing of it is in the tlb */
+void arch_clear_pmd(pmd_t *pmd_entry)
+{
+	*pmd_entry = PMD_TYPE_FAULT;
+	arm_clean_dcache();
+	system_account_cache_op(CACHE_OP_CACHE_ALL);
+}
+
+
+/*
+ * Batches that only fill empty ptes need no cleaning up front,
+ * which spares small mappings a full cache clean. We must not
+ * migrate during the batch, so it may not allocate or sleep.
+ */
+void arch_mapping_batch_begin(void)
+{
+	preempt_disable();
+	per_cpu(mapping_batch) = 1;
+	per_cpu(mapping_batch_cleaned) = 0;
+}
+
+/* Writes back the new page tables, and drops old translations */
+void arch_mapping_batch_end(void)
+{
+	per_cpu(mapping_batch) = 0;
+	arm_clean_invalidate_cache();
+	arm_invalidate_tlb();
+	system_account_cache_op(CACHE_OP_CACHE_ALL);
+	system_account_cache_op(CACHE_OP_TLB_ALL);
+	preempt_enable();
+}
 
 int arch_check_pte_access_perms(pte_t pte, unsigned int flags)
 {
@@ -354,10 +415,16 @@ void arch_space_switch(struct ktcb *to)
 
 	system_account_space_switch();
 
+	trace_event(TRACE_SPACE_SWITCH, to->space->spid);
+
 	arm_clean_invalidate_cache();
 	arm_invalidate_tlb();
 	arm_set_ttb(virt_to_phys(pgd));
 	arm_invalidate_tlb();
+
+	system_account_cache_op(CACHE_OP_CACHE_ALL);
+	system_account_cache_op(CACHE_OP_TLB_ALL);
+	system_account_cache_op(CACHE_OP_TLB_ALL);
 }
 
 void idle_task(void)
@@ -370,6 +437,11 @@ void idle_task(void)
 		per_cpu(scheduler).flags &= ~SCHED_RUN_IDLE;
 
 		schedule();
+
+#if defined (CONFIG_TICKLESS)
+		/* Nothing to run, and no tick to wait for */
+		sched_idle_wait();
+#endif
 	}
 }
 
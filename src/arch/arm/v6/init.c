@@ -38,10 +38,9 @@ void jump(struct ktcb *task)
 
 void switch_to_user(struct ktcb *task)
 {
+	/* Make sure loaded user images are seen by the icache */
 	arm_clean_invalidate_cache();
-	arm_invalidate_tlb();
-	arm_set_ttb(virt_to_phys(TASK_PGD(task)));
-	arm_invalidate_tlb();
+	arch_space_switch(task);
 	jump(task);
 }
 
@@ -90,6 +89,9 @@ void start_virtual_memory()
 
 	arm_enable_high_vectors();
 
+	/* Use v6 page tables, with asid-tagged user mappings */
+	arm_enable_extended_pt();
+
 	/*
 	 * Leave the past behind. Tlbs are invalidated, write buffer is drained.
 	 * The whole of I + D caches are invalidated unconditionally. This is
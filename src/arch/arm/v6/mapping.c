@@ -9,6 +9,10 @@
 #include <l4/generic/bootmem.h>
 #include <l4/generic/resource.h>
 #include <l4/generic/platform.h>
+#include <l4/generic/debug.h>
+#include <l4/generic/trace.h>
+#include <l4/generic/smp.h>
+#include <l4/generic/preempt.h>
 #include <l4/api/errno.h>
 #include INC_SUBARCH(mm.h)
 #include INC_SUBARCH(mmu_ops.h)
@@ -19,6 +23,124 @@
 #include INC_ARCH(asm.h)
 #include INC_API(kip.h)
 #include INC_ARCH(io.h)
+#include INC_SUBARCH(cpu.h)
+#if defined (CONFIG_SMP_)
+#include INC_GLUE(smp.h)
+#include INC_GLUE(ipi.h)
+#endif
+
+/*
+ * Space that last used each asid on this cpu. If a different
+ * space takes over an asid, the asid's tlb entries are stale.
+ */
+DECLARE_PERCPU(static struct address_space *, asid_owner[ASID_TOTAL]);
+
+/*
+ * Set while a batch of mapping changes is in progress, so that
+ * the icache is invalidated once at the end, if any translation
+ * was replaced. Tlb entries are still dropped one mva at a time.
+ */
+DECLARE_PERCPU(static int, mapping_batch);
+DECLARE_PERCPU(static int, mapping_batch_icache);
+
+#if defined (CONFIG_SMP_)
+/*
+ * Tlb maintenance on the MPCore only reaches the local cpu. When a
+ * valid user translation changes, other cpus that last ran its asid
+ * are made to flush the asid on their next switch to it. Those that
+ * run it now are asked to drop the translation with an ipi, which
+ * is waited for, since the page may be freed as soon as we return.
+ */
+DECLARE_PERCPU(static volatile int, asid_active);
+DECLARE_PERCPU(static volatile int, tlb_shootdown_pending);
+static DECLARE_SPINLOCK(tlb_shootdown_lock);
+static u32 tlb_shootdown_mva;
+static int tlb_shootdown_asid;
+
+/* The asid whose translations a batch changed, to shoot down at its end */
+DECLARE_PERCPU(static int, mapping_batch_asid);
+
+/* Called on an IPI_TLB_FLUSH, drops what the sender asked for */
+void arch_tlb_shootdown_ipi(void)
+{
+	if (tlb_shootdown_mva) {
+		arm_invalidate_tlb_mva(tlb_shootdown_mva | tlb_shootdown_asid);
+		system_account_cache_op(CACHE_OP_TLB_MVA);
+	} else {
+		arm_invalidate_tlb_asid(tlb_shootdown_asid);
+		system_account_cache_op(CACHE_OP_TLB_ASID);
+	}
+	arm_invalidate_icache();
+	arm_invalidate_btb();
+	dsb();
+	isb();
+
+	per_cpu(tlb_shootdown_pending) = 0;
+}
+
+/* Drops a translation, or all of the asid if mva is 0, on other cpus */
+static void tlb_shootdown(u32 mva, int asid)
+{
+	unsigned int cpus = 0;
+	int self;
+
+	preempt_disable();
+	self = smp_get_cpuid();
+
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++)
+		if (cpu != self)
+			per_cpu_byid(asid_owner[asid], cpu) = 0;
+
+	/* Pairs with the one in arch_space_switch() */
+	dsb();
+
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++)
+		if (cpu != self && per_cpu_byid(asid_active, cpu) == asid)
+			cpus |= 1 << cpu;
+
+	if (cpus) {
+		spin_lock(&tlb_shootdown_lock);
+		tlb_shootdown_mva = mva;
+		tlb_shootdown_asid = asid;
+		for (int cpu = 0; cpu < CONFIG_NCPU; cpu++)
+			if (cpus & (1 << cpu))
+				per_cpu_byid(tlb_shootdown_pending, cpu) = 1;
+		dsb();
+
+		smp_send_ipi(cpus, IPI_TLB_FLUSH);
+		for (int cpu = 0; cpu < CONFIG_NCPU; cpu++)
+			while (per_cpu_byid(tlb_shootdown_pending, cpu))
+				;
+		spin_unlock(&tlb_shootdown_lock);
+	}
+
+	preempt_enable();
+}
+
+/* A batch shoots down each asid it changed once, at its end */
+static void tlb_shootdown_batch(int asid)
+{
+	int batch_asid = per_cpu(mapping_batch_asid);
+
+	if (batch_asid && batch_asid != asid)
+		tlb_shootdown(0, batch_asid);
+	per_cpu(mapping_batch_asid) = asid;
+}
+
+static void tlb_shootdown_batch_end(void)
+{
+	if (per_cpu(mapping_batch_asid))
+		tlb_shootdown(0, per_cpu(mapping_batch_asid));
+	per_cpu(mapping_batch_asid) = 0;
+}
+
+#else /* End of CONFIG_SMP_ */
+
+static inline void tlb_shootdown(u32 mva, int asid) { }
+static inline void tlb_shootdown_batch(int asid) { }
+static inline void tlb_shootdown_batch_end(void) { }
+
+#endif /* End of !CONFIG_SMP_ */
 
 /*
  * Removes initial mappings needed for transition to virtual memory.
@@ -112,34 +234,49 @@ void arch_prepare_pte(u32 paddr, u32 vaddr, unsigned int flags,
 		*ptep = paddr | flags | PTE_TYPE_SMALL;
 }
 
-void arch_write_pte(pte_t *ptep, pte_t pte, u32 vaddr)
+/*
+ * The v6 data cache is physically tagged, so unlike v5 it needs no
+ * cleaning when a translation changes. We only push the pte itself
+ * out to memory for the table walk, and drop the old translation
+ * for this mva and asid from the tlb. Faults are never in the tlb.
+ */
+void arch_write_pte(pte_t *ptep, pte_t pte, u32 vaddr, u32 asid)
 {
-	/* FIXME:
-	 * Clean the dcache and invalidate the icache
-	 * for the old translation first?
-	 *
-	 * The dcache is virtual, therefore the data
-	 * in those entries should be cleaned first,
-	 * before the translation of that virtual
-	 * address is changed to a new physical address.
-	 *
-	 * Check that the entry was not faulty first.
-	 */
-	arm_clean_invalidate_cache();
+	pte_t old = *ptep;
 
 	*ptep = pte;
+	arm_clean_dcache_mva((u32)ptep);
+	dsb();
+	system_account_cache_op(CACHE_OP_DCACHE_CLEAN_MVA);
 
-	/* FIXME: Fix this!
-	 * - Use vaddr to clean the dcache pte by MVA.
-	 * - Use mapped area to invalidate the icache
-	 * - Invalidate the tlb for mapped area
-	 */
-	arm_clean_invalidate_cache();
-	arm_invalidate_tlb();
+	if ((old & PTE_TYPE_MASK) == PTE_TYPE_FAULT)
+		return;
+
+	/* Global entries match any asid */
+	arm_invalidate_tlb_mva(page_align(vaddr) | SPACE_ASID(asid));
+	system_account_cache_op(CACHE_OP_TLB_MVA);
+
+	if (per_cpu(mapping_batch)) {
+		per_cpu(mapping_batch_icache) = 1;
+		if (old & PAGE_NOT_GLOBAL)
+			tlb_shootdown_batch(SPACE_ASID(asid));
+		return;
+	}
+
+	/* A user translation may also be in other cpus' tlbs */
+	if (old & PAGE_NOT_GLOBAL)
+		tlb_shootdown(page_align(vaddr), SPACE_ASID(asid));
+
+	/* Instructions from the old page may be in the virtual icache */
+	arm_invalidate_icache();
+	arm_invalidate_btb();
+	dsb();
+	isb();
 }
 
 
-void arch_prepare_write_pte(u32 paddr, u32 vaddr,
+void arch_prepare_write_pte(struct address_space *space,
+			    u32 paddr, u32 vaddr,
 			    unsigned int flags, pte_t *ptep)
 {
 	pte_t pte = 0;
@@ -150,7 +287,7 @@ void arch_prepare_write_pte(u32 paddr, u32 vaddr,
 
 	arch_prepare_pte(paddr, vaddr, flags, &pte);
 
-	arch_write_pte(ptep, pte, vaddr);
+	arch_write_pte(ptep, pte, vaddr, space->spid);
 }
 
 pmd_t *
@@ -160,16 +297,47 @@ arch_pick_pmd(pgd_table_t *pgd, unsigned long vaddr)
 }
 
 /*
- * v5 pmd writes
+ * v6 pmd writes. Pmds are only attached over faulting
+ * entries, so there is nothing to drop from the tlb.
  */
-void arch_write_pmd(pmd_t *pmd_entry, u32 pmd_phys, u32 vaddr)
+void arch_write_pmd(pmd_t *pmd_entry, u32 pmd_phys, u32 vaddr, u32 asid)
 {
-	/* FIXME: Clean the dcache if there was a valid entry */
 	*pmd_entry = (pmd_t)(pmd_phys | PMD_TYPE_PMD);
-	arm_clean_invalidate_cache(); /*FIXME: Write these properly! */
-	arm_invalidate_tlb();
+	arm_clean_dcache_mva((u32)pmd_entry);
+	dsb();
+	system_account_cache_op(CACHE_OP_DCACHE_CLEAN_MVA);
 }
 
+/* Detaches an empty pmd, so nothing of it is in the tlb */
+void arch_clear_pmd(pmd_t *pmd_entry)
+{
+	*pmd_entry = PMD_TYPE_FAULT;
+	arm_clean_dcache_mva((u32)pmd_entry);
+	dsb();
+	system_account_cache_op(CACHE_OP_DCACHE_CLEAN_MVA);
+}
+
+
+/* We must not migrate during the batch, so it may not sleep */
+void arch_mapping_batch_begin(void)
+{
+	preempt_disable();
+	per_cpu(mapping_batch) = 1;
+	per_cpu(mapping_batch_icache) = 0;
+}
+
+void arch_mapping_batch_end(void)
+{
+	per_cpu(mapping_batch) = 0;
+	if (per_cpu(mapping_batch_icache)) {
+		arm_invalidate_icache();
+		arm_invalidate_btb();
+	}
+	dsb();
+	isb();
+	tlb_shootdown_batch_end();
+	preempt_enable();
+}
 
 int arch_check_pte_access_perms(pte_t pte, unsigned int flags)
 {
@@ -201,8 +369,26 @@ int is_global_pgdi(int i)
 
 extern pmd_table_t *pmd_array;
 
-void remove_mapping_pgd_all_user(pgd_table_t *pgd)
+/*
+ * Drops the space's translations from the tlb, and makes sure its
+ * asid is flushed on every cpu before another space may use it.
+ */
+static void arch_space_release_asid(struct address_space *space)
 {
+	int asid = SPACE_ASID(space->spid);
+
+	arm_invalidate_tlb_asid(asid);
+	system_account_cache_op(CACHE_OP_TLB_ASID);
+
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++)
+		if (per_cpu_byid(asid_owner[asid], cpu) == space)
+			per_cpu_byid(asid_owner[asid], cpu) = 0;
+}
+
+void remove_mapping_pgd_all_user(struct address_space *space,
+				 struct cap_list *clist)
+{
+	pgd_table_t *pgd = space->pgd;
 	pmd_table_t *pmd;
 
 	/* Traverse through all pgd entries. */
@@ -217,13 +403,14 @@ void remove_mapping_pgd_all_user(pgd_table_t *pgd)
 				      phys_to_virt((pgd->entry[i] &
 						    PMD_ALIGN_MASK));
 				/* Free it */
-				free_pmd(pmd);
+				pmd_cap_free(pmd, clist);
 			}
 
 			/* Clear the pgd entry */
 			pgd->entry[i] = PMD_TYPE_FAULT;
 		}
 	}
+	arch_space_release_asid(space);
 }
 
 
@@ -244,7 +431,7 @@ int pgd_count_boot_pmds()
  */
 pgd_table_t *arch_realloc_page_tables(void)
 {
-	pgd_table_t *pgd_new = alloc_pgd();
+	pgd_table_t *pgd_new = pgd_alloc();
 	pgd_table_t *pgd_old = &init_pgd;
 	pmd_table_t *orig, *pmd;
 
@@ -256,7 +443,7 @@ pgd_table_t *arch_realloc_page_tables(void)
 		/* Detect a pmd entry */
 		if ((pgd_old->entry[i] & PMD_TYPE_MASK) == PMD_TYPE_PMD) {
 			/* Allocate new pmd */
-			if (!(pmd = alloc_pmd())) {
+			if (!(pmd = pmd_cap_alloc(&current->space->cap_list))) {
 				printk("FATAL: PMD allocation "
 				       "failed during system initialization\n");
 				BUG();
@@ -346,15 +533,44 @@ void arch_copy_pgd_kernel_entries(pgd_table_t *to)
 				  USERSPACE_CONSOLE_VBASE + PAGE_SIZE);
 }
 
-/* Scheduler uses this to switch context */
+/*
+ * Scheduler uses this to switch context. User translations are
+ * tagged with the asid of their space, so neither the tlb nor the
+ * physically tagged caches need flushing. We go through the reserved
+ * asid so that no walk of the new tables is tagged with the old asid.
+ */
 void arch_space_switch(struct ktcb *to)
 {
 	pgd_table_t *pgd = TASK_PGD(to);
+	int asid = SPACE_ASID(to->space->spid);
 
-	arm_clean_invalidate_cache();
-	arm_invalidate_tlb();
+	system_account_space_switch();
+
+	trace_event(TRACE_SPACE_SWITCH, to->space->spid);
+
+	arm_set_context_id(ASID_RESERVED);
+	isb();
 	arm_set_ttb(virt_to_phys(pgd));
-	arm_invalidate_tlb();
+	isb();
+
+#if defined (CONFIG_SMP_)
+	/*
+	 * Shootdowns either see us on the asid and ask us to drop
+	 * what they change, or clear its owner before we check it.
+	 */
+	per_cpu(asid_active) = asid;
+	dsb();
+#endif
+
+	/* Someone else used this asid here since we did */
+	if (per_cpu(asid_owner[asid]) != to->space) {
+		arm_invalidate_tlb_asid(asid);
+		system_account_cache_op(CACHE_OP_TLB_ASID);
+		per_cpu(asid_owner[asid]) = to->space;
+	}
+
+	arm_set_context_id(asid);
+	isb();
 }
 
 void idle_task(void)
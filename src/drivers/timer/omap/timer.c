@@ -127,6 +127,41 @@ void timer_init_periodic(unsigned long timer_base)
 	write((1 << OMAP_TIMER_INTR_OVERFLOW), timer_base + OMAP_TIMER_TIER);
 }
 
+/* Free running, no irqs. Counts up from 0 and wraps */
+void timer_init_freerun(unsigned long timer_base)
+{
+	volatile u32 reg;
+
+	timer_reset(timer_base);
+
+	reg = read(timer_base + OMAP_TIMER_TCLR);
+	reg |= (1 << OMAP_TIMER_MODE_AUTORELAOD);
+	write(reg, timer_base + OMAP_TIMER_TCLR);
+
+	timer_load(timer_base, 0);
+}
+
+/* One shot, overflow irq once after ticks counts */
+void timer_oneshot(unsigned long timer_base, u32 ticks)
+{
+	volatile u32 reg;
+
+	timer_stop(timer_base);
+
+	/* No reload, so it stops at the overflow */
+	reg = read(timer_base + OMAP_TIMER_TCLR);
+	reg &= ~(1 << OMAP_TIMER_MODE_AUTORELAOD);
+	write(reg, timer_base + OMAP_TIMER_TCLR);
+
+	write(0 - ticks, timer_base + OMAP_TIMER_TCRR);
+
+	/* Clear pending Interrupts, if any */
+	write(7, timer_base + OMAP_TIMER_TISR);
+	write((1 << OMAP_TIMER_INTR_OVERFLOW), timer_base + OMAP_TIMER_TIER);
+
+	timer_start(timer_base);
+}
+
 void timer_init(unsigned long timer_base)
 {
 	timer_init_periodic(timer_base);
@@ -17,6 +17,7 @@
 #include <l4/api/ipc.h>
 #include <l4/api/irq.h>
 #include <l4/api/cache.h>
+#include <l4/api/trace.h>
 #include INC_GLUE(message.h)
 #include INC_GLUE(ipc.h)
 #include INC_PLAT(irq.h)
@@ -324,6 +325,7 @@ struct capability *cap_match_thread(struct capability *cap,
 			return 0;
 		break;
 	case THREAD_RUN:
+	case THREAD_AFFINITY:
 		if (!(cap->access & CAP_TCTRL_RUN))
 			return 0;
 		break;
@@ -447,6 +449,11 @@ struct capability *cap_match_mem(struct capability *cap,
 		if ((cap->access & perms) != perms)
 			return 0;
 		break;
+	case MAP_USR_IO_RO:
+		perms = CAP_MAP_READ | CAP_MAP_UNCACHED;
+		if ((cap->access & perms) != perms)
+			return 0;
+		break;
 	case MAP_UNMAP:	/* Check for unmap syscall */
 		if (!(cap->access & CAP_MAP_UNMAP))
 			return 0;
@@ -588,6 +595,56 @@ struct capability *cap_match_cache(struct capability *cap, void *args_ptr)
 	return cap;
 }
 
+struct sys_trace_args {
+	struct ktcb *task;
+	unsigned int req;
+};
+
+/*
+ * CAP_TYPE_TRACE already matched
+ */
+struct capability *cap_match_trace(struct capability *cap, void *args_ptr)
+{
+	struct sys_trace_args *args = args_ptr;
+	struct ktcb *target = args->task;
+
+	/* Check operation privileges */
+	switch (args->req) {
+	case TRACE_CONTROL_MAP:
+		if (!(cap->access & CAP_TRACE_MAP))
+			return 0;
+		break;
+	case TRACE_CONTROL_START:
+	case TRACE_CONTROL_STOP:
+	case TRACE_CONTROL_RESET:
+		if (!(cap->access & CAP_TRACE_CONTROL))
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+
+	/* Target is the caller, in any of its containment levels */
+	switch (cap_rtype(cap)) {
+	case CAP_RTYPE_THREAD:
+		if (target->tid != cap->resid)
+			return 0;
+		break;
+	case CAP_RTYPE_SPACE:
+		if (target->space->spid != cap->resid)
+			return 0;
+		break;
+	case CAP_RTYPE_CONTAINER:
+		if (target->container->cid != cap->resid)
+			return 0;
+		break;
+	default:
+		BUG(); /* Unknown cap type is a bug */
+	}
+
+	return cap;
+}
+
 #if defined(CONFIG_CAPABILITIES)
 int cap_map_check(struct ktcb *target, unsigned long phys, unsigned long virt,
 		  unsigned long npages, unsigned int flags)
@@ -741,6 +798,36 @@ int cap_cache_check(unsigned long start, unsigned long end, unsigned int flags)
 	return 0;
 }
 
+/*
+ * Trace buffers are mapped into the caller's own space,
+ * so mapping them also needs the virtual memory range.
+ */
+int cap_trace_check(unsigned int req, unsigned long virt,
+		    unsigned long npages)
+{
+	struct sys_trace_args args = {
+		.task = current,
+		.req = req,
+	};
+	struct sys_map_args map_args = {
+		.task = current,
+		.virt = virt,
+		.npages = npages,
+		.flags = MAP_USR_IO_RO,
+	};
+
+	if (!(cap_find(current, cap_match_trace,
+		       &args, CAP_TYPE_TRACE)))
+		return -ENOCAP;
+
+	if (req == TRACE_CONTROL_MAP &&
+	    !(cap_find(current, cap_match_mem,
+		       &map_args, CAP_TYPE_MAP_VIRTMEM)))
+		return -ENOCAP;
+
+	return 0;
+}
+
 #else /* Meaning !CONFIG_CAPABILITIES */
 int cap_ipc_check(l4id_t to, l4id_t from,
 		  unsigned int flags, unsigned int ipc_type)
@@ -783,4 +870,10 @@ int cap_cache_check(unsigned long start, unsigned long end,
 {
 	return 0;
 }
+
+int cap_trace_check(unsigned int req, unsigned long virt,
+		    unsigned long npages)
+{
+	return 0;
+}
 #endif /* End of !CONFIG_CAPABILITIES */
@@ -155,7 +155,7 @@ int init_pager(struct pager *pager, struct container *cont)
 	/* New ktcb allocation is needed */
 	task = tcb_alloc_init(cont->cid);
 
-	space = address_space_create(0);
+	space = address_space_create(0, 0);
 	address_space_attach(task, space);
 
 	/* Initialize ktcb */
@@ -32,6 +32,8 @@ void system_accounting_print(struct system_accounting *sys_acc)
 	printk("Time: %llu\n", sys_acc->syscalls.time);
 	printk("Mutex Control: %llu\n", sys_acc->syscalls.mutexctrl);
 	printk("Cache Control: %llu\n", sys_acc->syscalls.cachectrl);
+	printk("Map Batch: %llu\n", sys_acc->syscalls.mapbatch);
+	printk("Trace Control: %llu\n", sys_acc->syscalls.tracectrl);
 
 	printk("\nExceptions:\n");
 	printk("===========\n");
@@ -42,8 +44,26 @@ void system_accounting_print(struct system_accounting *sys_acc)
 	printk("Undef Abort: %llu\n", sys_acc->exceptions.undefined_abort);
 	printk("Context Switch: %llu\n", sys_acc->task_ops.context_switch);
 	printk("Space Switch: %llu\n", sys_acc->task_ops.space_switch);
+	printk("Migration by idle cpu: %llu\n", sys_acc->task_ops.migrate_idle);
+	printk("Migration by balancing: %llu\n",
+	       sys_acc->task_ops.migrate_balance);
 
 	printk("\nCache operations:\n");
+	printk("=================\n");
+	printk("Dcache clean by mva: %llu\n",
+	       sys_acc->cache_ops[CACHE_OP_DCACHE_CLEAN_MVA]);
+	printk("Dcache invalidate by mva: %llu\n",
+	       sys_acc->cache_ops[CACHE_OP_DCACHE_INVAL_MVA]);
+	printk("Icache invalidate by mva: %llu\n",
+	       sys_acc->cache_ops[CACHE_OP_ICACHE_INVAL_MVA]);
+	printk("Tlb invalidate by mva: %llu\n",
+	       sys_acc->cache_ops[CACHE_OP_TLB_MVA]);
+	printk("Tlb invalidate by asid: %llu\n",
+	       sys_acc->cache_ops[CACHE_OP_TLB_ASID]);
+	printk("Tlb invalidate all: %llu\n",
+	       sys_acc->cache_ops[CACHE_OP_TLB_ALL]);
+	printk("Cache clean/invalidate all: %llu\n",
+	       sys_acc->cache_ops[CACHE_OP_CACHE_ALL]);
 
 }
 #endif
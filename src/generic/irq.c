@@ -7,6 +7,7 @@
 #include <l4/macros.h>
 #include <l4/generic/scheduler.h>
 #include <l4/generic/debug.h>
+#include <l4/generic/trace.h>
 #include <l4/generic/platform.h>
 #include <l4/generic/tcb.h>
 #include <l4/generic/irq.h>
@@ -145,6 +146,8 @@ void do_irq(void)
 
 	system_account_irq();
 
+	trace_event(TRACE_IRQ, irq_index);
+
 	/*
 	 * Note, this can be easily done a few instructions
 	 * quicker by some immediate read/disable/enable_all().
@@ -344,6 +344,12 @@ struct mem_cache *init_resource_cache(int nstruct, int struct_size,
 	struct capability *cap;
 	unsigned long bufsize;
 
+	/*
+	 * Capabilities bound the number of structures in use,
+	 * so make sure none are stranded in per-cpu magazines
+	 */
+	nstruct += MEM_CACHE_MAGAZINE_RESERVE;
+
 	/* In all unused physical memory regions */
 	list_foreach_struct(cap, &kres->physmem_free.caps, list) {
 		/* Get buffer size needed for cache */
@@ -16,11 +16,14 @@
 #include <l4/generic/preempt.h>
 #include <l4/generic/thread.h>
 #include <l4/generic/debug.h>
+#include <l4/generic/trace.h>
 #include <l4/generic/irq.h>
 #include <l4/generic/tcb.h>
+#include <l4/generic/time.h>
 #include <l4/api/errno.h>
 #include <l4/api/kip.h>
 #include INC_SUBARCH(mm.h)
+#include INC_SUBARCH(mmu_ops.h)
 #include INC_GLUE(mapping.h)
 #include INC_GLUE(init.h)
 #include INC_PLAT(platform.h)
@@ -107,7 +110,9 @@ int in_process_context(void)
 
 void sched_init_runqueue(struct scheduler *sched, struct runqueue *rq)
 {
-	link_init(&rq->task_list);
+	for (int i = 0; i < SCHED_PRIO_LEVELS; i++)
+		link_init(&rq->task_list[i]);
+	rq->prio_bitmap = 0;
 	spin_lock_init(&rq->lock);
 	rq->sched = sched;
 }
@@ -123,6 +128,8 @@ void sched_init()
 	sched->rq_expired = &sched->sched_rq[1];
 	sched->prio_total = TASK_PRIO_TOTAL;
 	sched->idle_task = current;
+	sched->cpu = smp_get_cpuid();
+	sched->curr = current;
 }
 
 /* Swap runnable and expired runqueues. */
@@ -130,7 +137,7 @@ static void sched_rq_swap_queues(void)
 {
 	struct runqueue *temp;
 
-	BUG_ON(list_empty(&per_cpu(scheduler).rq_expired->task_list));
+	BUG_ON(!per_cpu(scheduler).rq_expired->prio_bitmap);
 
 	/* Queues are swapped and expired list becomes runnable */
 	temp = per_cpu(scheduler).rq_runnable;
@@ -142,23 +149,63 @@ static void sched_rq_swap_queues(void)
 #define RQ_ADD_BEHIND		0
 #define RQ_ADD_FRONT		1
 
-/* Helper for adding a new task to a runqueue */
-static void sched_rq_add_task(struct ktcb *task, struct runqueue *rq, int front)
+/* Returns the highest priority level that has a task queued */
+static inline int sched_rq_highest_prio(struct runqueue *rq)
 {
-	unsigned long irqflags;
-	struct scheduler *sched =
-		&per_cpu_byid(scheduler, task->affinity);
+	BUG_ON(!rq->prio_bitmap);
+	return 31 - __clz(rq->prio_bitmap);
+}
+
+/* Returns the first task on the highest non-empty priority level */
+static inline struct ktcb *sched_rq_first_task(struct runqueue *rq)
+{
+	return link_to_struct(rq->task_list[sched_rq_highest_prio(rq)].next,
+			      struct ktcb, rq_list);
+}
+
+/* Adds a task to a runqueue. Runqueues must be locked. */
+static inline void __sched_rq_add_task(struct ktcb *task,
+				       struct runqueue *rq, int front)
+{
+	int prio = task->priority;
 
 	BUG_ON(!list_empty(&task->rq_list));
+	BUG_ON(prio < 0 || prio > TASK_PRIO_MAX);
 
-	/* Lock that particular cpu's runqueue set */
-	sched_lock_runqueues(sched, &irqflags);
 	if (front)
-		list_insert(&task->rq_list, &rq->task_list);
+		list_insert(&task->rq_list, &rq->task_list[prio]);
 	else
-		list_insert_tail(&task->rq_list, &rq->task_list);
+		list_insert_tail(&task->rq_list, &rq->task_list[prio]);
+	rq->prio_bitmap |= (1 << prio);
 	rq->total++;
 	task->rq = rq;
+	task->affinity = rq->sched->cpu;
+}
+
+/* Removes a task from its runqueue. Runqueues must be locked. */
+static inline void __sched_rq_remove_task(struct ktcb *task)
+{
+	BUG_ON(list_empty(&task->rq_list));
+	list_remove_init(&task->rq_list);
+
+	/* Clear priority bit if this was the last task on its level */
+	if (list_empty(&task->rq->task_list[task->priority]))
+		task->rq->prio_bitmap &= ~(1 << task->priority);
+
+	task->rq->total--;
+	BUG_ON(task->rq->total < 0);
+	task->rq = 0;
+}
+
+/* Helper for adding a new task to a runqueue */
+static void sched_rq_add_task(struct ktcb *task, struct runqueue *rq, int front)
+{
+	unsigned long irqflags;
+	struct scheduler *sched = rq->sched;
+
+	/* Lock that particular cpu's runqueue set */
+	sched_lock_runqueues(sched, &irqflags);
+	__sched_rq_add_task(task, rq, front);
 
 	/* Unlock that particular cpu's runqueue set */
 	sched_unlock_runqueues(sched, irqflags);
@@ -168,28 +215,28 @@ static void sched_rq_add_task(struct ktcb *task, struct runqueue *rq, int front)
 static inline void sched_rq_remove_task(struct ktcb *task)
 {
 	unsigned long irqflags;
-	struct scheduler *sched =
-		&per_cpu_byid(scheduler, task->affinity);
-
-	sched_lock_runqueues(sched, &irqflags);
+	struct scheduler *sched;
 
 	/*
 	 * We must lock both, otherwise rqs may swap and
-	 * we may get the wrong rq.
+	 * we may get the wrong rq. The task may also move
+	 * to another cpu until its runqueues are locked.
 	 */
-	BUG_ON(list_empty(&task->rq_list));
-	list_remove_init(&task->rq_list);
-
-	task->rq->total--;
-	BUG_ON(task->rq->total < 0);
-	task->rq = 0;
-
+	for (;;) {
+		sched = &per_cpu_byid(scheduler, task->affinity);
+		sched_lock_runqueues(sched, &irqflags);
+		if (task->affinity == sched->cpu)
+			break;
+		sched_unlock_runqueues(sched, irqflags);
+	}
+	__sched_rq_remove_task(task);
 	sched_unlock_runqueues(sched, irqflags);
 }
 
 void sched_init_task(struct ktcb *task, int prio)
 {
 	link_init(&task->rq_list);
+	task->affinity_mask = cpu_mask_all();
 	task->priority = prio;
 	task->ticks_left = 0;
 	task->state = TASK_INACTIVE;
@@ -197,6 +244,252 @@ void sched_init_task(struct ktcb *task, int prio)
 	task->flags |= TASK_RESUMING;
 }
 
+/*
+ * A task that is woken up preempts current at the next
+ * scheduling point if it has a higher priority. Remote cpus
+ * pick it up on their next scheduling decision.
+ */
+static inline void sched_check_preempt(struct ktcb *task)
+{
+	if (task->affinity == smp_get_cpuid() &&
+	    task->priority > current->priority)
+		need_resched = 1;
+}
+
+#if defined (CONFIG_SMP_)
+
+/* Tasks on a cpu, the running one included, but not its idle task */
+static inline int sched_load(struct scheduler *sched)
+{
+	return sched->rq_runnable->total + sched->rq_expired->total -
+	       (sched->idle_task->rq ? 1 : 0);
+}
+
+/* Locks the runqueues of two cpus, always in the same order */
+static void sched_lock_pair(struct scheduler *a, struct scheduler *b,
+			    unsigned long *irqflags)
+{
+	struct scheduler *first = a < b ? a : b;
+	struct scheduler *second = a < b ? b : a;
+
+	sched_lock_runqueues(first, irqflags);
+	spin_lock(&second->sched_rq[0].lock);
+	spin_lock(&second->sched_rq[1].lock);
+}
+
+static void sched_unlock_pair(struct scheduler *a, struct scheduler *b,
+			      unsigned long irqflags)
+{
+	struct scheduler *first = a < b ? a : b;
+	struct scheduler *second = a < b ? b : a;
+
+	spin_unlock(&second->sched_rq[1].lock);
+	spin_unlock(&second->sched_rq[0].lock);
+	sched_unlock_runqueues(first, irqflags);
+}
+
+/* Whether a task queued on from may be moved to cpu, runqueues locked */
+static inline int sched_task_movable(struct scheduler *from,
+				     struct ktcb *task, int cpu)
+{
+	return task != from->curr && task != from->prev &&
+	       task != from->idle_task &&
+	       (task->affinity_mask & (1 << cpu));
+}
+
+/*
+ * Finds a task on rq that may move to cpu, highest priority first.
+ * If misplaced is set, only tasks not allowed on their cpu are taken.
+ */
+static struct ktcb *sched_rq_find_movable(struct scheduler *from,
+					  struct runqueue *rq,
+					  int cpu, int misplaced)
+{
+	struct ktcb *task;
+
+	for (int prio = TASK_PRIO_MAX; prio >= 0; prio--) {
+		if (!(rq->prio_bitmap & (1 << prio)))
+			continue;
+		list_foreach_struct(task, &rq->task_list[prio], rq_list)
+			if (sched_task_movable(from, task, cpu) &&
+			    (!misplaced ||
+			     !(task->affinity_mask & (1 << from->cpu))))
+				return task;
+	}
+	return 0;
+}
+
+/*
+ * Expired tasks are taken first, they have not run for the
+ * longest and have the least left in the caches of from.
+ */
+static struct ktcb *sched_find_movable(struct scheduler *from,
+				       int cpu, int misplaced)
+{
+	struct ktcb *task;
+
+	if ((task = sched_rq_find_movable(from, from->rq_expired,
+					  cpu, misplaced)))
+		return task;
+	return sched_rq_find_movable(from, from->rq_runnable, cpu, misplaced);
+}
+
+/* Moves a queued task to the same kind of runqueue on to */
+static void sched_migrate_task(struct ktcb *task, struct scheduler *to)
+{
+	struct runqueue *rq = task->rq == task->rq->sched->rq_expired ?
+			      to->rq_expired : to->rq_runnable;
+
+	__sched_rq_remove_task(task);
+	__sched_rq_add_task(task, rq, RQ_ADD_BEHIND);
+}
+
+/*
+ * Pulls one task over to this cpu. The busiest other cpu gives a
+ * task if it has at least two more than this one, and any cpu
+ * gives away a task that its affinity mask no longer allows there.
+ * Loads are read unlocked as hints, and checked again once locked.
+ */
+static struct ktcb *sched_balance(void)
+{
+	struct scheduler *this = &per_cpu(scheduler);
+	struct scheduler *busiest = 0, *peer;
+	struct ktcb *task = 0;
+	unsigned long irqflags;
+	int load, max = 0;
+
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++) {
+		peer = &per_cpu_byid(scheduler, cpu);
+		if (peer != this && (load = sched_load(peer)) > max) {
+			max = load;
+			busiest = peer;
+		}
+	}
+
+	for (int cpu = 0; cpu < CONFIG_NCPU && !task; cpu++) {
+		peer = &per_cpu_byid(scheduler, cpu);
+		if (peer == this)
+			continue;
+
+		sched_lock_pair(this, peer, &irqflags);
+		if (!(task = sched_find_movable(peer, this->cpu, 1)) &&
+		    peer == busiest &&
+		    sched_load(peer) - sched_load(this) >= 2)
+			task = sched_find_movable(peer, this->cpu, 0);
+		if (task)
+			sched_migrate_task(task, this);
+		sched_unlock_pair(this, peer, irqflags);
+	}
+
+	return task;
+}
+
+/*
+ * Called on timer irqs. Balances at an interval, and wakes up
+ * idle cpus if there is more to run here than the running task.
+ */
+void sched_balance_tick(void)
+{
+	struct scheduler *sched = &per_cpu(scheduler);
+	unsigned int idle = 0;
+	struct ktcb *task;
+
+	if (jiffies - sched->balance_stamp < SCHED_BALANCE_TICKS)
+		return;
+	sched->balance_stamp = jiffies;
+
+	if ((task = sched_balance())) {
+		system_account_migrate_balance();
+		if (is_idle_task(current))
+			need_resched = 1;
+		else
+			sched_check_preempt(task);
+	}
+
+	/* Idle cpus may have stopped ticking, they take tasks at once */
+	if (sched_load(sched) < 2)
+		return;
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++)
+		if (cpu != sched->cpu &&
+		    !sched_load(&per_cpu_byid(scheduler, cpu)))
+			idle |= (1 << cpu);
+	if (idle)
+		smp_send_ipi(idle, IPI_SCHEDULE);
+}
+
+/* Pulls a task to run, when this cpu has nothing else */
+static inline void sched_idle_balance(void)
+{
+	if (!sched_load(&per_cpu(scheduler)) && sched_balance())
+		system_account_migrate_idle();
+}
+
+#else /* !CONFIG_SMP_ */
+
+void sched_balance_tick(void) { }
+static inline void sched_idle_balance(void) { }
+
+#endif /* CONFIG_SMP_ */
+
+/*
+ * Sets the cpus a task may run on. A queued task that is not
+ * running is moved at once if it is no longer allowed where it
+ * is, and others are moved by balancing once they have stopped.
+ */
+int sched_set_affinity(struct ktcb *task, u32 mask)
+{
+	if (!(mask &= cpu_mask_all()))
+		return -EINVAL;
+
+	preempt_disable();
+	task->affinity_mask = mask;
+
+#if defined (CONFIG_SMP_)
+	if (!(mask & (1 << task->affinity))) {
+		struct scheduler *from = &per_cpu_byid(scheduler,
+						       task->affinity);
+		struct scheduler *to = &per_cpu_byid(scheduler,
+						     31 - __clz(mask));
+		unsigned long irqflags;
+
+		sched_lock_pair(from, to, &irqflags);
+		if (task->rq && task->affinity == from->cpu &&
+		    sched_task_movable(from, task, to->cpu)) {
+			sched_migrate_task(task, to);
+			system_account_migrate_balance();
+		} else if (!task->rq && task != current) {
+			/* Not queued, it is queued there on wakeup */
+			task->affinity = to->cpu;
+		}
+		sched_unlock_pair(from, to, irqflags);
+	}
+#endif
+	preempt_enable();
+
+	return 0;
+}
+
+/*
+ * Changes a task's priority. If the task is queued, it is
+ * requeued on the list for its new priority level.
+ */
+void sched_set_priority(struct ktcb *task, int prio)
+{
+	BUG_ON(prio < 0 || prio > TASK_PRIO_MAX);
+
+	preempt_disable();
+	if (task->rq) {
+		struct runqueue *rq = task->rq;
+
+		sched_rq_remove_task(task);
+		task->priority = prio;
+		sched_rq_add_task(task, rq, RQ_ADD_BEHIND);
+	} else {
+		task->priority = prio;
+	}
+	preempt_enable();
+}
+
 /* Synchronously resumes a task */
 void sched_resume_sync(struct ktcb *task)
 {
@@ -220,6 +513,7 @@ void sched_resume_async(struct ktcb *task)
 	sched_rq_add_task(task, per_cpu_byid(scheduler,
 					     task->affinity).rq_runnable,
 					     1);
+	sched_check_preempt(task);
 }
 
 /*
@@ -280,6 +574,8 @@ static inline void context_switch(struct ktcb *next)
 
 	system_account_context_switch();
 
+	trace_event(TRACE_CONTEXT_SWITCH, next->tid);
+
 	/* Flush caches and everything */
 	BUG_ON(!current);
 	BUG_ON(!current->space);
@@ -314,12 +610,15 @@ static inline int sched_recalc_ticks(struct ktcb *task, int prio_total)
 /*
  * Selection happens as follows:
  *
- * A real-time task is chosen %87.5 of the time. This is evenly
- * distributed to a given interval.
+ * The first task on the highest priority non-empty level of the
+ * runnable queue is chosen. Finding that level is a single clz on
+ * the runqueue's priority bitmap. Tasks of equal priority run
+ * round-robin, and a task that has used up its timeslice waits in
+ * the expired queue, so lower priorities are not starved beyond
+ * one runqueue swap.
  *
  * Idle task is run once when it is explicitly suggested (e.g.
- * for cleanup after a task exited) but only when no real-time
- * tasks are in the queues.
+ * for cleanup after a task exited).
  *
  * And idle task is otherwise run only when no other tasks are
  * runnable.
@@ -337,15 +636,13 @@ struct ktcb *sched_select_next(void)
 			next = sched->idle_task;
 			break;
 		} else if (sched->rq_runnable->total > 0) {
-			/* Get a regular runnable task, if available */
-			next = link_to_struct(sched->rq_runnable->task_list.next,
-					      struct ktcb, rq_list);
+			/* Get highest priority runnable task, if available */
+			next = sched_rq_first_task(sched->rq_runnable);
 			break;
 		} else if (sched->rq_expired->total > 0) {
 			/* Swap queues and retry if not */
 			sched_rq_swap_queues();
-			next = link_to_struct(sched->rq_runnable->task_list.next,
-					      struct ktcb, rq_list);
+			next = sched_rq_first_task(sched->rq_runnable);
 			break;
 		} else if (in_process_context()) {
 			/* No runnable task. Do idle if in process context */
@@ -364,6 +661,51 @@ struct ktcb *sched_select_next(void)
 }
 
 
+/*
+ * Sets the tick for when task must be rescheduled, at the end of
+ * its timeslice or schedule granularity, or for the first receive
+ * timeout if that is sooner. The tick is stopped if task is the
+ * idle task with nothing else to run on this cpu, and no timeouts.
+ */
+void sched_tick_program(struct ktcb *task)
+{
+	struct scheduler *sched = &per_cpu(scheduler);
+	u32 timeout = timeout_next_ticks();
+	u32 ticks;
+
+	/* An idle cpu only wakes up for the first receive timeout */
+	if (is_idle_task(task) && sched->rq_runnable->total <= 1 &&
+	    !sched->rq_expired->total) {
+		tick_program(timeout);
+		return;
+	}
+
+	/* Already due, try again on the next tick */
+	ticks = max(1, min(task->ticks_left, task->sched_granule));
+	if (timeout)
+		ticks = min(ticks, timeout);
+	tick_program(ticks);
+}
+
+#if defined (CONFIG_TICKLESS)
+/*
+ * Called by the idle task. With the tick stopped, the cpu
+ * sleeps until an irq instead of spinning in the scheduler.
+ * Irqs are disabled while checking, so that a wakeup can't
+ * come in between. A pending irq still ends the wait.
+ */
+void sched_idle_wait(void)
+{
+	struct scheduler *sched = &per_cpu(scheduler);
+
+	disable_irqs();
+	if (!need_resched && sched->rq_runnable->total <= 1 &&
+	    !sched->rq_expired->total)
+		arm_wait_for_interrupt();
+	enable_irqs();
+}
+#endif
+
 /* Prepare next runnable task right before switching to it */
 void sched_prepare_next(struct ktcb *next)
 {
@@ -390,6 +732,65 @@ void sched_prepare_next(struct ktcb *next)
 	next->sched_granule = SCHED_GRANULARITY;
 }
 
+/*
+ * Direct process switch, used by the ipc fast path.
+ *
+ * Current must be about to sleep, and next must be a sleeping
+ * task with the same cpu affinity. Next takes over current's
+ * place in the runnable queue under a single runqueue lock,
+ * and runs on what is left of current's timeslice.
+ *
+ * Like sched_prepare_sleep(), this must be called with the
+ * waitqueue locks that make current's sleep visible to wakers
+ * held, and with preemption disabled until sched_handoff_switch()
+ * has switched to next.
+ */
+void sched_handoff_prepare(struct ktcb *next)
+{
+	struct scheduler *sched = &per_cpu(scheduler);
+	unsigned long irqflags;
+	u32 ticks;
+
+	BUG_ON(next->affinity != current->affinity);
+	BUG_ON(current->state != TASK_RUNNABLE);
+	BUG_ON(next->state == TASK_RUNNABLE);
+
+	/* Charge current up to now, before its timeslice is donated */
+	tick_account();
+
+	sched_lock_runqueues(sched, &irqflags);
+	__sched_rq_remove_task(current);
+	__sched_rq_add_task(next, sched->rq_runnable, RQ_ADD_FRONT);
+	sched->prev = current;
+	sched->curr = next;
+	sched_unlock_runqueues(sched, irqflags);
+
+	current->state = TASK_SLEEPING;
+	next->state = TASK_RUNNABLE;
+
+	/* Donate current's timeslice, it gets next's leftover back */
+	ticks = next->ticks_left;
+	next->ticks_left = current->ticks_left;
+	current->ticks_left = ticks;
+}
+
+/*
+ * Switches to the task prepared by sched_handoff_prepare()
+ * without going through runqueue selection.
+ */
+void sched_handoff_switch(struct ktcb *next)
+{
+	BUG_ON(in_nested_irq_context());
+
+	need_resched = 0;
+	sched_prepare_next(next);
+	sched_tick_program(next);
+
+	disable_irqs();
+	preempt_enable();
+	context_switch(next);
+}
+
 /*
  * Tasks come here, either by setting need_resched (via next irq),
  * or by directly calling it (in process context).
@@ -413,14 +814,18 @@ void sched_prepare_next(struct ktcb *next)
  * task's timeslice is very long. In the future, real-time tasks will
  * be added, and they will be able to ignore SCHED_GRANULARITY.
  *
- * In the future, the tasks will be sorted by priority in their
- * runqueue, as well as having an adjusted timeslice.
+ * Tasks are kept sorted by priority in their runqueue, one list
+ * per priority level, and the highest priority runnable task is
+ * always selected first. A higher priority task that wakes up
+ * preempts current at the next scheduling point.
  *
  * Runqueues are swapped at a single second's interval. This implies
  * the timeslice recalculations would also occur at this interval.
  */
 void schedule()
 {
+	struct scheduler *sched = &per_cpu(scheduler);
+	unsigned long irqflags;
 	struct ktcb *next;
 
 	/* Should not schedule with preemption
@@ -431,10 +836,17 @@ void schedule()
 	/* Should not have more ticks than SCHED_TICKS */
 	BUG_ON(current->ticks_left > CONFIG_SCHED_TICKS);
 
+	/* Wake up receivers whose timeouts have run out */
+	if (timeout_due())
+		timeout_expire();
+
 	/* If coming from process path, cannot have
 	 * any irqs that schedule after this */
 	preempt_disable();
 
+	/* Charge current with any ticks that were not accounted */
+	tick_account();
+
 	/* Reset schedule flag */
 	need_resched = 0;
 
@@ -483,11 +895,22 @@ void schedule()
 		per_cpu(scheduler).flags |= SCHED_RUN_IDLE;
 	}
 
-	/* Decide on next runnable task */
+	/* Nothing to run here, take a task from a busier cpu */
+	sched_idle_balance();
+
+	/*
+	 * Decide on next runnable task. This is locked, so
+	 * that other cpus don't take it away meanwhile.
+	 */
+	sched_lock_runqueues(sched, &irqflags);
 	next = sched_select_next();
+	sched->prev = current;
+	sched->curr = next;
+	sched_unlock_runqueues(sched, irqflags);
 
 	/* Prepare next task for running */
 	sched_prepare_next(next);
+	sched_tick_program(next);
 
 	/* Finish */
 	disable_irqs();
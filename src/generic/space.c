@@ -22,6 +22,14 @@ void init_address_space_list(struct address_space_list *space_list)
 
 	link_init(&space_list->list);
 	spin_lock_init(&space_list->lock);
+	for (int i = 0; i < SPACE_HASH_BUCKETS; i++)
+		link_init(&space_list->hash[i]);
+}
+
+static inline struct link *
+space_hash_bucket(struct address_space_list *space_list, l4id_t spid)
+{
+	return &space_list->hash[spid & (SPACE_HASH_BUCKETS - 1)];
 }
 
 void address_space_attach(struct ktcb *tcb, struct address_space *space)
@@ -34,7 +42,8 @@ struct address_space *address_space_find(l4id_t spid)
 {
 	struct address_space *space;
 
-	list_foreach_struct(space, &curcont->space_list.list, list)
+	list_foreach_struct(space, space_hash_bucket(&curcont->space_list,
+						     spid), hash_list)
 		if (space->spid == spid)
 			return space;
 	return 0;
@@ -44,6 +53,8 @@ void address_space_add(struct address_space *space)
 {
 	BUG_ON(!list_empty(&space->list));
 	list_insert(&space->list, &curcont->space_list.list);
+	list_insert(&space->hash_list,
+		    space_hash_bucket(&curcont->space_list, space->spid));
 	BUG_ON(!++curcont->space_list.count);
 }
 
@@ -52,6 +63,7 @@ void address_space_remove(struct address_space *space, struct container *cont)
 	BUG_ON(list_empty(&space->list));
 	BUG_ON(--cont->space_list.count < 0);
 	list_remove_init(&space->list);
+	list_remove_init(&space->hash_list);
 }
 
 
@@ -72,7 +84,8 @@ void address_space_delete(struct address_space *space, struct cap_list *clist)
 	space_cap_free(space, clist);
 }
 
-struct address_space *address_space_create(struct address_space *orig)
+struct address_space *address_space_create(struct address_space *orig,
+					   int cow)
 {
 	struct address_space *space;
 	pgd_table_t *pgd;
@@ -90,6 +103,7 @@ struct address_space *address_space_create(struct address_space *orig)
 
 	/* Initialize space structure */
 	link_init(&space->list);
+	link_init(&space->hash_list);
 	cap_list_init(&space->cap_list);
 	spin_lock_init(&space->lock);
 	space->pgd = pgd;
@@ -107,7 +121,7 @@ struct address_space *address_space_create(struct address_space *orig)
 	/* If an original space is supplied */
 	if (orig) {
 		/* Copy its user entries/tables */
-		if ((err = copy_user_tables(space, orig)) < 0) {
+		if ((err = copy_user_tables(space, orig, cow)) < 0) {
 			pgd_free(pgd);
 			space_cap_free(space, &current->space->cap_list);
 			return PTR_ERR(err);
@@ -24,12 +24,27 @@ void init_ktcb_list(struct ktcb_list *ktcb_list)
 	memset(ktcb_list, 0, sizeof(*ktcb_list));
 	spin_lock_init(&ktcb_list->list_lock);
 	link_init(&ktcb_list->list);
+
+	for (int i = 0; i < KTCB_HASH_BUCKETS; i++) {
+		link_init(&ktcb_list->hash[i].list);
+		spin_lock_init(&ktcb_list->hash[i].lock);
+	}
+}
+
+/* Thread ids are allocated sequentially, so the id bits hash evenly */
+static inline struct ktcb_hash_bucket *
+ktcb_hash_bucket(struct ktcb_list *ktcb_list, l4id_t tid)
+{
+	return &ktcb_list->hash[(tid & TASK_ID_MASK) &
+				(KTCB_HASH_BUCKETS - 1)];
 }
 
 void tcb_init(struct ktcb *new)
 {
 
 	link_init(&new->task_list);
+	link_init(&new->tid_hash_list);
+	link_init(&new->timeout_list);
 	mutex_init(&new->thread_control_lock);
 
 	spin_lock_init(&new->thread_lock);
@@ -87,6 +102,7 @@ void tcb_delete_pager(struct ktcb *tcb)
 	BUG_ON(tcb->waiting_on);
 	BUG_ON(tcb->wq);
 	BUG_ON(tcb->nchild);
+	BUG_ON(!list_empty(&tcb->timeout_list));
 
 	/*
 	 * NOTE: This protects single threaded space
@@ -137,6 +153,7 @@ void tcb_delete(struct ktcb *tcb)
 	BUG_ON(tcb->waiting_on);
 	BUG_ON(tcb->wq);
 	BUG_ON(tcb->nchild);
+	BUG_ON(!list_empty(&tcb->timeout_list));
 
 	/*
 	 * NOTE: This protects single threaded space
@@ -196,34 +213,40 @@ struct ktcb *tcb_find_by_space(l4id_t spid)
 	return 0;
 }
 
+/*
+ * Tid lookups only lock and walk the hash bucket
+ * of the tid, not the whole container thread list.
+ */
 struct ktcb *container_find_tcb(struct container *c, l4id_t tid)
 {
+	struct ktcb_hash_bucket *bucket = ktcb_hash_bucket(&c->ktcb_list, tid);
 	struct ktcb *task;
 
-	spin_lock(&c->ktcb_list.list_lock);
-	list_foreach_struct(task, &c->ktcb_list.list, task_list) {
+	spin_lock(&bucket->lock);
+	list_foreach_struct(task, &bucket->list, tid_hash_list) {
 		if (task->tid == tid) {
-			spin_unlock(&c->ktcb_list.list_lock);
+			spin_unlock(&bucket->lock);
 			return task;
 		}
 	}
-	spin_unlock(&c->ktcb_list.list_lock);
+	spin_unlock(&bucket->lock);
 	return 0;
 }
 
 struct ktcb *container_find_lock_tcb(struct container *c, l4id_t tid)
 {
+	struct ktcb_hash_bucket *bucket = ktcb_hash_bucket(&c->ktcb_list, tid);
 	struct ktcb *task;
 
-	spin_lock(&c->ktcb_list.list_lock);
-	list_foreach_struct(task, &c->ktcb_list.list, task_list) {
+	spin_lock(&bucket->lock);
+	list_foreach_struct(task, &bucket->list, tid_hash_list) {
 		if (task->tid == tid) {
 			spin_lock(&task->thread_lock);
-			spin_unlock(&c->ktcb_list.list_lock);
+			spin_unlock(&bucket->lock);
 			return task;
 		}
 	}
-	spin_unlock(&c->ktcb_list.list_lock);
+	spin_unlock(&bucket->lock);
 	return 0;
 }
 
@@ -284,11 +307,18 @@ void ktcb_list_add(struct ktcb *new, struct ktcb_list *ktcb_list)
 void tcb_add(struct ktcb *new)
 {
 	struct container *c = new->container;
+	struct ktcb_hash_bucket *bucket =
+		ktcb_hash_bucket(&c->ktcb_list, new->tid);
 
 	spin_lock(&c->ktcb_list.list_lock);
 	BUG_ON(!list_empty(&new->task_list));
+	BUG_ON(!list_empty(&new->tid_hash_list));
 	BUG_ON(!++c->ktcb_list.count);
 	list_insert(&new->task_list, &c->ktcb_list.list);
+
+	spin_lock(&bucket->lock);
+	list_insert(&new->tid_hash_list, &bucket->list);
+	spin_unlock(&bucket->lock);
 	spin_unlock(&c->ktcb_list.list_lock);
 }
 
@@ -339,13 +369,19 @@ void tcb_delete_zombies(void)
  */
 void tcb_remove(struct ktcb *task)
 {
+	struct ktcb_hash_bucket *bucket =
+		ktcb_hash_bucket(&curcont->ktcb_list, task->tid);
+
 	/* Lock list */
 	spin_lock(&curcont->ktcb_list.list_lock);
 	BUG_ON(list_empty(&task->task_list));
 	BUG_ON(--curcont->ktcb_list.count < 0);
+	spin_lock(&bucket->lock);
 	spin_lock(&task->thread_lock);
 
 	list_remove_init(&task->task_list);
+	list_remove_init(&task->tid_hash_list);
+	spin_unlock(&bucket->lock);
 	spin_unlock(&curcont->ktcb_list.list_lock);
 	spin_unlock(&task->thread_lock);
 }
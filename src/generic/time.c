@@ -12,9 +12,16 @@
 #include <l4/generic/time.h>
 #include <l4/generic/preempt.h>
 #include <l4/generic/space.h>
+#include <l4/generic/platform.h>
+#include <l4/lib/spinlock.h>
+#include <l4/lib/math.h>
+#include <l4/lib/wait.h>
+#include <l4/generic/tcb.h>
 #include INC_ARCH(exception.h)
 #include <l4/api/syscall.h>
 #include <l4/api/errno.h>
+#include <l4/api/kip.h>
+#include INC_SUBARCH(mmu_ops.h)
 #include INC_GLUE(ipi.h)	/*FIXME: Remove this */
 
 /* TODO:
@@ -33,25 +40,63 @@ static inline void increase_jiffies(void)
 
 /* Internal representation of time since epoch */
 struct time_info {
-	int reader;
 	u32 thz;	/* Ticks in this hertz so far */
 	u64 sec;	/* Seconds so far */
 };
 
 static struct time_info systime = { 0 };
 
+/* Clock at the last tick of system time, if there is a clock */
+static u32 time_stamp;
+
+/*
+ * Publishes system time in the kip clock. Readers copy it and
+ * retry if seq was odd or changed, so there is only one writer,
+ * on the timer irq or under the time lock.
+ */
+static void update_kip_clock(void)
+{
+	kip_clock->seq++;
+	dmb();
+
+	kip_clock->sec = systime.sec;
+	kip_clock->usec = systime.thz * USEC_PER_TICK;
+	kip_clock->stamp = time_stamp;
+
+	dmb();
+	kip_clock->seq++;
+}
+
+/* Reads system time from the kip clock, as userspace does */
+static void read_kip_clock(struct timeval *tv)
+{
+	u32 seq, sec, usec;
+
+	do {
+		seq = kip_clock->seq;
+		dmb();
+
+		sec = kip_clock->sec;
+		usec = kip_clock->usec;
+#if defined (CONFIG_TICKLESS)
+		usec += platform_timer_clock() - kip_clock->stamp;
+#endif
+
+		dmb();
+	} while ((seq & 1) || seq != kip_clock->seq);
+
+	tv->tv_sec = sec + usec / 1000000;
+	tv->tv_usec = usec % 1000000;
+}
+
 /*
  * A very basic (probably erroneous)
  * rule-of-thumb time calculation.
  */
-void update_system_time(void)
+void update_system_time(u32 ticks)
 {
-	/* Did we interrupt a reader? Tell it to retry */
-	if (systime.reader)
-		systime.reader = 0;
-
 	/* Increase just like jiffies, but reset every second */
-	systime.thz++;
+	systime.thz += ticks;
 
 	/*
 	 * On every 1 second of timer ticks, increase seconds
@@ -59,16 +104,236 @@ void update_system_time(void)
 	 * TODO: Investigate: how do we make sure timer_irq is
 	 * called SCHED_TICKS times per second?
 	 */
-	if (systime.thz == CONFIG_SCHED_TICKS) {
-		systime.thz = 0;
-		systime.sec++;
+	if (systime.thz >= CONFIG_SCHED_TICKS) {
+		systime.sec += systime.thz / CONFIG_SCHED_TICKS;
+		systime.thz %= CONFIG_SCHED_TICKS;
+	}
+
+	update_kip_clock();
+}
+
+#if defined (CONFIG_TICKLESS)
+
+/*
+ * Dynamic ticks:
+ *
+ * The timer is programmed one-shot for when the current task
+ * must be rescheduled, and not at all while a cpu only has its
+ * idle task to run. Ticks that went by in between are counted
+ * on a free-running usec clock, and accounted all at once on
+ * timer irqs, on context switches and when the time is read.
+ *
+ * Stamps are kept on whole tick boundaries, so that the part
+ * of a tick that has not completed yet is carried over.
+ */
+
+/* Longest the tick stays off, so that clock stamps never wrap */
+#define TICK_IDLE_MAX_USEC		(1 << 30)
+
+/* Sooner than this, the event would be over before it is set */
+#define TICK_MIN_USEC			20
+
+static DECLARE_SPINLOCK(time_lock);
+
+/* Clock at the last tick charged to a task, and the next event */
+DECLARE_PERCPU(static u32, tick_stamp);
+DECLARE_PERCPU(static u32, tick_expires);
+DECLARE_PERCPU(static int, tick_stopped);
+
+/* Whole ticks since stamp, moving stamp up to the last of them */
+static inline u32 ticks_since(u32 *stamp, u32 now)
+{
+	u32 ticks = (now - *stamp) / USEC_PER_TICK;
+
+	*stamp += ticks * USEC_PER_TICK;
+	return ticks;
+}
+
+/* Catches up system time with the ticks that were skipped */
+static void update_time(void)
+{
+	unsigned long irqflags;
+	u32 ticks;
+
+	spin_lock_irq(&time_lock, &irqflags);
+	if ((ticks = ticks_since(&time_stamp, platform_timer_clock()))) {
+		jiffies += ticks;
+		update_system_time(ticks);
+	}
+	spin_unlock_irq(&time_lock, irqflags);
+}
+
+/* Charges current with the ticks it ran for since the last charge */
+void tick_account(void)
+{
+	u32 ticks;
+
+	if ((ticks = ticks_since(&per_cpu(tick_stamp),
+				 platform_timer_clock())))
+		update_process_times(ticks);
+}
+
+/*
+ * Sets this cpu's next event ticks away from its last tick, or
+ * stops its tick if ticks is 0. The timer is shared, so it is
+ * set for the earliest event of all cpus.
+ */
+void tick_program(u32 ticks)
+{
+	u32 now, delta, usecs = TICK_IDLE_MAX_USEC;
+	unsigned long irqflags;
+
+	spin_lock_irq(&time_lock, &irqflags);
+
+	per_cpu(tick_stopped) = !ticks;
+	per_cpu(tick_expires) = per_cpu(tick_stamp) + ticks * USEC_PER_TICK;
+
+	now = platform_timer_clock();
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++) {
+		if (per_cpu_byid(tick_stopped, cpu))
+			continue;
+		delta = per_cpu_byid(tick_expires, cpu) - now;
+		if ((int)delta < TICK_MIN_USEC)
+			delta = TICK_MIN_USEC;
+		usecs = min(usecs, delta);
+	}
+	platform_timer_oneshot(usecs);
+
+	spin_unlock_irq(&time_lock, irqflags);
+}
+
+#if defined (CONFIG_SMP_)
+/* Other cpus whose tick is due */
+static unsigned int tick_cpus_expired(void)
+{
+	unsigned int mask = 0;
+	u32 now = platform_timer_clock();
+
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++)
+		if (cpu != smp_get_cpuid() &&
+		    !per_cpu_byid(tick_stopped, cpu) &&
+		    (int)(per_cpu_byid(tick_expires, cpu) - now) <= 0)
+			mask |= (1 << cpu);
+	return mask;
+}
+#endif
+
+#endif /* CONFIG_TICKLESS */
+
+/*
+ * Receive timeouts. Tasks that sleep in a receive with a timeout
+ * are kept in the order they expire. The timer irq only looks at
+ * the first one, and asks for a reschedule once it is due. Tasks
+ * are woken up by the scheduler, since ipc holds the locks of the
+ * queue they sleep on with irqs enabled.
+ */
+static DECLARE_SPINLOCK(timeout_lock);
+static LINK_DECLARE(timeouts);
+
+/* Jiffies, caught up with the ticks that the tick may have skipped */
+static inline u32 timeout_clock(void)
+{
+#if defined (CONFIG_TICKLESS)
+	update_time();
+#endif
+	return jiffies;
+}
+
+void timeout_add(struct ktcb *task, u32 ticks)
+{
+	u32 expires = timeout_clock() + ticks;
+	unsigned long irqflags;
+	struct ktcb *t;
+
+	spin_lock_irq(&timeout_lock, &irqflags);
+	task->timeout_expires = expires;
+	list_foreach_struct(t, &timeouts, timeout_list)
+		if ((int)(t->timeout_expires - expires) > 0)
+			break;
+	list_insert_tail(&task->timeout_list, &t->timeout_list);
+	spin_unlock_irq(&timeout_lock, irqflags);
+}
+
+void timeout_del(struct ktcb *task)
+{
+	unsigned long irqflags;
+
+	spin_lock_irq(&timeout_lock, &irqflags);
+	list_remove_init(&task->timeout_list);
+	spin_unlock_irq(&timeout_lock, irqflags);
+}
+
+static inline struct ktcb *timeout_first(void)
+{
+	if (list_empty(&timeouts))
+		return 0;
+	return link_to_struct(timeouts.next, struct ktcb, timeout_list);
+}
+
+/* Tells if the first timeout has run out, called on timer irqs */
+int timeout_due(void)
+{
+	unsigned long irqflags;
+	struct ktcb *task;
+	int due;
+
+	if (list_empty(&timeouts))
+		return 0;
+
+	spin_lock_irq(&timeout_lock, &irqflags);
+	due = (task = timeout_first()) &&
+	      (int)(jiffies - task->timeout_expires) >= 0;
+	spin_unlock_irq(&timeout_lock, irqflags);
+
+	return due;
+}
+
+/*
+ * Wakes up the tasks whose timeouts have run out. A task may be
+ * woken up by a sender at the same time, in which case the
+ * message wins, and the receive succeeds.
+ */
+void timeout_expire(void)
+{
+	unsigned long irqflags;
+	struct ktcb *task;
+
+	spin_lock_irq(&timeout_lock, &irqflags);
+	while ((task = timeout_first()) &&
+	       (int)(jiffies - task->timeout_expires) >= 0) {
+		list_remove_init(&task->timeout_list);
+		task->flags |= TASK_TIMEDOUT;
+		if (wake_up_task(task, WAKEUP_INTERRUPT) < 0)
+			task->flags &= ~TASK_TIMEDOUT;
 	}
+	spin_unlock_irq(&timeout_lock, irqflags);
 }
 
-/* Read system time */
+/* Ticks until the first timeout runs out, or 0 if there is none */
+u32 timeout_next_ticks(void)
+{
+	unsigned long irqflags;
+	struct ktcb *task;
+	u32 now, ticks = 0;
+
+	if (list_empty(&timeouts))
+		return 0;
+
+	now = timeout_clock();
+	spin_lock_irq(&timeout_lock, &irqflags);
+	if ((task = timeout_first()))
+		ticks = max(1, (int)(task->timeout_expires - now));
+	spin_unlock_irq(&timeout_lock, irqflags);
+
+	return ticks;
+}
+
+/*
+ * Read system time. Userspace reads the kip clock by itself,
+ * this is for those that don't.
+ */
 int sys_time(struct timeval *tv, int set)
 {
-	int retries = 20;
 	int err;
 
 	if ((err = check_access((unsigned long)tv, sizeof(*tv),
@@ -77,24 +342,8 @@ int sys_time(struct timeval *tv, int set)
 
 	/* Get time */
 	if (!set) {
-		while(retries > 0) {
-			systime.reader = 1;
-			tv->tv_sec = systime.sec;
-			tv->tv_usec = 1000000 * systime.thz / CONFIG_SCHED_TICKS;
-
-			retries--;
-			if (systime.reader)
-				break;
-		}
-
-		/*
-		 * No need to reset reader since it will be reset
-		 * on next timer. If no retries return busy.
-		 */
-		if (!retries)
-			return -EBUSY;
-		else
-			return 0;
+		read_kip_clock(tv);
+		return 0;
 
 	/* Set */
 	} else {
@@ -105,10 +354,20 @@ int sys_time(struct timeval *tv, int set)
 	}
 }
 
-void update_process_times(void)
+/*
+ * Charges current with ticks that it has run for. These
+ * are TASK_RUNNABLE times, i.e. exludes sleeps.
+ */
+void update_process_times(u32 ticks)
 {
 	struct ktcb *cur = current;
 
+	/* In the future we may use timestamps for accuracy */
+	if (in_kernel())
+		cur->kernel_time += ticks;
+	else
+		cur->user_time += ticks;
+
 	if (cur->ticks_left == 0) {
 		/*
 		 * Nested irqs and irqs during non-preemptive
@@ -121,17 +380,8 @@ void update_process_times(void)
 			BUG();
 	}
 
-	/*
-	 * These are TASK_RUNNABLE times, i.e. exludes sleeps
-	 * In the future we may use timestamps for accuracy
-	 */
-	if (in_kernel())
-		cur->kernel_time++;
-	else
-		cur->user_time++;
-
-	cur->ticks_left--;
-	cur->sched_granule--;
+	cur->ticks_left -= min(ticks, cur->ticks_left);
+	cur->sched_granule -= min(ticks, cur->sched_granule);
 
 	/* Task has expired its timeslice */
 	if (!cur->ticks_left)
@@ -142,11 +392,51 @@ void update_process_times(void)
 		need_resched = 1;
 }
 
+#if defined (CONFIG_TICKLESS)
+
+int do_timer_irq(void)
+{
+	update_time();
+	tick_account();
+
+	/* Sleepers are woken up on the way out of the irq */
+	if (timeout_due())
+		need_resched = 1;
+
+#if defined (CONFIG_SMP_)
+	/* Only cpus whose tick is due, idle ones are left alone */
+	smp_send_ipi(tick_cpus_expired(), IPI_TIMER_EVENT);
+#endif
+
+	sched_balance_tick();
+
+	/* Until the scheduler sets it for the next task */
+	sched_tick_program(current);
+
+	return IRQ_HANDLED;
+}
+
+/* Secondary cpus call this */
+int secondary_timer_irq(void)
+{
+	tick_account();
+	sched_balance_tick();
+	sched_tick_program(current);
+	return IRQ_HANDLED;
+}
+
+#else /* !CONFIG_TICKLESS */
+
 int do_timer_irq(void)
 {
 	increase_jiffies();
-	update_process_times();
-	update_system_time();
+	update_process_times(1);
+	update_system_time(1);
+
+	/* Sleepers are woken up on the way out of the irq */
+	if (timeout_due())
+		need_resched = 1;
+	sched_balance_tick();
 
 #if defined (CONFIG_SMP_)
 	smp_send_ipi(cpu_mask_others(), IPI_TIMER_EVENT);
@@ -158,7 +448,9 @@ int do_timer_irq(void)
 /* Secondary cpus call this */
 int secondary_timer_irq(void)
 {
-	update_process_times();
+	update_process_times(1);
+	sched_balance_tick();
 	return IRQ_HANDLED;
 }
 
+#endif /* CONFIG_TICKLESS */
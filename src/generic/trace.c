@@ -0,0 +1,187 @@
+/*
+ * Kernel event tracing
+ *
+ * Each cpu records events in a ring buffer of its own, so writers
+ * take no locks. An event is written with local irqs disabled, as
+ * irq handlers record events too. A privileged container maps the
+ * buffers read-only and stops tracing before it reads them, or they
+ * are taken from a memory dump and decoded by tools/tracedump.py.
+ *
+ * Copyright (C) 2010 B Labs Ltd.
+ */
+#include <l4/lib/printk.h>
+#include <l4/lib/string.h>
+#include <l4/generic/tcb.h>
+#include <l4/generic/smp.h>
+#include <l4/generic/time.h>
+#include <l4/generic/trace.h>
+#include <l4/generic/platform.h>
+#include <l4/generic/capability.h>
+#include <l4/api/syscall.h>
+#include <l4/api/errno.h>
+#include INC_GLUE(memory.h)
+#include INC_GLUE(mapping.h)
+#include INC_GLUE(cache.h)
+#include INC_SUBARCH(irq.h)
+
+#if defined (CONFIG_TRACE)
+
+#define TRACE_BUFFER_SIZE	(CONFIG_TRACE_PAGES * PAGE_SIZE)
+#define TRACE_EVENTS		((TRACE_BUFFER_SIZE -			\
+				  sizeof(struct trace_header)) /	\
+				 sizeof(struct trace_event))
+
+struct trace_buffer {
+	struct trace_header header;
+	struct trace_event events[TRACE_EVENTS];
+} ALIGN(PAGE_SIZE);
+
+DECLARE_PERCPU(static struct trace_buffer, trace_buffer);
+
+volatile int trace_enabled;
+
+/*
+ * With dynamic ticks the free-running clock counts usecs,
+ * otherwise events are only as precise as the last tick.
+ */
+#if defined (CONFIG_TICKLESS)
+#define trace_clock()		platform_timer_clock()
+#define TRACE_USEC_PER_STAMP	1
+#else
+#define trace_clock()		jiffies
+#define TRACE_USEC_PER_STAMP	USEC_PER_TICK
+#endif
+
+void __trace_event(unsigned int type, unsigned int data, u32 arg)
+{
+	struct trace_buffer *buf = &per_cpu(trace_buffer);
+	struct trace_event *event;
+	unsigned long irqstate;
+
+	irq_local_disable_save(&irqstate);
+
+	event = &buf->events[buf->header.head];
+	event->stamp = trace_clock();
+	event->type = type;
+	event->data = data;
+	event->tid = current->tid;
+	event->arg = arg;
+
+	if (++buf->header.head == TRACE_EVENTS)
+		buf->header.head = 0;
+	buf->header.count++;
+
+	irq_local_restore(irqstate);
+}
+
+/* Sets up the headers, which also tell where buffers are in a dump */
+static void trace_buffers_reset(void)
+{
+	struct trace_header *header;
+
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++) {
+		header = &per_cpu_byid(trace_buffer, cpu).header;
+		header->magic = TRACE_MAGIC;
+		header->version = TRACE_VERSION;
+		header->cpu = cpu;
+		header->nevents = TRACE_EVENTS;
+		header->usec_per_stamp = TRACE_USEC_PER_STAMP;
+		header->head = 0;
+		header->count = 0;
+		header->enabled = trace_enabled;
+	}
+}
+
+static void trace_buffers_enable(int enable)
+{
+	trace_enabled = enable;
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++)
+		per_cpu_byid(trace_buffer, cpu).header.enabled = enable;
+}
+
+/*
+ * Writes the buffers back to memory, so that readers of
+ * the uncached user mapping and of memory dumps see them.
+ */
+static void trace_buffers_clean(void)
+{
+	unsigned long start;
+
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++) {
+		start = (unsigned long)&per_cpu_byid(trace_buffer, cpu);
+		arch_clean_dcache(start, start + sizeof(struct trace_buffer));
+	}
+}
+
+/*
+ * Maps the buffers of all cpus back to back at virt, in cpu
+ * order, and returns the number of pages mapped.
+ */
+static int trace_buffers_map(unsigned long virt)
+{
+	unsigned long size = sizeof(struct trace_buffer);
+	struct trace_buffer *buf;
+	int err;
+
+	for (int cpu = 0; cpu < CONFIG_NCPU; cpu++) {
+		buf = &per_cpu_byid(trace_buffer, cpu);
+		if ((err = add_mapping_space(virt_to_phys(buf),
+					     virt + cpu * size, size,
+					     MAP_USR_IO_RO,
+					     current->space)) < 0)
+			return err;
+	}
+
+	trace_buffers_clean();
+
+	return __pfn(size * CONFIG_NCPU);
+}
+
+void trace_init(void)
+{
+	trace_buffers_reset();
+}
+
+int sys_trace_control(unsigned int req, unsigned long virt)
+{
+	int err;
+
+	if ((err = cap_trace_check(req, virt,
+				   __pfn(sizeof(struct trace_buffer) *
+					 CONFIG_NCPU))) < 0)
+		return err;
+
+	switch (req) {
+	case TRACE_CONTROL_MAP:
+		if (!is_page_aligned(virt))
+			return -EINVAL;
+		return trace_buffers_map(virt);
+	case TRACE_CONTROL_START:
+		trace_buffers_enable(1);
+		break;
+	case TRACE_CONTROL_STOP:
+		trace_buffers_enable(0);
+		trace_buffers_clean();
+		break;
+	case TRACE_CONTROL_RESET:
+		/* Other cpus may be writing while tracing is on */
+		if (trace_enabled)
+			return -EBUSY;
+		trace_buffers_reset();
+		trace_buffers_clean();
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+#else /* !CONFIG_TRACE */
+
+int sys_trace_control(unsigned int req, unsigned long virt)
+{
+	return -ENOSYS;
+}
+
+#endif /* End of !CONFIG_TRACE */
@@ -15,6 +15,8 @@
 #include <l4/generic/bootmem.h>
 #include <l4/generic/resource.h>
 #include <l4/generic/container.h>
+#include <l4/generic/trace.h>
+#include <l4/api/ipc.h>
 #include INC_ARCH(linker.h)
 #include INC_ARCH(asm.h)
 #include INC_SUBARCH(mm.h)
@@ -84,6 +86,20 @@ void kip_init()
 
 	kip_init_syscalls();
 
+	/* Time of day, read by userspace without a system call */
+	kip.clock = USER_KIP_PAGE + KIP_CLOCK_OFFSET;
+
+	/*
+	 * Only tickless builds have a usec counter userspace can read,
+	 * and only pb926 has those. Elsewhere the clock is as recent
+	 * as the last tick.
+	 */
+#if defined (CONFIG_TICKLESS)
+	kip_clock->counter = platform_timer_clock_user();
+#else
+	kip_clock->counter = 0;
+#endif
+
 	add_boot_mapping(virt_to_phys(&kip), USER_KIP_PAGE, PAGE_SIZE,
 			 MAP_USR_RO);
 	printk("%s: Kernel built on %s, %s\n", __KERNELNAME__,
@@ -188,12 +204,18 @@ void start_kernel(void)
 	 */
 	kip_init();
 
+	/* Reserve the per-cpu ipc copy windows */
+	ipc_window_init();
+
 	/* Initialise system call page */
 	syscall_init();
 
 	/* Init performance monitor, if enabled */
 	perfmon_init();
 
+	/* Set up trace buffers, if enabled */
+	trace_init();
+
 	/*
 	 * Evaluate system resources
 	 * and set up resource pools
@@ -12,20 +12,29 @@
 #include <l4/lib/printk.h>
 #include <l4/drivers/irq/gic/gic.h>
 #include <l4/generic/time.h>
+#include <l4/generic/scheduler.h>
 
 /* This should be in a file something like exception.S */
 int ipi_handler(struct irq_desc *desc)
 {
-	int ipi_event = (desc - irq_desc_array) / sizeof(struct irq_desc);
+	int ipi_event = desc - irq_desc_array;
 
 //	printk("CPU%d: entered IPI%d\n", smp_get_cpuid(),
-//	       (desc - irq_desc_array) / sizeof(struct irq_desc));
+//	       desc - irq_desc_array);
 
 	switch (ipi_event) {
 	case IPI_TIMER_EVENT:
 		// printk("CPU%d: Handling timer ipi\n", smp_get_cpuid());
 		secondary_timer_irq();
 		break;
+	case IPI_TLB_FLUSH:
+		/* Another cpu changed a translation we may hold */
+		arch_tlb_shootdown_ipi();
+		break;
+	case IPI_SCHEDULE:
+		/* A busy cpu has tasks for us to take */
+		need_resched = 1;
+		break;
 	default:
 		printk("CPU%d: IPI with no meaning: %d\n",
 		       smp_get_cpuid(), ipi_event);
@@ -33,6 +33,8 @@ unsigned int space_flags_to_ptflags(unsigned int flags)
 		return __MAP_KERN_RW;
 	case MAP_USR_IO:
 		return __MAP_USR_IO;
+	case MAP_USR_IO_RO:
+		return __MAP_USR_IO_RO;
 	case MAP_KERN_IO:
 		return __MAP_KERN_IO;
 	case MAP_USR_RWX:
@@ -8,6 +8,7 @@
 #include <l4/generic/space.h>
 #include <l4/generic/scheduler.h>
 #include <l4/generic/debug.h>
+#include <l4/generic/trace.h>
 #include <l4/generic/tcb.h>
 #include <l4/api/errno.h>
 #include INC_GLUE(memlayout.h)
@@ -36,6 +37,8 @@ void kip_init_syscalls(void)
 	kip.time = ARM_SYSCALL_PAGE + sys_time_offset;
 	kip.mutex_control = ARM_SYSCALL_PAGE + sys_mutex_control_offset;
 	kip.cache_control = ARM_SYSCALL_PAGE + sys_cache_control_offset;
+	kip.map_batch = ARM_SYSCALL_PAGE + sys_map_batch_offset;
+	kip.trace_control = ARM_SYSCALL_PAGE + sys_trace_control_offset;
 }
 
 /* Jump table for all system calls. */
@@ -90,7 +93,8 @@ int arch_sys_irq_control(syscall_context_t *regs)
 
 int arch_sys_ipc_control(syscall_context_t *regs)
 {
-	return sys_ipc_control();
+	return sys_ipc_control((unsigned int)regs->r0, (l4id_t)regs->r1,
+			       (u32)regs->r2);
 }
 
 int arch_sys_map(syscall_context_t *regs)
@@ -131,6 +135,18 @@ int arch_sys_cache_control(syscall_context_t *regs)
 				 (unsigned int)regs->r2);
 }
 
+int arch_sys_map_batch(syscall_context_t *regs)
+{
+	return sys_map_batch((struct map_desc *)regs->r0, (int)regs->r1,
+			     (unsigned int)regs->r2, (l4id_t)regs->r3);
+}
+
+int arch_sys_trace_control(syscall_context_t *regs)
+{
+	return sys_trace_control((unsigned int)regs->r0,
+				 (unsigned long)regs->r1);
+}
+
 /*
  * Initialises the system call jump table, for kernel to use.
  * Also maps the system call page into userspace.
@@ -152,6 +168,8 @@ void syscall_init()
 	syscall_table[sys_time_offset >> 2]			= (syscall_fn_t)arch_sys_time;
 	syscall_table[sys_mutex_control_offset >> 2]		= (syscall_fn_t)arch_sys_mutex_control;
 	syscall_table[sys_cache_control_offset >> 2]		= (syscall_fn_t)arch_sys_cache_control;
+	syscall_table[sys_map_batch_offset >> 2]		= (syscall_fn_t)arch_sys_map_batch;
+	syscall_table[sys_trace_control_offset >> 2]		= (syscall_fn_t)arch_sys_trace_control;
 
 	add_boot_mapping(virt_to_phys(&__syscall_page_start),
 			 ARM_SYSCALL_PAGE, PAGE_SIZE, MAP_USR_RX);
@@ -175,9 +193,14 @@ int syscall(syscall_context_t *regs, unsigned long swi_addr)
 			/* Start measure syscall timing, if enabled */
 			system_measure_syscall_start();
 
+			trace_event(TRACE_SYSCALL_ENTRY,
+				    (swi_addr & 0xFF) >> 2);
+
 			/* Quick jump, rather than compare each */
 			ret = (*syscall_table[(swi_addr & 0xFF) >> 2])(regs);
 
+			trace_event(TRACE_SYSCALL_EXIT, ret);
+
 			/* End measure syscall timing, if enabled */
 			system_measure_syscall_end(swi_addr);
 
@@ -8,6 +8,7 @@
 #include <l4/lib/printk.h>
 #include INC_GLUE(memory.h)
 #include <l4/lib/bit.h>
+#include <l4/generic/preempt.h>
 #include <l4/api/errno.h>
 
 /* Allocate, clear and return element */
@@ -18,33 +19,113 @@ void *mem_cache_zalloc(struct mem_cache *cache)
 	return elem;
 }
 
+/*
+ * Finds and sets a free bit in the bitmap, starting from the hint
+ * word. Words below the hint are known to be full, and full words
+ * are skipped in one go, so allocation does not rescan the bitmap
+ * from its beginning each time. Called with the cache mutex held.
+ */
+static int mem_cache_bitmap_alloc(struct mem_cache *cache)
+{
+	unsigned int word, bit;
+
+	for (int i = cache->hint; i < cache->bwords; i++) {
+		if ((word = cache->bitmap[i]) == ~0)
+			continue;
+
+		/* Lowest clear bit */
+		word = ~word & -(~word);
+		bit = (i << 5) + (31 - __clz(word));
+
+		/* Padding bits of the last word */
+		if (bit >= cache->total)
+			break;
+
+		cache->bitmap[i] |= word;
+		cache->hint = i;
+		cache->free--;
+		return bit;
+	}
+	cache->hint = cache->bwords;
+	return -1;
+}
+
+/* Clears the bit of @bit in the bitmap. Called with the cache mutex held */
+static int mem_cache_bitmap_free(struct mem_cache *cache, unsigned int bit)
+{
+	if (check_and_clear_bit(cache->bitmap, bit) < 0) {
+		printk("Error: Anomaly in cache occupied state:\n"
+		       "Trying to free already free structure.\n");
+		return -1;
+	}
+	if (BITWISE_GETWORD(bit) < cache->hint)
+		cache->hint = BITWISE_GETWORD(bit);
+
+	cache->free++;
+	if (cache->free > cache->total) {
+		printk("Error: Anomaly in cache occupied state:\n"
+		       "More free elements than total.\n");
+		return -1;
+	}
+	return 0;
+}
+
+static inline void *mem_cache_bit_to_addr(struct mem_cache *cache, int bit)
+{
+	return (void *)(cache->start + (cache->struct_size * bit));
+}
+
 /* Allocate another element from given @cache. Returns 0 when full. */
 void *mem_cache_alloc(struct mem_cache *cache)
 {
+	struct mem_cache_magazine *mag;
+	void *elem = 0;
 	int bit;
 	int err;
 
-	if (cache->free > 0) {
-		if ((err = mutex_lock(&cache->mutex)) < 0)
-			return PTR_ERR(err);	/* Interruptible mutex */
-		cache->free--;
-		if ((bit = find_and_set_first_free_bit(cache->bitmap,
-						       cache->total)) < 0) {
-			printk("Error: Anomaly in cache occupied state.\n"
-			       "Bitmap full although cache->free > 0\n");
-			BUG();
-		}
+	/* Fast path: Take one from this cpu's magazine */
+	preempt_disable();
+	mag = &per_cpu(cache->magazine);
+	if (mag->count > 0) {
+		elem = (void *)mag->objs[--mag->count];
+		preempt_enable();
+		return elem;
+	}
+	preempt_enable();
+
+	if (cache->free == 0)
+		return 0;	/* Cache full */
+
+	if ((err = mutex_lock(&cache->mutex)) < 0)
+		return PTR_ERR(err);	/* Interruptible mutex */
+
+	/* Full, e.g. other cpus took the rest while we slept */
+	if ((bit = mem_cache_bitmap_alloc(cache)) < 0) {
 		mutex_unlock(&cache->mutex);
-		return (void *)(cache->start + (cache->struct_size * bit));
-	} else {
-		/* Cache full */
 		return 0;
 	}
+	elem = mem_cache_bit_to_addr(cache, bit);
+
+	/*
+	 * Refill half of the magazine of the cpu we are now
+	 * on, so that the next few allocations avoid the mutex.
+	 */
+	preempt_disable();
+	mag = &per_cpu(cache->magazine);
+	while (mag->count < MEM_CACHE_MAGAZINE_SIZE / 2 &&
+	       (bit = mem_cache_bitmap_alloc(cache)) >= 0)
+		mag->objs[mag->count++] =
+			(unsigned int)mem_cache_bit_to_addr(cache, bit);
+	preempt_enable();
+
+	mutex_unlock(&cache->mutex);
+	return elem;
 }
 
 /* Free element at @addr in @cache. Return negative on error. */
 int mem_cache_free(struct mem_cache *cache, void *addr)
 {
+	struct mem_cache_magazine *mag;
 	unsigned int struct_addr = (unsigned int)addr;
 	unsigned int bit;
 	int err = 0;
@@ -68,23 +149,50 @@ int mem_cache_free(struct mem_cache *cache, void *addr)
 		return err;
 	}
 
-	if ((err = mutex_lock(&cache->mutex)) < 0)
-		return err; /* Interruptible mutex */
-
-	/* Check free/occupied state */
-	if (check_and_clear_bit(cache->bitmap, bit) < 0) {
+	/* Objects handed out are always marked occupied */
+	if (!(cache->bitmap[BITWISE_GETWORD(bit)] & BITWISE_GETBIT(bit))) {
 		printk("Error: Anomaly in cache occupied state:\n"
 		       "Trying to free already free structure.\n");
-		err = -1;
-		goto out;
+		return -1;
 	}
-	cache->free++;
-	if (cache->free > cache->total) {
-		printk("Error: Anomaly in cache occupied state:\n"
-		       "More free elements than total.\n");
-		err = -1;
+
+	/* Fast path: Put it in this cpu's magazine */
+	preempt_disable();
+	mag = &per_cpu(cache->magazine);
+	for (int i = 0; i < mag->count; i++) {
+		if (mag->objs[i] == struct_addr) {
+			preempt_enable();
+			printk("Error: Anomaly in cache occupied state:\n"
+			       "Trying to free already free structure.\n");
+			return -1;
+		}
+	}
+	if (mag->count < MEM_CACHE_MAGAZINE_SIZE) {
+		mag->objs[mag->count++] = struct_addr;
+		preempt_enable();
+		return 0;
+	}
+	preempt_enable();
+
+	if ((err = mutex_lock(&cache->mutex)) < 0)
+		return err; /* Interruptible mutex */
+
+	if ((err = mem_cache_bitmap_free(cache, bit)) < 0)
 		goto out;
+
+	/*
+	 * Magazine was full. Drain half of it of the cpu we
+	 * are now on, leaving room for the next few frees.
+	 */
+	preempt_disable();
+	mag = &per_cpu(cache->magazine);
+	while (mag->count > MEM_CACHE_MAGAZINE_SIZE / 2) {
+		struct_addr = mag->objs[--mag->count];
+		bit = (struct_addr - cache->start) / cache->struct_size;
+		if ((err = mem_cache_bitmap_free(cache, bit)) < 0)
+			break;
 	}
+	preempt_enable();
 out:
 	mutex_unlock(&cache->mutex);
 	return err;
@@ -205,6 +313,9 @@ struct mem_cache *mem_cache_init(void *bufstart, int cache_size,
 	cache->free = cache->total;
 	cache->struct_size = struct_size;
 	cache->bitmap = bitmap;
+	cache->bwords = bwords;
+	cache->hint = 0;
+	memset(&cache->magazine, 0, sizeof(cache->magazine));
 
 	mutex_init(&cache->mutex);
 	memset(cache->bitmap, 0, bwords*SZ_WORD);
@@ -6,6 +6,7 @@
 #include <l4/generic/platform.h>
 #include <l4/generic/space.h>
 #include <l4/generic/irq.h>
+#include <l4/generic/time.h>
 #include <l4/generic/bootmem.h>
 #include INC_ARCH(linker.h)
 #include INC_SUBARCH(mm.h)
@@ -69,9 +70,36 @@ void init_platform_timer(void)
 	add_boot_mapping(PLATFORM_TIMER0_BASE, PLATFORM_TIMER0_VBASE,
 			 PAGE_SIZE, MAP_IO_DEFAULT);
 
+#if defined (CONFIG_TICKLESS)
+	/* Timer0 gives one-shot events, its sibling counts usecs */
+	timer_init_freerun(timer_secondary_base(PLATFORM_TIMER0_VBASE));
+
+	/* Userspace reads the clock too, but may not program timers */
+	add_boot_mapping(PLATFORM_TIMER0_BASE, USERSPACE_CLOCK_VBASE,
+			 PAGE_SIZE, MAP_USR_IO_RO);
+#else
 	/* 1 Mhz means can tick up to 1,000,000 times a second */
-	timer_init(PLATFORM_TIMER0_VBASE, 1000000 / CONFIG_SCHED_TICKS);
+	timer_init(PLATFORM_TIMER0_VBASE, USEC_PER_TICK);
+#endif
+}
+
+#if defined (CONFIG_TICKLESS)
+void platform_timer_oneshot(u32 usecs)
+{
+	timer_oneshot(PLATFORM_TIMER0_VBASE, usecs);
+}
+
+/* The clock counts down at 1Mhz */
+u32 platform_timer_clock(void)
+{
+	return ~timer_read(timer_secondary_base(PLATFORM_TIMER0_VBASE));
+}
+
+unsigned long platform_timer_clock_user(void)
+{
+	return timer_secondary_base(USERSPACE_CLOCK_VBASE) + SP804_VALUE;
 }
+#endif
 
 void init_platform_irq_controller()
 {
@@ -128,8 +156,14 @@ void platform_timer_start(void)
 	/* Enable irq line for TIMER0 */
 	irq_enable(IRQ_TIMER0);
 
+#if defined (CONFIG_TICKLESS)
+	/* Start the clock, and tick once until the scheduler sets it */
+	timer_start(timer_secondary_base(PLATFORM_TIMER0_VBASE));
+	platform_timer_oneshot(USEC_PER_TICK);
+#else
 	/* Enable timer */
 	timer_start(PLATFORM_TIMER0_VBASE);
+#endif
 }
 
 void platform_init(void)
@@ -0,0 +1,371 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-3.0
+#
+# Kernel Trace Decoder
+#
+# Finds the per-cpu kernel event trace buffers (CONFIG_TRACE) in a
+# memory dump and prints them as a single timeline. The dump can be
+# any raw image that contains the buffers, such as guest memory saved
+# from qemu or a debugger, or the buffers a container mapped with
+# l4_trace_control() and wrote out.
+#
+# Buffer layout is in include/l4/api/trace.h.
+#
+# Usage:
+#   tracedump.py dump.bin                  Text timeline
+#   tracedump.py --summary dump.bin        Event counts and syscall times
+#   tracedump.py --chrome out.json dump.bin
+#                                          Trace Event Format, for
+#                                          chrome://tracing or Perfetto
+#
+
+import argparse
+import json
+import struct
+import sys
+from typing import Dict, List, NamedTuple, Tuple
+
+TRACE_MAGIC = 0x45435254
+TRACE_VERSION = 1
+
+HEADER_FORMAT = "IHHIIIIII"
+EVENT_FORMAT = "IHHII"
+HEADER_SIZE = struct.calcsize("<" + HEADER_FORMAT)
+EVENT_SIZE = struct.calcsize("<" + EVENT_FORMAT)
+
+TRACE_SYSCALL_ENTRY = 1
+TRACE_SYSCALL_EXIT = 2
+TRACE_IPC_SEND = 3
+TRACE_IPC_RECV = 4
+TRACE_IPC_RENDEZVOUS = 5
+TRACE_CONTEXT_SWITCH = 6
+TRACE_SPACE_SWITCH = 7
+TRACE_IRQ = 8
+TRACE_PAGE_FAULT = 9
+TRACE_PAGE_FAULT_DONE = 10
+TRACE_MUTEX_SLEEP = 11
+TRACE_MUTEX_WAKE = 12
+
+EVENT_NAMES = {
+    TRACE_SYSCALL_ENTRY: "syscall",
+    TRACE_SYSCALL_EXIT: "sysret",
+    TRACE_IPC_SEND: "ipc-send",
+    TRACE_IPC_RECV: "ipc-recv",
+    TRACE_IPC_RENDEZVOUS: "ipc-meet",
+    TRACE_CONTEXT_SWITCH: "switch",
+    TRACE_SPACE_SWITCH: "space",
+    TRACE_IRQ: "irq",
+    TRACE_PAGE_FAULT: "fault",
+    TRACE_PAGE_FAULT_DONE: "fault-done",
+    TRACE_MUTEX_SLEEP: "mutex-sleep",
+    TRACE_MUTEX_WAKE: "mutex-wake",
+}
+
+TRACE_DATA_HANDOFF = 1 << 0
+TRACE_DATA_SENDER = 1 << 1
+
+# By syscall offset in the syscall page, over 4 (include/l4/api/syscall.h)
+SYSCALL_NAMES = [
+    "ipc",
+    "thread_switch",
+    "thread_control",
+    "exchange_registers",
+    "schedule",
+    "unmap",
+    "irq_control",
+    "ipc_control",
+    "map",
+    "getid",
+    "capability_control",
+    "container_control",
+    "time",
+    "mutex_control",
+    "cache_control",
+    "map_batch",
+    "trace_control",
+]
+
+L4_NILTHREAD = 0xFFFFFFFF
+L4_ANYTHREAD = 0xFFFFFFFE
+
+
+class TraceError(Exception):
+    """Trace decoding error."""
+
+    pass
+
+
+class Event(NamedTuple):
+    usec: int  # Unwrapped time
+    cpu: int
+    seq: int  # Order on its cpu
+    type: int
+    data: int
+    tid: int
+    arg: int
+
+
+class Buffer(NamedTuple):
+    offset: int
+    cpu: int
+    nevents: int
+    usec_per_stamp: int
+    head: int
+    count: int
+    enabled: int
+
+
+def tid_name(tid: int) -> str:
+    if tid == L4_ANYTHREAD:
+        return "any"
+    if tid == L4_NILTHREAD:
+        return "nil"
+    return str(tid)
+
+
+def signed(value: int) -> int:
+    return value - (1 << 32) if value & (1 << 31) else value
+
+
+def syscall_name(number: int) -> str:
+    if number < len(SYSCALL_NAMES):
+        return SYSCALL_NAMES[number]
+    return f"syscall{number}"
+
+
+def find_buffers(dump: bytes, endian: str) -> List[Buffer]:
+    """Finds buffer headers by their magic, checking the rest is sane."""
+    magic = struct.pack(endian + "I", TRACE_MAGIC)
+    buffers = []
+    offset = dump.find(magic)
+
+    while offset >= 0:
+        if offset % 4 == 0 and offset + HEADER_SIZE <= len(dump):
+            (_, version, cpu, nevents, usec_per_stamp, head, count,
+             enabled, _) = struct.unpack_from(endian + HEADER_FORMAT,
+                                              dump, offset)
+            end = offset + HEADER_SIZE + nevents * EVENT_SIZE
+            if (version == TRACE_VERSION and 0 < nevents and
+                    head < nevents and usec_per_stamp > 0 and
+                    end <= len(dump)):
+                buffers.append(Buffer(offset, cpu, nevents,
+                                      usec_per_stamp, head, count,
+                                      enabled))
+        offset = dump.find(magic, offset + 1)
+
+    return buffers
+
+
+def read_events(dump: bytes, endian: str, buf: Buffer) -> List[Event]:
+    """Reads a buffer oldest event first, unwrapping its stamps."""
+    if buf.count > buf.nevents:
+        first, n = buf.head, buf.nevents
+    else:
+        first, n = 0, buf.count
+
+    events = []
+    base = 0
+    last = None
+    for seq in range(n):
+        index = (first + seq) % buf.nevents
+        stamp, etype, data, tid, arg = struct.unpack_from(
+            endian + EVENT_FORMAT, dump,
+            buf.offset + HEADER_SIZE + index * EVENT_SIZE)
+
+        # The clock wraps at 32 bits, but never goes back otherwise
+        if last is not None and stamp < last:
+            base += 1 << 32
+        last = stamp
+
+        events.append(Event((base + stamp) * buf.usec_per_stamp, buf.cpu,
+                            seq, etype, data, tid, arg))
+    return events
+
+
+def describe(event: Event) -> str:
+    etype, arg = event.type, event.arg
+
+    if etype == TRACE_SYSCALL_ENTRY:
+        return syscall_name(arg)
+    if etype in (TRACE_SYSCALL_EXIT, TRACE_PAGE_FAULT_DONE):
+        return f"ret={signed(arg)}"
+    if etype == TRACE_IPC_SEND:
+        return f"to={tid_name(arg)}"
+    if etype == TRACE_IPC_RECV:
+        return f"from={tid_name(arg)}"
+    if etype == TRACE_IPC_RENDEZVOUS:
+        text = f"{'to' if event.data & TRACE_DATA_SENDER else 'from'}=" \
+               f"{tid_name(arg)}"
+        if event.data & TRACE_DATA_HANDOFF:
+            text += " handoff"
+        return text
+    if etype == TRACE_CONTEXT_SWITCH:
+        return f"next={tid_name(arg)}"
+    if etype == TRACE_SPACE_SWITCH:
+        return f"spid={arg}"
+    if etype == TRACE_IRQ:
+        return f"irq={arg}"
+    if etype == TRACE_PAGE_FAULT:
+        return f"addr=0x{arg:08x}"
+    if etype in (TRACE_MUTEX_SLEEP, TRACE_MUTEX_WAKE):
+        return f"mutex=0x{arg:08x}"
+    return f"type={etype} data=0x{event.data:x} arg=0x{arg:x}"
+
+
+def print_timeline(events: List[Event], out) -> None:
+    start = events[0].usec if events else 0
+
+    for event in events:
+        delta = event.usec - start
+        name = EVENT_NAMES.get(event.type, "unknown")
+        out.write(f"{delta // 1000000:6d}.{delta % 1000000:06d} "
+                  f"cpu{event.cpu} {tid_name(event.tid):>5} "
+                  f"{name:<12} {describe(event)}\n")
+
+
+def print_summary(buffers: List[Buffer], events: List[Event], out) -> None:
+    for buf in buffers:
+        lost = max(buf.count - buf.nevents, 0)
+        out.write(f"cpu{buf.cpu}: {min(buf.count, buf.nevents)} events, "
+                  f"{lost} overwritten, {buf.usec_per_stamp} usec/stamp"
+                  f"{', still tracing' if buf.enabled else ''}\n")
+
+    counts: Dict[int, int] = {}
+    for event in events:
+        counts[event.type] = counts.get(event.type, 0) + 1
+    out.write("\nEvents:\n")
+    for etype in sorted(counts):
+        out.write(f"  {EVENT_NAMES.get(etype, etype):<12} "
+                  f"{counts[etype]}\n")
+
+    # Time from each syscall entry to the exit of the same thread
+    entered: Dict[int, Event] = {}
+    times: Dict[str, List[int]] = {}
+    for event in events:
+        if event.type == TRACE_SYSCALL_ENTRY:
+            entered[event.tid] = event
+        elif event.type == TRACE_SYSCALL_EXIT and event.tid in entered:
+            entry = entered.pop(event.tid)
+            times.setdefault(syscall_name(entry.arg), []).append(
+                event.usec - entry.usec)
+
+    if times:
+        out.write("\nSystem calls (usec):\n")
+        out.write(f"  {'name':<20} {'calls':>8} {'avg':>10} "
+                  f"{'max':>10}\n")
+        for name in sorted(times):
+            t = times[name]
+            out.write(f"  {name:<20} {len(t):>8} "
+                      f"{sum(t) // len(t):>10} {max(t):>10}\n")
+
+
+def chrome_trace(events: List[Event]) -> Dict:
+    """
+    Converts events to the Trace Event Format. Each thread gets a
+    track, with system calls and page faults as slices on it. Irqs
+    and switches are instant events on the track of their cpu.
+    """
+    start = events[0].usec if events else 0
+    trace = []
+
+    for event in events:
+        ts = event.usec - start
+        name = EVENT_NAMES.get(event.type, "unknown")
+        common = {"ts": ts, "pid": 1, "tid": event.tid,
+                  "args": {"cpu": event.cpu, "detail": describe(event)}}
+
+        if event.type == TRACE_SYSCALL_ENTRY:
+            trace.append(dict(common, ph="B", name=syscall_name(event.arg)))
+        elif event.type == TRACE_PAGE_FAULT:
+            trace.append(dict(common, ph="B", name="page fault"))
+        elif event.type in (TRACE_SYSCALL_EXIT, TRACE_PAGE_FAULT_DONE):
+            trace.append(dict(common, ph="E"))
+        elif event.type in (TRACE_IRQ, TRACE_CONTEXT_SWITCH,
+                            TRACE_SPACE_SWITCH):
+            trace.append(dict(common, ph="i", s="t", name=name, pid=0,
+                              tid=event.cpu))
+        else:
+            trace.append(dict(common, ph="i", s="t", name=name))
+
+    cpus = sorted({event.cpu for event in events})
+    meta = [{"ph": "M", "name": "process_name", "pid": 0,
+             "args": {"name": "cpus"}},
+            {"ph": "M", "name": "process_name", "pid": 1,
+             "args": {"name": "threads"}}]
+    meta += [{"ph": "M", "name": "thread_name", "pid": 0, "tid": cpu,
+              "args": {"name": f"cpu{cpu}"}} for cpu in cpus]
+
+    return {"traceEvents": meta + trace}
+
+
+def decode(path: str, endian: str) -> Tuple[List[Buffer], List[Event]]:
+    with open(path, "rb") as f:
+        dump = f.read()
+
+    # A dump may hold copies of a buffer, keep the most complete one
+    found: Dict[int, Buffer] = {}
+    for buf in find_buffers(dump, endian):
+        if buf.cpu in found:
+            print(f"Warning: more than one buffer of cpu{buf.cpu}",
+                  file=sys.stderr)
+            if found[buf.cpu].count >= buf.count:
+                continue
+        found[buf.cpu] = buf
+    if not found:
+        raise TraceError(f"No trace buffers found in {path}")
+    buffers = [found[cpu] for cpu in sorted(found)]
+
+    events = []
+    for buf in buffers:
+        events += read_events(dump, endian, buf)
+
+    # Cpus share the clock, events on a cpu keep their order
+    events.sort(key=lambda e: (e.usec, e.cpu, e.seq))
+    return buffers, events
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Decode kernel trace buffers from a memory dump"
+    )
+    parser.add_argument("dump", help="Raw memory dump containing the buffers")
+    parser.add_argument(
+        "-s", "--summary", action="store_true",
+        help="Print event counts and system call times",
+    )
+    parser.add_argument(
+        "-c", "--chrome", metavar="FILE",
+        help="Write the timeline in Trace Event Format",
+    )
+    parser.add_argument(
+        "-b", "--big-endian", action="store_true",
+        help="Dump is of a big-endian target",
+    )
+    parser.add_argument(
+        "--cpu", type=int, help="Only show events of this cpu",
+    )
+
+    args = parser.parse_args()
+    endian = ">" if args.big_endian else "<"
+
+    try:
+        buffers, events = decode(args.dump, endian)
+    except (OSError, TraceError) as e:
+        print(f"Error: {e}", file=sys.stderr)
+        sys.exit(1)
+
+    if args.cpu is not None:
+        buffers = [b for b in buffers if b.cpu == args.cpu]
+        events = [e for e in events if e.cpu == args.cpu]
+
+    if args.chrome:
+        with open(args.chrome, "w") as f:
+            json.dump(chrome_trace(events), f)
+    elif args.summary:
+        print_summary(buffers, events, sys.stdout)
+    else:
+        print_timeline(events, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()